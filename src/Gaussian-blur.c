@@ -44,11 +44,158 @@
 #include <time.h>
 #include <math.h>
 #include "util.h"
+#include "pixel-buffer.h"
+#include "Lanczos.h"
+
+double recursiveGaussianVariance(double q) {
+  //
+  // variance of the Young, Gerbrands and van Vliet base poles scaled to d^(1/q): sum of 2d / (d - 1)^2 over the three
+  // poles, with the complex pair in polar form
+  //
+  double r;
+  double theta;
+  double x;
+  double y;
+  double d3;
+  double den_re;
+  double den_im;
+  double den_mag2;
+
+  r=pow(BSR_BLUR_YGVV_POLE_MAG, 1.0 / q);
+  theta=BSR_BLUR_YGVV_POLE_ARG / q;
+  x=r * cos(theta);
+  y=r * sin(theta);
+  d3=pow(BSR_BLUR_YGVV_POLE_REAL, 1.0 / q);
+  den_re=((x - 1.0) * (x - 1.0)) - (y * y);
+  den_im=2.0 * (x - 1.0) * y;
+  den_mag2=(den_re * den_re) + (den_im * den_im);
+
+  return((4.0 * ((x * den_re) + (y * den_im)) / den_mag2) + ((2.0 * d3) / ((d3 - 1.0) * (d3 - 1.0))));
+}
+
+int initRecursiveGaussian(recursive_Gaussian_t *recursive_Gaussian, double sigma) {
+  //
+  // Recursive Gaussian coefficients from the base poles of Young, Gerbrands and van Vliet (2002), scaled by d^(1/q)
+  // with q chosen so the filter variance is sigma^2 (valid for sigma >= 0.5), and the Triggs-Sdika matrix that gives
+  // exact anti-causal initial values for zero pixels beyond the image edge, the same boundary as the direct convolution
+  //
+  double q;
+  double q_low;
+  double q_high;
+  double r;
+  double theta;
+  double p_re;
+  double p_mag2;
+  double p3;
+  double a1;
+  double a2;
+  double a3;
+  double M_scale;
+  int i;
+
+  //
+  // variance increases with q, bisect for sigma^2
+  //
+  q_low=0.4;
+  q_high=(sigma > 1.0) ? sigma : 1.0;
+  q=q_high;
+  for (i=0; i < 60; i++) {
+    q=0.5 * (q_low + q_high);
+    if (recursiveGaussianVariance(q) < (sigma * sigma)) {
+      q_low=q;
+    } else {
+      q_high=q;
+    }
+  }
+
+  //
+  // filter poles p=1/d, the causal recursion coefficients are the elementary symmetric functions of the poles
+  //
+  r=pow(BSR_BLUR_YGVV_POLE_MAG, 1.0 / q);
+  theta=BSR_BLUR_YGVV_POLE_ARG / q;
+  p_re=cos(theta) / r;
+  p_mag2=1.0 / (r * r);
+  p3=1.0 / pow(BSR_BLUR_YGVV_POLE_REAL, 1.0 / q);
+  a1=(2.0 * p_re) + p3;
+  a2=-(p_mag2 + (2.0 * p_re * p3));
+  a3=p_mag2 * p3;
+  recursive_Gaussian->a1=a1;
+  recursive_Gaussian->a2=a2;
+  recursive_Gaussian->a3=a3;
+  recursive_Gaussian->B=1.0 - (a1 + a2 + a3);
+
+  M_scale=recursive_Gaussian->B / ((1.0 + a1 - a2 + a3) * (1.0 - a1 - a2 - a3) * (1.0 + a2 + ((a1 - a3) * a3)));
+  recursive_Gaussian->M[0]=M_scale * (1.0 - a2 - (a1 * a3) - (a3 * a3));
+  recursive_Gaussian->M[1]=M_scale * (a1 + a3) * (a2 + (a1 * a3));
+  recursive_Gaussian->M[2]=M_scale * a3 * (a1 + (a2 * a3));
+  recursive_Gaussian->M[3]=M_scale * (a1 + (a2 * a3));
+  recursive_Gaussian->M[4]=-M_scale * (a2 - 1.0) * (a2 + (a1 * a3));
+  recursive_Gaussian->M[5]=-M_scale * a3 * ((a1 * a3) + (a3 * a3) + a2 - 1.0);
+  recursive_Gaussian->M[6]=M_scale * ((a1 * a3) + a2 + (a1 * a1) - (a2 * a2));
+  recursive_Gaussian->M[7]=M_scale * ((a1 * a2) + (a2 * a2 * a3) - (a1 * a3 * a3) - (a3 * a3 * a3) - (a2 * a3) + a3);
+  recursive_Gaussian->M[8]=M_scale * a3 * (a1 + (a2 * a3));
+
+  return(0);
+}
+
+int recursiveGaussianLanes(recursive_Gaussian_t *recursive_Gaussian, double *buf, int n, int lanes) {
+  //
+  // Apply recursive Gaussian to 'lanes' interleaved signals of n samples each. buf has n + 5 rows of 'lanes' values:
+  // 3 rows of zeros before the signal, n rows of signal and 2 rows for anti-causal boundary values. Lanes are
+  // independent (color channels, and columns in the vertical pass) so the inner loops vectorize.
+  //
+  double *row_p;
+  double *last_p;
+  double B=recursive_Gaussian->B;
+  double a1=recursive_Gaussian->a1;
+  double a2=recursive_Gaussian->a2;
+  double a3=recursive_Gaussian->a3;
+  double *M=recursive_Gaussian->M;
+  double u0;
+  double u1;
+  double u2;
+  int row;
+  int lane;
+
+  //
+  // causal pass, top to bottom
+  //
+  for (row=3; row < (n + 3); row++) {
+    row_p=buf + ((size_t)row * (size_t)lanes);
+    for (lane=0; lane < lanes; lane++) {
+      row_p[lane]=(B * row_p[lane]) + (a1 * row_p[lane - lanes]) + (a2 * row_p[lane - (2 * lanes)]) + (a3 * row_p[lane - (3 * lanes)]);
+    }
+  }
+
+  //
+  // anti-causal initial values for the last row and the two rows beyond the edge
+  //
+  last_p=buf + ((size_t)(n + 2) * (size_t)lanes);
+  for (lane=0; lane < lanes; lane++) {
+    u0=last_p[lane];
+    u1=last_p[lane - lanes];
+    u2=last_p[lane - (2 * lanes)];
+    last_p[lane]=(M[0] * u0) + (M[1] * u1) + (M[2] * u2);
+    last_p[lane + lanes]=(M[3] * u0) + (M[4] * u1) + (M[5] * u2);
+    last_p[lane + (2 * lanes)]=(M[6] * u0) + (M[7] * u1) + (M[8] * u2);
+  }
+
+  //
+  // anti-causal pass, bottom to top
+  //
+  for (row=(n + 1); row >= 3; row--) {
+    row_p=buf + ((size_t)row * (size_t)lanes);
+    for (lane=0; lane < lanes; lane++) {
+      row_p[lane]=(B * row_p[lane]) + (a1 * row_p[lane + lanes]) + (a2 * row_p[lane + (2 * lanes)]) + (a3 * row_p[lane + (3 * lanes)]);
+    }
+  }
+
+  return(0);
+}
 
 int GaussianBlur(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
   int i;
   double radius;
-  int lines_per_thread;
   int sample_width;
   int half_sample_width;
   int blur_res_x;
@@ -61,10 +208,7 @@ int GaussianBlur(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
   int kernel_i;
   int current_image_res_x;
   int current_image_res_y;
-  int current_image_x;
-  int current_image_y;
   uint64_t current_image_offset;
-  uint64_t image_offset;
   double *G_kernel_array;
   double *G_kernel_p;
   double G_kernel_sum;
@@ -72,11 +216,33 @@ int GaussianBlur(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
   struct timespec starttime;
   struct timespec endtime;
   double elapsed_time;
-  pixel_composition_t *current_image_p;
-  pixel_composition_t *image_blur_p;
+  uint64_t image_blur_offset;
+  int current_image_precision;
+  int blur_precision;
+  double pixel_r;
+  double pixel_g;
+  double pixel_b;
   double G_r;
   double G_g;
   double G_b;
+  int trace_event;
+  int recursive;
+  recursive_Gaussian_t recursive_Gaussian;
+  double *line_buf;
+  double *line_p;
+  int first_strip;
+  int end_strip;
+  int first_column;
+  int last_column;
+  int strip_x;
+  int strip_width;
+  int lanes;
+  int first_line;
+  int last_line;
+  int block_lines;
+  int num_strips;
+  int resize_log;
+  double G_strip[BSR_BLUR_STRIP_WIDTH * 3];
 
   //
   // all threads: determine Gaussian kernel width
@@ -85,12 +251,27 @@ int GaussianBlur(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
   sample_width=((int)ceil(radius) * 6) + 1;
   half_sample_width=((int)ceil(radius) * 3) + 1;
 
+  //
+  // all threads: use the recursive Gaussian for large radii. Its cost per pixel does not depend on the radius, and
+  // it matches direct convolution to within about 1% of the peak of a blurred point per axis, 2% after both passes,
+  // less for smooth images
+  //
+  recursive=0;
+  if ((radius >= 0.5) && ((bsr_config->Gaussian_blur_mode == 2) || ((bsr_config->Gaussian_blur_mode == 0) && (radius >= BSR_BLUR_RECURSIVE_MIN_RADIUS)))) {
+    recursive=1;
+    initRecursiveGaussian(&recursive_Gaussian, radius);
+  }
+
   //
   // main thread: display status message if not in CGI mode
   //
   if ((bsr_state->perthread->my_pid == bsr_state->main_pid) && (bsr_config->cgi_mode != 1) && (bsr_config->print_status == 1)) {
     clock_gettime(CLOCK_REALTIME, &starttime);
-    printf("Applying Gaussian blur with radius %.3f...", radius);
+    if (recursive == 1) {
+      printf("Applying recursive Gaussian blur with radius %.3f...", radius);
+    } else {
+      printf("Applying Gaussian blur with radius %.3f...", radius);
+    }
     fflush(stdout);
   }
 
@@ -103,7 +284,7 @@ int GaussianBlur(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
       printf("Error: could not allocate memory for Gaussian blur kernel\n");
       fflush(stdout);
     }
-    return(1);
+    exit(1);
   }
 
   //
@@ -128,115 +309,125 @@ int GaussianBlur(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
   } // end for kernel
 
   //
-  // all threads: get current image pointer and resolution
+  // all threads: get current image and blur buffer precision and resolution
   //
-  current_image_p=bsr_state->current_image_buf;
+  current_image_precision=bsr_state->current_image_precision;
+  blur_precision=bsr_state->blur_precision;
   current_image_res_x=bsr_state->current_image_res_x;
   current_image_res_y=bsr_state->current_image_res_y;
   blur_res_x=current_image_res_x;
   blur_res_y=current_image_res_y;
-  lines_per_thread=(int)ceil(((double)current_image_res_y / (double)(bsr_state->num_worker_threads + 1)));
-  if (lines_per_thread < 1) {
-    lines_per_thread=1;
-  }
+  num_strips=(blur_res_x + BSR_BLUR_STRIP_WIDTH - 1) / BSR_BLUR_STRIP_WIDTH;
 
   //
-  // worker threads:  wait for main thread to say go
-  // main thread: tell worker threads to go
+  // all threads: if the image will be resized, the vertical pass also converts it to log scale for resizeLanczos()
   //
-  if (bsr_state->perthread->my_pid != bsr_state->main_pid) {
-    waitForMainThread(bsr_state, THREAD_STATUS_GAUSSIAN_BLUR_PREP_BEGIN);
+  if (bsr_config->output_scaling_factor != 1.0) {
+    resize_log=1;
   } else {
-    // main thread
-    for (i=1; i <= bsr_state->num_worker_threads; i++) {
-      bsr_state->status_array[i].status=THREAD_STATUS_GAUSSIAN_BLUR_PREP_BEGIN;
-    }
-  } // end if not main thread
-
-  //
-  // all threads: temporarily re-scale image as GaussianBlur() requires values in the range [0..1].
-  // /this is undone at the end of GaussianBlur()
-  //
-  current_image_x=0;
-  lines_per_thread=(int)ceil(((double)current_image_res_y / (double)(bsr_state->num_worker_threads + 1)));
-  if (lines_per_thread < 1) {
-    lines_per_thread=1;
+    resize_log=0;
   }
-  current_image_y=bsr_state->perthread->my_thread_id * lines_per_thread;
-  current_image_p=bsr_state->current_image_buf + ((uint64_t)current_image_res_x * (uint64_t)current_image_y);
-  for (image_offset=0; ((image_offset < ((uint64_t)bsr_state->current_image_res_x * (uint64_t)lines_per_thread)) && (current_image_y < current_image_res_y)); image_offset++) {
-    G_r=current_image_p->r;
-    G_g=current_image_p->g;
-    G_b=current_image_p->b;
-    G_r /= BSR_BLUR_RESCALE;
-    G_g /= BSR_BLUR_RESCALE;
-    G_b /= BSR_BLUR_RESCALE;
-    limitIntensity(bsr_config, &G_r, &G_g, &G_b);
-    current_image_p->r=G_r;
-    current_image_p->g=G_g;
-    current_image_p->b=G_b;
-
-    // if end of this line, move to next line
-    current_image_x++;
-    if (current_image_x == bsr_state->current_image_res_x) {
-      current_image_x=0;
-      current_image_y++;
-    }
-    current_image_p++;
-  } // end for i
 
   //
-  // worker threads: signal this thread is done and wait until main thread says we can continue to next step.
-  // main thread: wait until all other threads are done and then signal that they can continue to next step.
+  // worker threads:  wait for main thread to say go
+  // main thread: tell worker threads to go. The image was already limited to [0..BSR_BLUR_RESCALE] by postProcess()
   //
   if (bsr_state->perthread->my_pid != bsr_state->main_pid) {
-    bsr_state->status_array[bsr_state->perthread->my_thread_id].status=THREAD_STATUS_GAUSSIAN_BLUR_PREP_COMPLETE;
     waitForMainThread(bsr_state, THREAD_STATUS_GAUSSIAN_BLUR_HORIZONTAL_BEGIN);
   } else {
-    waitForWorkerThreads(bsr_state, THREAD_STATUS_GAUSSIAN_BLUR_PREP_COMPLETE);
-    // ready to continue, set all worker thread status to begin horizontal
+    // main thread
+    initRowBlocks(bsr_state, blur_res_y, 1);
     for (i=1; i <= bsr_state->num_worker_threads; i++) {
       bsr_state->status_array[i].status=THREAD_STATUS_GAUSSIAN_BLUR_HORIZONTAL_BEGIN;
     }
   } // end if not main thread
 
-  //
-  // all threads: apply Gaussian 1D kernel to each pixel horizontally and put output in blur buffer
-  //
-  blur_x=0;
-  blur_y=bsr_state->perthread->my_thread_id * lines_per_thread;
-  image_blur_p=bsr_state->image_blur_buf + ((uint64_t)blur_res_x * (uint64_t)blur_y);
-  for (blur_i=0; ((blur_i < ((uint64_t)blur_res_x * (uint64_t)lines_per_thread)) && (blur_y < blur_res_y)); blur_i++) {
-    // apply Gaussian kernel to this pixel horizontally
-    G_r=0.0;
-    G_g=0.0;
-    G_b=0.0;
-    G_kernel_p=G_kernel_array;
-    for (kernel_i=-half_sample_width + 1; kernel_i < half_sample_width; kernel_i++) {
-      source_x=blur_x + kernel_i;
-      if ((source_x >= 0) && (source_x < current_image_res_x)) {
-        current_image_offset=((uint64_t)blur_y * (uint64_t)blur_res_x) + (uint64_t)source_x;
-        current_image_p=bsr_state->current_image_buf + current_image_offset;
-        G_r+=(current_image_p->r * *G_kernel_p);
-        G_g+=(current_image_p->g * *G_kernel_p);
-        G_b+=(current_image_p->b * *G_kernel_p);
-      } // end if within current image bounds
-      G_kernel_p++;
-    } // end for kernel
-
-    // copy blurred pixel to blur buffer
-    image_blur_p->r=G_r;
-    image_blur_p->g=G_g;
-    image_blur_p->b=G_b;
-
-    // if end of this line, move to next line
-    blur_x++;
-    if (blur_x == blur_res_x) {
-      blur_x=0;
-      blur_y++;
+  trace_event=traceBegin(bsr_state, "Gaussian blur horizontal", NULL);
+
+  if (recursive == 1) {
+    //
+    // all threads: apply recursive Gaussian to each row and put output in blur buffer
+    //
+    line_buf=(double *)malloc((size_t)(blur_res_x + 5) * 3 * sizeof(double));
+    if (line_buf == NULL) {
+      if (bsr_config->cgi_mode != 1) {
+        printf("Error: could not allocate memory for Gaussian blur line buffer\n");
+        fflush(stdout);
+      }
+      exit(1);
     }
-    image_blur_p++;
-  } // end for blur_i
+    while (nextRowBlock(bsr_state, &first_line, &last_line) == 1) {
+      for (blur_y=first_line; blur_y < last_line; blur_y++) {
+        line_buf[0]=0.0;
+        line_buf[1]=0.0;
+        line_buf[2]=0.0;
+        line_buf[3]=0.0;
+        line_buf[4]=0.0;
+        line_buf[5]=0.0;
+        line_buf[6]=0.0;
+        line_buf[7]=0.0;
+        line_buf[8]=0.0;
+        line_p=line_buf + 9;
+        current_image_offset=(uint64_t)blur_y * (uint64_t)blur_res_x;
+        for (blur_x=0; blur_x < blur_res_x; blur_x++) {
+          loadPixel(bsr_state->current_image_buf, current_image_precision, current_image_offset, &line_p[0], &line_p[1], &line_p[2]);
+          line_p+=3;
+          current_image_offset++;
+        }
+        recursiveGaussianLanes(&recursive_Gaussian, line_buf, blur_res_x, 3);
+        line_p=line_buf + 9;
+        image_blur_offset=(uint64_t)blur_y * (uint64_t)blur_res_x;
+        for (blur_x=0; blur_x < blur_res_x; blur_x++) {
+          storePixel(bsr_state->image_blur_buf, blur_precision, image_blur_offset, line_p[0], line_p[1], line_p[2]);
+          line_p+=3;
+          image_blur_offset++;
+        }
+        checkCancel(bsr_state);
+      } // end for blur_y
+    } // end while nextRowBlock
+    free(line_buf);
+  } else {
+    //
+    // all threads: apply Gaussian 1D kernel to each pixel horizontally and put output in blur buffer
+    //
+    while (nextRowBlock(bsr_state, &first_line, &last_line) == 1) {
+      blur_x=0;
+      blur_y=first_line;
+      image_blur_offset=(uint64_t)blur_res_x * (uint64_t)blur_y;
+      for (blur_i=0; ((blur_i < ((uint64_t)blur_res_x * (uint64_t)(last_line - first_line))) && (blur_y < blur_res_y)); blur_i++) {
+        // apply Gaussian kernel to this pixel horizontally
+        G_r=0.0;
+        G_g=0.0;
+        G_b=0.0;
+        G_kernel_p=G_kernel_array;
+        for (kernel_i=-half_sample_width + 1; kernel_i < half_sample_width; kernel_i++) {
+          source_x=blur_x + kernel_i;
+          if ((source_x >= 0) && (source_x < current_image_res_x)) {
+            current_image_offset=((uint64_t)blur_y * (uint64_t)blur_res_x) + (uint64_t)source_x;
+            loadPixel(bsr_state->current_image_buf, current_image_precision, current_image_offset, &pixel_r, &pixel_g, &pixel_b);
+            G_r+=(pixel_r * *G_kernel_p);
+            G_g+=(pixel_g * *G_kernel_p);
+            G_b+=(pixel_b * *G_kernel_p);
+          } // end if within current image bounds
+          G_kernel_p++;
+        } // end for kernel
+
+        // copy blurred pixel to blur buffer
+        storePixel(bsr_state->image_blur_buf, blur_precision, image_blur_offset, G_r, G_g, G_b);
+
+        // if end of this line, move to next line
+        blur_x++;
+        if (blur_x == blur_res_x) {
+          blur_x=0;
+          blur_y++;
+          checkCancel(bsr_state);
+        }
+        image_blur_offset++;
+      } // end for blur_i
+    } // end while nextRowBlock
+  } // end if recursive
+
+  traceEnd(bsr_state, trace_event);
 
   //
   // worker threads: signal this thread is done and wait until main thread says we can continue to next step.
@@ -247,57 +438,154 @@ int GaussianBlur(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
     waitForMainThread(bsr_state, THREAD_STATUS_GAUSSIAN_BLUR_VERTICAL_BEGIN);
   } else {
     waitForWorkerThreads(bsr_state, THREAD_STATUS_GAUSSIAN_BLUR_HORIZONTAL_COMPLETE);
-    // ready to continue, set all worker thread status to begin vertical
+    // ready to continue, hand out column strips or blocks of lines with at least one kernel width of lines so the
+    // halo read for each block is at most as large as the block
+    if (recursive == 1) {
+      initRowBlocks(bsr_state, num_strips, 1);
+    } else {
+      initRowBlocks(bsr_state, blur_res_y, sample_width);
+    }
+    // set all worker thread status to begin vertical
     for (i=1; i <= bsr_state->num_worker_threads; i++) {
       bsr_state->status_array[i].status=THREAD_STATUS_GAUSSIAN_BLUR_VERTICAL_BEGIN;
     }
   } // end if not main thread
 
-  //
-  // all threads: apply Gaussian 1D kernel to each pixel vertically and put output back in 'current_image_buffer'
-  // note in this step we use image_blur_buf as source and current_iamge_buf as dest so some variable names will be backwards
-  //
-  blur_x=0;
-  blur_y=bsr_state->perthread->my_thread_id * lines_per_thread;
-  image_blur_p=bsr_state->current_image_buf + ((uint64_t)blur_res_x * (uint64_t)blur_y);
-  for (blur_i=0; ((blur_i < ((uint64_t)blur_res_x * (uint64_t)lines_per_thread)) && (blur_y < blur_res_y)); blur_i++) {
+  trace_event=traceBegin(bsr_state, "Gaussian blur vertical", NULL);
+
+  if (recursive == 1) {
     //
-    // apply Gaussian kernel to this pixel vertically
+    // all threads: apply recursive Gaussian to each column and put output back in 'current_image_buffer'. Columns are
+    // handed out in blocks of strips of BSR_BLUR_STRIP_WIDTH columns, so every row is read and written once per strip
+    // in contiguous runs instead of once per kernel tap
     //
-    G_r=0.0;
-    G_g=0.0;
-    G_b=0.0;
-    G_kernel_p=G_kernel_array;
-    for (kernel_i=-half_sample_width + 1; kernel_i < half_sample_width; kernel_i++) {
-      source_y=blur_y + kernel_i;
-      if ((source_y >= 0) && (source_y < current_image_res_y)) {
-        current_image_offset=((uint64_t)source_y * (uint64_t)blur_res_x) + (uint64_t)blur_x;
-        current_image_p=bsr_state->image_blur_buf + current_image_offset;
-        G_r+=(current_image_p->r * *G_kernel_p);
-        G_g+=(current_image_p->g * *G_kernel_p);
-        G_b+=(current_image_p->b * *G_kernel_p);
-      } // end if within current image bounds
-      G_kernel_p++;
-    } // end for kernel
-
-    // undo scaling
-    G_r *= BSR_BLUR_RESCALE;
-    G_g *= BSR_BLUR_RESCALE;
-    G_b *= BSR_BLUR_RESCALE;
-
-    // copy blurred pixel to blur buffer
-    image_blur_p->r=G_r;
-    image_blur_p->g=G_g;
-    image_blur_p->b=G_b;
-
-    // if end of this line, move to next line
-    blur_x++;
-    if (blur_x == blur_res_x) {
-      blur_x=0;
-      blur_y++;
+    line_buf=(double *)malloc((size_t)(blur_res_y + 5) * BSR_BLUR_STRIP_WIDTH * 3 * sizeof(double));
+    if (line_buf == NULL) {
+      if (bsr_config->cgi_mode != 1) {
+        printf("Error: could not allocate memory for Gaussian blur strip buffer\n");
+        fflush(stdout);
+      }
+      exit(1);
+    }
+    while (nextRowBlock(bsr_state, &first_strip, &end_strip) == 1) {
+      first_column=first_strip * BSR_BLUR_STRIP_WIDTH;
+      last_column=end_strip * BSR_BLUR_STRIP_WIDTH;
+      if (last_column > blur_res_x) {
+        last_column=blur_res_x;
+      }
+      for (strip_x=first_column; strip_x < last_column; strip_x+=BSR_BLUR_STRIP_WIDTH) {
+        strip_width=last_column - strip_x;
+        if (strip_width > BSR_BLUR_STRIP_WIDTH) {
+          strip_width=BSR_BLUR_STRIP_WIDTH;
+        }
+        lanes=strip_width * 3;
+        for (i=0; i < (3 * lanes); i++) {
+          line_buf[i]=0.0;
+        }
+        line_p=line_buf + (3 * lanes);
+        for (blur_y=0; blur_y < blur_res_y; blur_y++) {
+          image_blur_offset=((uint64_t)blur_y * (uint64_t)blur_res_x) + (uint64_t)strip_x;
+          for (blur_x=0; blur_x < strip_width; blur_x++) {
+            loadPixel(bsr_state->image_blur_buf, blur_precision, image_blur_offset, &line_p[0], &line_p[1], &line_p[2]);
+            line_p+=3;
+            image_blur_offset++;
+          }
+        }
+        recursiveGaussianLanes(&recursive_Gaussian, line_buf, blur_res_y, lanes);
+        line_p=line_buf + (3 * lanes);
+        for (blur_y=0; blur_y < blur_res_y; blur_y++) {
+          current_image_offset=((uint64_t)blur_y * (uint64_t)blur_res_x) + (uint64_t)strip_x;
+          for (blur_x=0; blur_x < strip_width; blur_x++) {
+            if (resize_log == 1) {
+              LanczosLogPixel(&line_p[0], &line_p[1], &line_p[2]);
+            }
+            storePixel(bsr_state->current_image_buf, current_image_precision, current_image_offset, line_p[0], line_p[1], line_p[2]);
+            line_p+=3;
+            current_image_offset++;
+          }
+        }
+        checkCancel(bsr_state);
+      } // end for strip_x
+    } // end while nextRowBlock
+    free(line_buf);
+  } else {
+    //
+    // all threads: apply Gaussian 1D kernel to each pixel vertically and put output back in 'current_image_buffer'.
+    // Each block of lines is processed in strips of BSR_BLUR_STRIP_WIDTH columns: the strip plus the kernel halo
+    // above and below is copied once into a small buffer (zeros beyond the image edges), then the kernel slides down
+    // the strip with the columns and colors in the inner loop, and each output line of the strip is written
+    // contiguously. This reads and writes each pixel about once instead of once per kernel tap
+    //
+    block_lines=bsr_state->row_block_rows + (2 * (half_sample_width - 1));
+    line_buf=(double *)malloc((size_t)block_lines * BSR_BLUR_STRIP_WIDTH * 3 * sizeof(double));
+    if (line_buf == NULL) {
+      if (bsr_config->cgi_mode != 1) {
+        printf("Error: could not allocate memory for Gaussian blur strip buffer\n");
+        fflush(stdout);
+      }
+      exit(1);
     }
-    image_blur_p++;
-  } // end for blur_i
+    while (nextRowBlock(bsr_state, &first_line, &last_line) == 1) {
+      for (strip_x=0; strip_x < blur_res_x; strip_x+=BSR_BLUR_STRIP_WIDTH) {
+        strip_width=blur_res_x - strip_x;
+        if (strip_width > BSR_BLUR_STRIP_WIDTH) {
+          strip_width=BSR_BLUR_STRIP_WIDTH;
+        }
+        lanes=strip_width * 3;
+
+        //
+        // copy strip and halo from blur buffer
+        //
+        line_p=line_buf;
+        for (source_y=(first_line - half_sample_width + 1); source_y < (last_line + half_sample_width - 1); source_y++) {
+          if ((source_y >= 0) && (source_y < current_image_res_y)) {
+            image_blur_offset=((uint64_t)source_y * (uint64_t)blur_res_x) + (uint64_t)strip_x;
+            for (blur_x=0; blur_x < strip_width; blur_x++) {
+              loadPixel(bsr_state->image_blur_buf, blur_precision, image_blur_offset, &line_p[0], &line_p[1], &line_p[2]);
+              line_p+=3;
+              image_blur_offset++;
+            }
+          } else {
+            for (i=0; i < lanes; i++) {
+              line_p[i]=0.0;
+            }
+            line_p+=lanes;
+          } // end if within current image bounds
+        } // end for source_y
+
+        //
+        // apply Gaussian kernel to each line of strip
+        //
+        for (blur_y=first_line; blur_y < last_line; blur_y++) {
+          for (i=0; i < lanes; i++) {
+            G_strip[i]=0.0;
+          }
+          line_p=line_buf + ((size_t)(blur_y - first_line) * (size_t)lanes);
+          for (kernel_i=0; kernel_i < sample_width; kernel_i++) {
+            G=G_kernel_array[kernel_i];
+            for (i=0; i < lanes; i++) {
+              G_strip[i]+=(line_p[i] * G);
+            }
+            line_p+=lanes;
+          } // end for kernel
+
+          // copy blurred pixels to current image buffer
+          current_image_offset=((uint64_t)blur_y * (uint64_t)blur_res_x) + (uint64_t)strip_x;
+          for (blur_x=0; blur_x < strip_width; blur_x++) {
+            if (resize_log == 1) {
+              LanczosLogPixel(&G_strip[(blur_x * 3)], &G_strip[(blur_x * 3) + 1], &G_strip[(blur_x * 3) + 2]);
+            }
+            storePixel(bsr_state->current_image_buf, current_image_precision, current_image_offset, G_strip[(blur_x * 3)], G_strip[(blur_x * 3) + 1], G_strip[(blur_x * 3) + 2]);
+            current_image_offset++;
+          }
+        } // end for blur_y
+        checkCancel(bsr_state);
+      } // end for strip_x
+    } // end while nextRowBlock
+    free(line_buf);
+  } // end if recursive
+
+  traceEnd(bsr_state, trace_event);
 
   //
   // worker threads: signal this thread is done and wait until main thread says we can continue to next step.
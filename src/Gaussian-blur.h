@@ -39,6 +39,9 @@
 #ifndef BSR_GAUSSIAN_BLUR_H
 #define BSR_GAUSSIAN_BLUR_H
 
+double recursiveGaussianVariance(double q);
+int initRecursiveGaussian(recursive_Gaussian_t *recursive_Gaussian, double sigma);
+int recursiveGaussianLanes(recursive_Gaussian_t *recursive_Gaussian, double *buf, int n, int lanes);
 int GaussianBlur(bsr_config_t *bsr_config, bsr_state_t *bsr_state);
 
 #endif // BSR_GAUSSIN_BLUR_H
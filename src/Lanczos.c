@@ -42,14 +42,108 @@
 #include <math.h>
 #include <time.h>
 #include "util.h"
+#include "pixel-buffer.h"
+
+int LanczosOrder(bsr_config_t *bsr_config) {
+  //
+  // Lanczos order parameter limited to [2..10]
+  //
+  if (bsr_config->Lanczos_order < 2) {
+    return(2);
+  } else if (bsr_config->Lanczos_order > 10) {
+    return(10);
+  }
+  return(bsr_config->Lanczos_order);
+}
+
+double LanczosRadius(bsr_config_t *bsr_config) {
+  //
+  // kernel radius in source pixels. When downscaling the kernel is widened by the scaling factor so it covers every
+  // source pixel of each output pixel, which keeps large reductions from aliasing
+  //
+  if (bsr_config->output_scaling_factor < 1.0) {
+    return((double)LanczosOrder(bsr_config) / bsr_config->output_scaling_factor);
+  }
+  return((double)LanczosOrder(bsr_config));
+}
+
+double LanczosKernel(int Lanczos_order, double distance) {
+  if (distance == 0.0) {
+    return(1.0);
+  } else if ((distance > -(double)Lanczos_order) && (distance < (double)Lanczos_order)) {
+    return(Lanczos_order * sin(M_PI * distance) * sin(M_PI * distance / (double)Lanczos_order) / (M_PI * M_PI * distance * distance));
+  }
+  return(0.0);
+}
+
+int LanczosWeights(int Lanczos_order, double radius, double center, int res, int *first, int *count, double *weights) {
+  //
+  // This function finds the source pixels [first..first+count) within 'radius' of 'center' and inside [0..res), and
+  // their kernel weights normalized to sum to 1.0 so image edges are not darkened or brightened
+  //
+  int lo;
+  int hi;
+  int source;
+  double kernel_scale;
+  double weight;
+  double weight_sum;
+  int i;
+
+  kernel_scale=radius / (double)Lanczos_order;
+  lo=(int)floor(center - radius) + 1;
+  hi=(int)floor(center + radius);
+  if (lo < 0) {
+    lo=0;
+  }
+  if (hi > (res - 1)) {
+    hi=res - 1;
+  }
+  *first=lo;
+  *count=0;
+  weight_sum=0.0;
+  for (source=lo; source <= hi; source++) {
+    weight=LanczosKernel(Lanczos_order, (center - (double)source) / kernel_scale);
+    weights[*count]=weight;
+    weight_sum+=weight;
+    (*count)++;
+  }
+  if (weight_sum != 0.0) {
+    for (i=0; i < *count; i++) {
+      weights[i]/=weight_sum;
+    }
+  }
+
+  return(0);
+}
+
+int LanczosLogPixel(double *pixel_r, double *pixel_g, double *pixel_b) {
+  //
+  // convert pixel to log scale before Lanczos resampling to reduce clipping artifacts. Recursive Gaussian blur can
+  // leave tiny negative values, which are limited to zero first
+  //
+  if (*pixel_r < 0.0) {
+    *pixel_r=0.0;
+  }
+  if (*pixel_g < 0.0) {
+    *pixel_g=0.0;
+  }
+  if (*pixel_b < 0.0) {
+    *pixel_b=0.0;
+  }
+  *pixel_r=log(BSR_RESIZE_LOG_OFFSET + *pixel_r);
+  *pixel_g=log(BSR_RESIZE_LOG_OFFSET + *pixel_g);
+  *pixel_b=log(BSR_RESIZE_LOG_OFFSET + *pixel_b);
+
+  return(0);
+}
 
 int resizeLanczos(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
   struct timespec starttime;
   struct timespec endtime;
   double elapsed_time;
-  pixel_composition_t *current_image_p;
-  pixel_composition_t *image_resize_p;
-  uint64_t current_image_offset;
+  uint64_t image_resize_offset;
+  int current_image_precision;
+  int resize_precision;
   int resize_res_x;
   int resize_res_y;
   double source_w;
@@ -60,26 +154,39 @@ int resizeLanczos(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
   int source_y;
   int resize_x;
   int resize_y;
-  double L_kernel;
   double L_x_r;
   double L_x_g;
   double L_x_b;
   double L_y_r;
   double L_y_g;
   double L_y_b;
-  double L_distance_x;
-  double L_distance_y;
-  uint64_t resize_i;
-  int i_x;
-  int i_y;
   int Lanczos_order;
+  double radius;
+  int max_taps;
+  int *x_first;
+  int *x_count;
+  double *x_weights;
+  double *x_weights_p;
+  int y_first;
+  int y_count;
+  double *y_weights;
+  double weight;
+  double *source_line;
+  double *source_p;
+  double *resample_lines;
+  double *resample_p;
+  double *resize_line;
+  double *resize_p;
+  int next_source_y;
   int current_image_res_x;
   int current_image_res_y;
-  int lines_per_thread;
+  int current_image_y_offset;
+  int resize_y_offset;
+  int first_line;
+  int end_line;
   int i;
-  int current_image_x;
-  int current_image_y;
   uint64_t image_offset;
+  int trace_event;
 
   //
   // all threads: get current image resolution and calculate resize resolution
@@ -88,6 +195,10 @@ int resizeLanczos(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
   current_image_res_y=bsr_state->current_image_res_y;
   resize_res_x=bsr_state->resize_res_x;
   resize_res_y=bsr_state->resize_res_y;
+  current_image_precision=bsr_state->current_image_precision;
+  resize_precision=bsr_state->resize_precision;
+  current_image_y_offset=bsr_state->current_image_y_offset;
+  resize_y_offset=bsr_state->resize_y_offset;
   source_w=1.0 / bsr_config->output_scaling_factor;
   half_source_w=source_w / 2.0;
 
@@ -102,159 +213,143 @@ int resizeLanczos(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
 
   //
   // worker threads:  wait for main thread to say go
-  // main thread: tell worker threads to go
+  // main thread: tell worker threads to go. The image was already converted to log scale by postProcess() or
+  // GaussianBlur() to reduce clipping artifacts. This is undone as each output line is stored
   //
   if (bsr_state->perthread->my_pid != bsr_state->main_pid) {
-    waitForMainThread(bsr_state, THREAD_STATUS_LANCZOS_PREP_BEGIN);
-  } else {
-    // main thread
-    for (i=1; i <= bsr_state->num_worker_threads; i++) {
-      bsr_state->status_array[i].status=THREAD_STATUS_LANCZOS_PREP_BEGIN;
-    }
-  } // end if not main thread
-
-  //
-  // all threads: convert to log scale to reduce clipping artifacts. This will be undone
-  // at the end of resizeLanczos()
-  //
-  current_image_x=0;
-  lines_per_thread=(int)ceil(((double)current_image_res_y / (double)(bsr_state->num_worker_threads + 1)));
-  if (lines_per_thread < 1) {
-    lines_per_thread=1;
-  }
-  current_image_y=bsr_state->perthread->my_thread_id * lines_per_thread;
-  current_image_p=bsr_state->current_image_buf + ((uint64_t)current_image_res_x * (uint64_t)current_image_y);
-  for (image_offset=0; ((image_offset < ((uint64_t)bsr_state->current_image_res_x * (uint64_t)lines_per_thread)) && (current_image_y < current_image_res_y)); image_offset++) {
-    L_x_r=current_image_p->r;
-    L_x_g=current_image_p->g;
-    L_x_b=current_image_p->b;
-    L_x_r=log(BSR_RESIZE_LOG_OFFSET + L_x_r); 
-    L_x_g=log(BSR_RESIZE_LOG_OFFSET + L_x_g);
-    L_x_b=log(BSR_RESIZE_LOG_OFFSET + L_x_b);
-    current_image_p->r=L_x_r;
-    current_image_p->g=L_x_g;
-    current_image_p->b=L_x_b;
-
-    // if end of this line, move to next line
-    current_image_x++;
-    if (current_image_x == bsr_state->current_image_res_x) {
-      current_image_x=0;
-      current_image_y++;
-    }
-    current_image_p++;
-  } // end for i
-
-  //
-  // worker threads: signal this thread is done and wait until main thread says we can continue to next step.
-  // main thread: wait until all other threads are done and then signal that they can continue to next step.
-  //
-  if (bsr_state->perthread->my_pid != bsr_state->main_pid) {
-    bsr_state->status_array[bsr_state->perthread->my_thread_id].status=THREAD_STATUS_LANCZOS_PREP_COMPLETE;
     waitForMainThread(bsr_state, THREAD_STATUS_LANCZOS_RESAMPLE_BEGIN);
   } else {
-    waitForWorkerThreads(bsr_state, THREAD_STATUS_LANCZOS_PREP_COMPLETE);
-    // ready to continue, set all worker thread status to continue
+    // main thread: each block of output lines spans at least as many source lines as the kernel, so the source lines
+    // resampled again at the top of each block are at most as many as the block uses anyway
+    initRowBlocks(bsr_state, resize_res_y, (int)ceil(2.0 * LanczosRadius(bsr_config) * bsr_config->output_scaling_factor));
     for (i=1; i <= bsr_state->num_worker_threads; i++) {
       bsr_state->status_array[i].status=THREAD_STATUS_LANCZOS_RESAMPLE_BEGIN;
     }
   } // end if not main thread
 
+  trace_event=traceBegin(bsr_state, "Lanczos resample", NULL);
+
   //
-  // all threads: copy rendered image to resize buffer using Lanczos interpolation
+  // all threads: copy rendered image to resize buffer using separable Lanczos interpolation. Weights only depend on
+  // the output column or row, so horizontal weights are computed once per column. Each thread resamples the source
+  // lines its output lines need horizontally into a ring of max_taps lines, then each output line is the weighted
+  // sum of those lines, with every column and color of the line in the inner loop. Blocks of output lines are handed
+  // out in increasing order, so lines still in the ring from the previous block are reused
   //
-  if (bsr_config->Lanczos_order < 2) {
-    Lanczos_order=2;
-  } else if (bsr_config->Lanczos_order > 10) {
-    Lanczos_order=10;
-  } else {
-    Lanczos_order=bsr_config->Lanczos_order;
-  }
-  resize_x=0;
-  lines_per_thread=(int)ceil(((double)resize_res_y / (double)(bsr_state->num_worker_threads + 1)));
-  if (lines_per_thread < 1) {
-    lines_per_thread=1;
+  Lanczos_order=LanczosOrder(bsr_config);
+  radius=LanczosRadius(bsr_config);
+  max_taps=(int)ceil(2.0 * radius) + 1;
+  x_first=(int *)malloc((size_t)resize_res_x * sizeof(int));
+  x_count=(int *)malloc((size_t)resize_res_x * sizeof(int));
+  x_weights=(double *)malloc((size_t)resize_res_x * (size_t)max_taps * sizeof(double));
+  y_weights=(double *)malloc((size_t)max_taps * sizeof(double));
+  source_line=(double *)malloc((size_t)current_image_res_x * 3 * sizeof(double));
+  resample_lines=(double *)malloc((size_t)max_taps * (size_t)resize_res_x * 3 * sizeof(double));
+  resize_line=(double *)malloc((size_t)resize_res_x * 3 * sizeof(double));
+  if ((x_first == NULL) || (x_count == NULL) || (x_weights == NULL) || (y_weights == NULL) || (source_line == NULL) || (resample_lines == NULL) || (resize_line == NULL)) {
+    if (bsr_config->cgi_mode != 1) {
+      printf("Error: could not allocate memory for Lanczos resampling\n");
+      fflush(stdout);
+    }
+    exit(1);
   }
-  resize_y=bsr_state->perthread->my_thread_id * lines_per_thread;
-  image_resize_p=bsr_state->image_resize_buf + ((uint64_t)resize_res_x * (uint64_t)resize_y);
-  for (resize_i=0; ((resize_i < ((uint64_t)resize_res_x * (uint64_t)lines_per_thread)) && (resize_y < resize_res_y)); resize_i++) {
+  for (resize_x=0; resize_x < resize_res_x; resize_x++) {
     source_x_center=((double)resize_x * source_w) + half_source_w - 0.5;
-    source_y_center=((double)resize_y * source_w) + half_source_w - 0.5;
-    L_y_r=0.0;
-    L_y_g=0.0;
-    L_y_b=0.0;
-    for (i_y=((int)source_y_center - Lanczos_order + 1); i_y <= ((int)source_y_center + Lanczos_order); i_y++) {
-      source_y=i_y;
+    LanczosWeights(Lanczos_order, radius, source_x_center, current_image_res_x, &x_first[resize_x], &x_count[resize_x], (x_weights + ((size_t)resize_x * (size_t)max_taps)));
+  }
 
-      // L_x
-      L_x_r=0.0;
-      L_x_g=0.0;
-      L_x_b=0.0;
-      for (i_x=((int)source_x_center - Lanczos_order + 1); i_x <= ((int)source_x_center + Lanczos_order); i_x++) {
-        source_x=i_x;
-        if ((source_x >= 0) && (source_x < current_image_res_x) && (source_y >= 0) && (source_y < current_image_res_y)) {
-          current_image_offset=((uint64_t)source_y * (uint64_t)current_image_res_x) + (uint64_t)source_x;
-          current_image_p=bsr_state->current_image_buf + current_image_offset;
-          L_distance_x=source_x_center - (double)i_x;
-          if (L_distance_x == 0.0) {
-            L_x_r+=current_image_p->r;
-            L_x_g+=current_image_p->g;
-            L_x_b+=current_image_p->b;
-          } else if ((L_distance_x >= -(double)Lanczos_order) && (L_distance_x <= (double)Lanczos_order)) {
-            L_kernel=Lanczos_order * sin(M_PI * L_distance_x) * sin(M_PI * L_distance_x / (double)Lanczos_order) / (M_PI * M_PI * L_distance_x * L_distance_x);
-            L_x_r+=(current_image_p->r * L_kernel);
-            L_x_g+=(current_image_p->g * L_kernel);
-            L_x_b+=(current_image_p->b * L_kernel);
-          } else {
-            // L_x == 0
-          } // end if L_distance_x
-        } // end if within composition buffer bounds
-      } // end for i_x
+  next_source_y=0;
+  while (nextRowBlock(bsr_state, &first_line, &end_line) == 1) {
+    for (resize_y=first_line; resize_y < end_line; resize_y++) {
+      source_y_center=((double)(resize_y + resize_y_offset) * source_w) + half_source_w - 0.5 - (double)current_image_y_offset; // offsets are 0 unless tiled rendering
+      LanczosWeights(Lanczos_order, radius, source_y_center, current_image_res_y, &y_first, &y_count, y_weights);
 
-      // L_y
-      L_distance_y=source_y_center - (double)i_y;
-      if (L_distance_y == 0.0) {
-        L_y_r+=L_x_r;
-        L_y_g+=L_x_g;
-        L_y_b+=L_x_b;
-      } else if ((L_distance_y >= -(double)Lanczos_order) && (L_distance_y <= (double)Lanczos_order)) {
-        L_kernel=Lanczos_order * sin(M_PI * L_distance_y) * sin(M_PI * L_distance_y / (double)Lanczos_order) / (M_PI * M_PI * L_distance_y * L_distance_y);
-        L_y_r+=(L_x_r * L_kernel);
-        L_y_g+=(L_x_g * L_kernel);
-        L_y_b+=(L_x_b * L_kernel);
-      } else {
-        // L_y = 0
-      } // end if L_distance_y
-    } // end for i_y
+      //
+      // resample source lines not already in the ring horizontally
+      //
+      if (next_source_y < y_first) {
+        next_source_y=y_first;
+      }
+      for (source_y=next_source_y; source_y < (y_first + y_count); source_y++) {
+        source_p=source_line;
+        image_offset=(uint64_t)source_y * (uint64_t)current_image_res_x;
+        for (source_x=0; source_x < current_image_res_x; source_x++) {
+          loadPixel(bsr_state->current_image_buf, current_image_precision, image_offset, &source_p[0], &source_p[1], &source_p[2]);
+          source_p+=3;
+          image_offset++;
+        }
+        resample_p=resample_lines + ((size_t)(source_y % max_taps) * (size_t)resize_res_x * 3);
+        x_weights_p=x_weights;
+        for (resize_x=0; resize_x < resize_res_x; resize_x++) {
+          L_x_r=0.0;
+          L_x_g=0.0;
+          L_x_b=0.0;
+          source_p=source_line + ((size_t)x_first[resize_x] * 3);
+          for (i=0; i < x_count[resize_x]; i++) {
+            L_x_r+=(source_p[0] * x_weights_p[i]);
+            L_x_g+=(source_p[1] * x_weights_p[i]);
+            L_x_b+=(source_p[2] * x_weights_p[i]);
+            source_p+=3;
+          }
+          resample_p[0]=L_x_r;
+          resample_p[1]=L_x_g;
+          resample_p[2]=L_x_b;
+          resample_p+=3;
+          x_weights_p+=max_taps;
+        } // end for resize_x
+      } // end for source_y
+      next_source_y=y_first + y_count;
 
-    // undo log scaling
-    L_y_r=exp(L_y_r) - BSR_RESIZE_LOG_OFFSET;
-    L_y_g=exp(L_y_g) - BSR_RESIZE_LOG_OFFSET;
-    L_y_b=exp(L_y_b) - BSR_RESIZE_LOG_OFFSET;
+      //
+      // resample vertically
+      //
+      for (i=0; i < (resize_res_x * 3); i++) {
+        resize_line[i]=0.0;
+      }
+      for (source_y=y_first; source_y < (y_first + y_count); source_y++) {
+        resample_p=resample_lines + ((size_t)(source_y % max_taps) * (size_t)resize_res_x * 3);
+        weight=y_weights[source_y - y_first];
+        for (i=0; i < (resize_res_x * 3); i++) {
+          resize_line[i]+=(resample_p[i] * weight);
+        }
+      }
 
-    // handle negative clipping, which is common
-    if (L_y_r < 0.0) {
-      L_y_r=0.0;
-    }
-    if (L_y_g < 0.0) {
-      L_y_g=0.0;
-    }
-    if (L_y_b < 0.0) {
-      L_y_b=0.0;
-    }
+      image_resize_offset=(uint64_t)resize_y * (uint64_t)resize_res_x;
+      resize_p=resize_line;
+      for (resize_x=0; resize_x < resize_res_x; resize_x++) {
+        // undo log scaling
+        L_y_r=exp(resize_p[0]) - BSR_RESIZE_LOG_OFFSET;
+        L_y_g=exp(resize_p[1]) - BSR_RESIZE_LOG_OFFSET;
+        L_y_b=exp(resize_p[2]) - BSR_RESIZE_LOG_OFFSET;
 
-    // copy to output buffer
-    image_resize_p->r=L_y_r;
-    image_resize_p->g=L_y_g;
-    image_resize_p->b=L_y_b;
+        // handle negative clipping, which is common
+        if (L_y_r < 0.0) {
+          L_y_r=0.0;
+        }
+        if (L_y_g < 0.0) {
+          L_y_g=0.0;
+        }
+        if (L_y_b < 0.0) {
+          L_y_b=0.0;
+        }
 
-    // if end of this line, move to next line
-    resize_x++;
-    if (resize_x == resize_res_x) {
-      resize_x=0;
-      resize_y++;
-    }
-    image_resize_p++;
-  }
+        // copy to output buffer
+        storePixel(bsr_state->image_resize_buf, resize_precision, image_resize_offset, L_y_r, L_y_g, L_y_b);
+        resize_p+=3;
+        image_resize_offset++;
+      } // end for resize_x
+      checkCancel(bsr_state);
+    } // end for resize_y
+  } // end while nextRowBlock
+  free(x_first);
+  free(x_count);
+  free(x_weights);
+  free(y_weights);
+  free(source_line);
+  free(resample_lines);
+  free(resize_line);
+
+  traceEnd(bsr_state, trace_event);
 
   //
   // worker threads: signal this thread is done and wait until main thread says we can continue to next step.
@@ -268,8 +363,11 @@ int resizeLanczos(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
     // main thread: update current_image_buf pointer
     if (bsr_state->perthread->my_pid == bsr_state->main_pid) {
       bsr_state->current_image_buf=bsr_state->image_resize_buf;
+      bsr_state->current_image_precision=resize_precision;
       bsr_state->current_image_res_x=resize_res_x;
       bsr_state->current_image_res_y=resize_res_y;
+      bsr_state->current_image_y_offset=resize_y_offset;
+      bsr_state->current_image_full_res_y=bsr_state->resize_full_res_y;
     }
     for (i=1; i <= bsr_state->num_worker_threads; i++) {
       bsr_state->status_array[i].status=THREAD_STATUS_LANCZOS_CONTINUE;
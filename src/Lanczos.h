@@ -39,6 +39,11 @@
 #ifndef BSR_LANCZOS_H
 #define BSR_LANCZOS_H
 
+int LanczosOrder(bsr_config_t *bsr_config);
+double LanczosRadius(bsr_config_t *bsr_config);
+double LanczosKernel(int Lanczos_order, double distance);
+int LanczosWeights(int Lanczos_order, double radius, double center, int res, int *first, int *count, double *weights);
+int LanczosLogPixel(double *pixel_r, double *pixel_g, double *pixel_b);
 int resizeLanczos(bsr_config_t *bsr_config, bsr_state_t *bsr_state);
 
 #endif // BSR_LANCZOS_H
@@ -0,0 +1,564 @@
+//
+// Billion Star 3D Rendering Engine
+// Kevin M. Loch
+//
+// 3D rendering engine for the ESA Gaia DR3 star dataset
+
+/*
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2021, Kevin Loch
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "bsrender.h" // needs to be first to get GNU_SOURCE define for strcasestr
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <math.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include "admission.h"
+#include "cgi.h"
+#include "util.h"
+#include "pixel-buffer.h"
+#include "Lanczos.h"
+#include "diffraction.h"
+
+//
+// Admission control limits the total estimated cost of CGI requests rendering at the same time. Each request's cost
+// (CPU-seconds) and peak memory are estimated from the resolution, field of view, Airy disk extents, blur and resize
+// settings and the sizes of the data files it will read. Requests over the per-request budget are degraded (lower
+// resolution or higher minimum parallax quality) or rejected. Requests that would exceed the active budget wait in a
+// first come first served queue, and are rejected if the queue is full or they wait longer than cgi_queue_timeout.
+// Rejected requests get an HTTP 503 response.
+//
+// The table of rendering and queued requests is mmapped from admission_file so it is shared by all bsrender
+// processes (CGI or daemon requests) using the same file. Slots of processes that exit without releasing them are
+// reclaimed.
+//
+
+//
+// cost model coefficients in CPU-seconds, measured on a reference system. Budgets are in the same units so these
+// only need to be roughly proportional to actual run times
+//
+#define BSR_COST_STAR_READ 0.8E-6       // per star record read from the data files
+#define BSR_COST_STAR_VIEW 7.0E-6       // per star within the field of view of a camera
+#define BSR_COST_AIRY_PIXEL 0.04E-6     // per Airy disk pixel rendered
+#define BSR_COST_PIXEL 0.08E-6          // per image composition pixel (clear, post-process)
+#define BSR_COST_OUTPUT_PIXEL 0.10E-6   // per output pixel (sequence, encode)
+#define BSR_COST_BLUR_TAP 0.034E-6      // per Gaussian blur kernel tap
+#define BSR_COST_RESIZE_TAP 0.004E-6    // per Lanczos kernel tap
+#define BSR_COST_FFT_BUTTERFLY 0.015E-6 // per FFT butterfly of Airy disk convolution
+
+double starRecords(bsr_config_t *bsr_config) {
+  //
+  // number of star records in the data files this request will read
+  //
+  const char *pq_names[10]={"pq100", "pq050", "pq030", "pq020", "pq010", "pq005", "pq003", "pq002", "pq001", "pq000"};
+  const int pq_min[10]={100, 50, 30, 20, 10, 5, 3, 2, 1, 0};
+  const char *suffix;
+  char file_path[1024];
+  struct stat sb;
+  double records;
+  int i;
+
+  if (littleEndianTest() == 1) {
+    suffix=BSR_LE_SUFFIX;
+  } else {
+    suffix=BSR_BE_SUFFIX;
+  }
+  records=0.0;
+  if (bsr_config->external_db_enable == 1) {
+    snprintf(file_path, 1024, "%s/%s-%s.%s", bsr_config->data_file_directory, BSR_EXTERNAL_PREFIX, suffix, BSR_EXTENSION);
+    if (stat(file_path, &sb) == 0) {
+      records+=(double)sb.st_size / (double)BSR_STAR_RECORD_SIZE;
+    }
+  }
+  if (bsr_config->Gaia_db_enable == 1) {
+    for (i=0; i < 10; i++) {
+      // pq100 is always read, other files only if they are above the minimum parallax quality
+      if ((i == 0) || (bsr_config->Gaia_min_parallax_quality < pq_min[i - 1])) {
+        snprintf(file_path, 1024, "%s/%s-%s-%s.%s", bsr_config->data_file_directory, BSR_GDR3_PREFIX, pq_names[i], suffix, BSR_EXTENSION);
+        if (stat(file_path, &sb) == 0) {
+          records+=(double)sb.st_size / (double)BSR_STAR_RECORD_SIZE;
+        }
+      }
+    }
+  }
+
+  return(records);
+}
+
+double viewFraction(bsr_config_t *bsr_config) {
+  //
+  // approximate fraction of the sky (solid angle / 4 pi) within the field of view of all cameras
+  //
+  double hfov;
+  double vfov;
+  double fraction;
+
+  if (bsr_config->vr_mode == 1) {
+    // cube map faces cover the whole sky once
+    return(1.0);
+  }
+  hfov=bsr_config->camera_fov * M_PI / 180.0;
+  if (bsr_config->camera_projection == 0) {
+    // lat/lon: band of longitude hfov and latitude +/- vfov/2
+    vfov=hfov * (double)bsr_config->camera_res_y / (double)bsr_config->camera_res_x;
+    if (vfov > M_PI) {
+      vfov=M_PI;
+    }
+    fraction=(hfov / (2.0 * M_PI)) * sin(vfov / 2.0);
+  } else if (bsr_config->camera_projection == 4) {
+    // rectilinear: solid angle of a rectangular pyramid
+    if (hfov > (179.0 * M_PI / 180.0)) {
+      hfov=179.0 * M_PI / 180.0;
+    }
+    vfov=2.0 * atan(tan(hfov / 2.0) * (double)bsr_config->camera_res_y / (double)bsr_config->camera_res_x);
+    fraction=asin(sin(hfov / 2.0) * sin(vfov / 2.0)) / M_PI;
+  } else {
+    // spherical, Hammer, Mollewide: cap of half angle fov/2
+    fraction=(1.0 - cos(hfov / 2.0)) / 2.0;
+  }
+  if (fraction > 1.0) {
+    fraction=1.0;
+  } else if (fraction < 0.0) {
+    fraction=0.0;
+  }
+  if (bsr_config->vr_mode == 2) {
+    // stereo renders every star for both eyes
+    fraction*=2.0;
+  }
+
+  return(fraction);
+}
+
+int estimateRequestCost(bsr_config_t *bsr_config, double *star_cost, double *pixel_cost, double *memory) {
+  //
+  // This function estimates CPU-seconds for rendering stars (star_cost) and processing image buffers (pixel_cost),
+  // and peak memory in MB for the current configuration
+  //
+  double composition_pixels;
+  double max_image_pixels;
+  double output_pixels;
+  double scale;
+  double records;
+  double visible;
+  double Airy_pixels;
+  double blur_taps;
+  double resize_taps;
+  double buffer_memory;
+  double total_memory;
+  int composition_precision;
+  int blur_precision;
+  int resize_precision;
+  int num_worker_threads;
+  int per_thread_buffers;
+  int Airymap_width;
+  int Airy_res_x;
+  int Airy_res_y;
+  int Airy_cameras;
+  int fft_size=0;
+  int block_size;
+  double Airy_blocks;
+
+  //
+  // image sizes
+  //
+  if (bsr_config->vr_mode == 1) {
+    max_image_pixels=(double)bsr_config->camera_res_y * (double)bsr_config->camera_res_y;
+    composition_pixels=6.0 * max_image_pixels;
+    Airy_res_x=bsr_config->camera_res_y;
+    Airy_cameras=6;
+  } else if (bsr_config->vr_mode == 2) {
+    max_image_pixels=(double)bsr_config->camera_res_x * (double)bsr_config->camera_res_y;
+    composition_pixels=2.0 * max_image_pixels;
+    Airy_res_x=bsr_config->camera_res_x;
+    Airy_cameras=2;
+  } else {
+    max_image_pixels=(double)bsr_config->camera_res_x * (double)bsr_config->camera_res_y;
+    composition_pixels=max_image_pixels;
+    Airy_res_x=bsr_config->camera_res_x;
+    Airy_cameras=1;
+  }
+  Airy_res_y=bsr_config->camera_res_y;
+  scale=bsr_config->output_scaling_factor;
+  output_pixels=composition_pixels * scale * scale;
+
+  //
+  // stars: every record is read, stars in the field of view are projected and rendered
+  //
+  records=starRecords(bsr_config);
+  visible=records * viewFraction(bsr_config);
+  *star_cost=(records * BSR_COST_STAR_READ) + (visible * BSR_COST_STAR_VIEW);
+  if ((bsr_config->Airy_disk_enable == 1) && (bsr_config->Airy_disk_mode == 0)) {
+    // every star covers at least the minimum extent, brighter stars spread out toward the maximum extent
+    Airy_pixels=pow(((2.0 * (double)bsr_config->Airy_disk_min_extent) + 1.0), 2.0)\
+      + (12.4 * (double)bsr_config->Airy_disk_max_extent * pow((bsr_config->Airy_disk_first_null / 0.75), 2.0));
+    *star_cost+=visible * Airy_pixels * BSR_COST_AIRY_PIXEL;
+  }
+
+  //
+  // image buffers: clear, post-process, blur, resize, sequence and encode
+  //
+  *pixel_cost=(composition_pixels * BSR_COST_PIXEL) + (output_pixels * BSR_COST_OUTPUT_PIXEL);
+  if (bsr_config->Gaussian_blur_radius > 0.0) {
+    if ((bsr_config->Gaussian_blur_radius >= 0.5) && ((bsr_config->Gaussian_blur_mode == 2) || ((bsr_config->Gaussian_blur_mode == 0) && (bsr_config->Gaussian_blur_radius >= BSR_BLUR_RECURSIVE_MIN_RADIUS)))) {
+      blur_taps=16.0; // recursive: causal and anti-causal 4 tap filters in each direction
+    } else {
+      blur_taps=2.0 * (double)(((int)ceil(bsr_config->Gaussian_blur_radius) * 6) + 1);
+    }
+    *pixel_cost+=composition_pixels * blur_taps * BSR_COST_BLUR_TAP;
+  }
+  if (scale != 1.0) {
+    // separable: horizontal taps for each source line plus vertical taps for each output pixel
+    resize_taps=2.0 * LanczosRadius(bsr_config) * ((1.0 / scale) + 1.0);
+    *pixel_cost+=output_pixels * resize_taps * BSR_COST_RESIZE_TAP;
+  }
+  if (bsr_config->Airy_disk_mode == 1) {
+    // three 2D transforms for every two blocks of each camera, each fft_size^2 * log2(fft_size) butterflies
+    fft_size=AiryFFTSize(bsr_config, Airy_res_x, Airy_res_y);
+    block_size=fft_size - (bsr_config->Airy_disk_max_extent * 2);
+    Airy_blocks=(double)Airy_cameras * ceil((double)Airy_res_x / (double)block_size) * ceil((double)Airy_res_y / (double)block_size);
+    *pixel_cost+=Airy_blocks * 1.5 * (double)fft_size * (double)fft_size * log2((double)fft_size) * BSR_COST_FFT_BUTTERFLY;
+  }
+
+  //
+  // memory: image buffers (limited by buffer_memory_limit with reduced precision or tiled rendering), output buffer,
+  // thread and dedup buffers, Airy disk maps, and bsr_state
+  //
+  composition_precision=(bsr_config->composition_precision == 0) ? 32 : bsr_config->composition_precision;
+  blur_precision=(bsr_config->blur_precision == 0) ? 32 : bsr_config->blur_precision;
+  resize_precision=(bsr_config->resize_precision == 0) ? 32 : bsr_config->resize_precision;
+  buffer_memory=composition_pixels * (double)pixelSize(composition_precision);
+  if ((bsr_config->Gaussian_blur_radius > 0.0) || (bsr_config->Airy_disk_mode == 1)) {
+    buffer_memory+=max_image_pixels * (double)pixelSize(blur_precision);
+  }
+  if (scale != 1.0) {
+    buffer_memory+=max_image_pixels * scale * scale * (double)pixelSize(resize_precision);
+  }
+  if ((bsr_config->buffer_memory_limit > 0) && (buffer_memory > ((double)bsr_config->buffer_memory_limit * 1048576.0))) {
+    buffer_memory=(double)bsr_config->buffer_memory_limit * 1048576.0;
+  }
+  total_memory=buffer_memory;
+  if (bsr_config->bits_per_color == 16) {
+    total_memory+=max_image_pixels * scale * scale * 6.0;
+  } else {
+    total_memory+=max_image_pixels * scale * scale * 3.0;
+  }
+  num_worker_threads=bsr_config->num_threads - 1;
+  if (num_worker_threads < 1) {
+    num_worker_threads=1;
+  }
+  if ((bsr_config->Airy_disk_enable == 1) && (bsr_config->Airy_disk_mode == 0)) {
+    per_thread_buffers=bsr_config->per_thread_buffer_Airy;
+  } else {
+    per_thread_buffers=bsr_config->per_thread_buffer;
+  }
+  total_memory+=(double)num_worker_threads * (double)per_thread_buffers * (double)(sizeof(thread_buffer_t) + sizeof(dedup_buffer_t));
+  if (composition_pixels <= 16777216.0) {
+    total_memory+=(double)num_worker_threads * composition_pixels * (double)sizeof(dedup_index_t);
+  } else {
+    total_memory+=(double)num_worker_threads * 16777215.0 * (double)sizeof(dedup_index_t);
+  }
+  if (bsr_config->Airy_disk_enable == 1) {
+    Airymap_width=bsr_config->Airy_disk_max_extent + 1;
+    total_memory+=3.0 * (double)Airymap_width * (double)Airymap_width * (double)sizeof(double);
+  }
+  if (bsr_config->Airy_disk_mode == 1) {
+    // FFT buffer for each thread and transfer functions
+    total_memory+=(double)(num_worker_threads + 1) * (double)fft_size * (double)fft_size * 2.0 * (double)sizeof(double);
+    total_memory+=3.0 * (double)((fft_size / 2) + 1) * (double)((fft_size / 2) + 1) * (double)sizeof(double);
+  }
+  total_memory+=(double)sizeof(bsr_state_t);
+  *memory=total_memory / 1048576.0;
+
+  return(0);
+}
+
+int overRequestBudget(bsr_config_t *bsr_config, double cost, double memory) {
+  if ((bsr_config->cgi_max_request_cost > 0.0) && (cost > bsr_config->cgi_max_request_cost)) {
+    return(1);
+  }
+  if ((bsr_config->cgi_max_request_memory > 0) && (memory > (double)bsr_config->cgi_max_request_memory)) {
+    return(1);
+  }
+
+  return(0);
+}
+
+int nextParallaxQuality(int parallax_quality) {
+  //
+  // minimum parallax quality that skips the lowest quality data file still being read
+  //
+  const int pq_tiers[10]={0, 1, 2, 3, 5, 10, 20, 30, 50, 100};
+  int i;
+
+  for (i=0; i < 10; i++) {
+    if (pq_tiers[i] > parallax_quality) {
+      return(pq_tiers[i]);
+    }
+  }
+
+  return(100);
+}
+
+int degradeRequest(bsr_config_t *bsr_config, bsr_admission_t *bsr_admission) {
+  //
+  // This function reduces resolution or raises the minimum parallax quality until the request fits the per-request
+  // budget. Parallax quality is raised while rendering stars is the larger part of the cost, since it skips whole
+  // data files. Returns 0 if the request fits.
+  //
+  double star_cost;
+  double pixel_cost;
+  double memory;
+  int steps;
+
+  estimateRequestCost(bsr_config, &star_cost, &pixel_cost, &memory);
+  steps=0;
+  while ((overRequestBudget(bsr_config, (star_cost + pixel_cost), memory) == 1) && (steps < 100)) {
+    if ((bsr_config->cgi_degrade_requests == 0) || ((bsr_config->camera_res_x <= 16) && (bsr_config->camera_res_y <= 16)\
+      && ((bsr_config->Gaia_db_enable == 0) || (bsr_config->Gaia_min_parallax_quality >= 100)))) {
+      break;
+    }
+    if ((bsr_config->Gaia_db_enable == 1) && (bsr_config->Gaia_min_parallax_quality < 100) && (star_cost > pixel_cost)\
+      && ((bsr_config->cgi_max_request_cost > 0.0) && ((star_cost + pixel_cost) > bsr_config->cgi_max_request_cost))) {
+      bsr_config->Gaia_min_parallax_quality=nextParallaxQuality(bsr_config->Gaia_min_parallax_quality);
+    } else if ((bsr_config->camera_res_x > 16) || (bsr_config->camera_res_y > 16)) {
+      bsr_config->camera_res_x=(int)((double)bsr_config->camera_res_x * 0.8);
+      bsr_config->camera_res_y=(int)((double)bsr_config->camera_res_y * 0.8);
+      if (bsr_config->camera_res_x < 1) {
+        bsr_config->camera_res_x=1;
+      }
+      if (bsr_config->camera_res_y < 1) {
+        bsr_config->camera_res_y=1;
+      }
+    } else {
+      // only parallax quality is left, even though most of the cost is image buffers
+      bsr_config->Gaia_min_parallax_quality=nextParallaxQuality(bsr_config->Gaia_min_parallax_quality);
+    }
+    bsr_admission->degraded=1;
+    estimateRequestCost(bsr_config, &star_cost, &pixel_cost, &memory);
+    steps++;
+  }
+  bsr_admission->cost=star_cost + pixel_cost;
+  bsr_admission->memory=memory;
+
+  return(overRequestBudget(bsr_config, bsr_admission->cost, bsr_admission->memory));
+}
+
+int slotIsLive(bsr_admission_slot_t *slot) {
+  if (slot->pid == 0) {
+    return(0);
+  }
+  if ((kill(slot->pid, 0) != 0) && (errno == ESRCH)) {
+    // process exited without releasing its slot
+    slot->pid=0;
+    return(0);
+  }
+
+  return(1);
+}
+
+int admitRequest(bsr_config_t *bsr_config, bsr_admission_t *bsr_admission) {
+  //
+  // This function waits until this request can be rendered within the active budget and reserves a slot for it.
+  // Returns 0 if the request was admitted (possibly degraded), or 1 if it was rejected and an HTTP 503 response
+  // has been sent.
+  //
+  bsr_admission_table_t *table;
+  bsr_admission_slot_t *slot;
+  struct stat sb;
+  struct timespec starttime;
+  struct timespec now;
+  struct timespec poll_interval;
+  double active_cost;
+  double active_memory;
+  double waited;
+  int num_rendering;
+  int num_queued;
+  int first_in_queue;
+  int queue_full;
+  int my_slot;
+  int admitted;
+  int i;
+
+  bsr_admission->table=NULL;
+  bsr_admission->slot=-1;
+  bsr_admission->degraded=0;
+
+  //
+  // requests over the per-request budget are degraded to fit, or rejected
+  //
+  if (degradeRequest(bsr_config, bsr_admission) != 0) {
+    printCGIUnavailable(bsr_config, "Request exceeds the rendering budget of this server");
+    return(1);
+  }
+  if (bsr_admission->degraded == 1) {
+    // don't let browsers or proxies keep a reduced image for this request
+    bsr_config->cgi_cache_max_age=0;
+  }
+
+  //
+  // map the shared admission table. If it can't be opened, render without admission control
+  //
+  bsr_admission->fd=open(bsr_config->admission_file, (O_RDWR | O_CREAT), 0600);
+  if (bsr_admission->fd == -1) {
+    return(0);
+  }
+  flock(bsr_admission->fd, LOCK_EX);
+  if ((fstat(bsr_admission->fd, &sb) != 0) || ((sb.st_size < (off_t)sizeof(bsr_admission_table_t)) && (ftruncate(bsr_admission->fd, sizeof(bsr_admission_table_t)) != 0))) {
+    flock(bsr_admission->fd, LOCK_UN);
+    close(bsr_admission->fd);
+    return(0);
+  }
+  flock(bsr_admission->fd, LOCK_UN);
+  table=(bsr_admission_table_t *)mmap(NULL, sizeof(bsr_admission_table_t), (PROT_READ | PROT_WRITE), MAP_SHARED, bsr_admission->fd, 0);
+  if (table == MAP_FAILED) {
+    close(bsr_admission->fd);
+    return(0);
+  }
+
+  //
+  // join the queue. If cgi_max_queued requests are already waiting, this one must be admitted immediately
+  //
+  flock(bsr_admission->fd, LOCK_EX);
+  my_slot=-1;
+  num_queued=0;
+  for (i=0; i < BSR_MAX_ADMISSION_SLOTS; i++) {
+    slot=table->slot + i;
+    if (slotIsLive(slot) == 0) {
+      if (my_slot == -1) {
+        my_slot=i;
+      }
+    } else if (slot->state == 1) {
+      num_queued++;
+    }
+  }
+  if (my_slot == -1) {
+    flock(bsr_admission->fd, LOCK_UN);
+    munmap(table, sizeof(bsr_admission_table_t));
+    close(bsr_admission->fd);
+    printCGIUnavailable(bsr_config, "Server is busy, too many requests are waiting");
+    return(1);
+  }
+  queue_full=(num_queued >= bsr_config->cgi_max_queued) ? 1 : 0;
+  slot=table->slot + my_slot;
+  slot->pid=getpid();
+  slot->state=1;
+  slot->ticket=table->next_ticket;
+  slot->cost=bsr_admission->cost;
+  slot->memory=bsr_admission->memory;
+  table->next_ticket++;
+  flock(bsr_admission->fd, LOCK_UN);
+
+  //
+  // wait until this request is first in the queue and fits within the active budget. A request is always admitted
+  // if nothing else is rendering
+  //
+  clock_gettime(CLOCK_MONOTONIC, &starttime);
+  poll_interval.tv_sec=0;
+  poll_interval.tv_nsec=100000000;
+  admitted=0;
+  while (admitted == 0) {
+    flock(bsr_admission->fd, LOCK_EX);
+    active_cost=0.0;
+    active_memory=0.0;
+    num_rendering=0;
+    first_in_queue=1;
+    for (i=0; i < BSR_MAX_ADMISSION_SLOTS; i++) {
+      if ((i != my_slot) && (slotIsLive(table->slot + i) == 1)) {
+        if (table->slot[i].state == 2) {
+          active_cost+=table->slot[i].cost;
+          active_memory+=table->slot[i].memory;
+          num_rendering++;
+        } else if (table->slot[i].ticket < slot->ticket) {
+          first_in_queue=0;
+        }
+      }
+    }
+    if ((first_in_queue == 1) && ((num_rendering == 0)\
+      || (((bsr_config->cgi_max_active_cost <= 0.0) || ((active_cost + slot->cost) <= bsr_config->cgi_max_active_cost))\
+      && ((bsr_config->cgi_max_active_memory <= 0) || ((active_memory + slot->memory) <= (double)bsr_config->cgi_max_active_memory))))) {
+      slot->state=2;
+      admitted=1;
+    }
+    flock(bsr_admission->fd, LOCK_UN);
+
+    if (admitted == 0) {
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      waited=((double)now.tv_sec + ((double)now.tv_nsec / 1.0E9)) - ((double)starttime.tv_sec + ((double)starttime.tv_nsec / 1.0E9));
+      if ((queue_full == 1) || (waited >= (double)bsr_config->cgi_queue_timeout)) {
+        flock(bsr_admission->fd, LOCK_EX);
+        slot->pid=0;
+        flock(bsr_admission->fd, LOCK_UN);
+        munmap(table, sizeof(bsr_admission_table_t));
+        close(bsr_admission->fd);
+        if (queue_full == 1) {
+          printCGIUnavailable(bsr_config, "Server is busy, too many requests are waiting");
+        } else {
+          printCGIUnavailable(bsr_config, "Server is busy, request timed out waiting to render");
+        }
+        return(1);
+      }
+      nanosleep(&poll_interval, NULL);
+    }
+  } // end while not admitted
+
+  bsr_admission->table=table;
+  bsr_admission->slot=my_slot;
+
+  return(0);
+}
+
+int releaseAdmission(bsr_admission_t *bsr_admission) {
+  //
+  // free this request's slot so queued requests can be admitted
+  //
+  if (bsr_admission->table == NULL) {
+    return(1);
+  }
+  flock(bsr_admission->fd, LOCK_EX);
+  if (bsr_admission->table->slot[bsr_admission->slot].pid == getpid()) {
+    bsr_admission->table->slot[bsr_admission->slot].pid=0;
+  }
+  flock(bsr_admission->fd, LOCK_UN);
+  munmap(bsr_admission->table, sizeof(bsr_admission_table_t));
+  close(bsr_admission->fd);
+  bsr_admission->table=NULL;
+
+  return(0);
+}
@@ -0,0 +1,440 @@
+//
+// Billion Star 3D Rendering Engine
+// Kevin M. Loch
+//
+// 3D rendering engine for the ESA Gaia DR3 star dataset
+
+/*
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2021, Kevin Loch
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "bsrender.h" // needs to be first to get GNU_SOURCE define for strcasestr
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "bsr-config.h"
+#include "multi-camera.h"
+#include "animation.h"
+#include "bsr-png.h"
+#include "bsr-jpeg.h"
+#include "bsr-avif.h"
+#include "bsr-heif.h"
+
+int storeKeyframe(bsr_config_t *bsr_config, bsr_keyframe_t *keyframe, int frames) {
+  keyframe->frames=frames;
+  keyframe->camera_icrs_x=bsr_config->camera_icrs_x;
+  keyframe->camera_icrs_y=bsr_config->camera_icrs_y;
+  keyframe->camera_icrs_z=bsr_config->camera_icrs_z;
+  keyframe->camera_icrs_ra=bsr_config->camera_icrs_ra;
+  keyframe->camera_icrs_dec=bsr_config->camera_icrs_dec;
+  keyframe->camera_icrs_r=bsr_config->camera_icrs_r;
+  keyframe->target_icrs_x=bsr_config->target_icrs_x;
+  keyframe->target_icrs_y=bsr_config->target_icrs_y;
+  keyframe->target_icrs_z=bsr_config->target_icrs_z;
+  keyframe->target_icrs_ra=bsr_config->target_icrs_ra;
+  keyframe->target_icrs_dec=bsr_config->target_icrs_dec;
+  keyframe->target_icrs_r=bsr_config->target_icrs_r;
+  keyframe->camera_rotation=bsr_config->camera_rotation;
+  keyframe->camera_pan=bsr_config->camera_pan;
+  keyframe->camera_tilt=bsr_config->camera_tilt;
+  keyframe->camera_fov=bsr_config->camera_fov;
+  keyframe->camera_projection=bsr_config->camera_projection;
+  keyframe->spherical_orientation=bsr_config->spherical_orientation;
+
+  return(0);
+}
+
+double interpolateKeyframe(double from, double to, double t) {
+  return(from + ((to - from) * t));
+}
+
+int loadFrameList(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
+  //
+  // This function loads camera keyframes for animation batch mode from frame_list_file_name. Each non-comment line
+  // of the file defines one keyframe as a list of option=value pairs separated by spaces, for example:
+  //
+  //   frames=240 camera_icrs_x=10.0 target_icrs_x=100.0 camera_fov=60.0
+  //
+  // 'frames' is the number of frames rendered from the previous keyframe up to and including this one (default 1).
+  // Camera position, target, rotation, pan, tilt and fov are linearly interpolated between keyframes so a list of
+  // keyframes with frames=1 (the default) is a per-frame parameter file. Options not specified on a line are
+  // inherited from the previous keyframe, or the main configuration for the first keyframe.
+  //
+  FILE *frame_list_file;
+  char *input_line_p;
+  char input_line[2048];
+  char segment[2048];
+  char *segment_p;
+  char *symbol_p;
+  size_t segment_length;
+  int from_cgi;
+  bsr_config_t keyframe_config;
+  int num_keyframes;
+  int frames;
+  int pass;
+
+  //
+  // frame lists are ignored in CGI mode since only one image can be returned
+  //
+  if (bsr_config->cgi_mode == 1) {
+    return(0);
+  }
+
+  //
+  // attempt to open frame list file
+  //
+  frame_list_file=fopen(bsr_config->frame_list_file_name, "r");
+  if (frame_list_file == NULL) {
+    printf("Error: could not open frame list file %s\n", bsr_config->frame_list_file_name);
+    fflush(stdout);
+    exit(1);
+  }
+  if (bsr_config->print_status == 1) {
+    printf("Loading frame list file %s\n", bsr_config->frame_list_file_name);
+    fflush(stdout);
+  }
+
+  //
+  // read frame list file twice, first to count keyframes then to store them
+  //
+  for (pass=0; pass < 2; pass++) {
+    if (pass == 1) {
+      bsr_state->keyframes=(bsr_keyframe_t *)malloc((size_t)num_keyframes * sizeof(bsr_keyframe_t));
+      if (bsr_state->keyframes == NULL) {
+        printf("Error: could not allocate memory for %d keyframes\n", num_keyframes);
+        fflush(stdout);
+        exit(1);
+      }
+      rewind(frame_list_file);
+    }
+    num_keyframes=0;
+    bsr_state->num_frames=0;
+    keyframe_config=*bsr_config;
+    input_line_p=fgets(input_line, 2048, frame_list_file);
+    while (input_line_p != NULL) {
+      //
+      // remove comments and newline
+      //
+      symbol_p=strchr(input_line, '#');
+      if (symbol_p != NULL) {
+        *symbol_p=0;
+      }
+      symbol_p=strchr(input_line, '\n');
+      if (symbol_p != NULL) {
+        *symbol_p=0;
+      }
+
+      //
+      // skip blank lines
+      //
+      segment_p=input_line;
+      while ((*segment_p == ' ') || (*segment_p == '\t') || (*segment_p == '\r')) {
+        segment_p++;
+      }
+      if (*segment_p != 0) {
+        //
+        // apply each option=value pair on this line to the previous keyframe's configuration
+        //
+        frames=1;
+        while (*segment_p != 0) {
+          segment_length=strcspn(segment_p, " \t\r");
+          strncpy(segment, segment_p, segment_length);
+          segment[segment_length]=0;
+          if (strncmp(segment, "frames=", 7) == 0) {
+            frames=atoi(segment + 7);
+          } else if (pass == 1) {
+            from_cgi=0;
+            processConfigSegment(&keyframe_config, segment, from_cgi);
+          }
+          segment_p+=segment_length;
+          while ((*segment_p == ' ') || (*segment_p == '\t') || (*segment_p == '\r')) {
+            segment_p++;
+          }
+        } // end while segments
+        if (frames < 1) {
+          printf("Error: invalid frames for keyframe %d in frame list file %s\n", (num_keyframes + 1), bsr_config->frame_list_file_name);
+          fflush(stdout);
+          exit(1);
+        }
+        if (num_keyframes == 0) {
+          frames=1; // first keyframe is always a single frame
+        }
+
+        //
+        // buffers are allocated once for all frames so resolution must not change
+        //
+        if (pass == 1) {
+          if ((keyframe_config.camera_res_x != bsr_config->camera_res_x) || (keyframe_config.camera_res_y != bsr_config->camera_res_y)) {
+            printf("Error: resolution cannot be changed in frame list file %s (keyframe %d)\n", bsr_config->frame_list_file_name, (num_keyframes + 1));
+            fflush(stdout);
+            exit(1);
+          }
+          storeKeyframe(&keyframe_config, &bsr_state->keyframes[num_keyframes], frames);
+        }
+        bsr_state->num_frames+=frames;
+        num_keyframes++;
+      } // end if not blank line
+
+      //
+      // load next line from frame list file
+      //
+      input_line_p=fgets(input_line, 2048, frame_list_file);
+    } // end while input_line_p
+
+    if (num_keyframes == 0) {
+      printf("Error: no keyframes found in frame list file %s\n", bsr_config->frame_list_file_name);
+      fflush(stdout);
+      exit(1);
+    }
+  } // end for pass
+  fclose(frame_list_file);
+  bsr_state->num_keyframes=num_keyframes;
+  strncpy(bsr_state->frame_output_file_name, bsr_config->output_file_name, 255);
+  bsr_state->frame_output_file_name[255]=0;
+  if (bsr_config->print_status == 1) {
+    printf("Keyframes: %d, frames: %d\n", bsr_state->num_keyframes, bsr_state->num_frames);
+    fflush(stdout);
+  }
+
+  //
+  // set up cameras for the first frame so memory is allocated for the correct number and size of images
+  //
+  selectFrame(bsr_config, bsr_state, 0);
+
+  return(0);
+}
+
+int selectFrame(bsr_config_t *bsr_config, bsr_state_t *bsr_state, int frame_index) {
+  //
+  // This function sets up cameras and output images for one frame of a frame list by interpolating between
+  // keyframes. Default output file names add "-NNNNN" to output_file_name for frame NNNNN.
+  // Worker threads do not read camera or image state until the next image composition buffer checkpoint so this
+  // is only called by the main thread, or before worker threads are forked.
+  //
+  bsr_config_t frame_config;
+  bsr_keyframe_t *from;
+  bsr_keyframe_t *to;
+  int to_index;
+  int frame;
+  double t;
+  char frame_number[16];
+  char output_file_name[256];
+
+  if (bsr_state->num_keyframes == 0) {
+    return(0);
+  }
+
+  //
+  // find keyframes before and after this frame and the interpolation position between them
+  //
+  to_index=0;
+  frame=frame_index;
+  t=1.0;
+  if (frame > 0) {
+    to_index=1;
+    while ((to_index < (bsr_state->num_keyframes - 1)) && (frame > bsr_state->keyframes[to_index].frames)) {
+      frame-=bsr_state->keyframes[to_index].frames;
+      to_index++;
+    }
+    t=(double)frame / (double)bsr_state->keyframes[to_index].frames;
+    from=bsr_state->keyframes + (to_index - 1);
+  } else {
+    from=bsr_state->keyframes;
+  }
+  to=bsr_state->keyframes + to_index;
+
+  //
+  // interpolate camera geometry, non-numeric options change at the keyframe
+  //
+  frame_config=*bsr_config;
+  frame_config.camera_icrs_x=interpolateKeyframe(from->camera_icrs_x, to->camera_icrs_x, t);
+  frame_config.camera_icrs_y=interpolateKeyframe(from->camera_icrs_y, to->camera_icrs_y, t);
+  frame_config.camera_icrs_z=interpolateKeyframe(from->camera_icrs_z, to->camera_icrs_z, t);
+  frame_config.camera_icrs_ra=interpolateKeyframe(from->camera_icrs_ra, to->camera_icrs_ra, t);
+  frame_config.camera_icrs_dec=interpolateKeyframe(from->camera_icrs_dec, to->camera_icrs_dec, t);
+  frame_config.camera_icrs_r=interpolateKeyframe(from->camera_icrs_r, to->camera_icrs_r, t);
+  frame_config.target_icrs_x=interpolateKeyframe(from->target_icrs_x, to->target_icrs_x, t);
+  frame_config.target_icrs_y=interpolateKeyframe(from->target_icrs_y, to->target_icrs_y, t);
+  frame_config.target_icrs_z=interpolateKeyframe(from->target_icrs_z, to->target_icrs_z, t);
+  frame_config.target_icrs_ra=interpolateKeyframe(from->target_icrs_ra, to->target_icrs_ra, t);
+  frame_config.target_icrs_dec=interpolateKeyframe(from->target_icrs_dec, to->target_icrs_dec, t);
+  frame_config.target_icrs_r=interpolateKeyframe(from->target_icrs_r, to->target_icrs_r, t);
+  frame_config.camera_rotation=interpolateKeyframe(from->camera_rotation, to->camera_rotation, t);
+  frame_config.camera_pan=interpolateKeyframe(from->camera_pan, to->camera_pan, t);
+  frame_config.camera_tilt=interpolateKeyframe(from->camera_tilt, to->camera_tilt, t);
+  frame_config.camera_fov=interpolateKeyframe(from->camera_fov, to->camera_fov, t);
+  frame_config.camera_projection=to->camera_projection;
+  frame_config.spherical_orientation=to->spherical_orientation;
+
+  //
+  // set output file name for this frame
+  //
+  strncpy(frame_config.output_file_name, bsr_state->frame_output_file_name, 255);
+  frame_config.output_file_name[255]=0;
+  snprintf(frame_number, 16, "%05d", (frame_index + 1));
+  setDefaultImageFileName(&frame_config, output_file_name, frame_number);
+  strncpy(frame_config.output_file_name, output_file_name, 255);
+  frame_config.output_file_name[255]=0;
+
+  //
+  // set up cameras and output images for this frame
+  //
+  if (bsr_config->vr_mode != 0) {
+    initVRCameras(&frame_config, bsr_state);
+  } else {
+    initMainCamera(&frame_config, bsr_state);
+  }
+
+  return(0);
+}
+
+int waitForImageWriters(bsr_config_t *bsr_config, bsr_state_t *bsr_state, int max_image_writers) {
+  //
+  // main thread: wait until no more than max_image_writers background image writers are still running
+  //
+  int writer_status;
+  int i;
+
+  while (bsr_state->perthread->num_image_writers > max_image_writers) {
+    //
+    // wait for oldest writer. If it was already reaped by checkExceptions() there is no status to check
+    //
+    if (waitpid(bsr_state->perthread->image_writer_pid[0], &writer_status, 0) == bsr_state->perthread->image_writer_pid[0]) {
+      if ((WIFEXITED(writer_status) == 0) || (WEXITSTATUS(writer_status) != 0)) {
+        if (bsr_config->cgi_mode != 1) {
+          printf("Error: background image writer failed\n");
+          fflush(stdout);
+        }
+        exit(1);
+      }
+    }
+    for (i=1; i < bsr_state->perthread->num_image_writers; i++) {
+      bsr_state->perthread->image_writer_pid[i - 1]=bsr_state->perthread->image_writer_pid[i];
+    }
+    bsr_state->perthread->num_image_writers--;
+  }
+
+  return(0);
+}
+
+int outputImageBackground(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
+  //
+  // This function encodes and writes the current image in a forked background process so the main thread can
+  // continue with the next frame or image. Used for the single-threaded encoders (PNG, JPEG, AVIF, HEIF)
+  // when more than one image is being rendered. Called by main thread only.
+  //
+  // The output buffer and row pointers are globally mmapped so they are copied to private memory before fork(),
+  // which gives the writer process its own copy-on-write snapshot of this image.
+  //
+  bsr_state_t writer_state;
+  unsigned char *writer_buf;
+  unsigned char **writer_row_pointers=NULL;
+  pid_t writer_pid;
+  int y;
+
+  //
+  // wait for a free background writer slot
+  //
+  waitForImageWriters(bsr_config, bsr_state, (bsr_config->image_writer_threads - 1));
+
+  //
+  // copy output image and row pointers to private memory
+  //
+  writer_buf=(unsigned char *)malloc(bsr_state->output_buffer_size);
+  if (writer_buf == NULL) {
+    if (bsr_config->cgi_mode != 1) {
+      printf("Error: could not allocate memory for background image writer\n");
+      fflush(stdout);
+    }
+    exit(1);
+  }
+  memcpy(writer_buf, bsr_state->image_output_buf, bsr_state->output_buffer_size);
+  if ((bsr_config->image_format == 0) || (bsr_config->image_format == 2)) {
+    writer_row_pointers=(unsigned char **)malloc(bsr_state->row_pointers_size);
+    if (writer_row_pointers == NULL) {
+      if (bsr_config->cgi_mode != 1) {
+        printf("Error: could not allocate memory for background image writer\n");
+        fflush(stdout);
+      }
+      exit(1);
+    }
+    for (y=0; y < bsr_state->current_image_res_y; y++) {
+      writer_row_pointers[y]=writer_buf + (bsr_state->row_pointers[y] - bsr_state->image_output_buf);
+    }
+  }
+  writer_state=*bsr_state;
+  writer_state.image_output_buf=writer_buf;
+  writer_state.row_pointers=writer_row_pointers;
+
+  if ((bsr_config->cgi_mode != 1) && (bsr_config->print_status == 1)) {
+    printf("Writing %s in background\n", bsr_config->output_file_name);
+    fflush(stdout);
+  }
+
+  //
+  // fork background writer
+  //
+  writer_pid=fork();
+  if (writer_pid == 0) {
+    //
+    // background writer: status messages would be mixed with the main thread's so only errors are printed
+    //
+    bsr_config->print_status=0;
+    if (bsr_config->image_format == 0) {
+      outputPNG(bsr_config, &writer_state);
+    } else if (bsr_config->image_format == 2) {
+      outputJpeg(bsr_config, &writer_state);
+    } else if (bsr_config->image_format == 3) {
+      outputAvif(bsr_config, &writer_state);
+    } else if (bsr_config->image_format == 4) {
+      outputHeif(bsr_config, &writer_state);
+    }
+    exit(0);
+  } else if (writer_pid < 0) {
+    if (bsr_config->cgi_mode != 1) {
+      printf("Error: could not fork background image writer\n");
+      fflush(stdout);
+    }
+    exit(1);
+  }
+
+  //
+  // main thread: the writer has its own copy of the image so private buffers can be freed now
+  //
+  bsr_state->perthread->image_writer_pid[bsr_state->perthread->num_image_writers]=writer_pid;
+  bsr_state->perthread->num_image_writers++;
+  free(writer_buf);
+  free(writer_row_pointers);
+
+  return(0);
+}
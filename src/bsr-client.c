@@ -0,0 +1,167 @@
+//
+// Billion Star 3D Rendering Engine
+// Kevin M. Loch
+//
+// 3D rendering engine for the ESA Gaia DR3 star dataset
+
+/*
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2021, Kevin Loch
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+//
+// bsr-client sends one request to a bsrender daemon (daemon_socket) and writes the response. The request is a
+// CGI query string, for example:
+//
+//   bsr-client -s /tmp/bsrender.sock -o galaxy.png "camera_res_x=1920&camera_res_y=1080&camera_fov=90"
+//
+// Without -o the full response (CGI header and image data) is written to stdout.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+int main(int argc, char **argv) {
+  char *socket_path="bsrender.sock";
+  char *output_file_name=NULL;
+  char *query_string="";
+  FILE *output_file;
+  struct sockaddr_un socket_address;
+  unsigned char length_bytes[4];
+  unsigned char buf[65536];
+  int request_length;
+  int conn_fd;
+  int bytes_read;
+  int header_done;
+  int newline_count;
+  long long body_size;
+  int opt;
+  int i;
+
+  //
+  // process command line arguments
+  //
+  while ((opt=getopt(argc, argv, "hs:o:")) != -1) {
+    if (opt == 's') {
+      socket_path=optarg;
+    } else if (opt == 'o') {
+      output_file_name=optarg;
+    } else {
+      printf("usage: bsr-client [-s socket] [-o output_file] [query_string]\n");
+      printf("  -s socket       bsrender daemon_socket (default: bsrender.sock)\n");
+      printf("  -o output_file  write image data to output_file without the CGI header\n");
+      exit(1);
+    }
+  }
+  if (optind < argc) {
+    query_string=argv[optind];
+  }
+  request_length=strlen(query_string);
+  if (request_length > 2047) {
+    fprintf(stderr, "Error: query string is longer than 2047 characters\n");
+    exit(1);
+  }
+
+  //
+  // connect to daemon and send request
+  //
+  if (strlen(socket_path) >= sizeof(socket_address.sun_path)) {
+    fprintf(stderr, "Error: socket path is too long\n");
+    exit(1);
+  }
+  memset(&socket_address, 0, sizeof(socket_address));
+  socket_address.sun_family=AF_UNIX;
+  strcpy(socket_address.sun_path, socket_path);
+  conn_fd=socket(AF_UNIX, SOCK_STREAM, 0);
+  if ((conn_fd < 0) || (connect(conn_fd, (struct sockaddr *)&socket_address, sizeof(socket_address)) != 0)) {
+    fprintf(stderr, "Error: could not connect to %s\n", socket_path);
+    exit(1);
+  }
+  length_bytes[0]=(request_length >> 24) & 0xff;
+  length_bytes[1]=(request_length >> 16) & 0xff;
+  length_bytes[2]=(request_length >> 8) & 0xff;
+  length_bytes[3]=request_length & 0xff;
+  if ((write(conn_fd, length_bytes, 4) != 4) || (write(conn_fd, query_string, request_length) != request_length)) {
+    fprintf(stderr, "Error: could not send request\n");
+    exit(1);
+  }
+
+  //
+  // copy response to output file or stdout. With -o the CGI header (up to the first blank line) is skipped
+  //
+  if (output_file_name != NULL) {
+    output_file=fopen(output_file_name, "wb");
+    if (output_file == NULL) {
+      fprintf(stderr, "Error: could not open %s for writing\n", output_file_name);
+      exit(1);
+    }
+    header_done=0;
+  } else {
+    output_file=stdout;
+    header_done=1;
+  }
+  newline_count=0;
+  body_size=0;
+  bytes_read=read(conn_fd, buf, sizeof(buf));
+  while (bytes_read > 0) {
+    i=0;
+    while ((header_done == 0) && (i < bytes_read)) {
+      if (buf[i] == '\n') {
+        newline_count++;
+        if (newline_count == 2) {
+          header_done=1;
+        }
+      } else if (buf[i] != '\r') {
+        newline_count=0;
+      }
+      i++;
+    }
+    if (i < bytes_read) {
+      fwrite((buf + i), 1, (bytes_read - i), output_file);
+      body_size+=bytes_read - i;
+    }
+    bytes_read=read(conn_fd, buf, sizeof(buf));
+  }
+  close(conn_fd);
+  if (output_file != stdout) {
+    fclose(output_file);
+  }
+  if (body_size == 0) {
+    fprintf(stderr, "Error: empty response\n");
+    exit(1);
+  }
+
+  return(0);
+}
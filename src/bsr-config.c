@@ -43,8 +43,11 @@
 #include <math.h>
 #include "util.h"
 #include "usage.h"
+#include "bsr-config.h"
 
 void initConfig(bsr_config_t *bsr_config) {
+  // start from all zero bytes so the configuration can be hashed for the image cache
+  memset(bsr_config, 0, sizeof(bsr_config_t));
   bsr_config->bsrender_cfg_version[0]=0;
   bsr_config->QUERY_STRING_p=NULL;
   strncpy(bsr_config->config_file_name, "bsrender.cfg", 255);
@@ -53,7 +56,27 @@ void initConfig(bsr_config_t *bsr_config) {
   bsr_config->data_file_directory[255]=0;
   strncpy(bsr_config->output_file_name, "galaxy.png", 255);
   bsr_config->output_file_name[255]=0;
+  bsr_config->camera_list_file_name[0]=0;
+  bsr_config->frame_list_file_name[0]=0;
+  bsr_config->output_list_file_name[0]=0;
+  bsr_config->daemon_socket[0]=0;
+  bsr_config->cache_directory[0]=0;
+  bsr_config->cache_size_limit=1024;
+  bsr_config->admission_file[0]=0;
+  bsr_config->image_writer_threads=2;
+  bsr_config->composition_precision=0;
+  bsr_config->blur_precision=0;
+  bsr_config->resize_precision=0;
+  bsr_config->buffer_memory_limit=0;
+  bsr_config->tile_height=0;
+  bsr_config->output_band_rows=32;
+  bsr_config->png_parallel_deflate=1;
   bsr_config->print_status=1;
+  bsr_config->perf_counters=0;
+  bsr_config->trace_file_name[0]=0;
+  bsr_config->stats_json_file_name[0]=0;
+  bsr_config->save_composition_file_name[0]=0;
+  bsr_config->load_composition_file_name[0]=0;
   bsr_config->num_threads=16;
   bsr_config->per_thread_buffer=1000;
   bsr_config->per_thread_buffer_Airy=100000;
@@ -66,6 +89,14 @@ void initConfig(bsr_config_t *bsr_config) {
   bsr_config->cgi_max_Airy_disk_max_extent=1000;
   bsr_config->cgi_max_Airy_disk_min_extent=3;
   bsr_config->cgi_allow_anti_alias=1;
+  bsr_config->cgi_cache_max_age=0;
+  bsr_config->cgi_max_request_cost=0.0;
+  bsr_config->cgi_max_request_memory=0;
+  bsr_config->cgi_max_active_cost=0.0;
+  bsr_config->cgi_max_active_memory=0;
+  bsr_config->cgi_degrade_requests=1;
+  bsr_config->cgi_max_queued=16;
+  bsr_config->cgi_queue_timeout=30;
   bsr_config->Gaia_db_enable=1;
   bsr_config->Gaia_min_parallax_quality=0;
   bsr_config->external_db_enable=1;
@@ -91,6 +122,13 @@ void initConfig(bsr_config_t *bsr_config) {
   bsr_config->camera_projection=0;
   bsr_config->spherical_orientation=0;
   bsr_config->Mollewide_iterations=5;
+  bsr_config->vr_mode=0;
+  bsr_config->vr_packed_output=1;
+  bsr_config->stereo_separation=1.0;
+  bsr_config->sky_tile_zoom=-1;
+  bsr_config->sky_tile_x=0;
+  bsr_config->sky_tile_y=0;
+  bsr_config->sky_tile_size=256;
   bsr_config->red_filter_long_limit=705.0;
   bsr_config->red_filter_short_limit=550.0;
   bsr_config->green_filter_long_limit=600.0;
@@ -102,6 +140,7 @@ void initConfig(bsr_config_t *bsr_config) {
   bsr_config->Airy_disk_max_extent=100;
   bsr_config->Airy_disk_min_extent=1;
   bsr_config->Airy_disk_obstruction=0.0;
+  bsr_config->Airy_disk_mode=0;
   bsr_config->anti_alias_enable=0;
   bsr_config->anti_alias_radius=1.0;
   bsr_config->skyglow_enable=0;
@@ -109,6 +148,7 @@ void initConfig(bsr_config_t *bsr_config) {
   bsr_config->skyglow_per_pixel_mag=14.0;
   bsr_config->pre_limit_intensity=1;
   bsr_config->Gaussian_blur_radius=0.0;
+  bsr_config->Gaussian_blur_mode=0;
   bsr_config->output_scaling_factor=1.0;
   bsr_config->Lanczos_order=3;
   bsr_config->draw_crosshairs=0;
@@ -119,6 +159,7 @@ void initConfig(bsr_config_t *bsr_config) {
   bsr_config->compression_quality=80;
   bsr_config->image_format=0;
   bsr_config->hdr_neutral_white_ref=100;
+  bsr_config->progressive=0;
   bsr_config->bits_per_color=8;
   bsr_config->image_number_format=0;
   bsr_config->camera_icrs_x=0.0;
@@ -174,6 +215,14 @@ void cleanupValueStr(char *value) {
     }
   }
 
+  //
+  // empty value (or only spaces/quotes)
+  //
+  if (start == -1) {
+    value[0]=0;
+    return;
+  }
+
   //
   // trim before and after value
   //
@@ -248,7 +297,27 @@ void setOptionValue(bsr_config_t *bsr_config, char *option, char *value, int fro
     match_count+=checkOptionStr(bsr_config->bsrender_cfg_version, option, value, "bsrender_cfg_version");
     match_count+=checkOptionStr(bsr_config->data_file_directory, option, value, "data_file_directory");
     match_count+=checkOptionStr(bsr_config->output_file_name, option, value, "output_file_name");
+    match_count+=checkOptionStr(bsr_config->camera_list_file_name, option, value, "camera_list_file");
+    match_count+=checkOptionStr(bsr_config->frame_list_file_name, option, value, "frame_list_file");
+    match_count+=checkOptionStr(bsr_config->output_list_file_name, option, value, "output_list_file");
+    match_count+=checkOptionStr(bsr_config->daemon_socket, option, value, "daemon_socket");
+    match_count+=checkOptionStr(bsr_config->cache_directory, option, value, "cache_directory");
+    match_count+=checkOptionInt(&bsr_config->cache_size_limit, option, value, "cache_size_limit");
+    match_count+=checkOptionStr(bsr_config->admission_file, option, value, "admission_file");
+    match_count+=checkOptionInt(&bsr_config->image_writer_threads, option, value, "image_writer_threads");
+    match_count+=checkOptionInt(&bsr_config->composition_precision, option, value, "composition_precision");
+    match_count+=checkOptionInt(&bsr_config->blur_precision, option, value, "blur_precision");
+    match_count+=checkOptionInt(&bsr_config->resize_precision, option, value, "resize_precision");
+    match_count+=checkOptionInt(&bsr_config->buffer_memory_limit, option, value, "buffer_memory_limit");
+    match_count+=checkOptionInt(&bsr_config->tile_height, option, value, "tile_height");
+    match_count+=checkOptionInt(&bsr_config->output_band_rows, option, value, "output_band_rows");
+    match_count+=checkOptionBool(&bsr_config->png_parallel_deflate, option, value, "png_parallel_deflate");
     match_count+=checkOptionBool(&bsr_config->print_status, option, value, "print_status");
+    match_count+=checkOptionInt(&bsr_config->perf_counters, option, value, "perf_counters");
+    match_count+=checkOptionStr(bsr_config->trace_file_name, option, value, "trace");
+    match_count+=checkOptionStr(bsr_config->stats_json_file_name, option, value, "stats_json");
+    match_count+=checkOptionStr(bsr_config->save_composition_file_name, option, value, "save_composition");
+    match_count+=checkOptionStr(bsr_config->load_composition_file_name, option, value, "load_composition");
     match_count+=checkOptionInt(&bsr_config->num_threads, option, value, "num_threads");
     match_count+=checkOptionInt(&bsr_config->per_thread_buffer, option, value, "per_thread_buffer");
     match_count+=checkOptionInt(&bsr_config->per_thread_buffer_Airy, option, value, "per_thread_buffer_Airy");
@@ -261,6 +330,14 @@ void setOptionValue(bsr_config_t *bsr_config, char *option, char *value, int fro
     match_count+=checkOptionInt(&bsr_config->cgi_max_Airy_disk_max_extent, option, value, "cgi_max_Airy_disk_max_extent");
     match_count+=checkOptionInt(&bsr_config->cgi_max_Airy_disk_min_extent, option, value, "cgi_max_Airy_disk_min_extent");
     match_count+=checkOptionBool(&bsr_config->cgi_allow_anti_alias, option, value, "cgi_allow_anti_alias");
+    match_count+=checkOptionInt(&bsr_config->cgi_cache_max_age, option, value, "cgi_cache_max_age");
+    match_count+=checkOptionDouble(&bsr_config->cgi_max_request_cost, option, value, "cgi_max_request_cost");
+    match_count+=checkOptionInt(&bsr_config->cgi_max_request_memory, option, value, "cgi_max_request_memory");
+    match_count+=checkOptionDouble(&bsr_config->cgi_max_active_cost, option, value, "cgi_max_active_cost");
+    match_count+=checkOptionInt(&bsr_config->cgi_max_active_memory, option, value, "cgi_max_active_memory");
+    match_count+=checkOptionBool(&bsr_config->cgi_degrade_requests, option, value, "cgi_degrade_requests");
+    match_count+=checkOptionInt(&bsr_config->cgi_max_queued, option, value, "cgi_max_queued");
+    match_count+=checkOptionInt(&bsr_config->cgi_queue_timeout, option, value, "cgi_queue_timeout");
   }
 
   //
@@ -291,6 +368,13 @@ void setOptionValue(bsr_config_t *bsr_config, char *option, char *value, int fro
   match_count+=checkOptionInt(&bsr_config->camera_projection, option, value, "camera_projection");
   match_count+=checkOptionInt(&bsr_config->spherical_orientation, option, value, "spherical_orientation");
   match_count+=checkOptionInt(&bsr_config->Mollewide_iterations, option, value, "Mollewide_iterations");
+  match_count+=checkOptionInt(&bsr_config->vr_mode, option, value, "vr_mode");
+  match_count+=checkOptionBool(&bsr_config->vr_packed_output, option, value, "vr_packed_output");
+  match_count+=checkOptionDouble(&bsr_config->stereo_separation, option, value, "stereo_separation");
+  match_count+=checkOptionInt(&bsr_config->sky_tile_zoom, option, value, "sky_tile_zoom");
+  match_count+=checkOptionInt(&bsr_config->sky_tile_x, option, value, "sky_tile_x");
+  match_count+=checkOptionInt(&bsr_config->sky_tile_y, option, value, "sky_tile_y");
+  match_count+=checkOptionInt(&bsr_config->sky_tile_size, option, value, "sky_tile_size");
   match_count+=checkOptionDouble(&bsr_config->red_filter_long_limit, option, value, "red_filter_long_limit");
   match_count+=checkOptionDouble(&bsr_config->red_filter_short_limit, option, value, "red_filter_short_limit");
   match_count+=checkOptionDouble(&bsr_config->green_filter_long_limit, option, value, "green_filter_long_limit");
@@ -302,6 +386,7 @@ void setOptionValue(bsr_config_t *bsr_config, char *option, char *value, int fro
   match_count+=checkOptionInt(&bsr_config->Airy_disk_max_extent, option, value, "Airy_disk_max_extent");
   match_count+=checkOptionInt(&bsr_config->Airy_disk_min_extent, option, value, "Airy_disk_min_extent");
   match_count+=checkOptionDouble(&bsr_config->Airy_disk_obstruction, option, value, "Airy_disk_obstruction");
+  match_count+=checkOptionInt(&bsr_config->Airy_disk_mode, option, value, "Airy_disk_mode");
   match_count+=checkOptionBool(&bsr_config->anti_alias_enable, option, value, "anti_alias_enable");
   match_count+=checkOptionDouble(&bsr_config->anti_alias_radius, option, value, "anti_alias_radius");
   match_count+=checkOptionBool(&bsr_config->skyglow_enable, option, value, "skyglow_enable");
@@ -309,6 +394,7 @@ void setOptionValue(bsr_config_t *bsr_config, char *option, char *value, int fro
   match_count+=checkOptionDouble(&bsr_config->skyglow_per_pixel_mag, option, value, "skyglow_per_pixel_mag");
   match_count+=checkOptionBool(&bsr_config->pre_limit_intensity, option, value, "pre_limit_intensity");
   match_count+=checkOptionDouble(&bsr_config->Gaussian_blur_radius, option, value, "Gaussian_blur_radius");
+  match_count+=checkOptionInt(&bsr_config->Gaussian_blur_mode, option, value, "Gaussian_blur_mode");
   match_count+=checkOptionDouble(&bsr_config->output_scaling_factor, option, value, "output_scaling_factor");
   match_count+=checkOptionInt(&bsr_config->Lanczos_order, option, value, "Lanczos_order");
   match_count+=checkOptionBool(&bsr_config->draw_crosshairs, option, value, "draw_crosshairs");
@@ -318,6 +404,7 @@ void setOptionValue(bsr_config_t *bsr_config, char *option, char *value, int fro
   match_count+=checkOptionInt(&bsr_config->exr_compression, option, value, "exr_compression");
   match_count+=checkOptionInt(&bsr_config->compression_quality, option, value, "compression_quality");
   match_count+=checkOptionInt(&bsr_config->hdr_neutral_white_ref, option, value, "hdr_neutral_white_ref");
+  match_count+=checkOptionBool(&bsr_config->progressive, option, value, "progressive");
   match_count+=checkOptionDouble(&bsr_config->camera_icrs_x, option, value, "camera_icrs_x");
   match_count+=checkOptionDouble(&bsr_config->camera_icrs_y, option, value, "camera_icrs_y");
   match_count+=checkOptionDouble(&bsr_config->camera_icrs_z, option, value, "camera_icrs_z");
@@ -606,6 +693,154 @@ int validateConfig(bsr_config_t *bsr_config) {
     bsr_config->num_threads=2;
   }
 
+  //
+  // limit number of background image writers
+  //
+  if (bsr_config->image_writer_threads < 0) {
+    bsr_config->image_writer_threads=0;
+  } else if (bsr_config->image_writer_threads > BSR_MAX_IMAGE_WRITERS) {
+    bsr_config->image_writer_threads=BSR_MAX_IMAGE_WRITERS;
+  }
+
+  //
+  // image buffer precision must be 16, 32, or 64 bits per color, or 0 for automatic
+  //
+  if ((bsr_config->composition_precision != 16) && (bsr_config->composition_precision != 32) && (bsr_config->composition_precision != 64)) {
+    bsr_config->composition_precision=0;
+  }
+  if ((bsr_config->blur_precision != 16) && (bsr_config->blur_precision != 32) && (bsr_config->blur_precision != 64)) {
+    bsr_config->blur_precision=0;
+  }
+  if ((bsr_config->resize_precision != 16) && (bsr_config->resize_precision != 32) && (bsr_config->resize_precision != 64)) {
+    bsr_config->resize_precision=0;
+  }
+  if (bsr_config->buffer_memory_limit < 0) {
+    bsr_config->buffer_memory_limit=0;
+  }
+  if (bsr_config->tile_height < 0) {
+    bsr_config->tile_height=0;
+  }
+  if (bsr_config->output_band_rows < 0) {
+    bsr_config->output_band_rows=0;
+  }
+  if (bsr_config->cgi_mode != 1) {
+    // progressive output is a multipart CGI response
+    bsr_config->progressive=0;
+  }
+  if ((bsr_config->perf_counters < 0) || (bsr_config->perf_counters > 2) || (bsr_config->cgi_mode == 1)) {
+    // performance counters are printed to stdout
+    bsr_config->perf_counters=0;
+  }
+  if (bsr_config->cgi_mode == 1) {
+    // trace, statistics and composition files would be overwritten by each request
+    bsr_config->trace_file_name[0]=0;
+    bsr_config->stats_json_file_name[0]=0;
+    bsr_config->save_composition_file_name[0]=0;
+  }
+  if ((bsr_config->save_composition_file_name[0] != 0) || (bsr_config->load_composition_file_name[0] != 0)) {
+    if ((bsr_config->save_composition_file_name[0] != 0) && (bsr_config->load_composition_file_name[0] != 0)) {
+      if (bsr_config->cgi_mode != 1) {
+        printf("Error: save_composition and load_composition cannot be used together\n");
+        fflush(stdout);
+      }
+      exit(1);
+    }
+    if (bsr_config->frame_list_file_name[0] != 0) {
+      if (bsr_config->cgi_mode != 1) {
+        printf("Error: save_composition and load_composition cannot be used with frame_list_file\n");
+        fflush(stdout);
+      }
+      exit(1);
+    }
+  }
+  if (bsr_config->cache_size_limit < 1) {
+    bsr_config->cache_size_limit=1;
+  }
+  if (bsr_config->cgi_cache_max_age < 0) {
+    bsr_config->cgi_cache_max_age=0;
+  }
+  if (bsr_config->cgi_max_request_cost < 0.0) {
+    bsr_config->cgi_max_request_cost=0.0;
+  }
+  if (bsr_config->cgi_max_request_memory < 0) {
+    bsr_config->cgi_max_request_memory=0;
+  }
+  if (bsr_config->cgi_max_active_cost < 0.0) {
+    bsr_config->cgi_max_active_cost=0.0;
+  }
+  if (bsr_config->cgi_max_active_memory < 0) {
+    bsr_config->cgi_max_active_memory=0;
+  }
+  if (bsr_config->cgi_max_queued < 0) {
+    bsr_config->cgi_max_queued=0;
+  }
+  if (bsr_config->cgi_queue_timeout < 0) {
+    bsr_config->cgi_queue_timeout=0;
+  }
+
+  //
+  // Gaussian blur mode: 0 = automatic, 1 = direct convolution, 2 = recursive
+  //
+  if ((bsr_config->Gaussian_blur_mode < 0) || (bsr_config->Gaussian_blur_mode > 2)) {
+    bsr_config->Gaussian_blur_mode=0;
+  }
+
+  //
+  // sky tiles are square sections of a virtual full sky lat/lon raster of 2^(zoom+1) x 2^zoom tiles. The camera
+  // projection, field of view and resolution are set from the tile options
+  //
+  if (bsr_config->sky_tile_zoom >= 0) {
+    if (bsr_config->sky_tile_zoom > BSR_MAX_SKY_TILE_ZOOM) {
+      bsr_config->sky_tile_zoom=BSR_MAX_SKY_TILE_ZOOM;
+    }
+    if (bsr_config->sky_tile_size < 16) {
+      bsr_config->sky_tile_size=16;
+    } else if (bsr_config->sky_tile_size > BSR_MAX_SKY_TILE_SIZE) {
+      bsr_config->sky_tile_size=BSR_MAX_SKY_TILE_SIZE;
+    }
+    if ((bsr_config->sky_tile_x < 0) || (bsr_config->sky_tile_x >= (2 << bsr_config->sky_tile_zoom))\
+     || (bsr_config->sky_tile_y < 0) || (bsr_config->sky_tile_y >= (1 << bsr_config->sky_tile_zoom))) {
+      if (bsr_config->cgi_mode != 1) {
+        printf("Error: sky_tile_x must be 0 to %d and sky_tile_y must be 0 to %d for sky_tile_zoom=%d\n", ((2 << bsr_config->sky_tile_zoom) - 1), ((1 << bsr_config->sky_tile_zoom) - 1), bsr_config->sky_tile_zoom);
+        fflush(stdout);
+      }
+      exit(1);
+    }
+    if ((bsr_config->vr_mode != 0) || (bsr_config->camera_list_file_name[0] != 0) || (bsr_config->frame_list_file_name[0] != 0)) {
+      if (bsr_config->cgi_mode != 1) {
+        printf("Error: sky tiles cannot be used with vr_mode, camera_list_file or frame_list_file\n");
+        fflush(stdout);
+      }
+      exit(1);
+    }
+    bsr_config->camera_projection=0;
+    bsr_config->camera_fov=360.0;
+    bsr_config->camera_res_x=bsr_config->sky_tile_size;
+    bsr_config->camera_res_y=bsr_config->sky_tile_size;
+  }
+
+  //
+  // Airy disk mode: 0 = Airy disk map for each star, 1 = render stars as points and convolve the image with the Airy
+  // disk by FFT. Sky tiles use Airy disk maps so stars just outside the tile continue across the tile edges
+  //
+  if ((bsr_config->Airy_disk_mode < 0) || (bsr_config->Airy_disk_mode > 1) || (bsr_config->Airy_disk_enable != 1) || (bsr_config->sky_tile_zoom >= 0)) {
+    bsr_config->Airy_disk_mode=0;
+  }
+
+  //
+  // output format and format dependent options
+  //
+  validateOutputConfig(bsr_config);
+
+  return(0);
+}
+
+int validateOutputConfig(bsr_config_t *bsr_config) {
+  //
+  // This function validates the options that only affect one output image, so it is also used for each line of
+  // output_list_file
+  //
+
   //
   // translate output_format to internal config variables
   // 0 = PNG 8-bit unsigned integer per color
@@ -355,9 +355,10 @@ int compressEXRDeflate(bsr_config_t *bsr_config, bsr_state_t *bsr_state, int lin
   int half_pixel_data_size;
   int mix;
   int mix_prev;
-  int lines_per_thread;
   unsigned char *image_output_p;
-  int y_offset;
+  int first_block;
+  int end_block;
+  int block;
   int bytes_per_pixel=6;
   int z_return;
 
@@ -370,93 +371,79 @@ int compressEXRDeflate(bsr_config_t *bsr_config, bsr_state_t *bsr_state, int lin
   *bsr_state->compression_buf2=0;
 
   //
-  // uncompressed full block data size
+  // bytes per pixel of uncompressed data
   //
   if (bsr_config->bits_per_color == 16) {
     bytes_per_pixel=6;
   } else if (bsr_config->bits_per_color == 32) {
     bytes_per_pixel=12;
   }
-  pixel_data_size=bytes_per_pixel * output_res_x * lines_per_block;
-  half_pixel_data_size = pixel_data_size / 2; // with 6 or 12 bytes per pixel this is always exactly divisible by 2
 
   //
-  // lines per thread
+  // compression loop. Each thread compresses the EXR blocks handed out by nextRowBlock(), see outputEXR(). The
+  // reorder/mixing steps are peculiar to OpenEXR
   //
-  lines_per_thread=(int)ceil(((double)output_res_y / (double)(bsr_state->num_worker_threads + 1)));
-  if (lines_per_thread % lines_per_block != 0) { // ensure thread boundary is also a block boundary
-    lines_per_thread+=(lines_per_block - (lines_per_thread % lines_per_block));
-  }
-
-  //
-  // compression loop. Each thread works on it's assigned section of image. The reorder/mixing steps are peculiar to OpenEXR
-  //
-  lines_remaining=lines_per_block;
-  output_y=bsr_state->perthread->my_thread_id * lines_per_thread;
-  image_output_p=bsr_state->image_output_buf + ((uint64_t)bytes_per_pixel * (uint64_t)output_res_x * (uint64_t)output_y);
-  for (y_offset=0; ((y_offset < lines_per_thread) && (output_y < output_res_y)); y_offset+=lines_per_block) {
-    // check for partial last block
-    if ((output_y + lines_per_block) > output_res_y) { // bottom of image
-      lines_remaining=output_res_y - output_y;
-    } else if ((y_offset + lines_per_block) > lines_per_thread) { // bottom of this thread's section of image (should never happen if thread boundary is also block boundary)
-      lines_remaining=lines_per_thread - y_offset;
-    }
-    if (lines_remaining != lines_per_block) {
+  while (nextRowBlock(bsr_state, &first_block, &end_block) == 1) {
+    for (block=first_block; block < end_block; block++) {
+      checkCancel(bsr_state);
+      output_y=block * lines_per_block;
+      image_output_p=bsr_state->image_output_buf + ((uint64_t)bytes_per_pixel * (uint64_t)output_res_x * (uint64_t)output_y);
+      // check for partial last block
+      lines_remaining=lines_per_block;
+      if ((output_y + lines_per_block) > output_res_y) { // bottom of image
+        lines_remaining=output_res_y - output_y;
+      }
       pixel_data_size=bytes_per_pixel * output_res_x * lines_remaining;
       half_pixel_data_size = pixel_data_size / 2; // with 6 or 12 bytes per pixel this is always exactly divisible by 2
-    }
 
-    // re-order bytes (first half of buffer = even bytes, second half = odd)
-    reorder_src_p=image_output_p;
-    reorder_dest_p=bsr_state->compression_buf1;
-    for (reorder_i=0; reorder_i < half_pixel_data_size; reorder_i++) {
-      *reorder_dest_p=*reorder_src_p; // even byte
-      reorder_src_p++;
-      reorder_dest_p+=half_pixel_data_size;
-      *reorder_dest_p=*reorder_src_p; // odd byte
-      reorder_src_p++;
-      reorder_dest_p-=(half_pixel_data_size - 1);
-    }
+      // re-order bytes (first half of buffer = even bytes, second half = odd)
+      reorder_src_p=image_output_p;
+      reorder_dest_p=bsr_state->compression_buf1;
+      for (reorder_i=0; reorder_i < half_pixel_data_size; reorder_i++) {
+        *reorder_dest_p=*reorder_src_p; // even byte
+        reorder_src_p++;
+        reorder_dest_p+=half_pixel_data_size;
+        *reorder_dest_p=*reorder_src_p; // odd byte
+        reorder_src_p++;
+        reorder_dest_p-=(half_pixel_data_size - 1);
+      }
 
-    // mix current with previous byte
-    mix_prev=(int)*bsr_state->compression_buf1;
-    reorder_dest_p=bsr_state->compression_buf1;
-    reorder_dest_p++;
-    for (reorder_i=1; reorder_i < pixel_data_size; reorder_i++) {
-      mix=(int)*reorder_dest_p - mix_prev + 384;
-      mix_prev=(int)*reorder_dest_p;
-      *reorder_dest_p=(uint8_t)mix;
+      // mix current with previous byte
+      mix_prev=(int)*bsr_state->compression_buf1;
+      reorder_dest_p=bsr_state->compression_buf1;
       reorder_dest_p++;
-    }
-
-    // compress pixel data
-    level=6;
-    compressed_data_size=pixel_data_size;
-    z_return=compress2((Bytef *)bsr_state->compression_buf2, &compressed_data_size, (const Bytef *)bsr_state->compression_buf1, (uLong)pixel_data_size, level);
-    if (z_return != Z_OK) {
-      // if compression fails for any reason, just use uncompressed data.
-      if ((bsr_state->perthread->my_pid == bsr_state->main_pid) && (bsr_config->cgi_mode != 1) && (bsr_config->print_status == 1)) {
-        printf("Warning, deflate compression failed for thread_id: %d, output_y: %d, y_offset: %d\n", bsr_state->perthread->my_thread_id, output_y, y_offset);
-        fflush(stdout);
+      for (reorder_i=1; reorder_i < pixel_data_size; reorder_i++) {
+        mix=(int)*reorder_dest_p - mix_prev + 384;
+        mix_prev=(int)*reorder_dest_p;
+        *reorder_dest_p=(uint8_t)mix;
+        reorder_dest_p++;
       }
-      compressed_data_size=pixel_data_size;
-    }
 
-    // store smaller of compressed or uncompressed data
-    if ((int)compressed_data_size < pixel_data_size) {
-      // copy compressed data to image output buffer (overwriting original uncompressed data)
-      // and store size in sizes array
-      memcpy(image_output_p, bsr_state->compression_buf2, (size_t)compressed_data_size);
-      bsr_state->compressed_sizes[output_y]=(int)compressed_data_size;
-    } else {
-      // just use uncompressed data and put uncompressed data size in sizes array
-      bsr_state->compressed_sizes[output_y]=pixel_data_size;
-    }
+      // compress pixel data
+      level=6;
+      compressed_data_size=pixel_data_size;
+      z_return=compress2((Bytef *)bsr_state->compression_buf2, &compressed_data_size, (const Bytef *)bsr_state->compression_buf1, (uLong)pixel_data_size, level);
+      if (z_return != Z_OK) {
+        // if compression fails for any reason, just use uncompressed data.
+        if ((bsr_state->perthread->my_pid == bsr_state->main_pid) && (bsr_config->cgi_mode != 1) && (bsr_config->print_status == 1)) {
+          printf("Warning, deflate compression failed for thread_id: %d, output_y: %d, block: %d\n", bsr_state->perthread->my_thread_id, output_y, block);
+          fflush(stdout);
+        }
+        compressed_data_size=pixel_data_size;
+      }
 
-    // move to next block
-    output_y+=lines_per_block;
-    image_output_p+=pixel_data_size;
-  }
+      // store smaller of compressed or uncompressed data
+      if ((int)compressed_data_size < pixel_data_size) {
+        // copy compressed data to image output buffer (overwriting original uncompressed data)
+        // and store size in sizes array
+        memcpy(image_output_p, bsr_state->compression_buf2, (size_t)compressed_data_size);
+        bsr_state->compressed_sizes[output_y]=(int)compressed_data_size;
+      } else {
+        // just use uncompressed data and put uncompressed data size in sizes array
+        bsr_state->compressed_sizes[output_y]=pixel_data_size;
+      }
+    } // end for block
+  } // end while nextRowBlock
 
 #endif // BSR_USE_EXR
 
@@ -471,6 +458,7 @@ int outputEXR(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
   int i;
   int header_size;
   int lines_per_block=1;
+  int trace_event;
 
   //
   // main thread: display status update if not in CGI mode
@@ -488,12 +476,19 @@ int outputEXR(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
   if (bsr_state->perthread->my_pid != bsr_state->main_pid) {
     waitForMainThread(bsr_state, THREAD_STATUS_IMAGE_COMPRESS_BEGIN);
   } else {
-    // main thread
+    // main thread: EXR blocks are handed out to threads for compression, 16 lines per block if exr_compression=3
+    if (bsr_config->exr_compression == 3) {
+      initRowBlocks(bsr_state, ((bsr_state->current_image_res_y + 15) / 16), 1);
+    } else {
+      initRowBlocks(bsr_state, bsr_state->current_image_res_y, 1);
+    }
     for (i=1; i <= bsr_state->num_worker_threads; i++) {
       bsr_state->status_array[i].status=THREAD_STATUS_IMAGE_COMPRESS_BEGIN;
     }
   } // end if not main thread
 
+  trace_event=traceBegin(bsr_state, "EXR compression", NULL);
+
   //
   // all threads: optionally compress pixel data
   //
@@ -507,6 +502,8 @@ int outputEXR(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
     compressEXRDeflate(bsr_config, bsr_state, lines_per_block);
   }
 
+  traceEnd(bsr_state, trace_event);
+
   //
   // worker threads: signal this thread is done and wait until main thread says we can continue to next step.
   // main thread: wait until all other threads are done and then signal that they can continue to next step.
@@ -522,6 +519,8 @@ int outputEXR(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
     }
   } // end if not main thread
 
+  trace_event=traceBegin(bsr_state, "EXR output", NULL);
+
   //
   // main thread: output EXR image to file or stdout 
   //
@@ -539,12 +538,10 @@ int outputEXR(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
     header_size=outputEXRHeader(bsr_config, bsr_state, output_file);
     outputEXROffsetTable(bsr_config, bsr_state, output_file, header_size, lines_per_block);
     outputEXRChunks(bsr_config, bsr_state, output_file, lines_per_block);
-
-    if (bsr_config->cgi_mode != 1) {
-      fclose(output_file);
-    }
   } // end if main thread
 
+  traceEnd(bsr_state, trace_event);
+
   //
   // worker threads: signal this thread is done and wait until main thread says we can continue to next step.
   // main thread: wait until all other threads are done and then signal that they can continue to next step.
@@ -49,32 +49,42 @@
 #include <jerror.h>
 #endif
 
-int outputJpeg(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
-
 #ifdef BSR_USE_JPEG
-
-  FILE *output_file=NULL;
+typedef struct {
+  FILE *output_file;
   struct jpeg_compress_struct jpeg_info;
   struct jpeg_error_mgr jpeg_err;
-  struct timespec starttime;
-  struct timespec endtime;
-  double elapsed_time;
+} jpeg_stream_t;
+#endif
 
+int beginJpeg(bsr_config_t *bsr_config, bsr_state_t *bsr_state, int res_x, int res_y) {
   //
-  // display status update if not in CGI mode
+  // This function opens the output file and starts compressing a res_x by res_y JPEG image. Scanlines are then
+  // written with one or more calls to writeJpegRows() and the image is finished with endJpeg(). Encoder state is kept
+  // in perthread->image_stream so these must be called from the same thread (normally the main thread).
   //
-  if ((bsr_config->cgi_mode != 1) && (bsr_config->print_status == 1)) {
-    clock_gettime(CLOCK_REALTIME, &starttime);
-    printf("Writing %s...", bsr_config->output_file_name);
-    fflush(stdout);
+
+#ifdef BSR_USE_JPEG
+
+  jpeg_stream_t *jpeg_stream;
+
+  jpeg_stream=(jpeg_stream_t *)malloc(sizeof(jpeg_stream_t));
+  if (jpeg_stream == NULL) {
+    if (bsr_config->cgi_mode != 1) {
+      printf("Error: could not allocate memory for JPEG encoder\n");
+      fflush(stdout);
+    }
+    exit(1);
   }
+  jpeg_stream->output_file=NULL;
+  bsr_state->perthread->image_stream=jpeg_stream;
 
   //
   // if not CGI mode, open output file
   //
   if (bsr_config->cgi_mode != 1) {
-    output_file=fopen(bsr_config->output_file_name, "wb");
-    if (output_file == NULL) {
+    jpeg_stream->output_file=fopen(bsr_config->output_file_name, "wb");
+    if (jpeg_stream->output_file == NULL) {
       printf("Error: could not open %s for writing\n", bsr_config->output_file_name);
       fflush(stdout);
       exit(1);
@@ -84,70 +94,131 @@ int outputJpeg(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
   //
   // initialize jpeg_info
   //
-  jpeg_info.err=jpeg_std_error(&jpeg_err);
-  jpeg_create_compress(&jpeg_info);
+  jpeg_stream->jpeg_info.err=jpeg_std_error(&jpeg_stream->jpeg_err);
+  jpeg_create_compress(&jpeg_stream->jpeg_info);
   if (bsr_config->cgi_mode == 1) {
-    jpeg_stdio_dest(&jpeg_info, stdout);
+    jpeg_stdio_dest(&jpeg_stream->jpeg_info, stdout);
   } else {
-    jpeg_stdio_dest(&jpeg_info, output_file);
+    jpeg_stdio_dest(&jpeg_stream->jpeg_info, jpeg_stream->output_file);
   }
-  jpeg_info.image_width=bsr_state->current_image_res_x;
-  jpeg_info.image_height=bsr_state->current_image_res_y;
-  jpeg_info.input_components=3;
-  jpeg_info.in_color_space=JCS_RGB;
-  jpeg_set_defaults(&jpeg_info);
-  jpeg_set_quality(&jpeg_info, bsr_config->compression_quality, 1);
-  jpeg_start_compress(&jpeg_info, 1);
+  jpeg_stream->jpeg_info.image_width=res_x;
+  jpeg_stream->jpeg_info.image_height=res_y;
+  jpeg_stream->jpeg_info.input_components=3;
+  jpeg_stream->jpeg_info.in_color_space=JCS_RGB;
+  jpeg_set_defaults(&jpeg_stream->jpeg_info);
+  jpeg_set_quality(&jpeg_stream->jpeg_info, bsr_config->compression_quality, 1);
+  jpeg_start_compress(&jpeg_stream->jpeg_info, 1);
 
   //
   // set color profile
   //
   if (bsr_config->color_profile == 2) {
     // Display-P3
-    jpeg_write_icc_profile(&jpeg_info, DisplayP3Compat_v4_icc, DisplayP3Compat_v4_icc_len);
+    jpeg_write_icc_profile(&jpeg_stream->jpeg_info, DisplayP3Compat_v4_icc, DisplayP3Compat_v4_icc_len);
   } else if (bsr_config->color_profile == 3) {
     // Rec. 2020
-    jpeg_write_icc_profile(&jpeg_info, Rec2020Compat_v4_icc, Rec2020Compat_v4_icc_len);
+    jpeg_write_icc_profile(&jpeg_stream->jpeg_info, Rec2020Compat_v4_icc, Rec2020Compat_v4_icc_len);
   } else if (bsr_config->color_profile == 4) {
     // Rec. 601 NTSC
-    jpeg_write_icc_profile(&jpeg_info, Rec601NTSC_v4_icc, Rec601NTSC_v4_icc_len);
+    jpeg_write_icc_profile(&jpeg_stream->jpeg_info, Rec601NTSC_v4_icc, Rec601NTSC_v4_icc_len);
   } else if (bsr_config->color_profile == 5) {
     // Rec. 601 PAL
-    jpeg_write_icc_profile(&jpeg_info, Rec601PAL_v4_icc, Rec601PAL_v4_icc_len);
+    jpeg_write_icc_profile(&jpeg_stream->jpeg_info, Rec601PAL_v4_icc, Rec601PAL_v4_icc_len);
   } else if (bsr_config->color_profile == 6) {
     // Rec. 709
-    jpeg_write_icc_profile(&jpeg_info, Rec709_v4_icc, Rec709_v4_icc_len);
+    jpeg_write_icc_profile(&jpeg_stream->jpeg_info, Rec709_v4_icc, Rec709_v4_icc_len);
   } else if (bsr_config->color_profile == 8) {
     // Rec. 2100 PQ
-    jpeg_write_icc_profile(&jpeg_info, Rec2100PQ_v4_icc, Rec2100PQ_v4_icc_len);
+    jpeg_write_icc_profile(&jpeg_stream->jpeg_info, Rec2100PQ_v4_icc, Rec2100PQ_v4_icc_len);
   } else {
     // default is sRGB
-    jpeg_write_icc_profile(&jpeg_info, sRGB_v4_icc, sRGB_v4_icc_len);
+    jpeg_write_icc_profile(&jpeg_stream->jpeg_info, sRGB_v4_icc, sRGB_v4_icc_len);
   }
 
-  //
-  // compress and output jpeg
-  //
-  jpeg_write_scanlines(&jpeg_info, bsr_state->row_pointers, bsr_state->current_image_res_y);
-  jpeg_finish_compress(&jpeg_info);
+#endif // BSR_USE_JPEG
+
+  return(0);
+}
+
+int writeJpegRows(bsr_config_t *bsr_config, bsr_state_t *bsr_state, unsigned char **row_pointers, int num_rows) {
+
+#ifdef BSR_USE_JPEG
+
+  jpeg_stream_t *jpeg_stream;
+  int rows_written;
+
+  jpeg_stream=(jpeg_stream_t *)bsr_state->perthread->image_stream;
+  rows_written=0;
+  while (rows_written < num_rows) {
+    rows_written+=jpeg_write_scanlines(&jpeg_stream->jpeg_info, (row_pointers + rows_written), (num_rows - rows_written));
+  }
+
+#endif // BSR_USE_JPEG
+
+  return(0);
+}
+
+int endJpeg(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
+
+#ifdef BSR_USE_JPEG
+
+  jpeg_stream_t *jpeg_stream;
+
+  jpeg_stream=(jpeg_stream_t *)bsr_state->perthread->image_stream;
+  jpeg_finish_compress(&jpeg_stream->jpeg_info);
 
   //
-  // display status message and close output file if not CGI mode
+  // close output file if not CGI mode
   //
   if (bsr_config->cgi_mode != 1) {
-    if (bsr_config->print_status == 1) {
-      clock_gettime(CLOCK_REALTIME, &endtime);
-      elapsed_time=((double)(endtime.tv_sec - 1500000000) + ((double)endtime.tv_nsec / 1.0E9)) - ((double)(starttime.tv_sec - 1500000000) + ((double)starttime.tv_nsec) / 1.0E9);
-      printf(" (%.3fs)\n", elapsed_time);
-      fflush(stdout);
-    }
-
-    // close output file
-    fclose(output_file);
+    fclose(jpeg_stream->output_file);
+  } else {
+    fflush(stdout);
   }
 
   // clean up libjpeg
-  jpeg_destroy_compress(&jpeg_info);
+  jpeg_destroy_compress(&jpeg_stream->jpeg_info);
+  free(jpeg_stream);
+  bsr_state->perthread->image_stream=NULL;
+
+#endif // BSR_USE_JPEG
+
+  return(0);
+}
+
+int outputJpeg(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
+
+#ifdef BSR_USE_JPEG
+
+  struct timespec starttime;
+  struct timespec endtime;
+  double elapsed_time;
+
+  //
+  // display status update if not in CGI mode
+  //
+  if ((bsr_config->cgi_mode != 1) && (bsr_config->print_status == 1)) {
+    clock_gettime(CLOCK_REALTIME, &starttime);
+    printf("Writing %s...", bsr_config->output_file_name);
+    fflush(stdout);
+  }
+
+  //
+  // compress and output jpeg
+  //
+  beginJpeg(bsr_config, bsr_state, bsr_state->current_image_res_x, bsr_state->current_image_res_y);
+  writeJpegRows(bsr_config, bsr_state, bsr_state->row_pointers, bsr_state->current_image_res_y);
+  endJpeg(bsr_config, bsr_state);
+
+  //
+  // display status message if not CGI mode
+  //
+  if ((bsr_config->cgi_mode != 1) && (bsr_config->print_status == 1)) {
+    clock_gettime(CLOCK_REALTIME, &endtime);
+    elapsed_time=((double)(endtime.tv_sec - 1500000000) + ((double)endtime.tv_nsec / 1.0E9)) - ((double)(starttime.tv_sec - 1500000000) + ((double)starttime.tv_nsec) / 1.0E9);
+    printf(" (%.3fs)\n", elapsed_time);
+    fflush(stdout);
+  }
 
 #endif // BSR_USE_JPEG
 
@@ -39,6 +39,9 @@
 #ifndef BSR_JPEG_H
 #define BSR_JPEG_H
 
+int beginJpeg(bsr_config_t *bsr_config, bsr_state_t *bsr_state, int res_x, int res_y);
+int writeJpegRows(bsr_config_t *bsr_config, bsr_state_t *bsr_state, unsigned char **row_pointers, int num_rows);
+int endJpeg(bsr_config_t *bsr_config, bsr_state_t *bsr_state);
 int outputJpeg(bsr_config_t *bsr_config, bsr_state_t *bsr_state);
 
 #endif // BSR_JPEG_H
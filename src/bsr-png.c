@@ -39,6 +39,7 @@
 #include "bsrender.h" // needs to be first to get GNU_SOURCE define for strcasestr
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include "util.h"
 #include "cgi.h"
 #include "icc-profiles.h"
@@ -46,36 +47,60 @@
 #ifdef BSR_USE_PNG
 #define PNG_SETJMP_NOT_SUPPORTED
 #include <png.h>
+#include <zlib.h>
 #endif
 
-int outputPNG(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
-
 #ifdef BSR_USE_PNG
-
-  FILE *output_file=NULL;
+typedef struct {
+  FILE *output_file;
   png_structp png_ptr;
   png_infop info_ptr;
-  unsigned char color_type=PNG_COLOR_TYPE_RGB;
-  unsigned char bit_depth;
-  struct timespec starttime;
-  struct timespec endtime;
-  double elapsed_time;
+  int idat_started; // 1 once the zlib header has been written by writePNGDeflated()
+  uLong adler;      // Adler-32 of the filtered bands written so far by writePNGDeflated()
+} png_stream_t;
+#endif
 
+//
+// Parallel deflate: instead of handing rows to libpng, which filters and deflates the whole image on the main
+// thread, worker threads filter and deflate bands of rows with deflatePNGRows(). Each band is a separate raw
+// deflate stream ending with a sync flush, so the bands can be concatenated in order (as pigz does) into one zlib
+// stream. The main thread writes each band as an IDAT chunk with writePNGDeflated() and endPNG() adds an empty
+// final block and the Adler-32 of the whole stream, combined from each band's Adler-32. The first row of each band
+// only uses the None or Sub filter since the previous row may not have been sequenced yet.
+//
+
+int beginPNG(bsr_config_t *bsr_config, bsr_state_t *bsr_state, int res_x, int res_y) {
   //
-  // display status update if not in CGI mode
+  // This function opens the output file and writes the PNG header for a res_x by res_y image. Image rows are then
+  // written with one or more calls to writePNGRows() and the image is finished with endPNG(). Encoder state is kept
+  // in perthread->image_stream so these must be called from the same thread (normally the main thread).
   //
-  if ((bsr_config->cgi_mode != 1) && (bsr_config->print_status == 1)) {
-    clock_gettime(CLOCK_REALTIME, &starttime);
-    printf("Writing %s...", bsr_config->output_file_name);
-    fflush(stdout);
+
+#ifdef BSR_USE_PNG
+
+  png_stream_t *png_stream;
+  unsigned char color_type=PNG_COLOR_TYPE_RGB;
+  unsigned char bit_depth;
+
+  png_stream=(png_stream_t *)malloc(sizeof(png_stream_t));
+  if (png_stream == NULL) {
+    if (bsr_config->cgi_mode != 1) {
+      printf("Error: could not allocate memory for PNG encoder\n");
+      fflush(stdout);
+    }
+    exit(1);
   }
+  png_stream->output_file=NULL;
+  png_stream->idat_started=0;
+  png_stream->adler=adler32(0L, Z_NULL, 0);
+  bsr_state->perthread->image_stream=png_stream;
 
   //
   // if not CGI mode, open output file
   //
   if (bsr_config->cgi_mode != 1) {
-    output_file=fopen(bsr_config->output_file_name, "wb");
-    if (output_file == NULL) {
+    png_stream->output_file=fopen(bsr_config->output_file_name, "wb");
+    if (png_stream->output_file == NULL) {
       printf("Error: could not open %s for writing\n", bsr_config->output_file_name);
       fflush(stdout);
       exit(1);
@@ -85,72 +110,358 @@ int outputPNG(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
   //
   // initialize PNG ptr and info_ptr
   //
-  png_ptr=png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-  info_ptr=png_create_info_struct(png_ptr);
+  png_stream->png_ptr=png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  png_stream->info_ptr=png_create_info_struct(png_stream->png_ptr);
   if (bsr_config->cgi_mode == 1) {
-    png_init_io(png_ptr, stdout);
+    png_init_io(png_stream->png_ptr, stdout);
   } else {
-    png_init_io(png_ptr, output_file);
+    png_init_io(png_stream->png_ptr, png_stream->output_file);
   } 
   if (bsr_config->bits_per_color == 16) {
     bit_depth=16;
   } else {
     bit_depth=8;
   }
-  png_set_IHDR(png_ptr, info_ptr, bsr_state->current_image_res_x, bsr_state->current_image_res_y, bit_depth, color_type, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+  png_set_IHDR(png_stream->png_ptr, png_stream->info_ptr, res_x, res_y, bit_depth, color_type, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
   
   //
   // set color profile
   //
   if (bsr_config->color_profile == 0) {
     // no ICC profile and linear gamma
-    png_set_gAMA(png_ptr, info_ptr, 1.0);
+    png_set_gAMA(png_stream->png_ptr, png_stream->info_ptr, 1.0);
   } else if (bsr_config->color_profile == 2) {
     // Display-P3
-    png_set_iCCP(png_ptr, info_ptr, "Display-P3", 0, DisplayP3Compat_v4_icc, DisplayP3Compat_v4_icc_len);
+    png_set_iCCP(png_stream->png_ptr, png_stream->info_ptr, "Display-P3", 0, DisplayP3Compat_v4_icc, DisplayP3Compat_v4_icc_len);
   } else if (bsr_config->color_profile == 3) {
     // Rec. 2020
-    png_set_iCCP(png_ptr, info_ptr, "Rec 2020", 0, Rec2020Compat_v4_icc, Rec2020Compat_v4_icc_len);
+    png_set_iCCP(png_stream->png_ptr, png_stream->info_ptr, "Rec 2020", 0, Rec2020Compat_v4_icc, Rec2020Compat_v4_icc_len);
   } else if (bsr_config->color_profile == 4) {
     // Rec. 601 NTSC
-    png_set_iCCP(png_ptr, info_ptr, "Rec 601 NTSC", 0, Rec601NTSC_v4_icc, Rec601NTSC_v4_icc_len);
+    png_set_iCCP(png_stream->png_ptr, png_stream->info_ptr, "Rec 601 NTSC", 0, Rec601NTSC_v4_icc, Rec601NTSC_v4_icc_len);
   } else if (bsr_config->color_profile == 5) {
     // Rec. 601 PAL
-    png_set_iCCP(png_ptr, info_ptr, "Re 601 PAL", 0, Rec601PAL_v4_icc, Rec601PAL_v4_icc_len);
+    png_set_iCCP(png_stream->png_ptr, png_stream->info_ptr, "Re 601 PAL", 0, Rec601PAL_v4_icc, Rec601PAL_v4_icc_len);
   } else if (bsr_config->color_profile == 6) {
     // Rec. 709
-    png_set_iCCP(png_ptr, info_ptr, "Rec 709", 0, Rec709_v4_icc, Rec709_v4_icc_len);
+    png_set_iCCP(png_stream->png_ptr, png_stream->info_ptr, "Rec 709", 0, Rec709_v4_icc, Rec709_v4_icc_len);
   } else if (bsr_config->color_profile == 7) {
     // no ICC profile and flat 2.0 gamma
-    png_set_gAMA(png_ptr, info_ptr, 0.5);
+    png_set_gAMA(png_stream->png_ptr, png_stream->info_ptr, 0.5);
   } else if (bsr_config->color_profile == 8) {
     // Rec. 2100 PQ
-    png_set_iCCP(png_ptr, info_ptr, "Rec 2100 PQ", 0, Rec2100PQ_v4_icc, Rec2100PQ_v4_icc_len);
+    png_set_iCCP(png_stream->png_ptr, png_stream->info_ptr, "Rec 2100 PQ", 0, Rec2100PQ_v4_icc, Rec2100PQ_v4_icc_len);
   } else {
     // default is sRGB
-    png_set_iCCP(png_ptr, info_ptr, "sRGB", 0, sRGB_v4_icc, sRGB_v4_icc_len);
+    png_set_iCCP(png_stream->png_ptr, png_stream->info_ptr, "sRGB", 0, sRGB_v4_icc, sRGB_v4_icc_len);
   }
 
   //
-  // write PNG header and image data
+  // write PNG header
   //
-  png_write_info(png_ptr, info_ptr);
-  png_write_image(png_ptr, bsr_state->row_pointers);
-  png_write_end(png_ptr, NULL);
+  png_write_info(png_stream->png_ptr, png_stream->info_ptr);
+
+#endif // BSR_USE_PNG
+
+  return(0);
+}
+
+int writePNGRows(bsr_config_t *bsr_config, bsr_state_t *bsr_state, unsigned char **row_pointers, int num_rows) {
+
+#ifdef BSR_USE_PNG
+
+  png_stream_t *png_stream;
+
+  png_stream=(png_stream_t *)bsr_state->perthread->image_stream;
+  png_write_rows(png_stream->png_ptr, row_pointers, num_rows);
+
+#endif // BSR_USE_PNG
 
+  return(0);
+}
+
+size_t deflatePNGBound(int row_bytes, int num_rows) {
   //
-  // display status message and close output file if not CGI mode
+  // upper bound of the raw deflate data made by deflatePNGRows() for num_rows rows of row_bytes bytes. The 6 bytes
+  // compressBound() allows for the zlib header and Adler-32 cover the sync flush at the end of each band
   //
-  if (bsr_config->cgi_mode != 1) {
-    if (bsr_config->print_status == 1) {
-      clock_gettime(CLOCK_REALTIME, &endtime);
-      elapsed_time=((double)(endtime.tv_sec - 1500000000) + ((double)endtime.tv_nsec / 1.0E9)) - ((double)(starttime.tv_sec - 1500000000) + ((double)starttime.tv_nsec) / 1.0E9);
-      printf(" (%.3fs)\n", elapsed_time);
+  size_t filtered_size;
+
+  filtered_size=(size_t)(row_bytes + 1) * (size_t)num_rows;
+#ifdef BSR_USE_PNG
+  return((size_t)compressBound((uLong)filtered_size) + 16);
+#else
+  return(filtered_size);
+#endif
+}
+
+static int filterPNGRow(unsigned char *row_p, unsigned char *prior_row_p, int row_bytes, int bytes_per_pixel, unsigned char *filtered_p) {
+  //
+  // select a filter for one row the same way libpng does by default (smallest sum of filtered bytes taken as signed
+  // values, first of None, Sub, Up, Average, Paeth on ties) and store the filter type and filtered row in
+  // filtered_p. If prior_row_p is NULL only None and Sub are used
+  //
+  int sums[5]={0, 0, 0, 0, 0};
+  int num_filters;
+  int filter;
+  int best_filter;
+  int i;
+  int raw;
+  int a;
+  int b;
+  int c;
+  int p;
+  int pa;
+  int pb;
+  int pc;
+  int predictor[5];
+  unsigned char v;
+
+  if (prior_row_p == NULL) {
+    num_filters=2;
+  } else {
+    num_filters=5;
+  }
+
+  //
+  // first pass: sum of each filter's output
+  //
+  for (i=0; i < row_bytes; i++) {
+    raw=row_p[i];
+    a=(i >= bytes_per_pixel) ? row_p[i - bytes_per_pixel] : 0;
+    predictor[0]=0;
+    predictor[1]=a;
+    if (num_filters == 5) {
+      b=prior_row_p[i];
+      c=(i >= bytes_per_pixel) ? prior_row_p[i - bytes_per_pixel] : 0;
+      predictor[2]=b;
+      predictor[3]=(a + b) >> 1;
+      p=a + b - c;
+      pa=abs(p - a);
+      pb=abs(p - b);
+      pc=abs(p - c);
+      if ((pa <= pb) && (pa <= pc)) {
+        predictor[4]=a;
+      } else if (pb <= pc) {
+        predictor[4]=b;
+      } else {
+        predictor[4]=c;
+      }
+    }
+    for (filter=0; filter < num_filters; filter++) {
+      v=(unsigned char)(raw - predictor[filter]);
+      sums[filter]+=(v < 128) ? v : (256 - v);
+    }
+  }
+  best_filter=0;
+  for (filter=1; filter < num_filters; filter++) {
+    if (sums[filter] < sums[best_filter]) {
+      best_filter=filter;
+    }
+  }
+
+  //
+  // second pass: store filter type and filtered row
+  //
+  filtered_p[0]=(unsigned char)best_filter;
+  for (i=0; i < row_bytes; i++) {
+    raw=row_p[i];
+    a=(i >= bytes_per_pixel) ? row_p[i - bytes_per_pixel] : 0;
+    if (best_filter == 0) {
+      filtered_p[i + 1]=(unsigned char)raw;
+    } else if (best_filter == 1) {
+      filtered_p[i + 1]=(unsigned char)(raw - a);
+    } else {
+      b=prior_row_p[i];
+      if (best_filter == 2) {
+        filtered_p[i + 1]=(unsigned char)(raw - b);
+      } else if (best_filter == 3) {
+        filtered_p[i + 1]=(unsigned char)(raw - ((a + b) >> 1));
+      } else {
+        c=(i >= bytes_per_pixel) ? prior_row_p[i - bytes_per_pixel] : 0;
+        p=a + b - c;
+        pa=abs(p - a);
+        pb=abs(p - b);
+        pc=abs(p - c);
+        if ((pa <= pb) && (pa <= pc)) {
+          filtered_p[i + 1]=(unsigned char)(raw - a);
+        } else if (pb <= pc) {
+          filtered_p[i + 1]=(unsigned char)(raw - b);
+        } else {
+          filtered_p[i + 1]=(unsigned char)(raw - c);
+        }
+      }
+    }
+  }
+
+  return(best_filter);
+}
+
+int deflatePNGRows(bsr_config_t *bsr_config, bsr_state_t *bsr_state, unsigned char **row_pointers, int num_rows, int res_x, unsigned char *deflate_buf, size_t deflate_buf_size, size_t *deflate_size, size_t *filtered_size, uint32_t *adler) {
+  //
+  // This function filters num_rows rows and deflates them into deflate_buf as a raw deflate stream ending with a
+  // sync flush. It may be called by any thread, each thread uses its own png_filter_buf. deflate_buf_size must be at
+  // least deflatePNGBound()
+  //
+
+#ifdef BSR_USE_PNG
+
+  z_stream z;
+  int z_return;
+  int row_bytes;
+  int bytes_per_pixel;
+  int row;
+  uLong row_adler;
+
+  if (bsr_config->bits_per_color == 16) {
+    bytes_per_pixel=6;
+  } else {
+    bytes_per_pixel=3;
+  }
+  row_bytes=res_x * bytes_per_pixel;
+
+  //
+  // same zlib settings libpng uses for filtered image data, without the zlib header and Adler-32
+  //
+  z.zalloc=Z_NULL;
+  z.zfree=Z_NULL;
+  z.opaque=Z_NULL;
+  if (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_FILTERED) != Z_OK) {
+    if (bsr_config->cgi_mode != 1) {
+      printf("Error: could not initialize PNG deflate stream\n");
       fflush(stdout);
     }
+    exit(1);
+  }
+  z.next_out=deflate_buf;
+  z.avail_out=(uInt)deflate_buf_size;
+
+  //
+  // filter and deflate each row, sync flush after the last row so the next band starts on a byte boundary
+  //
+  row_adler=adler32(0L, Z_NULL, 0);
+  for (row=0; row < num_rows; row++) {
+    filterPNGRow(row_pointers[row], ((row == 0) ? NULL : row_pointers[row - 1]), row_bytes, bytes_per_pixel, bsr_state->png_filter_buf);
+    row_adler=adler32(row_adler, bsr_state->png_filter_buf, (uInt)(row_bytes + 1));
+    z.next_in=bsr_state->png_filter_buf;
+    z.avail_in=(uInt)(row_bytes + 1);
+    z_return=deflate(&z, ((row == (num_rows - 1)) ? Z_SYNC_FLUSH : Z_NO_FLUSH));
+    if ((z_return != Z_OK) || (z.avail_in != 0) || (z.avail_out == 0)) {
+      if (bsr_config->cgi_mode != 1) {
+        printf("Error: PNG deflate failed for thread_id: %d\n", bsr_state->perthread->my_thread_id);
+        fflush(stdout);
+      }
+      exit(1);
+    }
+  }
+  *deflate_size=deflate_buf_size - (size_t)z.avail_out;
+  *filtered_size=(size_t)(row_bytes + 1) * (size_t)num_rows;
+  *adler=(uint32_t)row_adler;
+  deflateEnd(&z);
+
+#endif // BSR_USE_PNG
+
+  return(0);
+}
+
+int writePNGDeflated(bsr_config_t *bsr_config, bsr_state_t *bsr_state, unsigned char *deflate_buf, size_t deflate_size, size_t filtered_size, uint32_t adler) {
+  //
+  // write one band deflated by deflatePNGRows() as an IDAT chunk. The first band is preceded by the zlib header
+  //
+
+#ifdef BSR_USE_PNG
+
+  png_stream_t *png_stream;
+  unsigned char zlib_header[2]={0x78, 0x9c}; // deflate, 32K window, default compression level
+
+  png_stream=(png_stream_t *)bsr_state->perthread->image_stream;
+  if (png_stream->idat_started == 0) {
+    png_write_chunk_start(png_stream->png_ptr, (png_const_bytep)"IDAT", (png_uint_32)(deflate_size + 2));
+    png_write_chunk_data(png_stream->png_ptr, zlib_header, 2);
+    png_stream->idat_started=1;
+  } else {
+    png_write_chunk_start(png_stream->png_ptr, (png_const_bytep)"IDAT", (png_uint_32)deflate_size);
+  }
+  png_write_chunk_data(png_stream->png_ptr, deflate_buf, deflate_size);
+  png_write_chunk_end(png_stream->png_ptr);
+  png_stream->adler=adler32_combine(png_stream->adler, (uLong)adler, (z_off_t)filtered_size);
+
+#endif // BSR_USE_PNG
+
+  return(0);
+}
+
+int endPNG(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
+
+#ifdef BSR_USE_PNG
+
+  png_stream_t *png_stream;
+  unsigned char zlib_trailer[6];
+
+  png_stream=(png_stream_t *)bsr_state->perthread->image_stream;
+  if (png_stream->idat_started == 1) {
+    // bands written by writePNGDeflated(): empty final fixed Huffman block, Adler-32 (big-endian) and IEND
+    zlib_trailer[0]=0x03;
+    zlib_trailer[1]=0x00;
+    zlib_trailer[2]=(unsigned char)((png_stream->adler >> 24) & 0xff);
+    zlib_trailer[3]=(unsigned char)((png_stream->adler >> 16) & 0xff);
+    zlib_trailer[4]=(unsigned char)((png_stream->adler >> 8) & 0xff);
+    zlib_trailer[5]=(unsigned char)(png_stream->adler & 0xff);
+    png_write_chunk(png_stream->png_ptr, (png_const_bytep)"IDAT", zlib_trailer, 6);
+    png_write_chunk(png_stream->png_ptr, (png_const_bytep)"IEND", NULL, 0);
+  } else {
+    png_write_end(png_stream->png_ptr, NULL);
+  }
+  png_destroy_write_struct(&png_stream->png_ptr, &png_stream->info_ptr);
 
-    // close output file
-    fclose(output_file);
+  //
+  // close output file if not CGI mode
+  //
+  if (bsr_config->cgi_mode != 1) {
+    fclose(png_stream->output_file);
+  } else {
+    fflush(stdout);
+  }
+  free(png_stream);
+  bsr_state->perthread->image_stream=NULL;
+
+#endif // BSR_USE_PNG
+
+  return(0);
+}
+
+int outputPNG(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
+
+#ifdef BSR_USE_PNG
+
+  struct timespec starttime;
+  struct timespec endtime;
+  double elapsed_time;
+
+  //
+  // display status update if not in CGI mode
+  //
+  if ((bsr_config->cgi_mode != 1) && (bsr_config->print_status == 1)) {
+    clock_gettime(CLOCK_REALTIME, &starttime);
+    printf("Writing %s...", bsr_config->output_file_name);
+    fflush(stdout);
+  }
+
+  //
+  // write PNG header and image data
+  //
+  beginPNG(bsr_config, bsr_state, bsr_state->current_image_res_x, bsr_state->current_image_res_y);
+  writePNGRows(bsr_config, bsr_state, bsr_state->row_pointers, bsr_state->current_image_res_y);
+  endPNG(bsr_config, bsr_state);
+
+  //
+  // display status message if not CGI mode
+  //
+  if ((bsr_config->cgi_mode != 1) && (bsr_config->print_status == 1)) {
+    clock_gettime(CLOCK_REALTIME, &endtime);
+    elapsed_time=((double)(endtime.tv_sec - 1500000000) + ((double)endtime.tv_nsec / 1.0E9)) - ((double)(starttime.tv_sec - 1500000000) + ((double)starttime.tv_nsec) / 1.0E9);
+    printf(" (%.3fs)\n", elapsed_time);
+    fflush(stdout);
   }
 
 #endif // BSR_USE_PNG
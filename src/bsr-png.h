@@ -39,6 +39,12 @@
 #ifndef BSR_PNG_H
 #define BSR_PNG_H
 
+int beginPNG(bsr_config_t *bsr_config, bsr_state_t *bsr_state, int res_x, int res_y);
+int writePNGRows(bsr_config_t *bsr_config, bsr_state_t *bsr_state, unsigned char **row_pointers, int num_rows);
+size_t deflatePNGBound(int row_bytes, int num_rows);
+int deflatePNGRows(bsr_config_t *bsr_config, bsr_state_t *bsr_state, unsigned char **row_pointers, int num_rows, int res_x, unsigned char *deflate_buf, size_t deflate_buf_size, size_t *deflate_size, size_t *filtered_size, uint32_t *adler);
+int writePNGDeflated(bsr_config_t *bsr_config, bsr_state_t *bsr_state, unsigned char *deflate_buf, size_t deflate_size, size_t filtered_size, uint32_t adler);
+int endPNG(bsr_config_t *bsr_config, bsr_state_t *bsr_state);
 int outputPNG(bsr_config_t *bsr_config, bsr_state_t *bsr_state);
 
 #endif // BSR_PNG_H
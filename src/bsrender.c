@@ -62,11 +62,30 @@
 #include "file.h"
 #include "sequence-pixels.h"
 #include "diffraction.h"
+#include "process-stars.h"
+#include "multi-camera.h"
+#include "multi-output.h"
+#include "animation.h"
+#include "pixel-buffer.h"
+#include "tiled-render.h"
+#include "stream-output.h"
+#include "daemon.h"
+#include "image-cache.h"
+#include "admission.h"
+#include "progressive.h"
+#include "perf-counters.h"
+#include "trace.h"
+#include "render-stats.h"
+#include "composition-file.h"
 
 int main(int argc, char **argv) {
   bsr_config_t bsr_config;
+  bsr_config_t output_base_config;
   bsr_state_t *bsr_state;
   bsr_thread_state_t perthread;
+  bsr_daemon_t bsr_daemon;
+  bsr_cache_t bsr_cache;
+  bsr_admission_t bsr_admission;
   struct timespec overall_starttime;
   struct timespec overall_endtime;
   struct timespec starttime;
@@ -74,11 +93,18 @@ int main(int argc, char **argv) {
   double elapsed_time;
   int all_workers_done;
   int i;
-  pixel_composition_t *image_composition_p;
+  int composition_precision;
+  double composition_prescale;
   int main_thread_buffer_index;
   int buffer_is_empty;
   int empty_passes;
   thread_buffer_t *main_thread_buf_p;
+  int image_index;
+  int output_index;
+  int pass_index;
+  int frame_index;
+  int tile_index;
+  int trace_event;
 
   //
   // initialize bsr_config to default values
@@ -111,6 +137,15 @@ int main(int argc, char **argv) {
   //
   processCmdArgs(&bsr_config, argc, argv);
 
+  //
+  // if daemon_socket is set, keep data files and rgb tables resident and fork a process for each request.
+  // runDaemon() only returns in request processes, with cgi_mode enabled and QUERY_STRING set to the request
+  //
+  bsr_daemon.state=NULL;
+  if (bsr_config.daemon_socket[0] != 0) {
+    runDaemon(&bsr_config, &bsr_daemon);
+  }
+
   //
   // if CGI mode, proces QUERY_STRING and print CGI header
   //
@@ -120,15 +155,43 @@ int main(int argc, char **argv) {
   }
 
   //
-  // validate config parameters are sane
+  // validate config parameters are sane. Lines of output_list_file are applied to a copy of the configuration from
+  // before validation, so output format dependent defaults follow each output's format
   //
+  output_base_config=bsr_config;
   validateConfig(&bsr_config);
 
+  //
+  // if CGI mode and cache_directory is set, send the cached image if this request has been rendered before
+  //
+  bsr_cache.cache_file=NULL;
+  if ((bsr_config.cgi_mode == 1) && (bsr_config.cache_directory[0] != 0)) {
+    if (checkImageCache(&bsr_config, &bsr_cache) == 0) {
+      return(0);
+    }
+  }
+
+  //
+  // if CGI mode and admission_file is set, wait until this request fits within the active rendering budget.
+  // Requests over the per-request budget are degraded or rejected with HTTP 503
+  //
+  bsr_admission.table=NULL;
+  bsr_admission.degraded=0;
+  if ((bsr_config.cgi_mode == 1) && (bsr_config.admission_file[0] != 0)) {
+    if (admitRequest(&bsr_config, &bsr_admission) != 0) {
+      return(0);
+    }
+  }
+
   //
   // if CGI mode, print CGI header (must be done after validate to translate output_format
   //
   if (bsr_config.cgi_mode == 1) {
-    printCGIHeader(bsr_config);
+    printCGIHeader(&bsr_config);
+    // store the image in the cache while it is sent, unless it was degraded by admission control or is sent in progressive passes
+    if ((bsr_config.cache_directory[0] != 0) && (bsr_admission.degraded == 0) && (bsr_config.progressive == 0)) {
+      beginImageCache(&bsr_config, &bsr_cache);
+    }
   }
 
   //
@@ -143,11 +206,50 @@ int main(int argc, char **argv) {
     exit(1);
   }
   bsr_state->perthread=&perthread;
+  bsr_state->perthread->num_image_writers=0;
+  bsr_state->perthread->last_connection_check=0;
+  memset(&bsr_state->perthread->stats, 0, sizeof(bsr_render_stats_t));
+  bsr_state->perthread->stats_file_index=0;
+  memset(&bsr_state->perthread->encode_table, 0, sizeof(bsr_encode_table_t));
+
+  //
+  // optionally load list of cameras or setup VR cameras to render in a single pass through the star data files
+  //
+  if ((bsr_config.camera_list_file_name[0] != 0) && ((bsr_config.vr_mode != 0) || (bsr_config.frame_list_file_name[0] != 0))) {
+    if (bsr_config.cgi_mode != 1) {
+      printf("Error: camera_list_file cannot be used with vr_mode or frame_list_file\n");
+      fflush(stdout);
+    }
+    exit(1);
+  } else if (bsr_config.camera_list_file_name[0] != 0) {
+    loadCameraList(&bsr_config, bsr_state);
+  } else if (bsr_config.vr_mode != 0) {
+    initVRCameras(&bsr_config, bsr_state);
+  }
 
   //
-  // open input files
+  // optionally load camera keyframes to render a sequence of frames with the same worker threads, tables and buffers
   //
-  openInputFiles(&bsr_config, bsr_state);
+  if (bsr_config.frame_list_file_name[0] != 0) {
+    loadFrameList(&bsr_config, bsr_state);
+  }
+
+  //
+  // optionally load a list of output images (format, size, exposure) to make from each rendered image
+  //
+  if (bsr_config.output_list_file_name[0] != 0) {
+    loadOutputList(&bsr_config, &output_base_config, bsr_state);
+  }
+
+  //
+  // open input files, daemon request processes use the daemon's mappings if they include all files needed. Not needed
+  // if the image composition buffer is loaded from a composition file
+  //
+  if (bsr_config.load_composition_file_name[0] != 0) {
+    // no input files
+  } else if ((bsr_daemon.state == NULL) || (attachDaemonFiles(&bsr_config, bsr_state, &bsr_daemon) != 0)) {
+    openInputFiles(&bsr_config, bsr_state);
+  }
 
   //
   // calculate number of worker threads to be forked
@@ -167,19 +269,21 @@ int main(int argc, char **argv) {
   }
 
   //
-  // initialize RGB color lookup tables
+  // initialize RGB color lookup tables, daemon request processes use the daemon's tables if options are the same
   //
-  if ((bsr_config.cgi_mode != 1) && (bsr_config.print_status == 1)) {
-    clock_gettime(CLOCK_REALTIME, &starttime);
-    printf("Initializing rgb color tables...");
-    fflush(stdout);
-  }
-  initRGBTables(&bsr_config, bsr_state);
-  if ((bsr_config.cgi_mode != 1) && (bsr_config.print_status == 1)) {
-    clock_gettime(CLOCK_REALTIME, &endtime);
-    elapsed_time=((double)(endtime.tv_sec - 1500000000) + ((double)endtime.tv_nsec / 1.0E9)) - ((double)(starttime.tv_sec - 1500000000) + ((double)starttime.tv_nsec) / 1.0E9);
-    printf(" (%.3fs)\n", elapsed_time);
-    fflush(stdout);
+  if ((bsr_daemon.state == NULL) || (attachDaemonRGBTables(&bsr_config, bsr_state, &bsr_daemon) != 0)) {
+    if ((bsr_config.cgi_mode != 1) && (bsr_config.print_status == 1)) {
+      clock_gettime(CLOCK_REALTIME, &starttime);
+      printf("Initializing rgb color tables...");
+      fflush(stdout);
+    }
+    initRGBTables(&bsr_config, bsr_state);
+    if ((bsr_config.cgi_mode != 1) && (bsr_config.print_status == 1)) {
+      clock_gettime(CLOCK_REALTIME, &endtime);
+      elapsed_time=((double)(endtime.tv_sec - 1500000000) + ((double)endtime.tv_nsec / 1.0E9)) - ((double)(starttime.tv_sec - 1500000000) + ((double)starttime.tv_nsec) / 1.0E9);
+      printf(" (%.3fs)\n", elapsed_time);
+      fflush(stdout);
+    }
   }
 
   //
@@ -187,6 +291,11 @@ int main(int argc, char **argv) {
   //
   allocateMemory(&bsr_config, bsr_state);
 
+  //
+  // open composition files to save or load the image composition buffer, shared by all threads
+  //
+  openCompositionFiles(&bsr_config, bsr_state);
+
   //
   // fork worker threads
   //
@@ -209,6 +318,13 @@ int main(int argc, char **argv) {
     bsr_state->perthread->my_thread_id=0;
   }
 
+  //
+  // all threads: open performance counters if enabled
+  //
+  if (bsr_state->perf_stages != NULL) {
+    openPerfCounters(bsr_state);
+  }
+
 // 
 // begin thread specific processing.
 //
@@ -221,174 +337,355 @@ int main(int argc, char **argv) {
   }
 
   //
-  // all threads: initialize (clear) image composition buffer
-  //
-  initImageCompositionBuffer(&bsr_config, bsr_state);
-
-  //
-  // main thread: display begin rendering status if not in CGI mode
-  //
-  if ((bsr_state->perthread->my_pid == bsr_state->main_pid) && (bsr_config.cgi_mode != 1) && (bsr_config.print_status == 1)) {
-    clock_gettime(CLOCK_REALTIME, &starttime);
-    printf("Rendering stars to image composition buffer...");
-    fflush(stdout);
-  }
-
+  // all threads: render each frame. There is only one frame unless frame_list_file is set
   //
-  // worker threads:  wait for main thread to say go
-  // main thread: tell worker threads to go
-  //
-  if (bsr_state->perthread->my_pid != bsr_state->main_pid) {
-    waitForMainThread(bsr_state, THREAD_STATUS_PROCESS_STARS_BEGIN);
-  } else {
-    // main thread
-    for (i=1; i <= bsr_state->num_worker_threads; i++) {
-      bsr_state->status_array[i].status=THREAD_STATUS_PROCESS_STARS_BEGIN;
+  for (frame_index=0; frame_index < bsr_state->num_frames; frame_index++) {
+    if ((bsr_state->num_frames > 1) && (bsr_state->perthread->my_pid == bsr_state->main_pid) && (bsr_config.cgi_mode != 1) && (bsr_config.print_status == 1)) {
+      printf("Frame %d of %d\n", (frame_index + 1), bsr_state->num_frames);
+      fflush(stdout);
     }
-  } // end if not main thread
-
-  //
-  // worker threads: process stars from binary data files
-  //
-  if (bsr_state->perthread->my_pid != bsr_state->main_pid) {
-    //
-    // worker threads: set main thread buffer postion to the beginning of this threads block
-    //
-    bsr_state->perthread->thread_buf_p=bsr_state->thread_buf + ((bsr_state->perthread->my_thread_id - 1) * bsr_state->per_thread_buffers);
-    bsr_state->perthread->thread_buffer_index=0; // index within this threads block
 
     //
-    // worker threads: send each input file to rendering function
+    // all threads: render each tile. There is only one tile unless tiled rendering is used for images that
+    // would not otherwise fit in buffer_memory_limit
     //
-    if (bsr_config.external_db_enable == 1) {
-      processStars(&bsr_config, bsr_state, &bsr_state->input_file_external);
-    } // end if enable external
-    if (bsr_config.Gaia_db_enable == 1) {
-      processStars(&bsr_config, bsr_state, &bsr_state->input_file_pq100);
-      if (bsr_config.Gaia_min_parallax_quality < 100) {
-        processStars(&bsr_config, bsr_state, &bsr_state->input_file_pq050);
+    for (tile_index=0; tile_index < bsr_state->num_tiles; tile_index++) {
+      //
+      // main thread: select rows for this tile
+      //
+      if ((bsr_state->num_tiles > 1) && (bsr_state->perthread->my_pid == bsr_state->main_pid)) {
+        selectTile(&bsr_config, bsr_state, tile_index);
       }
-      if (bsr_config.Gaia_min_parallax_quality < 50) {
-        processStars(&bsr_config, bsr_state, &bsr_state->input_file_pq030);
-      }
-      if (bsr_config.Gaia_min_parallax_quality < 30) {
-        processStars(&bsr_config, bsr_state, &bsr_state->input_file_pq020);
-      }
-      if (bsr_config.Gaia_min_parallax_quality < 20) {
-        processStars(&bsr_config, bsr_state, &bsr_state->input_file_pq010);
-      }
-      if (bsr_config.Gaia_min_parallax_quality < 10) {
-        processStars(&bsr_config, bsr_state, &bsr_state->input_file_pq005);
-      }
-      if (bsr_config.Gaia_min_parallax_quality < 05) {
-        processStars(&bsr_config, bsr_state, &bsr_state->input_file_pq003);
-      }
-      if (bsr_config.Gaia_min_parallax_quality < 03) {
-        processStars(&bsr_config, bsr_state, &bsr_state->input_file_pq002);
-      }
-      if (bsr_config.Gaia_min_parallax_quality < 02) {
-        processStars(&bsr_config, bsr_state, &bsr_state->input_file_pq001);
-      }
-      if (bsr_config.Gaia_min_parallax_quality < 01) {
-        processStars(&bsr_config, bsr_state, &bsr_state->input_file_pq000);
+
+      //
+      // all threads: initialize (clear) image composition buffer
+      //
+      initImageCompositionBuffer(&bsr_config, bsr_state);
+
+      //
+      // main thread: display begin rendering status if not in CGI mode
+      //
+      if ((bsr_state->perthread->my_pid == bsr_state->main_pid) && (bsr_config.cgi_mode != 1) && (bsr_config.print_status == 1)) {
+        clock_gettime(CLOCK_REALTIME, &starttime);
+        if (bsr_state->num_cameras > 1) {
+          printf("Rendering stars to image composition buffers for %d cameras...", bsr_state->num_cameras);
+        } else {
+          printf("Rendering stars to image composition buffer...");
+        }
+        fflush(stdout);
       }
-    } // end if enable Gaia
 
-    //
-    // let main thread know we are done, then wait until main thread says ok to continue
-    //
-    bsr_state->status_array[bsr_state->perthread->my_thread_id].status=THREAD_STATUS_PROCESS_STARS_COMPLETE;
-    waitForMainThread(bsr_state, THREAD_STATUS_PROCESS_STARS_CONTINUE);
-  } else {
-    //
-    // main thread: scan main thread buffer for pixels to integrate into image until all worker threads are done
-    //
-    empty_passes=0;
-    while (empty_passes < 2) { // do second pass once empty
-      // check if any worker threads have died
-      checkExceptions(bsr_state);
-
-      // scan buffer for new pixel data
-      main_thread_buf_p=bsr_state->thread_buf;
-      buffer_is_empty=1;
-      for (main_thread_buffer_index=0; main_thread_buffer_index < bsr_state->thread_buffer_count; main_thread_buffer_index++) {
-        if ((main_thread_buf_p->status_left == 1) && (main_thread_buf_p->status_right == 1)) {
-          // buffer location has new pixel data, add to image composition buffer
-          if (buffer_is_empty == 1) {
-            buffer_is_empty=0; 
+      //
+      // all threads: render each pass. There is only one pass unless progressive CGI output is enabled, then each
+      // pass adds fainter stars to the image composition buffer and the image is output after each pass
+      //
+      for (pass_index=0; pass_index < bsr_state->num_passes; pass_index++) {
+        //
+        // worker threads:  wait for main thread to say go
+        // main thread: tell worker threads to go
+        //
+        if (bsr_state->perthread->my_pid != bsr_state->main_pid) {
+          waitForMainThread(bsr_state, THREAD_STATUS_PROCESS_STARS_BEGIN);
+        } else {
+          // main thread
+          for (i=1; i <= bsr_state->num_worker_threads; i++) {
+            bsr_state->status_array[i].status=THREAD_STATUS_PROCESS_STARS_BEGIN;
           }
-          image_composition_p=bsr_state->image_composition_buf + main_thread_buf_p->image_offset;
-          image_composition_p->r+=main_thread_buf_p->r;
-          image_composition_p->g+=main_thread_buf_p->g;
-          image_composition_p->b+=main_thread_buf_p->b;
-          // set this buffer location to free
-          main_thread_buf_p->status_left=0;
-          main_thread_buf_p->status_right=0;
-        }
-        main_thread_buf_p++;
-      } // end for thread_buffer_index
-      // if buffer is completely empty, check if all threads are done
-      if (buffer_is_empty == 1) {
-        all_workers_done=1;
-        for (i=1; i <= bsr_state->num_worker_threads; i++) {
-          if (bsr_state->status_array[i].status < THREAD_STATUS_PROCESS_STARS_COMPLETE) {
-            all_workers_done=0;
+        } // end if not main thread
+
+        //
+        // worker threads: process stars from binary data files
+        //
+        if (bsr_state->perthread->my_pid != bsr_state->main_pid) {
+          //
+          // worker threads: set main thread buffer postion to the beginning of this threads block
+          //
+          bsr_state->perthread->thread_buf_p=bsr_state->thread_buf + ((bsr_state->perthread->my_thread_id - 1) * bsr_state->per_thread_buffers);
+          bsr_state->perthread->thread_buffer_index=0; // index within this threads block
+
+          //
+          // worker threads: send each input file of this pass to rendering function
+          //
+          processPassFiles(&bsr_config, bsr_state, pass_index);
+
+          //
+          // store render statistics, let main thread know we are done, then wait until main thread says ok to continue
+          //
+          if (bsr_state->render_stats != NULL) {
+            bsr_state->render_stats[bsr_state->perthread->my_thread_id]=bsr_state->perthread->stats;
+          }
+          bsr_state->status_array[bsr_state->perthread->my_thread_id].status=THREAD_STATUS_PROCESS_STARS_COMPLETE;
+          waitForMainThread(bsr_state, THREAD_STATUS_PROCESS_STARS_CONTINUE);
+        } else {
+          //
+          // main thread: scan main thread buffer for pixels to integrate into image until all worker threads are done
+          //
+          trace_event=traceBegin(bsr_state, "Integrate pixels", NULL);
+          empty_passes=0;
+          composition_precision=bsr_state->composition_precision;
+          composition_prescale=bsr_state->composition_prescale;
+          while (empty_passes < 2) { // do second pass once empty
+            // check if any worker threads have died
+            checkExceptions(bsr_state);
+
+            // scan buffer for new pixel data
+            main_thread_buf_p=bsr_state->thread_buf;
+            buffer_is_empty=1;
+            bsr_state->perthread->stats.main_scan_passes++;
+            for (main_thread_buffer_index=0; main_thread_buffer_index < bsr_state->thread_buffer_count; main_thread_buffer_index++) {
+              if ((main_thread_buf_p->status_left == 1) && (main_thread_buf_p->status_right == 1)) {
+                // buffer location has new pixel data, add to image composition buffer
+                if (buffer_is_empty == 1) {
+                  buffer_is_empty=0; 
+                }
+                bsr_state->perthread->stats.main_pixels_integrated++;
+                addPixel(bsr_state->image_composition_buf, composition_precision, main_thread_buf_p->image_offset,\
+                  (main_thread_buf_p->r * composition_prescale), (main_thread_buf_p->g * composition_prescale), (main_thread_buf_p->b * composition_prescale));
+                // set this buffer location to free
+                main_thread_buf_p->status_left=0;
+                main_thread_buf_p->status_right=0;
+              }
+              main_thread_buf_p++;
+            } // end for thread_buffer_index
+            // if buffer is completely empty, check if all threads are done
+            if (buffer_is_empty == 1) {
+              bsr_state->perthread->stats.main_empty_scans++;
+              all_workers_done=1;
+              for (i=1; i <= bsr_state->num_worker_threads; i++) {
+                if (bsr_state->status_array[i].status < THREAD_STATUS_PROCESS_STARS_COMPLETE) {
+                  all_workers_done=0;
+                }
+              }
+              if (all_workers_done == 1) {
+                // if main thread buffer is empty and all worker threads are done, increment empty_passes
+                empty_passes++;
+              }
+            } 
+          } // end while not done
+          traceEnd(bsr_state, trace_event);
+          if (bsr_state->render_stats != NULL) {
+            bsr_state->render_stats[0]=bsr_state->perthread->stats;
           }
-        }
-        if (all_workers_done == 1) {
-          // if main thread buffer is empty and all worker threads are done, increment empty_passes
-          empty_passes++;
-        }
-      } 
-    } // end while not done
 
-    // main thread: tell worker threads it's ok to continue
-    for (i=1; i <= bsr_state->num_worker_threads; i++) {
-      bsr_state->status_array[i].status=THREAD_STATUS_PROCESS_STARS_CONTINUE;
-    }
+          // main thread: account integration to the process stars stage
+          if (bsr_state->perf_stages != NULL) {
+            samplePerfCounters(bsr_state, THREAD_STATUS_PROCESS_STARS_COMPLETE, 0);
+          }
 
-    // main thread: report rendering time if not in CGI mode
-    if ((bsr_config.cgi_mode != 1) && (bsr_config.print_status == 1)) {
-      clock_gettime(CLOCK_REALTIME, &endtime);
-      elapsed_time=((double)(endtime.tv_sec - 1500000000) + ((double)endtime.tv_nsec / 1.0E9)) - ((double)(starttime.tv_sec - 1500000000) + ((double)starttime.tv_nsec) / 1.0E9);
-      printf(" (%.3fs)\n", elapsed_time);
-      fflush(stdout);
-    }
-  } // end if main thread
+          // main thread: keep a copy of the image composition buffer for the next pass
+          if (pass_index < (bsr_state->num_passes - 1)) {
+            saveProgressiveImage(bsr_state);
+          }
 
-  //
-  // all threads: post processing
-  //
-  postProcess(&bsr_config, bsr_state);
+          // main thread: tell worker threads it's ok to continue
+          for (i=1; i <= bsr_state->num_worker_threads; i++) {
+            bsr_state->status_array[i].status=THREAD_STATUS_PROCESS_STARS_CONTINUE;
+          }
 
-  //
-  // all threads: convert image to byte sequence required by output image_format and store in image_output_buf.
-  // This is also where quantization happens for integer number formats
-  //
-  sequencePixels(&bsr_config, bsr_state);  
+          // main thread: report rendering time if not in CGI mode
+          if ((bsr_config.cgi_mode != 1) && (bsr_config.print_status == 1)) {
+            clock_gettime(CLOCK_REALTIME, &endtime);
+            elapsed_time=((double)(endtime.tv_sec - 1500000000) + ((double)endtime.tv_nsec / 1.0E9)) - ((double)(starttime.tv_sec - 1500000000) + ((double)starttime.tv_nsec) / 1.0E9);
+            printf(" (%.3fs)\n", elapsed_time);
+            fflush(stdout);
+          }
 
-  //
-  // all threads: output image file
-  //
-  if ((bsr_config.image_format == 0) && (bsr_state->perthread->my_pid == bsr_state->main_pid)) { // PNG encoder not yet multi-threadded
-    outputPNG(&bsr_config, bsr_state);
-  } else if (bsr_config.image_format == 1) {
-    outputEXR(&bsr_config, bsr_state);
-  } else if ((bsr_config.image_format == 2) && (bsr_state->perthread->my_pid == bsr_state->main_pid)) { // JPG encoder not yet multi-threadded (but still very fast)
-    outputJpeg(&bsr_config, bsr_state);
-  } else if ((bsr_config.image_format == 3) && (bsr_state->perthread->my_pid == bsr_state->main_pid)) { // libavif is already multi-thredded internally so we invoke from main thread
-    outputAvif(&bsr_config, bsr_state);
-  } else if ((bsr_config.image_format == 4) && (bsr_state->perthread->my_pid == bsr_state->main_pid)) {
-    outputHeif(&bsr_config, bsr_state);
-  }
+          // main thread: save the image composition buffer before it is post-processed in place
+          if ((bsr_state->composition_save_fd != -1) && (pass_index == (bsr_state->num_passes - 1))) {
+            saveComposition(&bsr_config, bsr_state);
+          }
+        } // end if main thread
+
+        //
+        // all threads: post process and output each image
+        //
+        for (image_index=0; image_index < bsr_state->num_images; image_index++) {
+          //
+          // all threads: select image for post processing and output
+          //
+          selectImage(&bsr_config, bsr_state, image_index);
+          if ((bsr_state->num_images > 1) && (bsr_state->perthread->my_pid == bsr_state->main_pid) && (bsr_config.cgi_mode != 1) && (bsr_config.print_status == 1)) {
+            printf("Image %d of %d, %dx%d\n", (image_index + 1), bsr_state->num_images, bsr_state->current_image_res_x, bsr_state->current_image_res_y);
+            fflush(stdout);
+          }
+
+          //
+          // all threads: convolve stars with the Airy disk if they were rendered as points
+          //
+          if (bsr_config.Airy_disk_mode == 1) {
+            convolveAiryDisks(&bsr_config, bsr_state);
+          }
+
+          //
+          // all threads: make each output image (format, size, exposure) from this image. There is only one output
+          // unless output_list_file is set
+          //
+          for (output_index=0; output_index < bsr_state->num_outputs; output_index++) {
+            //
+            // all threads: select output options
+            // main thread: keep a copy of the image for the next output, or restore it for this one
+            //
+            if (bsr_state->num_outputs > 1) {
+              selectOutput(&bsr_config, bsr_state, output_index, image_index);
+              if (bsr_state->perthread->my_pid == bsr_state->main_pid) {
+                if ((bsr_config.cgi_mode != 1) && (bsr_config.print_status == 1)) {
+                  printf("Output %d of %d, %s\n", (output_index + 1), bsr_state->num_outputs, bsr_config.output_file_name);
+                  fflush(stdout);
+                }
+                if (output_index == 0) {
+                  saveUnprocessedImage(bsr_state);
+                } else {
+                  restoreUnprocessedImage(bsr_state);
+                }
+              }
+            }
+
+            //
+            // all threads: post processing
+            //
+            postProcess(&bsr_config, bsr_state);
+
+            //
+            // all threads: convert image to byte sequence required by output image_format and output image file.
+            // This is also where quantization happens for integer number formats
+            //
+            if ((bsr_config.progressive == 1) && (bsr_state->perthread->my_pid == bsr_state->main_pid)) {
+              printCGIPartHeader(&bsr_config);
+            }
+            if (bsr_state->stream_output == 1) {
+              // worker threads sequence bands of rows that are streamed to the PNG or JPEG encoder by the main thread
+              streamImage(&bsr_config, bsr_state);
+            } else {
+              sequencePixels(&bsr_config, bsr_state);
+
+              //
+              // all threads: output image file
+              //
+              trace_event=traceBegin(bsr_state, "Image output", NULL);
+              if (bsr_state->num_tiles > 1) {
+                // tiled rendering streams each tile's rows to the encoder
+                if (bsr_state->perthread->my_pid == bsr_state->main_pid) {
+                  outputImageTile(&bsr_config, bsr_state);
+                }
+              } else if ((bsr_config.image_format != 1) && (bsr_config.image_writer_threads > 0) && ((bsr_state->num_frames > 1) || (bsr_state->num_images > 1) || (bsr_state->num_outputs > 1))) {
+                // single-threaded encoders write in background while the next frame, image or output is processed
+                if (bsr_state->perthread->my_pid == bsr_state->main_pid) {
+                  outputImageBackground(&bsr_config, bsr_state);
+                }
+              } else if ((bsr_config.image_format == 0) && (bsr_state->perthread->my_pid == bsr_state->main_pid)) { // PNG is only deflated by worker threads when streamed, see streamImage()
+                outputPNG(&bsr_config, bsr_state);
+              } else if (bsr_config.image_format == 1) {
+                outputEXR(&bsr_config, bsr_state);
+              } else if ((bsr_config.image_format == 2) && (bsr_state->perthread->my_pid == bsr_state->main_pid)) { // JPG encoder not yet multi-threadded (but still very fast)
+                outputJpeg(&bsr_config, bsr_state);
+              } else if ((bsr_config.image_format == 3) && (bsr_state->perthread->my_pid == bsr_state->main_pid)) { // libavif is already multi-thredded internally so we invoke from main thread
+                outputAvif(&bsr_config, bsr_state);
+              } else if ((bsr_config.image_format == 4) && (bsr_state->perthread->my_pid == bsr_state->main_pid)) {
+                outputHeif(&bsr_config, bsr_state);
+              }
+              traceEnd(bsr_state, trace_event);
+            } // end if stream_output
+            if ((bsr_config.progressive == 1) && (bsr_state->perthread->my_pid == bsr_state->main_pid)) {
+              printCGIPartEnd(&bsr_config, ((pass_index == (bsr_state->num_passes - 1)) ? 1 : 0));
+            }
+
+            //
+            // all threads: if there are more outputs, wait until this output is complete and rewind thread status
+            //
+            if (output_index < (bsr_state->num_outputs - 1)) {
+              rewindThreadStatus(bsr_state, THREAD_STATUS_PROCESS_STARS_CONTINUE);
+            }
+          } // end for output_index
+
+          //
+          // all threads: if there are more images, wait until this image is complete and rewind thread status
+          //
+          if (image_index < (bsr_state->num_images - 1)) {
+            rewindThreadStatus(bsr_state, THREAD_STATUS_PROCESS_STARS_CONTINUE);
+          }
+        } // end for image_index
+
+        //
+        // all threads: if there are more passes, wait until this pass is complete and rewind thread status
+        // main thread: restore the image composition buffer from before post processing
+        //
+        if (pass_index < (bsr_state->num_passes - 1)) {
+          rewindThreadStatus(bsr_state, THREAD_STATUS_INIT_IMAGECOMP_CONTINUE);
+          if (bsr_state->perthread->my_pid == bsr_state->main_pid) {
+            restoreProgressiveImage(bsr_state);
+          }
+        }
+      } // end for pass_index
+
+      //
+      // all threads: if there are more tiles, wait until this tile is complete and rewind thread status
+      //
+      if (tile_index < (bsr_state->num_tiles - 1)) {
+        rewindThreadStatus(bsr_state, THREAD_STATUS_AIRY_MAP_CONTINUE);
+      }
+    } // end for tile_index
+
+    //
+    // all threads: if there are more frames, wait until this frame is complete, rewind thread status and
+    // main thread: set up cameras for the next frame
+    //
+    if (frame_index < (bsr_state->num_frames - 1)) {
+      rewindThreadStatus(bsr_state, THREAD_STATUS_AIRY_MAP_CONTINUE);
+      if (bsr_state->perthread->my_pid == bsr_state->main_pid) {
+        selectFrame(&bsr_config, bsr_state, (frame_index + 1));
+      }
+    }
+  } // end for frame_index
 
   //
   // main thread: cleanup
   //
   if (bsr_state->perthread->my_pid == bsr_state->main_pid) {
-    // main thread: clean up memory allocations
+    // main thread: wait for background image writers to finish
+    if (bsr_state->perthread->num_image_writers > 0) {
+      if ((bsr_config.cgi_mode != 1) && (bsr_config.print_status == 1)) {
+        clock_gettime(CLOCK_REALTIME, &starttime);
+        printf("Waiting for background image writers...");
+        fflush(stdout);
+      }
+      waitForImageWriters(&bsr_config, bsr_state, 0);
+      if ((bsr_config.cgi_mode != 1) && (bsr_config.print_status == 1)) {
+        clock_gettime(CLOCK_REALTIME, &endtime);
+        elapsed_time=((double)(endtime.tv_sec - 1500000000) + ((double)endtime.tv_nsec / 1.0E9)) - ((double)(starttime.tv_sec - 1500000000) + ((double)starttime.tv_nsec) / 1.0E9);
+        printf(" (%.3fs)\n", elapsed_time);
+        fflush(stdout);
+      }
+    }
+
+    // main thread: move completed image into the cache
+    if (bsr_cache.cache_file != NULL) {
+      endImageCache(&bsr_config, &bsr_cache);
+    }
+
+    // main thread: output performance counters
+    if (bsr_state->perf_stages != NULL) {
+      printPerfCounters(&bsr_config, bsr_state);
+    }
+
+    // main thread: write render statistics
+    if (bsr_state->render_stats != NULL) {
+      writeRenderStats(&bsr_config, bsr_state);
+    }
+
+    // main thread: write timeline trace
+    if (bsr_state->trace_buffers != NULL) {
+      writeTraceFile(&bsr_config, bsr_state);
+    }
+
+    // main thread: close composition files and clean up memory allocations
+    closeCompositionFiles(bsr_state);
     freeMemory(bsr_state);
 
+    // main thread: let queued requests be admitted
+    if (bsr_admission.table != NULL) {
+      releaseAdmission(&bsr_admission);
+    }
+
     // main thread: output total runtime
     if ((bsr_config.cgi_mode != 1) && (bsr_config.print_status == 1)) {
       clock_gettime(CLOCK_REALTIME, &overall_endtime);
@@ -49,9 +49,6 @@
 #define BSR_USE_EXR
 #define BSR_USE_AVIF
 #define BSR_USE_HEIF
-#define BSR_32BIT_BUFFERS // use 32-bit floats in image composition, blur, and resize buffers. This reduces the size of these buffers by half which may
-                          // be useful for extremely large image resolutions at the expense of summation precision within these buffers. This does not
-                          // change the main thread, or dedup buffers which are relatively small and always double precision.
 
 
 //
@@ -93,13 +90,42 @@
 #define BSR_MAGIC_NUMBER_LE "BSRENDER_LE" // file identifier for little-endian files, included in file header size
 #define BSR_MAGIC_NUMBER_BE "BSRENDER_BE" // file identifier for big-endian files, included in file header size
 #define BSR_STAR_RECORD_SIZE 33  // bytes
-#define BSR_BLUR_RESCALE 16777216.0 // pixel values are divided by this number before Gaussian blur to help keep values between [0..1]
+#define BSR_BLUR_RESCALE 16777216.0 // pixel values are limited to [0..BSR_BLUR_RESCALE] before Gaussian blur
+#define BSR_BLUR_RECURSIVE_MIN_RADIUS 4.0 // Gaussian_blur_mode=0 uses the recursive Gaussian blur at and above this radius
+#define BSR_BLUR_YGVV_POLE_MAG 1.7387124472 // |1.41650 + 1.00829i|, complex base pole for sigma=2 (Young, Gerbrands and van Vliet 2002)
+#define BSR_BLUR_YGVV_POLE_ARG 0.6186134587 // arg(1.41650 + 1.00829i) in radians
+#define BSR_BLUR_YGVV_POLE_REAL 1.86543 // real base pole for sigma=2
+#define BSR_BLUR_STRIP_WIDTH 16 // columns per strip in the vertical pass of the Gaussian blur
+#define BSR_FFT_STRIP_WIDTH 16 // columns per strip in the column pass of 2D FFTs
+#define BSR_AIRY_FFT_MIN_SIZE 1024 // Airy_disk_mode=1 uses FFT blocks of at least this size, unless the image is smaller
+#define BSR_ROW_BLOCKS_PER_THREAD 8 // image stages hand out rows to threads in blocks of about rows / (threads * this)
+#define BSR_ENCODE_TABLE_EXPONENTS 32 // transfer function encode table buckets cover pixel values [2^-32..1]
 #define BSR_RESIZE_LOG_OFFSET 1.0E-6 // pixel values are converted to log(BSR_LOG_OFFSET + pixel value) before Lanczos scaline to minimize clipping artifacts
+#define BSR_MAX_CAMERAS 32 // maximum number of cameras that can be rendered in a single pass through the star data files
+#define BSR_MAX_OUTPUTS 16 // maximum number of output images (format, size, exposure) made from each rendered image
+#define BSR_MAX_IMAGE_WRITERS 16 // maximum number of background image writer processes when rendering multiple frames or images
+#define BSR_MAX_STREAM_BANDS 64 // maximum number of bands in the streaming output ring
+#define BSR_MAX_ADMISSION_SLOTS 256 // maximum number of CGI requests rendering or queued under admission control
+#define BSR_DAEMON_MAX_REQUESTS 64 // maximum number of daemon request processes, more connections wait in the listen queue
+#define BSR_DAEMON_REQUEST_TIMEOUT 5 // seconds a daemon request process waits for the complete request
+#define BSR_NUM_INPUT_FILES 11 // external and 10 Gaia parallax quality files, in rendering order
+#define BSR_MAX_PASSES 3 // maximum number of progressive rendering passes
+#define BSR_COMPOSITION_MAGIC "BSRCOMP" // composition file identifier, included in file header size
+#define BSR_COMPOSITION_BYTE_ORDER 0x01020304 // composition files can only be loaded with the byte order they were saved with
+#define BSR_MULTIPART_BOUNDARY "bsrender-image" // separates images of a progressive CGI response
+#define BSR_MAX_SKY_TILE_ZOOM 16 // maximum sky tile zoom level, keeps virtual raster coordinates within int range
+#define BSR_MAX_SKY_TILE_SIZE 4096 // maximum sky tile width and height in pixels
+#define BSR_PERF_EVENTS 6 // performance counter events per thread: task clock, cycles, instructions, LLC, dTLB and branch misses
+#define BSR_PERF_STAGES 10 // performance counter stages, one for each group of ten THREAD_STATUS values
+#define BSR_TRACE_MAX_EVENTS 16384 // maximum timeline trace events per thread, later events are counted as dropped
+#define BSR_TRACE_NAME_SIZE 32 // trace event name, including terminating null
+#define BSR_TRACE_DETAIL_SIZE 32 // optional trace event detail such as input file, including terminating null
 
 #define _GNU_SOURCE // needed for strcasestr in string.h
 #include <stdint.h> // needed for uint64_t
 #include <unistd.h>
 #include <sys/stat.h>
+#include <stdio.h> // needed for FILE
 
 //
 // For most things we detect endianness runtime with littleEndianTest(). For certain expensive
@@ -142,18 +168,19 @@ typedef enum {
   THREAD_STATUS_PROCESS_STARS_BEGIN               = 30,
   THREAD_STATUS_PROCESS_STARS_COMPLETE            = 31,
   THREAD_STATUS_PROCESS_STARS_CONTINUE            = 32,
+  THREAD_STATUS_AIRY_CONVOLVE_BEGIN               = 35,
+  THREAD_STATUS_AIRY_CONVOLVE_COMPLETE            = 36,
+  THREAD_STATUS_AIRY_COPY_BEGIN                   = 37,
+  THREAD_STATUS_AIRY_COPY_COMPLETE                = 38,
+  THREAD_STATUS_AIRY_CONVOLVE_CONTINUE            = 39,
   THREAD_STATUS_POST_PROCESS_BEGIN                = 40,
   THREAD_STATUS_POST_PROCESS_COMPLETE             = 41,
   THREAD_STATUS_POST_PROCESS_CONTINUE             = 42,
-  THREAD_STATUS_GAUSSIAN_BLUR_PREP_BEGIN          = 50,
-  THREAD_STATUS_GAUSSIAN_BLUR_PREP_COMPLETE       = 51,
   THREAD_STATUS_GAUSSIAN_BLUR_HORIZONTAL_BEGIN    = 52,
   THREAD_STATUS_GAUSSIAN_BLUR_HORIZONTAL_COMPLETE = 53,
   THREAD_STATUS_GAUSSIAN_BLUR_VERTICAL_BEGIN      = 54,
   THREAD_STATUS_GAUSSIAN_BLUR_VERTICAL_COMPLETE   = 55,
   THREAD_STATUS_GAUSSIAN_BLUR_CONTINUE            = 56,
-  THREAD_STATUS_LANCZOS_PREP_BEGIN                = 60,
-  THREAD_STATUS_LANCZOS_PREP_COMPLETE             = 61,
   THREAD_STATUS_LANCZOS_RESAMPLE_BEGIN            = 62,
   THREAD_STATUS_LANCZOS_RESAMPLE_COMPLETE         = 63,
   THREAD_STATUS_LANCZOS_POINTERS_BEGIN            = 64,
@@ -167,8 +194,65 @@ typedef enum {
   THREAD_STATUS_IMAGE_OUTPUT_BEGIN                = 82,
   THREAD_STATUS_IMAGE_OUTPUT_COMPLETE             = 83,
   THREAD_STATUS_IMAGE_OUTPUT_CONTINUE             = 84,
+  THREAD_STATUS_REWIND_READY                      = 90, // used by rewindThreadStatus() to reuse the above checkpoints for another image
 } bsr_thread_status_t;
 
+typedef struct {
+  //
+  // performance counter totals for one thread and stage, globally mmapped so the main thread can aggregate them
+  //
+  uint64_t work_count[BSR_PERF_EVENTS]; // counted while processing the stage
+  uint64_t wait_count[BSR_PERF_EVENTS]; // counted while waiting for other threads at the stage's checkpoints
+} bsr_perf_stage_t;
+
+typedef struct {
+  char name[BSR_TRACE_NAME_SIZE];
+  char detail[BSR_TRACE_DETAIL_SIZE]; // empty if none
+  uint64_t begin_ns;                  // CLOCK_MONOTONIC
+  uint64_t end_ns;                    // 0 until the event is ended
+} bsr_trace_event_t;
+
+typedef struct {
+  //
+  // timeline trace events for one thread, globally mmapped. Each thread only writes its own buffer so no locking
+  // is needed, the main thread reads all buffers after rendering
+  //
+  int num_events;
+  int dropped_events;
+  bsr_trace_event_t events[BSR_TRACE_MAX_EVENTS];
+} bsr_trace_buffer_t;
+
+typedef struct {
+  //
+  // render statistics for one input file, see render-stats.c
+  //
+  uint64_t stars_read;
+  uint64_t view_cone_rejects;   // sky tiles only, counted per camera like the filters below
+  uint64_t distance_rejects;
+  uint64_t intensity_rejects;
+  uint64_t color_rejects;
+  uint64_t off_raster_rejects;
+  uint64_t stars_rendered;
+  uint64_t pixel_contributions; // pixels sent to the dedup buffer, including Airy disk and anti-aliasing pixels
+} bsr_file_stats_t;
+
+typedef struct {
+  //
+  // render statistics for one thread. Each thread counts in its private copy, the copy is stored in the globally
+  // mmapped render_stats array at the process stars checkpoint
+  //
+  bsr_file_stats_t file[BSR_NUM_INPUT_FILES];
+  uint64_t dedup_inserts;       // new dedup buffer records
+  uint64_t dedup_merges;        // pixels added to an existing dedup buffer record
+  uint64_t dedup_collisions;    // dedup index collisions sent directly to the main thread
+  uint64_t dedup_flushes;       // dedup buffer sent to the main thread
+  uint64_t pixels_sent;         // pixels sent to the main thread buffer
+  uint64_t send_stalls;         // sendPixelToMainThread() iterations waiting for a free main thread buffer slot
+  uint64_t main_scan_passes;    // main thread buffer scans, main thread only
+  uint64_t main_empty_scans;    // main thread buffer scans that found no pixels, main thread only
+  uint64_t main_pixels_integrated; // main thread only
+} bsr_render_stats_t;
+
 typedef struct {
   float redX;
   float redY;
@@ -187,9 +271,30 @@ typedef struct {
   double k;
 } quaternion_t;
 
+typedef struct {
+  //
+  // Young, Gerbrands and van Vliet recursive Gaussian filter coefficients and Triggs-Sdika boundary matrix
+  //
+  double B;
+  double a1;
+  double a2;
+  double a3;
+  double M[9];
+} recursive_Gaussian_t;
+
+typedef struct {
+  //
+  // radix-2 complex FFT of n points: twiddle factors exp(-2*pi*i*k/n) for k < n/2 and bit reversal permutation
+  //
+  int n;
+  double *twiddle;
+  int *bit_reverse;
+} fft_plan_t;
+
 typedef struct {
   pid_t pid;
   int status;
+  int cancel; // set by main thread when the render is canceled, worker threads exit when they see it
 } bsr_status_t;
 
 typedef struct {
@@ -212,17 +317,140 @@ typedef struct {
   dedup_buffer_t *dedup_record_p;
 } dedup_index_t;
 
+//
+// image composition, blur, and resize buffers can each use 16, 32, or 64-bit floating-point pixels, selected at runtime.
+// These are only accessed through the loadPixel()/storePixel()/addPixel() kernels in pixel-buffer.h
+//
+typedef struct {
+  uint16_t r; // IEEE 754 half precision
+  uint16_t g;
+  uint16_t b;
+} pixel_composition_fp16_t;
+
 typedef struct {
-#ifdef BSR_32BIT_BUFFERS
   float r;
   float g;
   float b;
-#else
+} pixel_composition_fp32_t;
+
+typedef struct {
   double r;
   double g;
   double b;
-#endif
-} pixel_composition_t;
+} pixel_composition_fp64_t;
+
+typedef struct {
+  //
+  // camera geometry for one rendered image. Stored in bsr_state so these are globally mmapped.
+  // processStars() transforms each star once per camera so multiple images can be rendered with
+  // a single pass through the star data files
+  //
+  double camera_icrs_x;
+  double camera_icrs_y;
+  double camera_icrs_z;
+  double target_icrs_x;
+  double target_icrs_y;
+  double target_icrs_z;
+  double camera_fov;
+  int camera_res_x;
+  int camera_res_y;
+  int camera_projection;
+  int spherical_orientation;
+  double camera_hfov;
+  double camera_half_res_x;
+  double camera_half_res_y;
+  double pixels_per_radian;
+  double rectilinear_focal_length; // in pixels
+  quaternion_t target_rotation;
+  uint64_t image_offset; // offset of this camera's first pixel within image_composition_buf
+  int image_stride;      // pixels per row of the output image this camera renders into. This is larger than camera_res_x
+                         // when several cameras are packed into one output image (cube map, stereo)
+  int tile_y_min;        // first raster row held in image_composition_buf, 0 unless tiled rendering
+  int tile_y_max;        // last raster row + 1 held in image_composition_buf, camera_res_y unless tiled rendering
+  int star_y_min;        // stars are rendered if their center row is within [star_y_min..star_y_max). This is the full raster
+  int star_y_max;        // unless tiled rendering, where stars too far from the current tile to reach it are skipped
+  int star_x_min;        // stars are rendered if their center column is within [star_x_min..star_x_max). This is the full
+  int star_x_max;        // raster unless rendering a sky tile, where stars just outside the tile may reach it
+  int view_cone_enable;  // sky tiles: skip stars outside a cone around the tile before rotating and projecting them
+  double view_cone_x;    // cone axis (unit vector) in icrs coordinates relative to the camera
+  double view_cone_y;
+  double view_cone_z;
+  double view_cone_cos2; // square of cosine of the cone half-angle, which is less than 90 degrees
+} bsr_camera_t;
+
+typedef struct {
+  //
+  // output image within image_composition_buf. Each output image contains one or more cameras
+  //
+  uint64_t image_offset;
+  int res_x;
+  int res_y;
+  char output_file_name[256];
+} bsr_image_t;
+
+typedef struct {
+  //
+  // camera geometry at one keyframe of a frame list (animation batch mode). Values are linearly interpolated
+  // over 'frames' frames from the previous keyframe
+  //
+  int frames;
+  double camera_icrs_x;
+  double camera_icrs_y;
+  double camera_icrs_z;
+  double camera_icrs_ra;
+  double camera_icrs_dec;
+  double camera_icrs_r;
+  double target_icrs_x;
+  double target_icrs_y;
+  double target_icrs_z;
+  double target_icrs_ra;
+  double target_icrs_dec;
+  double target_icrs_r;
+  double camera_rotation;
+  double camera_pan;
+  double camera_tilt;
+  double camera_fov;
+  int camera_projection;
+  int spherical_orientation;
+} bsr_keyframe_t;
+
+//
+// composition files (save_composition/load_composition) have this header, then a resolution record for each camera,
+// then the rows of each camera's image composition buffer as linear 32-bit float rgb pixels
+//
+typedef struct {
+  char magic[8];
+  uint32_t byte_order;
+  int32_t num_cameras;
+  int32_t Airy_disk_mode;        // 1 if stars were saved as points to be convolved with the Airy disk
+  int32_t reserved;
+} bsr_composition_header_t;
+
+typedef struct {
+  int32_t res_x;
+  int32_t res_y;
+} bsr_composition_camera_t;
+
+typedef struct {
+  char output_file_name[256];
+  int output_format;
+  int image_format;
+  int image_number_format;
+  int bits_per_color;
+  int color_profile;
+  int pre_limit_intensity;
+  double output_scaling_factor;
+  double camera_pixel_limit_mag;
+  int camera_pixel_limit_mode;
+  double camera_gamma;
+} bsr_output_t;
+
+typedef struct {
+  double *thresholds;            // smallest pixel value for each integer code, plus a sentinel
+  uint16_t *buckets;             // first code of each pixel value bucket
+  int max_code;
+  int bucket_bits;               // mantissa bits used for the bucket index
+} bsr_encode_table_t;
 
 typedef struct {
   //
@@ -233,6 +461,15 @@ typedef struct {
   int my_thread_id;
   pid_t my_pid;
   int dedup_count;
+  pid_t image_writer_pid[BSR_MAX_IMAGE_WRITERS]; // background image writer processes, main thread only
+  int num_image_writers;
+  void *image_stream; // streaming image encoder state for tiled rendering, main thread only
+  time_t last_connection_check; // last check of the httpd parent's tcp connection, main thread only
+  int perf_fd[BSR_PERF_EVENTS];    // performance counter file descriptors, -1 if not available
+  uint64_t perf_last[BSR_PERF_EVENTS]; // counter values at the last checkpoint
+  bsr_render_stats_t stats;      // render statistics, only used if stats_json is set
+  int stats_file_index;          // input file index being processed, see progressive.c
+  bsr_encode_table_t encode_table; // transfer function encode table, see sequence-pixels.c
 } bsr_thread_state_t;
 
 typedef struct {
@@ -249,16 +486,20 @@ typedef struct {
   // depending on if they are initialized and/or updated by multiple threads
   //
   thread_buffer_t *thread_buf;                // updated by all threads, globally mmaped
-  pixel_composition_t *image_composition_buf; // updated by all threads, globally mmaped
+  void *image_composition_buf;                // updated by all threads, globally mmaped
   unsigned char *image_output_buf;            // updated by all threads, globally mmaped
   unsigned char **row_pointers;               // updated by all threads, globally mmaped
   int *compressed_sizes;                      // updated by all threads, globally mmaped
-  pixel_composition_t *image_blur_buf;        // updated by all threads, globally mmaped
-  pixel_composition_t *image_resize_buf;      // updated by all threads, globally mmaped
+  unsigned char *stream_deflate_buf;          // updated by all threads, globally mmaped
+  void *image_blur_buf;                       // updated by all threads, globally mmaped
+  void *image_resize_buf;                     // updated by all threads, globally mmaped
+  void *image_progressive_buf;                // copy of image composition buffer between progressive passes, main thread only
+  void *image_unprocessed_buf;                // copy of the current image before post processing for each output, main thread only
   dedup_buffer_t *dedup_buf;        // thread-specific buffer, malloc'ed so each thread get's it's own local buffer when fork()'ed
   dedup_index_t *dedup_index;       // thread-specific buffer, malloc'ed so each thread get's it's own local buffer when fork()'ed
   unsigned char *compression_buf1;  // thread-specific buffer, malloc'ed so each thread get's it's own local buffer when fork()'ed
   unsigned char *compression_buf2;  // thread-specific buffer, malloc'ed so each thread get's it's own local buffer when fork()'ed
+  unsigned char *png_filter_buf;    // thread-specific buffer, malloc'ed so each thread get's it's own local buffer when fork()'ed
   input_file_t input_file_external;
   input_file_t input_file_pq100;
   input_file_t input_file_pq050;
@@ -273,23 +514,64 @@ typedef struct {
   int dedup_index_mode;
   int resize_res_x;
   int resize_res_y;
-  pixel_composition_t *current_image_buf; // just a pointer to one of the real image buffers which are all globally mmapped
+  void *current_image_buf; // just a pointer to one of the real image buffers which are all globally mmapped
+  int current_image_precision;
+  int composition_precision; // bits per color of image composition, blur, and resize buffers: 16, 32, or 64
+  int blur_precision;
+  int resize_precision;
+  double composition_prescale; // multiplied with pixels added to image composition buffer to keep 16-bit values in range
   int current_image_res_x;
   int current_image_res_y;
+  int current_image_y_offset;   // image row at the top of current_image_buf, non-zero only with tiled rendering
+  int current_image_full_res_y; // full height of the current image, larger than current_image_res_y only with tiled rendering
+  int resize_y_offset;          // same as above for image_resize_buf
+  int resize_full_res_y;
+  int num_tiles;                // number of horizontal tiles each image is rendered in, 1 unless tiled rendering
+  int tile_index;
+  int tile_output_rows;         // output image rows per tile
+  int tile_output_y;            // first output image row of the current tile
+  int tile_output_res_y;        // output image rows in the current tile
+  int stream_output;            // 1 if output rows are streamed to the encoder through a ring of bands
+  int stream_band_rows;         // output rows per band
+  int stream_ring_bands;        // number of bands in the ring (image_output_buf)
+  int stream_bands_encoded;     // bands of the current image encoded so far, updated by main thread
+  int stream_band_status[BSR_MAX_STREAM_BANDS]; // band number + 1 held by each ring slot once sequenced, updated by worker threads
+  int stream_deflate;           // 1 if worker threads filter and deflate each PNG band, see deflatePNGRows()
+  size_t stream_deflate_slot_size;                    // bytes of stream_deflate_buf per ring slot
+  size_t stream_deflate_sizes[BSR_MAX_STREAM_BANDS];  // deflated bytes held by each ring slot, updated by worker threads
+  size_t stream_deflate_lengths[BSR_MAX_STREAM_BANDS]; // filtered (uncompressed) bytes of each ring slot's band
+  uint32_t stream_deflate_adler[BSR_MAX_STREAM_BANDS]; // Adler-32 of each ring slot's filtered band
+  int row_block_next;           // next row of the current image stage handed out by nextRowBlock(), advanced atomically
+  int row_block_num_rows;       // rows of the current image stage, set by initRowBlocks()
+  int row_block_rows;           // rows per block
+  int composition_load_fd;      // load_composition file, shared by all threads, -1 if not set
+  int composition_save_fd;      // save_composition file, main thread only, -1 if not set
+  int num_passes;               // progressive rendering passes, 1 unless progressive CGI output
+  int pass_first_file[BSR_MAX_PASSES + 1]; // first input file of each pass, pass_first_file[num_passes] is the end
   int num_worker_threads;
   pid_t main_pid;
   pid_t main_pgid;
   pid_t httpd_pid;
+  int client_fd;                // CGI output checked for client disconnects by the main thread, -1 if not CGI
+  int check_httpd_connection;   // 1 to also check if the httpd parent's tcp connection is in CLOSE_WAIT
+  char httpd_remote_tcp[48];    // this request's REMOTE_ADDR:REMOTE_PORT as shown in /proc/net/tcp, empty if not IPv4
+  char httpd_remote_tcp6[48];   // same as above for /proc/net/tcp6, IPv4 clients are shown as IPv4-mapped addresses
   bsr_thread_state_t *perthread; // thread-specific variables, not globally mmapped
   int per_thread_buffers;
   int thread_buffer_count;
   bsr_status_t *status_array;    // updated by all threads, globally mmaped
+  bsr_perf_stage_t *perf_stages; // performance counters per thread and stage, globally mmaped, NULL unless perf_counters
+  bsr_trace_buffer_t *trace_buffers; // timeline trace events per thread, globally mmaped, NULL unless trace is set
+  uint64_t trace_start_ns;       // CLOCK_MONOTONIC time of trace timestamp 0
+  bsr_render_stats_t *render_stats; // render statistics per thread, globally mmaped, NULL unless stats_json is set
   double rgb_red[32768];
   double rgb_green[32768];
   double rgb_blue[32768];
   double *Airymap_red;           // multi-thread initialization, globally mmapped
   double *Airymap_green;         // multi-thread initialization, globally mmapped
   double *Airymap_blue;          // multi-thread initialization, globally mmapped
+  double *Airy_spectra;          // Airy disk transfer functions for Airy_disk_mode=1, main thread initialization, globally mmapped
+  int Airy_fft_size;             // FFT block size for Airy_disk_mode=1
   double camera_hfov;
   double camera_half_res_x;
   double camera_half_res_y;
@@ -301,19 +583,37 @@ typedef struct {
   double linear_star_intensity_max;
   double anti_alias_per_pixel;
   quaternion_t target_rotation;
+  int num_cameras;
+  bsr_camera_t camera[BSR_MAX_CAMERAS];
+  int num_images;
+  bsr_image_t image[BSR_MAX_CAMERAS];
+  int num_outputs;                    // output images made from each rendered image, 1 unless output_list_file is set
+  bsr_output_t output[BSR_MAX_OUTPUTS];
+  int num_frames;
+  int num_keyframes;
+  bsr_keyframe_t *keyframes;          // read-only after loadFrameList(), malloc'ed before fork()
+  char frame_output_file_name[256];   // base output file name for frames
   int little_endian;
   size_t composition_buffer_size;
   size_t output_buffer_size;
   size_t row_pointers_size;
   size_t compressed_sizes_size;
+  size_t stream_deflate_buf_size;
   size_t blur_buffer_size;
   size_t resize_buffer_size;
+  size_t progressive_buffer_size;
+  size_t unprocessed_buffer_size;
   size_t thread_buffer_size;
   size_t status_array_size;
+  size_t perf_stages_size;
+  size_t trace_buffers_size;
+  size_t render_stats_size;
   size_t dedup_buffer_size;
   size_t dedup_index_size;
   size_t compression_buf_size;
+  size_t png_filter_buf_size;
   size_t Airymap_size;
+  size_t Airy_spectra_size;
   size_t bsr_state_size;
 } bsr_state_t;
 
@@ -332,7 +632,28 @@ typedef struct {
   char config_file_name[256];
   char data_file_directory[256];
   char output_file_name[256];
+  char camera_list_file_name[256];
+  char frame_list_file_name[256];
+  char output_list_file_name[256];
+  char daemon_socket[256];
+  char cache_directory[256];
+  int cache_size_limit;
+  char admission_file[256];
+  int image_writer_threads;
+  int composition_precision;
+  int blur_precision;
+  int resize_precision;
+  int buffer_memory_limit;
+  int tile_height;
+  int output_band_rows;
+  int png_parallel_deflate;
+  int progressive;
   int print_status;
+  int perf_counters;
+  char trace_file_name[256];
+  char stats_json_file_name[256];
+  char save_composition_file_name[256];
+  char load_composition_file_name[256];
   int num_threads;
   int per_thread_buffer;
   int per_thread_buffer_Airy;
@@ -345,6 +666,14 @@ typedef struct {
   int cgi_max_Airy_disk_max_extent;
   int cgi_max_Airy_disk_min_extent;
   int cgi_allow_anti_alias;
+  int cgi_cache_max_age;
+  double cgi_max_request_cost;
+  int cgi_max_request_memory;
+  double cgi_max_active_cost;
+  int cgi_max_active_memory;
+  int cgi_degrade_requests;
+  int cgi_max_queued;
+  int cgi_queue_timeout;
   int Gaia_db_enable;
   int Gaia_min_parallax_quality;
   int external_db_enable;
@@ -370,6 +699,13 @@ typedef struct {
   int camera_projection;
   int spherical_orientation;
   int Mollewide_iterations;
+  int vr_mode;
+  int vr_packed_output;
+  double stereo_separation;
+  int sky_tile_zoom;
+  int sky_tile_x;
+  int sky_tile_y;
+  int sky_tile_size;
   double red_filter_long_limit;
   double red_filter_short_limit;
   double green_filter_long_limit;
@@ -381,6 +717,7 @@ typedef struct {
   int Airy_disk_max_extent;
   int Airy_disk_min_extent;
   double Airy_disk_obstruction;
+  int Airy_disk_mode;
   int anti_alias_enable;
   double anti_alias_radius;
   int skyglow_enable;
@@ -388,6 +725,7 @@ typedef struct {
   double skyglow_per_pixel_mag;
   int pre_limit_intensity;
   double Gaussian_blur_radius;
+  int Gaussian_blur_mode;
   double output_scaling_factor;
   int Lanczos_order;
   int draw_crosshairs;
@@ -417,4 +755,41 @@ typedef struct {
   double camera_tilt;
 } bsr_config_t;
 
+typedef struct {
+  bsr_config_t config;  // daemon configuration from config file and command line, validated
+  bsr_state_t *state;   // data file mappings and rgb tables kept resident by the daemon, NULL if not in daemon mode
+  char request[2048];   // query string of the current request, used as QUERY_STRING in request processes
+} bsr_daemon_t;
+
+typedef struct {
+  char key[33];                // hex digest of the canonical configuration and data files
+  char file_name[512];         // cached image file
+  char temp_file_name[512];    // written while rendering, renamed to file_name when complete
+  FILE *cache_file;            // NULL if not storing the current image
+  FILE *client_stream;         // original stdout, written through the tee stream that replaces stdout
+  int write_failed;
+} bsr_cache_t;
+
+typedef struct {
+  pid_t pid;                   // main process of the request, 0 if the slot is free
+  int state;                   // 1 = queued, 2 = rendering
+  uint64_t ticket;             // arrival order, queued requests are admitted first come first served
+  double cost;                 // estimated CPU-seconds
+  double memory;               // estimated peak memory in MB
+} bsr_admission_slot_t;
+
+typedef struct {
+  uint64_t next_ticket;
+  bsr_admission_slot_t slot[BSR_MAX_ADMISSION_SLOTS];
+} bsr_admission_table_t;
+
+typedef struct {
+  int fd;                            // admission_file, locked with flock() while the table is updated
+  bsr_admission_table_t *table;      // mmapped from admission_file, NULL if this request does not hold a slot
+  int slot;
+  int degraded;                      // 1 if resolution or parallax quality was reduced to fit the request budget
+  double cost;
+  double memory;
+} bsr_admission_t;
+
 #endif // BSRENDER_H
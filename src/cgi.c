@@ -42,8 +42,24 @@
 #include <string.h>
 #include "bsr-config.h"
 
+const char *imageContentType(bsr_config_t *bsr_config) {
+  if (bsr_config->image_format == 1) {
+    return("image/x-exr");
+  } else if (bsr_config->image_format == 2) {
+    return("image/jpeg");
+  } else if (bsr_config->image_format == 3) {
+    return("image/avif");
+  } else if (bsr_config->image_format == 4) {
+    return("image/heif");
+  }
+  return("image/png");
+}
+
 int printCGIHeader(bsr_config_t *bsr_config) {
-  if (bsr_config->image_format == 0) {
+  if (bsr_config->progressive == 1) {
+    // each rendering pass replaces the previous image in the browser
+    printf("Content-type: multipart/x-mixed-replace; boundary=%s\n", BSR_MULTIPART_BOUNDARY);
+  } else if (bsr_config->image_format == 0) {
     printf("Content-type: image/png\n");
     printf("Content-Disposition: attachment; filename=\"galaxy.png\"\n");
   } else if (bsr_config->image_format == 1) {
@@ -59,14 +75,56 @@ int printCGIHeader(bsr_config_t *bsr_config) {
     printf("Content-type: image/heif\n");
     printf("Content-Disposition: attachment; filename=\"galaxy.heif\"\n");
   }
-  printf("Expires: 0\n");
-  printf("Cache-control: no-store, no-cache, must-revalidate\n");
-  printf("Pragma: no-cache\n");
+  if ((bsr_config->cgi_cache_max_age > 0) && (bsr_config->progressive != 1)) {
+    // images are fully determined by the request so browsers and proxies may cache them
+    printf("Cache-control: public, max-age=%d\n", bsr_config->cgi_cache_max_age);
+  } else {
+    printf("Expires: 0\n");
+    printf("Cache-control: no-store, no-cache, must-revalidate\n");
+    printf("Pragma: no-cache\n");
+  }
   printf("\n");
   fflush(stdout);
   return(0);
 }
 
+int printCGIPartHeader(bsr_config_t *bsr_config) {
+  //
+  // progressive rendering: begin the next image of a multipart/x-mixed-replace response
+  //
+  printf("--%s\r\n", BSR_MULTIPART_BOUNDARY);
+  printf("Content-type: %s\r\n", imageContentType(bsr_config));
+  printf("\r\n");
+  fflush(stdout);
+  return(0);
+}
+
+int printCGIPartEnd(bsr_config_t *bsr_config, int last_part) {
+  //
+  // progressive rendering: end this image, and the multipart response after the last image
+  //
+  printf("\r\n");
+  if (last_part == 1) {
+    printf("--%s--\r\n", BSR_MULTIPART_BOUNDARY);
+  }
+  fflush(stdout);
+  return(0);
+}
+
+int printCGIUnavailable(bsr_config_t *bsr_config, const char *message) {
+  //
+  // HTTP 503 response for requests rejected by admission control, clients may retry after the queue timeout
+  //
+  printf("Status: 503 Service Unavailable\n");
+  printf("Content-type: text/plain\n");
+  printf("Retry-After: %d\n", ((bsr_config->cgi_queue_timeout > 0) ? bsr_config->cgi_queue_timeout : 10));
+  printf("Cache-control: no-store\n");
+  printf("\n");
+  printf("%s\n", message);
+  fflush(stdout);
+  return(0);
+}
+
 int sanitizeQueryString(char *query_string_2048) {
   int i;
   int tmpstr_len;
@@ -139,6 +197,12 @@ int enforceCGILimits(bsr_config_t *bsr_config) {
   if (bsr_config->camera_res_y > bsr_config->cgi_max_res_y) {
     bsr_config->camera_res_y=bsr_config->cgi_max_res_y;
   }
+  if (bsr_config->sky_tile_size > bsr_config->cgi_max_res_x) {
+    bsr_config->sky_tile_size=bsr_config->cgi_max_res_x;
+  }
+  if (bsr_config->sky_tile_size > bsr_config->cgi_max_res_y) {
+    bsr_config->sky_tile_size=bsr_config->cgi_max_res_y;
+  }
   if (bsr_config->Gaia_min_parallax_quality < bsr_config->cgi_Gaia_min_parallax_quality) {
     bsr_config->Gaia_min_parallax_quality=bsr_config->cgi_Gaia_min_parallax_quality;
   }
@@ -157,6 +221,24 @@ int enforceCGILimits(bsr_config_t *bsr_config) {
   if (bsr_config->cgi_allow_anti_alias == 0) {
     bsr_config->anti_alias_enable=0;
   }
+  if (bsr_config->vr_mode != 0) {
+    //
+    // VR modes can only output one packed image, which must also fit within the resolution limits
+    //
+    bsr_config->vr_packed_output=1;
+    if ((bsr_config->vr_mode == 1) && ((bsr_config->camera_res_y * 3) > bsr_config->cgi_max_res_x)) {
+      bsr_config->camera_res_y=bsr_config->cgi_max_res_x / 3;
+    }
+    if ((bsr_config->vr_mode == 1) && ((bsr_config->camera_res_y * 2) > bsr_config->cgi_max_res_y)) {
+      bsr_config->camera_res_y=bsr_config->cgi_max_res_y / 2;
+    }
+    if ((bsr_config->vr_mode == 2) && ((bsr_config->camera_res_y * 2) > bsr_config->cgi_max_res_y)) {
+      bsr_config->camera_res_y=bsr_config->cgi_max_res_y / 2;
+    }
+    if (bsr_config->camera_res_y < 1) {
+      bsr_config->camera_res_y=1;
+    }
+  }
 
   return(0);
 }
@@ -39,7 +39,10 @@
 #ifndef BSR_CGI_H
 #define BSR_CGI_H
 
-int printCGIHeader();
+int printCGIHeader(bsr_config_t *bsr_config);
+int printCGIPartHeader(bsr_config_t *bsr_config);
+int printCGIPartEnd(bsr_config_t *bsr_config, int last_part);
+int printCGIUnavailable(bsr_config_t *bsr_config, const char *message);
 int getCGIOptions(bsr_config_t *bsr_config);
 int enforceCGILimits(bsr_config_t *bsr_config);
 
@@ -0,0 +1,328 @@
+//
+// Billion Star 3D Rendering Engine
+// Kevin M. Loch
+//
+// 3D rendering engine for the ESA Gaia DR3 star dataset
+
+/*
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2021, Kevin Loch
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "bsrender.h" // needs to be first to get GNU_SOURCE define for strcasestr
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include "util.h"
+#include "pixel-buffer.h"
+#include "composition-file.h"
+
+//
+// Composition files hold the linear image composition buffer after all stars have been rendered, so an image can be
+// re-exposed (camera_pixel_limit_mag, camera_gamma, blur, resize, color_profile, output format...) without reading
+// the star data files again. save_composition writes the file while rendering, load_composition replaces star
+// rendering with reading it. Pixels are stored without composition_prescale so files can be loaded with any
+// composition_precision or camera_pixel_limit_mag.
+//
+// Skyglow and Airy disk maps are part of the saved pixels. With Airy_disk_mode=1 stars are saved as points and the
+// Airy disk convolution is done after loading, so the file can only be loaded with the same Airy_disk_mode
+//
+
+static uint64_t compositionFileOffset(bsr_state_t *bsr_state, bsr_camera_t *camera, int image_y) {
+  //
+  // file offset of row image_y of camera
+  //
+  uint64_t file_offset;
+  int camera_index;
+
+  file_offset=(uint64_t)sizeof(bsr_composition_header_t) + ((uint64_t)bsr_state->num_cameras * (uint64_t)sizeof(bsr_composition_camera_t));
+  for (camera_index=0; (bsr_state->camera + camera_index) != camera; camera_index++) {
+    file_offset+=(uint64_t)bsr_state->camera[camera_index].camera_res_x * (uint64_t)bsr_state->camera[camera_index].camera_res_y * 3 * sizeof(float);
+  }
+  file_offset+=(uint64_t)image_y * (uint64_t)camera->camera_res_x * 3 * sizeof(float);
+
+  return(file_offset);
+}
+
+static int loadCompositionHeader(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
+  //
+  // check that the load_composition file was saved with the same cameras and Airy_disk_mode
+  //
+  bsr_composition_header_t header;
+  bsr_composition_camera_t file_camera;
+  struct stat sb;
+  int camera_index;
+
+  if (pread(bsr_state->composition_load_fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+    return(1);
+  }
+  if ((memcmp(header.magic, BSR_COMPOSITION_MAGIC, sizeof(header.magic)) != 0) || (header.byte_order != BSR_COMPOSITION_BYTE_ORDER)) {
+    if (bsr_config->cgi_mode != 1) {
+      printf("Error: %s is not a composition file or was saved on a platform with different byte order\n", bsr_config->load_composition_file_name);
+      fflush(stdout);
+    }
+    exit(1);
+  }
+  if (header.num_cameras != bsr_state->num_cameras) {
+    if (bsr_config->cgi_mode != 1) {
+      printf("Error: %s was saved with %d cameras, current configuration has %d\n", bsr_config->load_composition_file_name, header.num_cameras, bsr_state->num_cameras);
+      fflush(stdout);
+    }
+    exit(1);
+  }
+  if (header.Airy_disk_mode != bsr_config->Airy_disk_mode) {
+    if (bsr_config->cgi_mode != 1) {
+      printf("Error: %s was saved with Airy_disk_mode=%d\n", bsr_config->load_composition_file_name, header.Airy_disk_mode);
+      fflush(stdout);
+    }
+    exit(1);
+  }
+  for (camera_index=0; camera_index < bsr_state->num_cameras; camera_index++) {
+    if (pread(bsr_state->composition_load_fd, &file_camera, sizeof(file_camera), (sizeof(header) + (camera_index * sizeof(file_camera)))) != (ssize_t)sizeof(file_camera)) {
+      return(1);
+    }
+    if ((file_camera.res_x != bsr_state->camera[camera_index].camera_res_x) || (file_camera.res_y != bsr_state->camera[camera_index].camera_res_y)) {
+      if (bsr_config->cgi_mode != 1) {
+        printf("Error: %s was saved with camera resolution %dx%d, current configuration has %dx%d\n", bsr_config->load_composition_file_name,\
+          file_camera.res_x, file_camera.res_y, bsr_state->camera[camera_index].camera_res_x, bsr_state->camera[camera_index].camera_res_y);
+        fflush(stdout);
+      }
+      exit(1);
+    }
+  }
+
+  //
+  // rows are read with pread() by all threads, make sure they are all there
+  //
+  if ((fstat(bsr_state->composition_load_fd, &sb) != 0) || ((uint64_t)sb.st_size < compositionFileOffset(bsr_state, (bsr_state->camera + bsr_state->num_cameras), 0))) {
+    return(1);
+  }
+
+  return(0);
+}
+
+int openCompositionFiles(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
+  //
+  // main thread: open composition files before worker threads are forked so they can share the file descriptors.
+  // Cameras must already be set up
+  //
+  bsr_composition_header_t header;
+  bsr_composition_camera_t file_camera;
+  int camera_index;
+
+  bsr_state->composition_load_fd=-1;
+  bsr_state->composition_save_fd=-1;
+
+  if (bsr_config->load_composition_file_name[0] != 0) {
+    bsr_state->composition_load_fd=open(bsr_config->load_composition_file_name, O_RDONLY);
+    if (bsr_state->composition_load_fd == -1) {
+      if (bsr_config->cgi_mode != 1) {
+        printf("Error: could not open composition file %s\n", bsr_config->load_composition_file_name);
+        fflush(stdout);
+      }
+      exit(1);
+    }
+    if (loadCompositionHeader(bsr_config, bsr_state) != 0) {
+      if (bsr_config->cgi_mode != 1) {
+        printf("Error: composition file %s is truncated\n", bsr_config->load_composition_file_name);
+        fflush(stdout);
+      }
+      exit(1);
+    }
+  }
+
+  if (bsr_config->save_composition_file_name[0] != 0) {
+    bsr_state->composition_save_fd=open(bsr_config->save_composition_file_name, (O_WRONLY | O_CREAT | O_TRUNC), 0644);
+    if (bsr_state->composition_save_fd == -1) {
+      if (bsr_config->cgi_mode != 1) {
+        printf("Error: could not create composition file %s\n", bsr_config->save_composition_file_name);
+        fflush(stdout);
+      }
+      exit(1);
+    }
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BSR_COMPOSITION_MAGIC, sizeof(header.magic));
+    header.byte_order=BSR_COMPOSITION_BYTE_ORDER;
+    header.num_cameras=bsr_state->num_cameras;
+    header.Airy_disk_mode=bsr_config->Airy_disk_mode;
+    if (pwrite(bsr_state->composition_save_fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+      if (bsr_config->cgi_mode != 1) {
+        printf("Error: could not write composition file %s\n", bsr_config->save_composition_file_name);
+        fflush(stdout);
+      }
+      exit(1);
+    }
+    for (camera_index=0; camera_index < bsr_state->num_cameras; camera_index++) {
+      file_camera.res_x=bsr_state->camera[camera_index].camera_res_x;
+      file_camera.res_y=bsr_state->camera[camera_index].camera_res_y;
+      if (pwrite(bsr_state->composition_save_fd, &file_camera, sizeof(file_camera), (sizeof(header) + (camera_index * sizeof(file_camera)))) != (ssize_t)sizeof(file_camera)) {
+        if (bsr_config->cgi_mode != 1) {
+          printf("Error: could not write composition file %s\n", bsr_config->save_composition_file_name);
+          fflush(stdout);
+        }
+        exit(1);
+      }
+    }
+  }
+
+  return(0);
+}
+
+int closeCompositionFiles(bsr_state_t *bsr_state) {
+  if (bsr_state->composition_load_fd != -1) {
+    close(bsr_state->composition_load_fd);
+    bsr_state->composition_load_fd=-1;
+  }
+  if (bsr_state->composition_save_fd != -1) {
+    close(bsr_state->composition_save_fd);
+    bsr_state->composition_save_fd=-1;
+  }
+
+  return(0);
+}
+
+int loadCompositionRow(bsr_config_t *bsr_config, bsr_state_t *bsr_state, bsr_camera_t *camera, int image_y, uint64_t image_offset, float *row_buf) {
+  //
+  // all threads: read row image_y of camera from the load_composition file into the image composition buffer at
+  // image_offset. row_buf must hold camera_res_x pixels
+  //
+  size_t row_size;
+  double composition_prescale;
+  int composition_precision;
+  float *row_p;
+  int x;
+
+  row_size=(size_t)camera->camera_res_x * 3 * sizeof(float);
+  if (pread(bsr_state->composition_load_fd, row_buf, row_size, compositionFileOffset(bsr_state, camera, image_y)) != (ssize_t)row_size) {
+    if (bsr_config->cgi_mode != 1) {
+      printf("Error: could not read composition file %s\n", bsr_config->load_composition_file_name);
+      fflush(stdout);
+    }
+    exit(1);
+  }
+
+  composition_precision=bsr_state->composition_precision;
+  composition_prescale=bsr_state->composition_prescale;
+  row_p=row_buf;
+  for (x=0; x < camera->camera_res_x; x++) {
+    storePixel(bsr_state->image_composition_buf, composition_precision, image_offset, ((double)row_p[0] * composition_prescale), ((double)row_p[1] * composition_prescale), ((double)row_p[2] * composition_prescale));
+    row_p+=3;
+    image_offset++;
+  }
+
+  return(0);
+}
+
+int saveComposition(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
+  //
+  // main thread: write the rows of the current tile of each camera to the save_composition file
+  //
+  struct timespec starttime;
+  struct timespec endtime;
+  double elapsed_time;
+  bsr_camera_t *camera;
+  float *row_buf;
+  float *row_p;
+  size_t row_size;
+  uint64_t image_offset;
+  double inv_composition_prescale;
+  double r;
+  double g;
+  double b;
+  int camera_index;
+  int max_res_x;
+  int image_y;
+  int x;
+  int trace_event;
+
+  if ((bsr_config->cgi_mode != 1) && (bsr_config->print_status == 1)) {
+    clock_gettime(CLOCK_REALTIME, &starttime);
+    printf("Saving image composition buffer to %s...", bsr_config->save_composition_file_name);
+    fflush(stdout);
+  }
+  trace_event=traceBegin(bsr_state, "Save composition", NULL);
+
+  max_res_x=0;
+  for (camera_index=0; camera_index < bsr_state->num_cameras; camera_index++) {
+    if (bsr_state->camera[camera_index].camera_res_x > max_res_x) {
+      max_res_x=bsr_state->camera[camera_index].camera_res_x;
+    }
+  }
+  row_buf=(float *)malloc((size_t)max_res_x * 3 * sizeof(float));
+  if (row_buf == NULL) {
+    if (bsr_config->cgi_mode != 1) {
+      printf("Error: could not allocate memory for composition file row buffer\n");
+      fflush(stdout);
+    }
+    exit(1);
+  }
+
+  inv_composition_prescale=1.0 / bsr_state->composition_prescale;
+  for (camera_index=0; camera_index < bsr_state->num_cameras; camera_index++) {
+    camera=bsr_state->camera + camera_index;
+    row_size=(size_t)camera->camera_res_x * 3 * sizeof(float);
+    image_offset=camera->image_offset;
+    for (image_y=camera->tile_y_min; image_y < camera->tile_y_max; image_y++) {
+      row_p=row_buf;
+      for (x=0; x < camera->camera_res_x; x++) {
+        loadPixel(bsr_state->image_composition_buf, bsr_state->composition_precision, (image_offset + (uint64_t)x), &r, &g, &b);
+        row_p[0]=(float)(r * inv_composition_prescale);
+        row_p[1]=(float)(g * inv_composition_prescale);
+        row_p[2]=(float)(b * inv_composition_prescale);
+        row_p+=3;
+      }
+      if (pwrite(bsr_state->composition_save_fd, row_buf, row_size, compositionFileOffset(bsr_state, camera, image_y)) != (ssize_t)row_size) {
+        if (bsr_config->cgi_mode != 1) {
+          printf("Error: could not write composition file %s\n", bsr_config->save_composition_file_name);
+          fflush(stdout);
+        }
+        exit(1);
+      }
+      image_offset+=camera->image_stride;
+    } // end for image_y
+  } // end for camera_index
+  free(row_buf);
+
+  traceEnd(bsr_state, trace_event);
+  if ((bsr_config->cgi_mode != 1) && (bsr_config->print_status == 1)) {
+    clock_gettime(CLOCK_REALTIME, &endtime);
+    elapsed_time=((double)(endtime.tv_sec - 1500000000) + ((double)endtime.tv_nsec / 1.0E9)) - ((double)(starttime.tv_sec - 1500000000) + ((double)starttime.tv_nsec) / 1.0E9);
+    printf(" (%.3fs)\n", elapsed_time);
+    fflush(stdout);
+  }
+
+  return(0);
+}
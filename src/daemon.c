@@ -0,0 +1,287 @@
+//
+// Billion Star 3D Rendering Engine
+// Kevin M. Loch
+//
+// 3D rendering engine for the ESA Gaia DR3 star dataset
+
+/*
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2021, Kevin Loch
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "bsrender.h" // needs to be first to get GNU_SOURCE define for strcasestr
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "daemon.h"
+#include "bsr-config.h"
+#include "init-state.h"
+#include "file.h"
+#include "rgb.h"
+
+//
+// Daemon mode keeps the star data file mappings and rgb tables resident between requests. The daemon listens on
+// the UNIX socket daemon_socket and forks a request process for each connection. The request process inherits the
+// daemon's mappings and tables, applies the request as a CGI query string (with the usual privileged option and
+// cgi_ limit checks), renders with its own worker threads, and writes the same output as CGI mode to the socket.
+//
+// Request protocol: the client sends a 4-byte big-endian length followed by the query string (up to 2047 bytes).
+// The response is the CGI header and image data, and ends when the daemon closes the connection.
+//
+
+int readDaemonRequest(int conn_fd, char *request_2048) {
+  unsigned char length_bytes[4];
+  int request_length;
+  int bytes_read;
+  int total_read;
+
+  //
+  // read 4-byte big-endian request length
+  //
+  total_read=0;
+  while (total_read < 4) {
+    bytes_read=read(conn_fd, (length_bytes + total_read), (4 - total_read));
+    if (bytes_read <= 0) {
+      return(1);
+    }
+    total_read+=bytes_read;
+  }
+  request_length=((int)length_bytes[0] << 24) | ((int)length_bytes[1] << 16) | ((int)length_bytes[2] << 8) | (int)length_bytes[3];
+  if ((request_length < 0) || (request_length > 2047)) {
+    return(1);
+  }
+
+  //
+  // read query string
+  //
+  total_read=0;
+  while (total_read < request_length) {
+    bytes_read=read(conn_fd, (request_2048 + total_read), (request_length - total_read));
+    if (bytes_read <= 0) {
+      return(1);
+    }
+    total_read+=bytes_read;
+  }
+  request_2048[request_length]=0;
+
+  return(0);
+}
+
+int runDaemon(bsr_config_t *bsr_config, bsr_daemon_t *bsr_daemon) {
+  //
+  // This function initializes resident state and serves requests on daemon_socket. It only returns in request
+  // processes, with cgi_mode enabled and QUERY_STRING_p pointing to the request.
+  //
+  struct timespec starttime;
+  struct timespec endtime;
+  double elapsed_time;
+  struct sockaddr_un socket_address;
+  int listen_fd;
+  int conn_fd;
+  int active_requests;
+  pid_t request_pid;
+  uint64_t request_count;
+
+  //
+  // keep a validated copy of the daemon configuration, request processes start from the unvalidated configuration
+  //
+  memcpy(&bsr_daemon->config, bsr_config, sizeof(bsr_config_t));
+  validateConfig(&bsr_daemon->config);
+
+  //
+  // open (mmap) input files and initialize rgb tables once for all requests
+  //
+  if ((bsr_config->cgi_mode != 1) && (bsr_config->print_status == 1)) {
+    clock_gettime(CLOCK_REALTIME, &starttime);
+    printf("Initializing daemon data files and rgb color tables...");
+    fflush(stdout);
+  }
+  bsr_daemon->state=initState(&bsr_daemon->config);
+  if (bsr_daemon->state == NULL) {
+    if (bsr_config->cgi_mode != 1) {
+      printf("Error: could not initialize daemon state\n");
+      fflush(stdout);
+    }
+    exit(1);
+  }
+  openInputFiles(&bsr_daemon->config, bsr_daemon->state);
+  initRGBTables(&bsr_daemon->config, bsr_daemon->state);
+  if ((bsr_config->cgi_mode != 1) && (bsr_config->print_status == 1)) {
+    clock_gettime(CLOCK_REALTIME, &endtime);
+    elapsed_time=((double)(endtime.tv_sec - 1500000000) + ((double)endtime.tv_nsec / 1.0E9)) - ((double)(starttime.tv_sec - 1500000000) + ((double)starttime.tv_nsec) / 1.0E9);
+    printf(" (%.3fs)\n", elapsed_time);
+    fflush(stdout);
+  }
+
+  //
+  // create listening socket
+  //
+  if (strlen(bsr_config->daemon_socket) >= sizeof(socket_address.sun_path)) {
+    if (bsr_config->cgi_mode != 1) {
+      printf("Error: daemon_socket path is too long\n");
+      fflush(stdout);
+    }
+    exit(1);
+  }
+  memset(&socket_address, 0, sizeof(socket_address));
+  socket_address.sun_family=AF_UNIX;
+  strcpy(socket_address.sun_path, bsr_config->daemon_socket);
+  unlink(bsr_config->daemon_socket);
+  listen_fd=socket(AF_UNIX, SOCK_STREAM, 0);
+  if ((listen_fd < 0) || (bind(listen_fd, (struct sockaddr *)&socket_address, sizeof(socket_address)) != 0) || (listen(listen_fd, 64) != 0)) {
+    if (bsr_config->cgi_mode != 1) {
+      printf("Error: could not listen on daemon_socket %s\n", bsr_config->daemon_socket);
+      fflush(stdout);
+    }
+    exit(1);
+  }
+  if ((bsr_config->cgi_mode != 1) && (bsr_config->print_status == 1)) {
+    printf("Listening on %s\n", bsr_config->daemon_socket);
+    fflush(stdout);
+  }
+
+  //
+  // serve requests until killed. Request processes are forked before the request is read so a slow or broken
+  // client only holds its own process. At most BSR_DAEMON_MAX_REQUESTS run at once, further connections wait in the
+  // listen queue until one finishes.
+  //
+  request_count=0;
+  active_requests=0;
+  while (1) {
+    // clean up finished request processes
+    while (waitpid(-1, NULL, WNOHANG) > 0) {
+      active_requests--;
+    }
+    while (active_requests >= BSR_DAEMON_MAX_REQUESTS) {
+      if (waitpid(-1, NULL, 0) > 0) {
+        active_requests--;
+      } else {
+        active_requests=0;
+      }
+    }
+
+    conn_fd=accept(listen_fd, NULL, NULL);
+    if (conn_fd < 0) {
+      continue;
+    }
+    request_count++;
+
+    //
+    // fork request process. It reads the request within BSR_DAEMON_REQUEST_TIMEOUT seconds (the default SIGALRM
+    // action ends the process) and renders in CGI mode with stdout connected to the client
+    //
+    request_pid=fork();
+    if (request_pid == 0) {
+      close(listen_fd);
+      alarm(BSR_DAEMON_REQUEST_TIMEOUT);
+      if (readDaemonRequest(conn_fd, bsr_daemon->request) != 0) {
+        exit(1);
+      }
+      alarm(0);
+      if ((bsr_config->cgi_mode != 1) && (bsr_config->print_status == 1)) {
+        printf("Request %llu: %s\n", (unsigned long long)request_count, bsr_daemon->request);
+      }
+      fflush(stdout);
+      dup2(conn_fd, STDOUT_FILENO);
+      close(conn_fd);
+      bsr_config->cgi_mode=1;
+      bsr_config->QUERY_STRING_p=bsr_daemon->request;
+      return(0);
+    } else if (request_pid > 0) {
+      active_requests++;
+    } else if ((bsr_config->cgi_mode != 1) && (bsr_config->print_status == 1)) {
+      printf("Error: could not fork request process\n");
+      fflush(stdout);
+    }
+    close(conn_fd);
+  } // end while serving requests
+
+  return(0);
+}
+
+int attachDaemonFiles(bsr_config_t *bsr_config, bsr_state_t *bsr_state, bsr_daemon_t *bsr_daemon) {
+  //
+  // use the daemon's input file mappings if they include every file this request needs. CGI users can enable
+  // databases or lower Gaia_min_parallax_quality (down to cgi_Gaia_min_parallax_quality) relative to the daemon
+  // configuration, in which case the request process opens its own files. Returns 0 if attached.
+  //
+  if ((bsr_config->external_db_enable == 1) && (bsr_daemon->config.external_db_enable != 1)) {
+    return(1);
+  }
+  if ((bsr_config->Gaia_db_enable == 1) && ((bsr_daemon->config.Gaia_db_enable != 1)\
+   || (bsr_config->Gaia_min_parallax_quality < bsr_daemon->config.Gaia_min_parallax_quality))) {
+    return(1);
+  }
+
+  bsr_state->input_file_external=bsr_daemon->state->input_file_external;
+  bsr_state->input_file_pq100=bsr_daemon->state->input_file_pq100;
+  bsr_state->input_file_pq050=bsr_daemon->state->input_file_pq050;
+  bsr_state->input_file_pq030=bsr_daemon->state->input_file_pq030;
+  bsr_state->input_file_pq020=bsr_daemon->state->input_file_pq020;
+  bsr_state->input_file_pq010=bsr_daemon->state->input_file_pq010;
+  bsr_state->input_file_pq005=bsr_daemon->state->input_file_pq005;
+  bsr_state->input_file_pq003=bsr_daemon->state->input_file_pq003;
+  bsr_state->input_file_pq002=bsr_daemon->state->input_file_pq002;
+  bsr_state->input_file_pq001=bsr_daemon->state->input_file_pq001;
+  bsr_state->input_file_pq000=bsr_daemon->state->input_file_pq000;
+
+  return(0);
+}
+
+int attachDaemonRGBTables(bsr_config_t *bsr_config, bsr_state_t *bsr_state, bsr_daemon_t *bsr_daemon) {
+  //
+  // use the daemon's rgb tables if this request has the same white balance, saturation and color channel filter
+  // options. Returns 0 if attached.
+  //
+  if ((bsr_config->camera_wb_enable != bsr_daemon->config.camera_wb_enable)\
+   || (bsr_config->camera_wb_temp != bsr_daemon->config.camera_wb_temp)\
+   || (bsr_config->camera_color_saturation != bsr_daemon->config.camera_color_saturation)\
+   || (bsr_config->red_filter_long_limit != bsr_daemon->config.red_filter_long_limit)\
+   || (bsr_config->red_filter_short_limit != bsr_daemon->config.red_filter_short_limit)\
+   || (bsr_config->green_filter_long_limit != bsr_daemon->config.green_filter_long_limit)\
+   || (bsr_config->green_filter_short_limit != bsr_daemon->config.green_filter_short_limit)\
+   || (bsr_config->blue_filter_long_limit != bsr_daemon->config.blue_filter_long_limit)\
+   || (bsr_config->blue_filter_short_limit != bsr_daemon->config.blue_filter_short_limit)) {
+    return(1);
+  }
+
+  memcpy(bsr_state->rgb_red, bsr_daemon->state->rgb_red, sizeof(bsr_state->rgb_red));
+  memcpy(bsr_state->rgb_green, bsr_daemon->state->rgb_green, sizeof(bsr_state->rgb_green));
+  memcpy(bsr_state->rgb_blue, bsr_daemon->state->rgb_blue, sizeof(bsr_state->rgb_blue));
+
+  return(0);
+}
@@ -38,12 +38,17 @@
 
 #include "bsrender.h" // needs to be first to get GNU_SOURCE define for strcasestr
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <time.h>
 #include "Bessel.h"
 #include "util.h"
+#include "fft.h"
+#include "pixel-buffer.h"
+#include "image-composition.h"
 
-int makeAiryMap(bsr_state_t *bsr_state, double *Airymap, int max_extent, int half_oversampling, double pixel_scaling_factor, double I0, double obs_ratio) {
+int makeAiryMap(bsr_state_t *bsr_state, double *Airymap, int max_extent, int half_oversampling, double pixel_scaling_factor, double I0, double obs_ratio, int first_line, int end_line) {
   double *Airymap_p;
   int Airymap_max_width;
   int map_offset;
@@ -60,7 +65,6 @@ int makeAiryMap(bsr_state_t *bsr_state, double *Airymap, int max_extent, int hal
   double oversample_r;
   double Bessel_x;
   int Bessel_x_index;
-  int lines_per_thread;
   double obs_I0_factor=0.0;
   int obs_x_index=0;
   double oversampling_factor;
@@ -71,22 +75,18 @@ int makeAiryMap(bsr_state_t *bsr_state, double *Airymap, int max_extent, int hal
   //
   Airymap_max_width=max_extent + 1;
   oversampling=(half_oversampling * 2) + 1;
-  lines_per_thread=(int)ceil(((double)Airymap_max_width / ((double)bsr_state->num_worker_threads + 1)));
-  if (lines_per_thread < 1) {
-    lines_per_thread=1;
-  }
   if (obs_ratio > 0.0) {
     obs_I0_factor=1.0 / pow((1.0 - (obs_ratio * obs_ratio)), 2.0);
   }
   oversampling_factor=1.0 / (double)oversampling;
 
   //
-  // generate Airy disk map
+  // generate lines [first_line..end_line) of Airy disk map
   //
   map_index_x=0;
-  map_index_y=bsr_state->perthread->my_thread_id * lines_per_thread;
+  map_index_y=first_line;
   Airymap_p=Airymap + (Airymap_max_width * map_index_y);
-  for (map_offset=0; ((map_offset < (Airymap_max_width * lines_per_thread)) && (map_index_y < Airymap_max_width)); map_offset++) {
+  for (map_offset=0; ((map_offset < (Airymap_max_width * (end_line - first_line))) && (map_index_y < Airymap_max_width)); map_offset++) {
     pixel_x=(double)map_index_x;
     pixel_y=(double)map_index_y;
     pixel_r=sqrt((pixel_x * pixel_x) + (pixel_y * pixel_y));
@@ -124,6 +124,7 @@ int makeAiryMap(bsr_state_t *bsr_state, double *Airymap, int max_extent, int hal
     if (map_index_x == Airymap_max_width) {
       map_index_x=0;
       map_index_y++;
+      checkCancel(bsr_state);
     }
     Airymap_p++;
   } // end for pixel_index
@@ -131,6 +132,125 @@ int makeAiryMap(bsr_state_t *bsr_state, double *Airymap, int max_extent, int hal
   return(0);
 }
 
+int AiryFFTSize(bsr_config_t *bsr_config, int res_x, int res_y) {
+  //
+  // FFT block size for Airy_disk_mode=1. Each block outputs (size - 2 * Airy_disk_max_extent) pixels square, so blocks
+  // are at least twice the width of the Airy disk and at least BSR_AIRY_FFT_MIN_SIZE to keep the overlap between
+  // blocks small, but no larger than needed for the whole image in one block
+  //
+  int Airy_disk_width;
+  int fft_size;
+  int image_size;
+
+  Airy_disk_width=(bsr_config->Airy_disk_max_extent * 2) + 1;
+  fft_size=1;
+  while (fft_size < (Airy_disk_width * 2)) {
+    fft_size*=2;
+  }
+  if (fft_size < BSR_AIRY_FFT_MIN_SIZE) {
+    fft_size=BSR_AIRY_FFT_MIN_SIZE;
+    image_size=((res_x > res_y) ? res_x : res_y) + Airy_disk_width - 1;
+    while (((fft_size / 2) >= (Airy_disk_width * 2)) && ((fft_size / 2) >= image_size)) {
+      fft_size/=2;
+    }
+  }
+
+  return(fft_size);
+}
+
+int initAirySpectra(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
+  //
+  // main thread: transform the red, green and blue Airy disk maps into the transfer functions used by
+  // convolveAiryDisks(). Pixels are included where all three maps are non-zero, the same as Airy disk map rendering.
+  // The maps are symmetric about both axes so the transfer functions are real and symmetric, only one quadrant is
+  // stored. Red and green are stored as (red + green) / 2 and (red - green) / 2 to separate the red and green images
+  // that are transformed together. All are scaled by 1/(fft_size^2) for the inverse transform
+  //
+  fft_plan_t fft_plan;
+  double *fft_buf;
+  double *spectra_rg_sum;
+  double *spectra_rg_diff;
+  double *spectra_blue;
+  int fft_size;
+  int quadrant_size;
+  int extent;
+  int Airymap_max_width;
+  int Airymap_x;
+  int Airymap_y;
+  int Airymap_offset;
+  int pass;
+  int fft_x;
+  int fft_y;
+  int q_x;
+  int q_y;
+  double inv_fft_points;
+  size_t fft_offset;
+
+  fft_size=bsr_state->Airy_fft_size;
+  quadrant_size=(fft_size / 2) + 1;
+  extent=bsr_config->Airy_disk_max_extent;
+  Airymap_max_width=extent + 1;
+  inv_fft_points=1.0 / ((double)fft_size * (double)fft_size);
+  spectra_rg_sum=bsr_state->Airy_spectra;
+  spectra_rg_diff=spectra_rg_sum + ((size_t)quadrant_size * (size_t)quadrant_size);
+  spectra_blue=spectra_rg_diff + ((size_t)quadrant_size * (size_t)quadrant_size);
+
+  fft_buf=(double *)malloc((size_t)fft_size * (size_t)fft_size * 2 * sizeof(double));
+  if ((fft_buf == NULL) || (initFFT(&fft_plan, fft_size) != 0)) {
+    if (bsr_config->cgi_mode != 1) {
+      printf("Error: could not allocate memory for Airy disk FFT buffer\n");
+      fflush(stdout);
+    }
+    return(1);
+  }
+
+  //
+  // red in the real part and green in the imaginary part, then blue in the real part. Pixels at negative offsets
+  // wrap around to the end of each row and column
+  //
+  for (pass=0; pass < 2; pass++) {
+    memset(fft_buf, 0, ((size_t)fft_size * (size_t)fft_size * 2 * sizeof(double)));
+    for (Airymap_y=0; Airymap_y < Airymap_max_width; Airymap_y++) {
+      for (Airymap_x=0; Airymap_x < Airymap_max_width; Airymap_x++) {
+        Airymap_offset=(Airymap_y * Airymap_max_width) + Airymap_x;
+        if ((bsr_state->Airymap_red[Airymap_offset] <= 0.0) || (bsr_state->Airymap_green[Airymap_offset] <= 0.0) || (bsr_state->Airymap_blue[Airymap_offset] <= 0.0)) {
+          continue;
+        }
+        for (q_y=0; q_y < 2; q_y++) {
+          fft_y=(q_y == 0) ? Airymap_y : ((fft_size - Airymap_y) % fft_size);
+          for (q_x=0; q_x < 2; q_x++) {
+            fft_x=(q_x == 0) ? Airymap_x : ((fft_size - Airymap_x) % fft_size);
+            fft_offset=(((size_t)fft_y * (size_t)fft_size) + (size_t)fft_x) * 2;
+            if (pass == 0) {
+              fft_buf[fft_offset]=bsr_state->Airymap_red[Airymap_offset];
+              fft_buf[fft_offset + 1]=bsr_state->Airymap_green[Airymap_offset];
+            } else {
+              fft_buf[fft_offset]=bsr_state->Airymap_blue[Airymap_offset];
+            }
+          } // end for q_x
+        } // end for q_y
+      } // end for Airymap_x
+    } // end for Airymap_y
+    complexFFT2D(&fft_plan, fft_buf, 0, fft_size, 0);
+    for (q_y=0; q_y < quadrant_size; q_y++) {
+      for (q_x=0; q_x < quadrant_size; q_x++) {
+        fft_offset=(((size_t)q_y * (size_t)fft_size) + (size_t)q_x) * 2;
+        if (pass == 0) {
+          spectra_rg_sum[(q_y * quadrant_size) + q_x]=(fft_buf[fft_offset] + fft_buf[fft_offset + 1]) * 0.5 * inv_fft_points;
+          spectra_rg_diff[(q_y * quadrant_size) + q_x]=(fft_buf[fft_offset] - fft_buf[fft_offset + 1]) * 0.5 * inv_fft_points;
+        } else {
+          spectra_blue[(q_y * quadrant_size) + q_x]=fft_buf[fft_offset] * inv_fft_points;
+        }
+      } // end for q_x
+    } // end for q_y
+  } // end for pass
+
+  freeFFT(&fft_plan);
+  free(fft_buf);
+
+  return(0);
+}
+
 int initAiryMaps(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
   struct timespec starttime;
   struct timespec endtime;
@@ -151,8 +271,14 @@ int initAiryMaps(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
   double green_center;
   double blue_center;
   int i;
+  int trace_event;
   double obs_ratio;
   const double I0_calibration=1.1675;
+  int Airymap_max_width;
+  int first_line;
+  int end_line;
+  int map_first_line;
+  int map_end_line;
 
   //
   // main thread: display status message if not in CGI mode
@@ -170,12 +296,15 @@ int initAiryMaps(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
   if (bsr_state->perthread->my_pid != bsr_state->main_pid) {
     waitForMainThread(bsr_state, THREAD_STATUS_AIRY_MAP_BEGIN);
   } else {
-    // main thread
+    // main thread: lines of the red, green, and blue maps are handed out as one range
+    initRowBlocks(bsr_state, (3 * (bsr_config->Airy_disk_max_extent + 1)), 1);
     for (i=1; i <= bsr_state->num_worker_threads; i++) {
       bsr_state->status_array[i].status=THREAD_STATUS_AIRY_MAP_BEGIN;
     }
   } // end if not main thread
 
+  trace_event=traceBegin(bsr_state, "Airy disk maps", NULL);
+
   //
   // all threads: calculate center wavelengths for each color channel
   //
@@ -230,11 +359,34 @@ int initAiryMaps(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
   I0_blue=I0_calibration * pow(green_center, 2.0) / (pow(blue_center, 2.0)  * pow((bsr_config->Airy_disk_first_null * oversampling_blue), 2.0));
 
   //
-  // all threads: generate Airy disk map for each color
+  // all threads: generate the lines of each color's Airy disk map in each block. Lines 0..Airymap_max_width-1 of
+  // the range are red, then green, then blue
   //
-  makeAiryMap(bsr_state, bsr_state->Airymap_red, bsr_config->Airy_disk_max_extent, half_oversampling_red, pixel_scaling_factor_red, I0_red, obs_ratio);
-  makeAiryMap(bsr_state, bsr_state->Airymap_green, bsr_config->Airy_disk_max_extent, half_oversampling_green, pixel_scaling_factor_green, I0_green, obs_ratio);
-  makeAiryMap(bsr_state, bsr_state->Airymap_blue, bsr_config->Airy_disk_max_extent, half_oversampling_blue, pixel_scaling_factor_blue, I0_blue, obs_ratio);
+  Airymap_max_width=bsr_config->Airy_disk_max_extent + 1;
+  while (nextRowBlock(bsr_state, &first_line, &end_line) == 1) {
+    for (i=0; i < 3; i++) {
+      map_first_line=first_line - (i * Airymap_max_width);
+      map_end_line=end_line - (i * Airymap_max_width);
+      if (map_first_line < 0) {
+        map_first_line=0;
+      }
+      if (map_end_line > Airymap_max_width) {
+        map_end_line=Airymap_max_width;
+      }
+      if (map_first_line >= map_end_line) {
+        continue;
+      }
+      if (i == 0) {
+        makeAiryMap(bsr_state, bsr_state->Airymap_red, bsr_config->Airy_disk_max_extent, half_oversampling_red, pixel_scaling_factor_red, I0_red, obs_ratio, map_first_line, map_end_line);
+      } else if (i == 1) {
+        makeAiryMap(bsr_state, bsr_state->Airymap_green, bsr_config->Airy_disk_max_extent, half_oversampling_green, pixel_scaling_factor_green, I0_green, obs_ratio, map_first_line, map_end_line);
+      } else {
+        makeAiryMap(bsr_state, bsr_state->Airymap_blue, bsr_config->Airy_disk_max_extent, half_oversampling_blue, pixel_scaling_factor_blue, I0_blue, obs_ratio, map_first_line, map_end_line);
+      }
+    } // end for i
+  } // end while nextRowBlock
+
+  traceEnd(bsr_state, trace_event);
 
   //
   // worker threads: signal this thread is done and wait until main thread says we can continue to next step.
@@ -245,6 +397,12 @@ int initAiryMaps(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
     waitForMainThread(bsr_state, THREAD_STATUS_AIRY_MAP_CONTINUE);
   } else {
     waitForWorkerThreads(bsr_state, THREAD_STATUS_AIRY_MAP_COMPLETE);
+    // Airy disk transfer functions for FFT convolution
+    if (bsr_config->Airy_disk_mode == 1) {
+      if (initAirySpectra(bsr_config, bsr_state) != 0) {
+        return(1);
+      }
+    }
     // ready to continue, set all worker thread status to continue
     for (i=1; i <= bsr_state->num_worker_threads; i++) {
       bsr_state->status_array[i].status=THREAD_STATUS_AIRY_MAP_CONTINUE;
@@ -263,3 +421,480 @@ int initAiryMaps(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
 
   return 0;
 }
+
+int AiryBlock(bsr_state_t *bsr_state, uint64_t image_start, uint64_t image_end, int block_size, int block_index, bsr_camera_t **camera, int *block_x, int *block_y) {
+  //
+  // find camera and position of one block of Airy disk convolution. Blocks of each camera in the current image are
+  // numbered in camera order, left to right and top to bottom. Returns 0 if block_index is past the last block
+  //
+  bsr_camera_t *camera_p;
+  int camera_index;
+  int camera_rows;
+  int blocks_x;
+  int blocks_y;
+
+  for (camera_index=0; camera_index < bsr_state->num_cameras; camera_index++) {
+    camera_p=bsr_state->camera + camera_index;
+    if ((camera_p->image_offset < image_start) || (camera_p->image_offset >= image_end)) {
+      continue;
+    }
+    camera_rows=camera_p->tile_y_max - camera_p->tile_y_min;
+    blocks_x=(camera_p->camera_res_x + block_size - 1) / block_size;
+    blocks_y=(camera_rows + block_size - 1) / block_size;
+    if (block_index < (blocks_x * blocks_y)) {
+      *camera=camera_p;
+      *block_x=(block_index % blocks_x) * block_size;
+      *block_y=(block_index / blocks_x) * block_size;
+      return(1);
+    }
+    block_index-=(blocks_x * blocks_y);
+  }
+
+  return(0);
+}
+
+int loadAiryBlock(bsr_state_t *bsr_state, double *fft_buf, int fft_size, int extent, bsr_camera_t *camera, int block_x, int block_y, int blue_part, int *first_row, int *end_row) {
+  //
+  // load the pixels of a block plus extent pixels on each side into fft_buf. Red goes in the real part and green in
+  // the imaginary part, or if blue_part is 0 or 1 blue goes in the real or imaginary part. Pixels outside the
+  // camera's raster are zero. first_row and end_row are extended to include the rows loaded
+  //
+  int composition_precision;
+  int camera_rows;
+  int x_min;
+  int x_max;
+  int y_min;
+  int y_max;
+  int x;
+  int y;
+  uint64_t composition_offset;
+  double *fft_p;
+  double pixel_r;
+  double pixel_g;
+  double pixel_b;
+
+  composition_precision=bsr_state->composition_precision;
+  camera_rows=camera->tile_y_max - camera->tile_y_min;
+  x_min=block_x - extent;
+  x_max=block_x + fft_size - extent;
+  y_min=block_y - extent;
+  y_max=block_y + fft_size - extent;
+  if (x_min < 0) {
+    x_min=0;
+  }
+  if (x_max > camera->camera_res_x) {
+    x_max=camera->camera_res_x;
+  }
+  if (y_min < 0) {
+    y_min=0;
+  }
+  if (y_max > camera_rows) {
+    y_max=camera_rows;
+  }
+
+  for (y=y_min; y < y_max; y++) {
+    composition_offset=camera->image_offset + ((uint64_t)camera->image_stride * (uint64_t)y) + (uint64_t)x_min;
+    fft_p=fft_buf + (((size_t)(y - block_y + extent) * (size_t)fft_size) + (size_t)(x_min - block_x + extent)) * 2;
+    if (blue_part < 0) {
+      for (x=x_min; x < x_max; x++) {
+        loadPixel(bsr_state->image_composition_buf, composition_precision, composition_offset, &pixel_r, &pixel_g, &pixel_b);
+        fft_p[0]=pixel_r;
+        fft_p[1]=pixel_g;
+        fft_p+=2;
+        composition_offset++;
+      }
+    } else {
+      fft_p+=blue_part;
+      for (x=x_min; x < x_max; x++) {
+        loadPixel(bsr_state->image_composition_buf, composition_precision, composition_offset, &pixel_r, &pixel_g, &pixel_b);
+        fft_p[0]=pixel_b;
+        fft_p+=2;
+        composition_offset++;
+      }
+    }
+  } // end for y
+
+  if ((y_min - block_y + extent) < *first_row) {
+    *first_row=y_min - block_y + extent;
+  }
+  if ((y_max - block_y + extent) > *end_row) {
+    *end_row=y_max - block_y + extent;
+  }
+
+  return(0);
+}
+
+int storeAiryBlock(bsr_state_t *bsr_state, double *fft_buf, int fft_size, int extent, bsr_camera_t *camera, uint64_t image_start, int block_x, int block_y, int blue_part) {
+  //
+  // store the convolved pixels of a block in the blur buffer at the same position they have in the current image.
+  // Red and green are stored from the real and imaginary parts, or if blue_part is 0 or 1 blue is updated from the
+  // real or imaginary part. Rounding errors can make dark pixels slightly negative, these are set to zero
+  //
+  int blur_precision;
+  int block_size;
+  int x_max;
+  int y_max;
+  int x;
+  int y;
+  uint64_t blur_offset;
+  double *fft_p;
+  double pixel_r;
+  double pixel_g;
+  double pixel_b;
+
+  blur_precision=bsr_state->blur_precision;
+  block_size=fft_size - (extent * 2);
+  x_max=block_x + block_size;
+  y_max=block_y + block_size;
+  if (x_max > camera->camera_res_x) {
+    x_max=camera->camera_res_x;
+  }
+  if (y_max > (camera->tile_y_max - camera->tile_y_min)) {
+    y_max=camera->tile_y_max - camera->tile_y_min;
+  }
+
+  for (y=block_y; y < y_max; y++) {
+    blur_offset=(camera->image_offset - image_start) + ((uint64_t)camera->image_stride * (uint64_t)y) + (uint64_t)block_x;
+    fft_p=fft_buf + (((size_t)(y - block_y + extent) * (size_t)fft_size) + (size_t)extent) * 2;
+    if (blue_part < 0) {
+      for (x=block_x; x < x_max; x++) {
+        pixel_r=(fft_p[0] > 0.0) ? fft_p[0] : 0.0;
+        pixel_g=(fft_p[1] > 0.0) ? fft_p[1] : 0.0;
+        storePixel(bsr_state->image_blur_buf, blur_precision, blur_offset, pixel_r, pixel_g, 0.0);
+        fft_p+=2;
+        blur_offset++;
+      }
+    } else {
+      fft_p+=blue_part;
+      for (x=block_x; x < x_max; x++) {
+        loadPixel(bsr_state->image_blur_buf, blur_precision, blur_offset, &pixel_r, &pixel_g, &pixel_b);
+        pixel_b=(fft_p[0] > 0.0) ? fft_p[0] : 0.0;
+        storePixel(bsr_state->image_blur_buf, blur_precision, blur_offset, pixel_r, pixel_g, pixel_b);
+        fft_p+=2;
+        blur_offset++;
+      }
+    }
+  } // end for y
+
+  return(0);
+}
+
+int multiplyAirySpectra(bsr_state_t *bsr_state, double *fft_buf, int fft_size, int blue) {
+  //
+  // multiply the transform of a block by the Airy disk transfer functions. For red (real part) and green (imaginary
+  // part) each frequency k and its mirror -k are updated together:
+  //   out(k) = in(k) * (red + green) / 2 + conj(in(-k)) * (red - green) / 2
+  // which applies the red transfer function to the real image and the green transfer function to the imaginary image.
+  // Blue is the same for both parts so is a simple multiplication
+  //
+  double *spectra_rg_sum;
+  double *spectra_rg_diff;
+  double *spectra_blue;
+  int quadrant_size;
+  int k_x;
+  int k_y;
+  int m_x;
+  int m_y;
+  int q_x;
+  int q_y;
+  size_t k_offset;
+  size_t m_offset;
+  double h;
+  double h_sum;
+  double h_diff;
+  double k_re;
+  double k_im;
+  double m_re;
+  double m_im;
+
+  quadrant_size=(fft_size / 2) + 1;
+  spectra_rg_sum=bsr_state->Airy_spectra;
+  spectra_rg_diff=spectra_rg_sum + ((size_t)quadrant_size * (size_t)quadrant_size);
+  spectra_blue=spectra_rg_diff + ((size_t)quadrant_size * (size_t)quadrant_size);
+
+  for (k_y=0; k_y < fft_size; k_y++) {
+    m_y=(fft_size - k_y) & (fft_size - 1);
+    q_y=(k_y < quadrant_size) ? k_y : m_y;
+    for (k_x=0; k_x < fft_size; k_x++) {
+      m_x=(fft_size - k_x) & (fft_size - 1);
+      q_x=(k_x < quadrant_size) ? k_x : m_x;
+      k_offset=(((size_t)k_y * (size_t)fft_size) + (size_t)k_x) * 2;
+      if (blue == 1) {
+        h=spectra_blue[(q_y * quadrant_size) + q_x];
+        fft_buf[k_offset]*=h;
+        fft_buf[k_offset + 1]*=h;
+        continue;
+      }
+      m_offset=(((size_t)m_y * (size_t)fft_size) + (size_t)m_x) * 2;
+      if (m_offset < k_offset) {
+        // already updated with its mirror
+        continue;
+      }
+      h_sum=spectra_rg_sum[(q_y * quadrant_size) + q_x];
+      h_diff=spectra_rg_diff[(q_y * quadrant_size) + q_x];
+      k_re=fft_buf[k_offset];
+      k_im=fft_buf[k_offset + 1];
+      m_re=fft_buf[m_offset];
+      m_im=fft_buf[m_offset + 1];
+      fft_buf[k_offset]=(h_sum * k_re) + (h_diff * m_re);
+      fft_buf[k_offset + 1]=(h_sum * k_im) - (h_diff * m_im);
+      fft_buf[m_offset]=(h_sum * m_re) + (h_diff * k_re);
+      fft_buf[m_offset + 1]=(h_sum * m_im) - (h_diff * k_im);
+    } // end for k_x
+  } // end for k_y
+
+  return(0);
+}
+
+int convolveAiryDisks(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
+  //
+  // Airy_disk_mode=1: stars were rendered as points, convolve each camera of the current image with the Airy disk.
+  // The image is split into blocks that are convolved by FFT with the overlap-save method: each block is transformed
+  // with extent pixels of its neighbors on each side and only its own pixels are kept, so the FFT size and memory per
+  // thread do not depend on the image size. Blocks are handed out in pairs, the red and green of each block are
+  // transformed together and the blue of both blocks are transformed together, three transforms for two blocks.
+  // Results go in the blur buffer and are copied back to the image composition buffer when all blocks are done,
+  // adding skyglow if enabled
+  //
+  struct timespec starttime;
+  struct timespec endtime;
+  double elapsed_time;
+  int i;
+  int trace_event;
+  int fft_size;
+  int extent;
+  int block_size;
+  int num_blocks;
+  int block_index;
+  int block_pair;
+  int first_pair;
+  int end_pair;
+  int first_row;
+  int end_row;
+  int row;
+  int num_rows;
+  int camera_first_row;
+  int camera_rows;
+  int camera_index;
+  int pass;
+  int found[2];
+  int block_x[2];
+  int block_y[2];
+  int x;
+  int blocks_x;
+  int blocks_y;
+  int composition_precision;
+  int blur_precision;
+  int skyglow_enable;
+  double skyglow_red=0.0;
+  double skyglow_green=0.0;
+  double skyglow_blue=0.0;
+  double pixel_r;
+  double pixel_g;
+  double pixel_b;
+  uint64_t image_start;
+  uint64_t image_end;
+  uint64_t composition_offset;
+  uint64_t blur_offset;
+  bsr_camera_t *camera;
+  bsr_camera_t *block_camera[2];
+  fft_plan_t fft_plan;
+  double *fft_buf;
+
+  //
+  // all threads: block size and the current image's range of the image composition buffer
+  //
+  fft_size=bsr_state->Airy_fft_size;
+  extent=bsr_config->Airy_disk_max_extent;
+  block_size=fft_size - (extent * 2);
+  composition_precision=bsr_state->composition_precision;
+  blur_precision=bsr_state->blur_precision;
+  image_start=(uint64_t)(((unsigned char *)bsr_state->current_image_buf - (unsigned char *)bsr_state->image_composition_buf) / pixelSize(composition_precision));
+  image_end=image_start + ((uint64_t)bsr_state->current_image_res_x * (uint64_t)bsr_state->current_image_res_y);
+  num_blocks=0;
+  num_rows=0;
+  for (camera_index=0; camera_index < bsr_state->num_cameras; camera_index++) {
+    camera=bsr_state->camera + camera_index;
+    if ((camera->image_offset >= image_start) && (camera->image_offset < image_end)) {
+      camera_rows=camera->tile_y_max - camera->tile_y_min;
+      blocks_x=(camera->camera_res_x + block_size - 1) / block_size;
+      blocks_y=(camera_rows + block_size - 1) / block_size;
+      num_blocks+=(blocks_x * blocks_y);
+      num_rows+=camera_rows;
+    }
+  }
+
+  //
+  // main thread: display status message if not in CGI mode
+  //
+  if ((bsr_state->perthread->my_pid == bsr_state->main_pid) && (bsr_config->cgi_mode != 1) && (bsr_config->print_status == 1)) {
+    clock_gettime(CLOCK_REALTIME, &starttime);
+    printf("Convolving Airy disks in %d blocks of %dx%d...", num_blocks, fft_size, fft_size);
+    fflush(stdout);
+  }
+
+  //
+  // worker threads:  wait for main thread to say go
+  // main thread: tell worker threads to go
+  //
+  if (bsr_state->perthread->my_pid != bsr_state->main_pid) {
+    waitForMainThread(bsr_state, THREAD_STATUS_AIRY_CONVOLVE_BEGIN);
+  } else {
+    // main thread
+    initRowBlocks(bsr_state, ((num_blocks + 1) / 2), 1);
+    for (i=1; i <= bsr_state->num_worker_threads; i++) {
+      bsr_state->status_array[i].status=THREAD_STATUS_AIRY_CONVOLVE_BEGIN;
+    }
+  } // end if not main thread
+
+  trace_event=traceBegin(bsr_state, "Airy disk convolution", NULL);
+
+  //
+  // all threads: allocate FFT buffer
+  //
+  fft_buf=(double *)malloc((size_t)fft_size * (size_t)fft_size * 2 * sizeof(double));
+  if ((fft_buf == NULL) || (initFFT(&fft_plan, fft_size) != 0)) {
+    if (bsr_config->cgi_mode != 1) {
+      printf("Error: could not allocate memory for Airy disk FFT buffer\n");
+      fflush(stdout);
+    }
+    return(1);
+  }
+
+  //
+  // all threads: convolve each pair of blocks. Pass 0 and 1 are red and green of each block, pass 2 is blue of both
+  //
+  while (nextRowBlock(bsr_state, &first_pair, &end_pair) == 1) {
+    for (block_pair=first_pair; block_pair < end_pair; block_pair++) {
+      for (i=0; i < 2; i++) {
+        block_index=(block_pair * 2) + i;
+        found[i]=AiryBlock(bsr_state, image_start, image_end, block_size, block_index, &block_camera[i], &block_x[i], &block_y[i]);
+      }
+      for (pass=0; pass < 3; pass++) {
+        if ((pass < 2) && (found[pass] == 0)) {
+          continue;
+        }
+        memset(fft_buf, 0, ((size_t)fft_size * (size_t)fft_size * 2 * sizeof(double)));
+        first_row=fft_size;
+        end_row=0;
+        if (pass < 2) {
+          loadAiryBlock(bsr_state, fft_buf, fft_size, extent, block_camera[pass], block_x[pass], block_y[pass], -1, &first_row, &end_row);
+        } else {
+          for (i=0; i < 2; i++) {
+            if (found[i] == 1) {
+              loadAiryBlock(bsr_state, fft_buf, fft_size, extent, block_camera[i], block_x[i], block_y[i], i, &first_row, &end_row);
+            }
+          }
+        }
+        complexFFT2D(&fft_plan, fft_buf, first_row, end_row, 0);
+        multiplyAirySpectra(bsr_state, fft_buf, fft_size, ((pass == 2) ? 1 : 0));
+        complexFFT2D(&fft_plan, fft_buf, extent, (extent + block_size), 1);
+        if (pass < 2) {
+          storeAiryBlock(bsr_state, fft_buf, fft_size, extent, block_camera[pass], image_start, block_x[pass], block_y[pass], -1);
+        } else {
+          for (i=0; i < 2; i++) {
+            if (found[i] == 1) {
+              storeAiryBlock(bsr_state, fft_buf, fft_size, extent, block_camera[i], image_start, block_x[i], block_y[i], i);
+            }
+          }
+        }
+        checkCancel(bsr_state);
+      } // end for pass
+    } // end for block_pair
+  } // end while nextRowBlock
+  freeFFT(&fft_plan);
+  free(fft_buf);
+
+  traceEnd(bsr_state, trace_event);
+
+  //
+  // worker threads: signal this thread is done and wait until main thread says we can continue to next step.
+  // main thread: wait until all other threads are done and then signal that they can continue to next step.
+  //
+  if (bsr_state->perthread->my_pid != bsr_state->main_pid) {
+    bsr_state->status_array[bsr_state->perthread->my_thread_id].status=THREAD_STATUS_AIRY_CONVOLVE_COMPLETE;
+    waitForMainThread(bsr_state, THREAD_STATUS_AIRY_COPY_BEGIN);
+  } else {
+    waitForWorkerThreads(bsr_state, THREAD_STATUS_AIRY_CONVOLVE_COMPLETE);
+    // ready to continue, rows of all cameras in the current image are handed out as one range
+    initRowBlocks(bsr_state, num_rows, 1);
+    for (i=1; i <= bsr_state->num_worker_threads; i++) {
+      bsr_state->status_array[i].status=THREAD_STATUS_AIRY_COPY_BEGIN;
+    }
+  } // end if not main thread
+
+  trace_event=traceBegin(bsr_state, "Airy disk copy", NULL);
+
+  //
+  // all threads: copy convolved rows back to the image composition buffer and add skyglow
+  //
+  if (bsr_config->skyglow_enable == 1) {
+    skyglow_enable=1;
+    skyglowRGB(bsr_config, bsr_state, &skyglow_red, &skyglow_green, &skyglow_blue);
+  } else {
+    skyglow_enable=0;
+  }
+  while (nextRowBlock(bsr_state, &first_row, &end_row) == 1) {
+    for (row=first_row; row < end_row; row++) {
+      //
+      // find this row's camera
+      //
+      camera=NULL;
+      camera_first_row=0;
+      for (camera_index=0; camera_index < bsr_state->num_cameras; camera_index++) {
+        camera=bsr_state->camera + camera_index;
+        if ((camera->image_offset < image_start) || (camera->image_offset >= image_end)) {
+          continue;
+        }
+        camera_rows=camera->tile_y_max - camera->tile_y_min;
+        if (row < (camera_first_row + camera_rows)) {
+          break;
+        }
+        camera_first_row+=camera_rows;
+      }
+      composition_offset=camera->image_offset + ((uint64_t)camera->image_stride * (uint64_t)(row - camera_first_row));
+      blur_offset=composition_offset - image_start;
+      for (x=0; x < camera->camera_res_x; x++) {
+        loadPixel(bsr_state->image_blur_buf, blur_precision, blur_offset, &pixel_r, &pixel_g, &pixel_b);
+        if ((skyglow_enable == 1) && (pixelHasSkyglow(camera, x, (camera->tile_y_min + (row - camera_first_row))) == 1)) {
+          pixel_r+=skyglow_red;
+          pixel_g+=skyglow_green;
+          pixel_b+=skyglow_blue;
+        }
+        storePixel(bsr_state->image_composition_buf, composition_precision, composition_offset, pixel_r, pixel_g, pixel_b);
+        composition_offset++;
+        blur_offset++;
+      }
+      checkCancel(bsr_state);
+    } // end for row
+  } // end while nextRowBlock
+
+  traceEnd(bsr_state, trace_event);
+
+  //
+  // worker threads: signal this thread is done and wait until main thread says we can continue to next step.
+  // main thread: wait until all other threads are done and then signal that they can continue to next step.
+  //
+  if (bsr_state->perthread->my_pid != bsr_state->main_pid) {
+    bsr_state->status_array[bsr_state->perthread->my_thread_id].status=THREAD_STATUS_AIRY_COPY_COMPLETE;
+    waitForMainThread(bsr_state, THREAD_STATUS_AIRY_CONVOLVE_CONTINUE);
+  } else {
+    waitForWorkerThreads(bsr_state, THREAD_STATUS_AIRY_COPY_COMPLETE);
+    // ready to continue, set all worker thread status to continue
+    for (i=1; i <= bsr_state->num_worker_threads; i++) {
+      bsr_state->status_array[i].status=THREAD_STATUS_AIRY_CONVOLVE_CONTINUE;
+    }
+  } // end if not main thread
+
+  //
+  // main thread: display execution time if not in CGI mode
+  //
+  if ((bsr_state->perthread->my_pid == bsr_state->main_pid) && (bsr_config->cgi_mode != 1) && (bsr_config->print_status == 1)) {
+    clock_gettime(CLOCK_REALTIME, &endtime);
+    elapsed_time=((double)(endtime.tv_sec - 1500000000) + ((double)endtime.tv_nsec / 1.0E9)) - ((double)(starttime.tv_sec - 1500000000) + ((double)starttime.tv_nsec) / 1.0E9);
+    printf(" (%.3fs)\n", elapsed_time);
+    fflush(stdout);
+  } // end if main thread
+
+  return(0);
+}
@@ -39,6 +39,13 @@
 #ifndef BSR_DIFFRACTION_H
 #define BSR_DIFFRACTION_H
 
+int AiryFFTSize(bsr_config_t *bsr_config, int res_x, int res_y);
+int initAirySpectra(bsr_config_t *bsr_config, bsr_state_t *bsr_state);
 int initAiryMaps(bsr_config_t *bsr_config, bsr_state_t *bsr_state);
+int AiryBlock(bsr_state_t *bsr_state, uint64_t image_start, uint64_t image_end, int block_size, int block_index, bsr_camera_t **camera, int *block_x, int *block_y);
+int loadAiryBlock(bsr_state_t *bsr_state, double *fft_buf, int fft_size, int extent, bsr_camera_t *camera, int block_x, int block_y, int blue_part, int *first_row, int *end_row);
+int storeAiryBlock(bsr_state_t *bsr_state, double *fft_buf, int fft_size, int extent, bsr_camera_t *camera, uint64_t image_start, int block_x, int block_y, int blue_part);
+int multiplyAirySpectra(bsr_state_t *bsr_state, double *fft_buf, int fft_size, int blue);
+int convolveAiryDisks(bsr_config_t *bsr_config, bsr_state_t *bsr_state);
 
 #endif // BSR_DIFFRACTION_H
@@ -0,0 +1,219 @@
+//
+// Billion Star 3D Rendering Engine
+// Kevin M. Loch
+//
+// 3D rendering engine for the ESA Gaia DR3 star dataset
+
+/*
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2021, Kevin Loch
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "bsrender.h" // needs to be first to get GNU_SOURCE define for strcasestr
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "fft.h"
+
+//
+// In-tree radix-2 FFT used to convolve the image composition buffer with large point spread functions. Complex
+// values are interleaved (real, imaginary) doubles. Transforms are unnormalized, the caller scales by 1/n per
+// dimension. Two real images are transformed at once by putting the second in the imaginary part
+//
+
+int initFFT(fft_plan_t *fft_plan, int n) {
+  int i;
+  int j;
+  int bit;
+  int log2_n;
+  double angle;
+
+  //
+  // n must be a power of two
+  //
+  log2_n=0;
+  while ((1 << log2_n) < n) {
+    log2_n++;
+  }
+  if ((1 << log2_n) != n) {
+    return(1);
+  }
+
+  fft_plan->n=n;
+  fft_plan->twiddle=(double *)malloc((size_t)n * sizeof(double));
+  fft_plan->bit_reverse=(int *)malloc((size_t)n * sizeof(int));
+  if ((fft_plan->twiddle == NULL) || (fft_plan->bit_reverse == NULL)) {
+    freeFFT(fft_plan);
+    return(1);
+  }
+
+  //
+  // twiddle factors exp(-2*pi*i*k/n) for k < n/2
+  //
+  for (i=0; i < (n / 2); i++) {
+    angle=-2.0 * M_PI * (double)i / (double)n;
+    fft_plan->twiddle[(i * 2)]=cos(angle);
+    fft_plan->twiddle[(i * 2) + 1]=sin(angle);
+  }
+
+  //
+  // bit reversal permutation
+  //
+  for (i=0; i < n; i++) {
+    j=0;
+    for (bit=0; bit < log2_n; bit++) {
+      if ((i & (1 << bit)) != 0) {
+        j|=(1 << (log2_n - 1 - bit));
+      }
+    }
+    fft_plan->bit_reverse[i]=j;
+  }
+
+  return(0);
+}
+
+int freeFFT(fft_plan_t *fft_plan) {
+  if (fft_plan->twiddle != NULL) {
+    free(fft_plan->twiddle);
+    fft_plan->twiddle=NULL;
+  }
+  if (fft_plan->bit_reverse != NULL) {
+    free(fft_plan->bit_reverse);
+    fft_plan->bit_reverse=NULL;
+  }
+
+  return(0);
+}
+
+int complexFFTLanes(fft_plan_t *fft_plan, double *buf, int lanes, int stride, int inverse) {
+  //
+  // transform n elements in place, each element is 'lanes' adjacent complex values transformed independently, like
+  // the columns of a strip of an image. Elements are 'stride' complex values apart
+  //
+  int n;
+  int i;
+  int j;
+  int half;
+  int start;
+  int k;
+  int twiddle_step;
+  int lane_i;
+  int lane_doubles;
+  size_t element_doubles;
+  double *a_p;
+  double *b_p;
+  double t;
+  double t_re;
+  double t_im;
+  double w_re;
+  double w_im;
+
+  n=fft_plan->n;
+  lane_doubles=lanes * 2;
+  element_doubles=(size_t)stride * 2;
+
+  //
+  // bit reversal permutation of whole elements
+  //
+  for (i=0; i < n; i++) {
+    j=fft_plan->bit_reverse[i];
+    if (i < j) {
+      a_p=buf + ((size_t)i * element_doubles);
+      b_p=buf + ((size_t)j * element_doubles);
+      for (lane_i=0; lane_i < lane_doubles; lane_i++) {
+        t=a_p[lane_i];
+        a_p[lane_i]=b_p[lane_i];
+        b_p[lane_i]=t;
+      }
+    }
+  }
+
+  //
+  // butterflies, the inverse transform uses conjugate twiddle factors
+  //
+  for (half=1; half < n; half*=2) {
+    twiddle_step=n / (half * 2);
+    for (start=0; start < n; start+=(half * 2)) {
+      for (k=0; k < half; k++) {
+        w_re=fft_plan->twiddle[(k * twiddle_step * 2)];
+        w_im=fft_plan->twiddle[(k * twiddle_step * 2) + 1];
+        if (inverse == 1) {
+          w_im=-w_im;
+        }
+        a_p=buf + ((size_t)(start + k) * element_doubles);
+        b_p=a_p + ((size_t)half * element_doubles);
+        for (lane_i=0; lane_i < lane_doubles; lane_i+=2) {
+          t_re=(w_re * b_p[lane_i]) - (w_im * b_p[lane_i + 1]);
+          t_im=(w_re * b_p[lane_i + 1]) + (w_im * b_p[lane_i]);
+          b_p[lane_i]=a_p[lane_i] - t_re;
+          b_p[lane_i + 1]=a_p[lane_i + 1] - t_im;
+          a_p[lane_i]+=t_re;
+          a_p[lane_i + 1]+=t_im;
+        } // end for lane_i
+      } // end for k
+    } // end for start
+  } // end for half
+
+  return(0);
+}
+
+int complexFFT2D(fft_plan_t *fft_plan, double *buf, int first_row, int end_row, int inverse) {
+  //
+  // 2D transform of an n x n buffer. Only rows [first_row..end_row) are transformed in the row pass: for the
+  // forward transform the other rows must be zero on input, for the inverse transform the other rows are not
+  // needed on output. Columns are transformed in strips of BSR_FFT_STRIP_WIDTH so each strip stays in cache
+  //
+  int n;
+  int row;
+  int strip_x;
+  int strip_width;
+
+  n=fft_plan->n;
+
+  if (inverse == 0) {
+    for (row=first_row; row < end_row; row++) {
+      complexFFTLanes(fft_plan, (buf + ((size_t)row * (size_t)n * 2)), 1, 1, 0);
+    }
+  }
+  for (strip_x=0; strip_x < n; strip_x+=BSR_FFT_STRIP_WIDTH) {
+    strip_width=n - strip_x;
+    if (strip_width > BSR_FFT_STRIP_WIDTH) {
+      strip_width=BSR_FFT_STRIP_WIDTH;
+    }
+    complexFFTLanes(fft_plan, (buf + ((size_t)strip_x * 2)), strip_width, n, inverse);
+  }
+  if (inverse == 1) {
+    for (row=first_row; row < end_row; row++) {
+      complexFFTLanes(fft_plan, (buf + ((size_t)row * (size_t)n * 2)), 1, 1, 1);
+    }
+  }
+
+  return(0);
+}
@@ -0,0 +1,359 @@
+//
+// Billion Star 3D Rendering Engine
+// Kevin M. Loch
+//
+// 3D rendering engine for the ESA Gaia DR3 star dataset
+
+/*
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2021, Kevin Loch
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "bsrender.h" // needs to be first to get GNU_SOURCE define for strcasestr
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <utime.h>
+#include "image-cache.h"
+#include "cgi.h"
+
+//
+// The image cache stores encoded CGI images in cache_directory so identical requests are served without rendering.
+// Images are keyed by a 128-bit FNV-1a hash of the effective configuration (after CGI options, cgi_ limits and
+// validation) with options that don't change the image cleared, combined with the name, size and modification time
+// of every file in data_file_directory and the bsrender version.
+//
+// Images are written to a temporary file as they are sent to the client and renamed into place only when complete.
+// The cache is limited to cache_size_limit MB by removing the least recently used images (hits update the file
+// modification time).
+//
+
+typedef unsigned __int128 bsr_hash_t;
+
+bsr_hash_t hashBytes(bsr_hash_t hash, const void *data, size_t size) {
+  const unsigned char *data_p;
+  const bsr_hash_t fnv_prime=((bsr_hash_t)0x0000000001000000ull << 64) | (bsr_hash_t)0x000000000000013Bull;
+  size_t i;
+
+  data_p=(const unsigned char *)data;
+  for (i=0; i < size; i++) {
+    hash^=(bsr_hash_t)data_p[i];
+    hash*=fnv_prime;
+  }
+
+  return(hash);
+}
+
+bsr_hash_t hashDataFiles(bsr_config_t *bsr_config) {
+  //
+  // combine name, size and modification time of each file in data_file_directory. Per-file hashes are added so
+  // the result does not depend on directory order
+  //
+  const bsr_hash_t fnv_offset=((bsr_hash_t)0x6c62272e07bb0142ull << 64) | (bsr_hash_t)0x62b821756295c58dull;
+  DIR *data_dir;
+  struct dirent *dir_entry;
+  struct stat sb;
+  char file_path[1024];
+  bsr_hash_t file_hash;
+  bsr_hash_t sum;
+
+  sum=0;
+  data_dir=opendir(bsr_config->data_file_directory);
+  if (data_dir == NULL) {
+    return(sum);
+  }
+  dir_entry=readdir(data_dir);
+  while (dir_entry != NULL) {
+    snprintf(file_path, 1024, "%s/%s", bsr_config->data_file_directory, dir_entry->d_name);
+    if ((stat(file_path, &sb) == 0) && S_ISREG(sb.st_mode)) {
+      file_hash=hashBytes(fnv_offset, dir_entry->d_name, strlen(dir_entry->d_name));
+      file_hash=hashBytes(file_hash, &sb.st_size, sizeof(sb.st_size));
+      file_hash=hashBytes(file_hash, &sb.st_mtime, sizeof(sb.st_mtime));
+      sum+=file_hash;
+    }
+    dir_entry=readdir(data_dir);
+  }
+  closedir(data_dir);
+
+  return(sum);
+}
+
+int imageCacheKey(bsr_config_t *bsr_config, char *key_33) {
+  const bsr_hash_t fnv_offset=((bsr_hash_t)0x6c62272e07bb0142ull << 64) | (bsr_hash_t)0x62b821756295c58dull;
+  bsr_config_t canonical_config;
+  bsr_hash_t hash;
+  bsr_hash_t data_files_hash;
+  struct stat sb;
+
+  //
+  // canonical configuration: clear options that only affect performance, logging or file locations. initConfig()
+  // zeroes the whole struct and string options are zero padded, so the remaining bytes are deterministic
+  //
+  memcpy(&canonical_config, bsr_config, sizeof(bsr_config_t));
+  canonical_config.QUERY_STRING_p=NULL;
+  memset(canonical_config.bsrender_cfg_version, 0, sizeof(canonical_config.bsrender_cfg_version));
+  memset(canonical_config.config_file_name, 0, sizeof(canonical_config.config_file_name));
+  memset(canonical_config.output_file_name, 0, sizeof(canonical_config.output_file_name));
+  memset(canonical_config.daemon_socket, 0, sizeof(canonical_config.daemon_socket));
+  memset(canonical_config.cache_directory, 0, sizeof(canonical_config.cache_directory));
+  canonical_config.cache_size_limit=0;
+  canonical_config.cgi_cache_max_age=0;
+  canonical_config.image_writer_threads=0;
+  canonical_config.output_band_rows=0;
+  canonical_config.progressive=0;
+  canonical_config.print_status=0;
+  canonical_config.num_threads=0;
+  canonical_config.per_thread_buffer=0;
+  canonical_config.per_thread_buffer_Airy=0;
+
+  //
+  // hash bsrender version, configuration, data files and composition file
+  //
+  hash=hashBytes(fnv_offset, BSR_VERSION, strlen(BSR_VERSION));
+  hash=hashBytes(hash, &canonical_config, sizeof(bsr_config_t));
+  data_files_hash=hashDataFiles(bsr_config);
+  hash=hashBytes(hash, &data_files_hash, sizeof(data_files_hash));
+  if ((bsr_config->load_composition_file_name[0] != 0) && (stat(bsr_config->load_composition_file_name, &sb) == 0)) {
+    // image composition buffer is loaded from a composition file instead of the data files
+    hash=hashBytes(hash, &sb.st_size, sizeof(sb.st_size));
+    hash=hashBytes(hash, &sb.st_mtime, sizeof(sb.st_mtime));
+  }
+  snprintf(key_33, 33, "%016llx%016llx", (unsigned long long)(hash >> 64), (unsigned long long)hash);
+
+  return(0);
+}
+
+int checkImageCache(bsr_config_t *bsr_config, bsr_cache_t *bsr_cache) {
+  //
+  // This function computes the cache key for this request and sends the cached image (with CGI header) if there is
+  // one. Returns 0 if the image was served from the cache.
+  //
+  FILE *cached_file;
+  char buf[65536];
+  size_t bytes_read;
+  const char *extension;
+
+  bsr_cache->cache_file=NULL;
+  bsr_cache->client_stream=NULL;
+  bsr_cache->write_failed=0;
+  imageCacheKey(bsr_config, bsr_cache->key);
+  if (bsr_config->image_format == 1) {
+    extension="exr";
+  } else if (bsr_config->image_format == 2) {
+    extension="jpg";
+  } else if (bsr_config->image_format == 3) {
+    extension="avif";
+  } else if (bsr_config->image_format == 4) {
+    extension="heif";
+  } else {
+    extension="png";
+  }
+  snprintf(bsr_cache->file_name, 512, "%s/%s.%s", bsr_config->cache_directory, bsr_cache->key, extension);
+  snprintf(bsr_cache->temp_file_name, 512, "%s/%s.%d.tmp", bsr_config->cache_directory, bsr_cache->key, (int)getpid());
+
+  cached_file=fopen(bsr_cache->file_name, "rb");
+  if (cached_file == NULL) {
+    return(1);
+  }
+
+  //
+  // cache hit: mark as recently used and send header and image
+  //
+  utime(bsr_cache->file_name, NULL);
+  bsr_config->progressive=0; // the finished image is sent as a single image
+  printCGIHeader(bsr_config);
+  bytes_read=fread(buf, 1, sizeof(buf), cached_file);
+  while (bytes_read > 0) {
+    fwrite(buf, 1, bytes_read, stdout);
+    bytes_read=fread(buf, 1, sizeof(buf), cached_file);
+  }
+  fclose(cached_file);
+  fflush(stdout);
+
+  return(0);
+}
+
+ssize_t writeImageCacheTee(void *cookie, const char *buf, size_t size) {
+  //
+  // stdout write function while storing: send to the client and append to the temporary cache file
+  //
+  bsr_cache_t *bsr_cache;
+  size_t bytes_written;
+
+  bsr_cache=(bsr_cache_t *)cookie;
+  bytes_written=fwrite(buf, 1, size, bsr_cache->client_stream);
+  fflush(bsr_cache->client_stream);
+  if ((bsr_cache->write_failed == 0) && (fwrite(buf, 1, size, bsr_cache->cache_file) != size)) {
+    bsr_cache->write_failed=1;
+  }
+
+  return((ssize_t)bytes_written);
+}
+
+int beginImageCache(bsr_config_t *bsr_config, bsr_cache_t *bsr_cache) {
+  //
+  // This function replaces stdout with a stream that also writes the image to a temporary cache file. Called after
+  // the CGI header is printed, which is not cached.
+  //
+  cookie_io_functions_t tee_functions;
+  FILE *tee_stream;
+
+  bsr_cache->cache_file=fopen(bsr_cache->temp_file_name, "wb");
+  if (bsr_cache->cache_file == NULL) {
+    return(1);
+  }
+  memset(&tee_functions, 0, sizeof(tee_functions));
+  tee_functions.write=writeImageCacheTee;
+  tee_stream=fopencookie(bsr_cache, "w", tee_functions);
+  if (tee_stream == NULL) {
+    fclose(bsr_cache->cache_file);
+    bsr_cache->cache_file=NULL;
+    unlink(bsr_cache->temp_file_name);
+    return(1);
+  }
+  fflush(stdout);
+  bsr_cache->client_stream=stdout;
+  stdout=tee_stream;
+
+  return(0);
+}
+
+typedef struct {
+  char name[256];
+  off_t size;
+  time_t mtime;
+} cache_entry_t;
+
+int compareCacheEntries(const void *a, const void *b) {
+  const cache_entry_t *entry_a=(const cache_entry_t *)a;
+  const cache_entry_t *entry_b=(const cache_entry_t *)b;
+
+  if (entry_a->mtime < entry_b->mtime) {
+    return(-1);
+  } else if (entry_a->mtime > entry_b->mtime) {
+    return(1);
+  }
+  return(0);
+}
+
+int evictImageCache(bsr_config_t *bsr_config) {
+  //
+  // remove least recently used images until the cache is within cache_size_limit, and temporary files left by
+  // requests that did not finish
+  //
+  DIR *cache_dir;
+  struct dirent *dir_entry;
+  struct stat sb;
+  char file_path[1024];
+  cache_entry_t *entries=NULL;
+  cache_entry_t *new_entries;
+  int num_entries=0;
+  int max_entries=0;
+  uint64_t total_size=0;
+  uint64_t size_limit;
+  time_t now;
+  int i;
+
+  cache_dir=opendir(bsr_config->cache_directory);
+  if (cache_dir == NULL) {
+    return(1);
+  }
+  now=time(NULL);
+  dir_entry=readdir(cache_dir);
+  while (dir_entry != NULL) {
+    snprintf(file_path, 1024, "%s/%s", bsr_config->cache_directory, dir_entry->d_name);
+    if ((strlen(dir_entry->d_name) > 33) && (strlen(dir_entry->d_name) < 256) && (dir_entry->d_name[32] == '.')\
+     && (strspn(dir_entry->d_name, "0123456789abcdef") == 32) && (stat(file_path, &sb) == 0) && S_ISREG(sb.st_mode)) {
+      if (strstr(dir_entry->d_name, ".tmp") != NULL) {
+        // temporary file more than an hour old is from a request that died
+        if ((now - sb.st_mtime) > 3600) {
+          unlink(file_path);
+        }
+      } else {
+        if (num_entries == max_entries) {
+          max_entries=(max_entries == 0) ? 1024 : (max_entries * 2);
+          new_entries=(cache_entry_t *)realloc(entries, ((size_t)max_entries * sizeof(cache_entry_t)));
+          if (new_entries == NULL) {
+            break;
+          }
+          entries=new_entries;
+        }
+        strcpy(entries[num_entries].name, dir_entry->d_name);
+        entries[num_entries].size=sb.st_size;
+        entries[num_entries].mtime=sb.st_mtime;
+        total_size+=(uint64_t)sb.st_size;
+        num_entries++;
+      }
+    }
+    dir_entry=readdir(cache_dir);
+  }
+  closedir(cache_dir);
+
+  size_limit=(uint64_t)bsr_config->cache_size_limit * 1024ull * 1024ull;
+  if (total_size > size_limit) {
+    qsort(entries, num_entries, sizeof(cache_entry_t), compareCacheEntries);
+    for (i=0; ((i < num_entries) && (total_size > size_limit)); i++) {
+      snprintf(file_path, 1024, "%s/%s", bsr_config->cache_directory, entries[i].name);
+      unlink(file_path);
+      total_size-=(uint64_t)entries[i].size;
+    }
+  }
+  free(entries);
+
+  return(0);
+}
+
+int endImageCache(bsr_config_t *bsr_config, bsr_cache_t *bsr_cache) {
+  //
+  // This function finishes storing the image after it has been completely sent: restore stdout, move the temporary
+  // file into place (atomic rename), and enforce the cache size limit. Called by main thread only.
+  //
+  FILE *tee_stream;
+
+  if (bsr_cache->cache_file == NULL) {
+    return(1);
+  }
+  tee_stream=stdout;
+  fflush(tee_stream);
+  stdout=bsr_cache->client_stream;
+  fclose(tee_stream);
+  fflush(stdout);
+  if ((fclose(bsr_cache->cache_file) != 0) || (bsr_cache->write_failed == 1) || (rename(bsr_cache->temp_file_name, bsr_cache->file_name) != 0)) {
+    unlink(bsr_cache->temp_file_name);
+  }
+  bsr_cache->cache_file=NULL;
+  evictImageCache(bsr_config);
+
+  return(0);
+}
@@ -38,6 +38,7 @@
 
 #include "bsrender.h" // needs to be first to get GNU_SOURCE define for strcasestr
 #include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
 #include <time.h>
 #include "util.h"
@@ -45,51 +46,143 @@
 #include "Gaussian-blur.h"
 #include "overlay.h"
 #include "Gaia-passbands.h"
+#include "pixel-buffer.h"
+#include "composition-file.h"
+
+int pixelHasSkyglow(bsr_camera_t *camera, int current_image_x, int current_image_y) {
+  //
+  // returns 1 if a raster pixel is inside the valid rendering area of the camera's raster projection, which is where
+  // skyglow is applied
+  //
+  int pixel_has_skyglow;
+  double pixel_x_distance;
+  double pixel_y_distance;
+  const double pi_over_2=0.5 * M_PI;
+  double semimajor2;
+  double semiminor2;
+  double elipse;
+  double circle_r2;
+  double circle;
+  double aesthetic_edge=0.4999999; // for rectangular edges, this instead of 0.5 eliminates an extra skyglow pixel on "even" pixel raster sizes without being too small for reasonable arbitrary raster sizes
+
+  circle_r2=((pi_over_2 * camera->pixels_per_radian) + 0.5) * ((pi_over_2 * camera->pixels_per_radian) + 0.5);
+  semimajor2=((M_PI * camera->pixels_per_radian) + 0.5) * ((M_PI * camera->pixels_per_radian) + 0.5);
+  semiminor2=((pi_over_2 * camera->pixels_per_radian) + 0.5) * ((pi_over_2 * camera->pixels_per_radian) + 0.5);
+
+  if (camera->camera_projection == 0) { // equirectangular (lat/lon)
+    pixel_has_skyglow=0;
+    pixel_y_distance=fabs((double)current_image_y - camera->camera_half_res_y + 0.5);
+    pixel_x_distance=fabs((double)current_image_x - camera->camera_half_res_x + 0.5);
+    if ((pixel_x_distance <= ((M_PI * camera->pixels_per_radian) + aesthetic_edge)) && (pixel_y_distance <= ((pi_over_2 * camera->pixels_per_radian) + aesthetic_edge))) {
+       pixel_has_skyglow=1;
+    }
+  } else if ((camera->camera_projection == 1) && (camera->spherical_orientation == 0)) { // forward centered spherical
+    pixel_has_skyglow=0;
+    pixel_y_distance=(double)current_image_y - camera->camera_half_res_y + 0.5;
+    // center zone
+    pixel_x_distance=(double)current_image_x - camera->camera_half_res_x + 0.5;
+    circle=((pixel_x_distance * pixel_x_distance) + (pixel_y_distance * pixel_y_distance)) / circle_r2;
+    if (circle <= 1.0) {
+      pixel_has_skyglow=1;
+    }
+    // left zone
+    pixel_x_distance=(double)current_image_x - camera->camera_half_res_x + (M_PI * camera->pixels_per_radian) + 0.5;
+    circle=((pixel_x_distance * pixel_x_distance) + (pixel_y_distance * pixel_y_distance)) / circle_r2;
+    if ((circle <= 1.0) && (pixel_x_distance >= -aesthetic_edge)) {
+      pixel_has_skyglow=1;
+    }
+    // right zone
+    pixel_x_distance=(double)current_image_x - camera->camera_half_res_x - (M_PI * camera->pixels_per_radian) + 0.5;
+    circle=((pixel_x_distance * pixel_x_distance) + (pixel_y_distance * pixel_y_distance)) / circle_r2;
+    if ((circle <= 1.0) && (pixel_x_distance <= aesthetic_edge)) {
+      pixel_has_skyglow=1;
+    }
+  } else if ((camera->camera_projection == 1) && (camera->spherical_orientation == 1)) { // side-by-side spherical
+    pixel_has_skyglow=0;
+    pixel_y_distance=(double)current_image_y - camera->camera_half_res_y + 0.5;
+    // left zone
+    pixel_x_distance=(double)current_image_x - camera->camera_half_res_x + (pi_over_2 * camera->pixels_per_radian) + 0.5;
+    circle=((pixel_x_distance * pixel_x_distance) + (pixel_y_distance * pixel_y_distance)) / circle_r2;
+    if (circle <= 1.0) {
+      pixel_has_skyglow=1;
+    }
+    // right zone
+    pixel_x_distance=(double)current_image_x - camera->camera_half_res_x - (pi_over_2 * camera->pixels_per_radian) + 0.5;
+    circle=((pixel_x_distance * pixel_x_distance) + (pixel_y_distance * pixel_y_distance)) / circle_r2;
+    if (circle <= 1.0) {
+      pixel_has_skyglow=1;
+    }
+  } else if ((camera->camera_projection == 2) || (camera->camera_projection == 3)) { // Hammer or Mollewide ellipse
+    pixel_has_skyglow=0;
+    pixel_y_distance=(double)current_image_y - camera->camera_half_res_y + 0.5;
+    pixel_x_distance=(double)current_image_x - camera->camera_half_res_x + 0.5;
+    elipse=(pixel_x_distance * pixel_x_distance / semimajor2) + (pixel_y_distance * pixel_y_distance / semiminor2);
+    if (elipse <= 1.0) {
+      pixel_has_skyglow=1;
+    }
+  } else {
+    pixel_has_skyglow=1;
+  } // end if inside valid rendering area
+
+  return(pixel_has_skyglow);
+}
+
+int skyglowRGB(bsr_config_t *bsr_config, bsr_state_t *bsr_state, double *skyglow_red, double *skyglow_green, double *skyglow_blue) {
+  //
+  // skyglow rgb values, scaled for the image composition buffer
+  // note: rgb lookup table values are adjusted for Gaia Gband transmissivity, so we must uncorrect for that with Gaia_Gband_scalar
+  //
+  int skyglow_temp;
+  double skyglow_intensity;
+
+  skyglow_temp=(int)(bsr_config->skyglow_temp + 0.5);
+  skyglow_intensity=Gaia_Gband_scalar * pow(100.0, (-bsr_config->skyglow_per_pixel_mag / 5.0));
+  *skyglow_red=skyglow_intensity * bsr_state->rgb_red[skyglow_temp] * bsr_state->composition_prescale;
+  *skyglow_green=skyglow_intensity * bsr_state->rgb_green[skyglow_temp] * bsr_state->composition_prescale;
+  *skyglow_blue=skyglow_intensity * bsr_state->rgb_blue[skyglow_temp] * bsr_state->composition_prescale;
+
+  return(0);
+}
 
 int initImageCompositionBuffer(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
   struct timespec starttime;
   struct timespec endtime;
   double elapsed_time;
-  uint64_t image_offset;
   int current_image_x;
   int current_image_y;
-  pixel_composition_t *current_image_p;
-  int current_image_res_x;
-  int current_image_res_y;
-  int lines_per_thread;
+  uint64_t current_image_offset;
+  int composition_precision;
+  int current_image_res_x=0;
+  int num_rows;
+  int first_row;
+  int end_row;
+  int row;
+  int camera_first_row;
   int i;
-  int skyglow_temp;
-  double skyglow_intensity;
+  int skyglow_enable;
   double skyglow_red=0.0;
   double skyglow_green=0.0;
   double skyglow_blue=0.0;
   int pixel_has_skyglow=0;
-  double pixel_x_distance;
-  double pixel_y_distance;
-  const double pi_over_2=0.5 * M_PI;
-  double semimajor2=0.0;
-  double semiminor2=0.0;
-  double elipse;
-  double circle_r2=0.0;
-  double circle;
-  double aesthetic_edge=0.4999999; // for rectangular edges, this instead of 0.5 eliminates an extra skyglow pixel on "even" pixel raster sizes without being too small for reasonable arbitrary raster sizes
-
-  //
-  // all threads: get current image resolution and lines per thread
-  //
-  current_image_res_x=bsr_state->current_image_res_x;
-  current_image_res_y=bsr_state->current_image_res_y;
-  lines_per_thread=(int)ceil(((double)current_image_res_y / (double)(bsr_state->num_worker_threads + 1)));
-  if (lines_per_thread < 1) {
-    lines_per_thread=1;
-  }
+  int camera_index;
+  int current_camera_index;
+  bsr_camera_t *camera=NULL;
+  float *load_row_buf=NULL;
+  int load_res_x;
+  int trace_event;
 
   //
   // main thread: display status message if not in CGI mode
   //
   if ((bsr_state->perthread->my_pid == bsr_state->main_pid) && (bsr_config->cgi_mode != 1) && (bsr_config->print_status == 1)) {
     clock_gettime(CLOCK_REALTIME, &starttime);
-    printf("Initializing image composition buffer %dx%d...", current_image_res_x, current_image_res_y);
+    if (bsr_state->composition_load_fd != -1) {
+      printf("Loading image composition buffer from %s...", bsr_config->load_composition_file_name);
+    } else if (bsr_state->num_cameras > 1) {
+      printf("Initializing image composition buffers for %d cameras...", bsr_state->num_cameras);
+    } else {
+      printf("Initializing image composition buffer %dx%d...", bsr_state->camera[0].camera_res_x, bsr_state->camera[0].camera_res_y);
+    }
     fflush(stdout);
   }
 
@@ -101,115 +194,109 @@ int initImageCompositionBuffer(bsr_config_t *bsr_config, bsr_state_t *bsr_state)
     // worker thread
     waitForMainThread(bsr_state, THREAD_STATUS_INIT_IMAGECOMP_BEGIN);
   } else {
-    // main thread
+    // main thread: rows of all cameras are handed out as one range, in camera order
+    num_rows=0;
+    for (camera_index=0; camera_index < bsr_state->num_cameras; camera_index++) {
+      num_rows+=(bsr_state->camera[camera_index].tile_y_max - bsr_state->camera[camera_index].tile_y_min);
+    }
+    initRowBlocks(bsr_state, num_rows, 1);
     for (i=1; i <= bsr_state->num_worker_threads; i++) {
       bsr_state->status_array[i].status=THREAD_STATUS_INIT_IMAGECOMP_BEGIN;
     }
   }
 
+  trace_event=traceBegin(bsr_state, "Init image composition", NULL);
+
   //
-  // all threads: set skyglow variables enabled
-  //
-  if (bsr_config->skyglow_enable == 1) {
-    // skyglow rgb values
-    // note: rgb lookup table values are adjusted for Gaia Gband transmissivity, so we must uncorrect for that with Gaia_Gband_scalar
-    skyglow_temp=(int)(bsr_config->skyglow_temp + 0.5);
-    skyglow_intensity=Gaia_Gband_scalar * pow(100.0, (-bsr_config->skyglow_per_pixel_mag / 5.0));
-    skyglow_red=skyglow_intensity * bsr_state->rgb_red[skyglow_temp];
-    skyglow_green=skyglow_intensity * bsr_state->rgb_green[skyglow_temp];
-    skyglow_blue=skyglow_intensity * bsr_state->rgb_blue[skyglow_temp];
-    // set shortcut variables we don't need to calculate for each pixel
-    circle_r2=((pi_over_2 * bsr_state->pixels_per_radian) + 0.5) * ((pi_over_2 * bsr_state->pixels_per_radian) + 0.5);
-    semimajor2=((M_PI * bsr_state->pixels_per_radian) + 0.5) * ((M_PI * bsr_state->pixels_per_radian) + 0.5);
-    semiminor2=((pi_over_2 * bsr_state->pixels_per_radian) + 0.5) * ((pi_over_2 * bsr_state->pixels_per_radian) + 0.5);
+  // all threads: skyglow rgb values. With Airy_disk_mode=1 skyglow is added after the stars are convolved with the
+  // Airy disk instead
+  //
+  if ((bsr_config->skyglow_enable == 1) && (bsr_config->Airy_disk_mode == 0)) {
+    skyglow_enable=1;
+    skyglowRGB(bsr_config, bsr_state, &skyglow_red, &skyglow_green, &skyglow_blue);
+  } else {
+    skyglow_enable=0;
   }
 
   //
-  // all threads: initialize image composition buffer
-  //
-  current_image_x=0;
-  current_image_y=bsr_state->perthread->my_thread_id * lines_per_thread;
-  current_image_p=bsr_state->current_image_buf + ((uint64_t)current_image_res_x * (uint64_t)current_image_y);
-  for (image_offset=0; ((image_offset < ((uint64_t)bsr_state->current_image_res_x * (uint64_t)lines_per_thread)) && (current_image_y < current_image_res_y)); image_offset++) {
-    //
-    // check if pixel is inside a valid rendering area for the selected raster projection
-    //
-    if (bsr_config->skyglow_enable == 1) {
-      if (bsr_config->camera_projection == 0) { // equirectangular (lat/lon)
-        pixel_has_skyglow=0;
-        pixel_y_distance=fabs((double)current_image_y - bsr_state->camera_half_res_y + 0.5);
-        pixel_x_distance=fabs((double)current_image_x - bsr_state->camera_half_res_x + 0.5);
-        if ((pixel_x_distance <= ((M_PI * bsr_state->pixels_per_radian) + aesthetic_edge)) && (pixel_y_distance <= ((pi_over_2 * bsr_state->pixels_per_radian) + aesthetic_edge))) {
-           pixel_has_skyglow=1;
-        }
-      } else if ((bsr_config->camera_projection == 1) && (bsr_config->spherical_orientation == 0)) { // forward centered spherical
-        pixel_has_skyglow=0;
-        pixel_y_distance=(double)current_image_y - bsr_state->camera_half_res_y + 0.5;
-        // center zone
-        pixel_x_distance=(double)current_image_x - bsr_state->camera_half_res_x + 0.5;
-        circle=((pixel_x_distance * pixel_x_distance) + (pixel_y_distance * pixel_y_distance)) / circle_r2;
-        if (circle <= 1.0) {
-          pixel_has_skyglow=1;
-        }
-        // left zone
-        pixel_x_distance=(double)current_image_x - bsr_state->camera_half_res_x + (M_PI * bsr_state->pixels_per_radian) + 0.5;
-        circle=((pixel_x_distance * pixel_x_distance) + (pixel_y_distance * pixel_y_distance)) / circle_r2;
-        if ((circle <= 1.0) && (pixel_x_distance >= -aesthetic_edge)) {
-          pixel_has_skyglow=1;
-        }
-        // right zone
-        pixel_x_distance=(double)current_image_x - bsr_state->camera_half_res_x - (M_PI * bsr_state->pixels_per_radian) + 0.5;
-        circle=((pixel_x_distance * pixel_x_distance) + (pixel_y_distance * pixel_y_distance)) / circle_r2;
-        if ((circle <= 1.0) && (pixel_x_distance <= aesthetic_edge)) {
-          pixel_has_skyglow=1;
-        }
-      } else if ((bsr_config->camera_projection == 1) && (bsr_config->spherical_orientation == 1)) { // side-by-side spherical
-        pixel_has_skyglow=0;
-        pixel_y_distance=(double)current_image_y - bsr_state->camera_half_res_y + 0.5;
-        // left zone
-        pixel_x_distance=(double)current_image_x - bsr_state->camera_half_res_x + (pi_over_2 * bsr_state->pixels_per_radian) + 0.5;
-        circle=((pixel_x_distance * pixel_x_distance) + (pixel_y_distance * pixel_y_distance)) / circle_r2;
-        if (circle <= 1.0) {
-          pixel_has_skyglow=1;
-        }
-        // right zone
-        pixel_x_distance=(double)current_image_x - bsr_state->camera_half_res_x - (pi_over_2 * bsr_state->pixels_per_radian) + 0.5;
-        circle=((pixel_x_distance * pixel_x_distance) + (pixel_y_distance * pixel_y_distance)) / circle_r2;
-        if (circle <= 1.0) {
-          pixel_has_skyglow=1;
-        }
-      } else if ((bsr_config->camera_projection == 2) || (bsr_config->camera_projection == 3)) { // Hammer or Mollewide ellipse
-        pixel_has_skyglow=0;
-        pixel_y_distance=(double)current_image_y - bsr_state->camera_half_res_y + 0.5;
-        pixel_x_distance=(double)current_image_x - bsr_state->camera_half_res_x + 0.5;
-        elipse=(pixel_x_distance * pixel_x_distance / semimajor2) + (pixel_y_distance * pixel_y_distance / semiminor2);
-        if (elipse <= 1.0) {
-          pixel_has_skyglow=1;
-        }
-      } else {
-        pixel_has_skyglow=1;
-      } // end if inside valid rendering area
-    } // end if skyglow enabled
-
-    //
-    // all threads: set pixel rgb background value (skyglow or 0.0)
-    //
-    if (pixel_has_skyglow == 1) {
-      current_image_p->r=skyglow_red;
-      current_image_p->g=skyglow_green;
-      current_image_p->b=skyglow_blue;
-    } else {
-      current_image_p->r=0.0;
-      current_image_p->g=0.0;
-      current_image_p->b=0.0;
+  // all threads: row buffer if the image composition buffer is loaded from a composition file
+  //
+  if (bsr_state->composition_load_fd != -1) {
+    load_res_x=0;
+    for (camera_index=0; camera_index < bsr_state->num_cameras; camera_index++) {
+      if (bsr_state->camera[camera_index].camera_res_x > load_res_x) {
+        load_res_x=bsr_state->camera[camera_index].camera_res_x;
+      }
     }
-    current_image_x++;
-    if (current_image_x == bsr_state->current_image_res_x) {
-      current_image_x=0;
-      current_image_y++;
+    load_row_buf=(float *)malloc((size_t)load_res_x * 3 * sizeof(float));
+    if (load_row_buf == NULL) {
+      if (bsr_config->cgi_mode != 1) {
+        printf("Error: could not allocate memory for composition file row buffer\n");
+        fflush(stdout);
+      }
+      exit(1);
     }
-    current_image_p++;
-  } // end for i
+  }
+
+  //
+  // all threads: initialize each block of rows of the image composition buffer
+  //
+  composition_precision=bsr_state->composition_precision;
+  current_camera_index=-1;
+  while (nextRowBlock(bsr_state, &first_row, &end_row) == 1) {
+    for (row=first_row; row < end_row; row++) {
+      //
+      // find this row's camera
+      //
+      camera_index=0;
+      camera_first_row=0;
+      while (row >= (camera_first_row + (bsr_state->camera[camera_index].tile_y_max - bsr_state->camera[camera_index].tile_y_min))) {
+        camera_first_row+=(bsr_state->camera[camera_index].tile_y_max - bsr_state->camera[camera_index].tile_y_min);
+        camera_index++;
+      }
+      if (camera_index != current_camera_index) {
+        current_camera_index=camera_index;
+        camera=bsr_state->camera + camera_index;
+        current_image_res_x=camera->camera_res_x;
+      } // end if new camera
+
+      //
+      // initialize this row, rows are whole raster unless tiled rendering
+      //
+      current_image_y=camera->tile_y_min + (row - camera_first_row);
+      current_image_offset=camera->image_offset + ((uint64_t)camera->image_stride * (uint64_t)(row - camera_first_row));
+      if (load_row_buf != NULL) {
+        // load_composition: row includes skyglow as it was saved
+        loadCompositionRow(bsr_config, bsr_state, camera, current_image_y, current_image_offset, load_row_buf);
+        checkCancel(bsr_state);
+        continue;
+      }
+      for (current_image_x=0; current_image_x < current_image_res_x; current_image_x++) {
+        //
+        // check if pixel is inside a valid rendering area for the selected raster projection
+        //
+        if (skyglow_enable == 1) {
+          pixel_has_skyglow=pixelHasSkyglow(camera, current_image_x, current_image_y);
+        } // end if skyglow enabled
+
+        //
+        // set pixel rgb background value (skyglow or 0.0)
+        //
+        if (pixel_has_skyglow == 1) {
+          storePixel(bsr_state->image_composition_buf, composition_precision, current_image_offset, skyglow_red, skyglow_green, skyglow_blue);
+        } else {
+          storePixel(bsr_state->image_composition_buf, composition_precision, current_image_offset, 0.0, 0.0, 0.0);
+        }
+        current_image_offset++;
+      } // end for current_image_x
+      checkCancel(bsr_state);
+    } // end for row
+  } // end while nextRowBlock
+  if (load_row_buf != NULL) {
+    free(load_row_buf);
+  }
+
+  traceEnd(bsr_state, trace_event);
 
   //
   // worker threads: signal this thread is done and wait until main thread says we can continue to next step.
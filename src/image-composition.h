@@ -39,6 +39,8 @@
 #ifndef BSR_IMAGE_COMPOSITION_H
 #define BSR_IMAGE_COMPOSITION_H
 
+int pixelHasSkyglow(bsr_camera_t *camera, int current_image_x, int current_image_y);
+int skyglowRGB(bsr_config_t *bsr_config, bsr_state_t *bsr_state, double *skyglow_red, double *skyglow_green, double *skyglow_blue);
 int initImageCompositionBuffer(bsr_config_t *bsr_config, bsr_state_t *bsr_state);
 
 #endif // BSR_IMAGE_COMPOSITION_H
@@ -41,6 +41,13 @@
 #include <stdlib.h>
 #include <sys/mman.h>
 #include <time.h>
+#include "util.h"
+#include "pixel-buffer.h"
+#include "tiled-render.h"
+#include "stream-output.h"
+#include "bsr-png.h"
+#include "progressive.h"
+#include "diffraction.h"
 
 int freeMemory(bsr_state_t *bsr_state) {
   if (bsr_state->image_composition_buf != NULL) {
@@ -52,12 +59,27 @@ int freeMemory(bsr_state_t *bsr_state) {
   if (bsr_state->image_resize_buf != NULL) {
     munmap(bsr_state->image_resize_buf, bsr_state->resize_buffer_size);
   }
+  if (bsr_state->image_progressive_buf != NULL) {
+    munmap(bsr_state->image_progressive_buf, bsr_state->progressive_buffer_size);
+  }
+  if (bsr_state->image_unprocessed_buf != NULL) {
+    munmap(bsr_state->image_unprocessed_buf, bsr_state->unprocessed_buffer_size);
+  }
   if (bsr_state->thread_buf != NULL) {
     munmap(bsr_state->thread_buf, bsr_state->thread_buffer_size);
   }
   if (bsr_state->status_array != NULL) {
     munmap(bsr_state->status_array, bsr_state->status_array_size);
   }
+  if (bsr_state->perf_stages != NULL) {
+    munmap(bsr_state->perf_stages, bsr_state->perf_stages_size);
+  }
+  if (bsr_state->trace_buffers != NULL) {
+    munmap(bsr_state->trace_buffers, bsr_state->trace_buffers_size);
+  }
+  if (bsr_state->render_stats != NULL) {
+    munmap(bsr_state->render_stats, bsr_state->render_stats_size);
+  }
   if (bsr_state->Airymap_red != NULL) {
     munmap(bsr_state->Airymap_red, bsr_state->Airymap_size);
   }
@@ -67,6 +89,9 @@ int freeMemory(bsr_state_t *bsr_state) {
   if (bsr_state->Airymap_blue != NULL) {
     munmap(bsr_state->Airymap_blue, bsr_state->Airymap_size);
   }
+  if (bsr_state->Airy_spectra != NULL) {
+    munmap(bsr_state->Airy_spectra, bsr_state->Airy_spectra_size);
+  }
   if (bsr_state->dedup_buf != NULL) {
     free(bsr_state->dedup_buf);
   }
@@ -88,6 +113,12 @@ int freeMemory(bsr_state_t *bsr_state) {
   if (bsr_state->compression_buf2 != NULL) {
     free(bsr_state->compression_buf2);
   }
+  if (bsr_state->stream_deflate_buf != NULL) {
+    munmap(bsr_state->stream_deflate_buf, bsr_state->stream_deflate_buf_size);
+  }
+  if (bsr_state->png_filter_buf != NULL) {
+    free(bsr_state->png_filter_buf);
+  }
   // must be freed last
   if (bsr_state != NULL) {
     munmap(bsr_state, bsr_state->bsr_state_size);
@@ -111,6 +142,30 @@ int allocateMemory(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
   int output_res_y;
   int lines_per_block=0;
   int pixel_data_size=0;
+  int png_row_bytes;
+  int image_index;
+  int output_index;
+  double output_scaling_factor;
+  int max_bits_per_color;
+  int exr_bits_per_color;
+  bsr_image_t *image;
+  uint64_t composition_pixels;
+  uint64_t image_pixels;
+  uint64_t max_image_pixels;
+  uint64_t resize_pixels;
+  uint64_t max_resize_pixels;
+  int max_output_res_x;
+  int max_output_res_y;
+  uint64_t max_output_pixels;
+  int tile_index;
+  int tile_y_min;
+  int tile_y_max;
+  int max_tile_rows;
+  int camera_index;
+  int max_camera_res_x;
+  int max_camera_res_y;
+  int quadrant_size;
+  uint64_t blur_pixels;
 
   //
   // allocate shared memory for Airy disk maps if Airy disk mode enabled
@@ -125,13 +180,117 @@ int allocateMemory(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
     bsr_state->Airymap_blue=(double *)mmap(NULL, bsr_state->Airymap_size, mmap_protection, mmap_visibility, -1, 0);
   }
 
+  //
+  // allocate shared memory for Airy disk transfer functions if Airy disks are convolved by FFT
+  //
+  if (bsr_config->Airy_disk_mode == 1) {
+    max_camera_res_x=0;
+    max_camera_res_y=0;
+    for (camera_index=0; camera_index < bsr_state->num_cameras; camera_index++) {
+      if (bsr_state->camera[camera_index].camera_res_x > max_camera_res_x) {
+        max_camera_res_x=bsr_state->camera[camera_index].camera_res_x;
+      }
+      if (bsr_state->camera[camera_index].camera_res_y > max_camera_res_y) {
+        max_camera_res_y=bsr_state->camera[camera_index].camera_res_y;
+      }
+    }
+    bsr_state->Airy_fft_size=AiryFFTSize(bsr_config, max_camera_res_x, max_camera_res_y);
+    quadrant_size=(bsr_state->Airy_fft_size / 2) + 1;
+    mmap_protection=PROT_READ | PROT_WRITE;
+    mmap_visibility=MAP_SHARED | MAP_ANONYMOUS;
+    bsr_state->Airy_spectra_size=(size_t)3 * (size_t)quadrant_size * (size_t)quadrant_size * sizeof(double);
+    bsr_state->Airy_spectra=(double *)mmap(NULL, bsr_state->Airy_spectra_size, mmap_protection, mmap_visibility, -1, 0);
+    if (bsr_state->Airy_spectra == MAP_FAILED) {
+      if (bsr_config->cgi_mode != 1) {
+        printf("Error: could not allocate shared memory for Airy disk transfer functions\n");
+        fflush(stdout);
+      }
+      exit(1);
+    }
+  }
+
+  //
+  // find total size of all output images and the largest image sizes. Buffers used after the star rendering pass
+  // are shared by all output images (and each output of an output list) so only need to be large enough for the
+  // largest image.
+  //
+  composition_pixels=0;
+  max_image_pixels=0;
+  max_resize_pixels=0;
+  max_output_res_x=0;
+  max_output_res_y=0;
+  max_output_pixels=0;
+  for (image_index=0; image_index < bsr_state->num_images; image_index++) {
+    image=bsr_state->image + image_index;
+    image_pixels=(uint64_t)image->res_x * (uint64_t)image->res_y;
+    composition_pixels+=image_pixels;
+    if (image_pixels > max_image_pixels) {
+      max_image_pixels=image_pixels;
+    }
+    for (output_index=0; output_index < bsr_state->num_outputs; output_index++) {
+      output_scaling_factor=bsr_state->output[output_index].output_scaling_factor;
+      if (output_scaling_factor != 1.0) {
+        output_res_x=(int)(((double)image->res_x * output_scaling_factor) + 0.5);
+        output_res_y=(int)(((double)image->res_y * output_scaling_factor) + 0.5);
+        resize_pixels=(uint64_t)output_res_x * (uint64_t)output_res_y;
+        if (resize_pixels > max_resize_pixels) {
+          max_resize_pixels=resize_pixels;
+        }
+      } else {
+        output_res_x=image->res_x;
+        output_res_y=image->res_y;
+      }
+      if (output_res_x > max_output_res_x) {
+        max_output_res_x=output_res_x;
+      }
+      if (output_res_y > max_output_res_y) {
+        max_output_res_y=output_res_y;
+      }
+      if (((uint64_t)output_res_x * (uint64_t)output_res_y) > max_output_pixels) {
+        max_output_pixels=(uint64_t)output_res_x * (uint64_t)output_res_y;
+      }
+    } // end for output_index
+  } // end for image_index
+
+  //
+  // decide if images are rendered in tiles. If so, buffers only need to be large enough for the largest tile
+  //
+  initTiles(bsr_config, bsr_state);
+  if (bsr_state->num_tiles > 1) {
+    max_tile_rows=0;
+    for (tile_index=0; tile_index < bsr_state->num_tiles; tile_index++) {
+      tileCompositionRows(bsr_config, bsr_state, (tile_index * bsr_state->tile_output_rows), bsr_state->tile_output_rows, &tile_y_min, &tile_y_max);
+      if ((tile_y_max - tile_y_min) > max_tile_rows) {
+        max_tile_rows=tile_y_max - tile_y_min;
+      }
+    }
+    composition_pixels=(uint64_t)bsr_state->image[0].res_x * (uint64_t)max_tile_rows;
+    max_image_pixels=composition_pixels;
+    max_output_res_y=bsr_state->tile_output_rows;
+    max_output_pixels=(uint64_t)max_output_res_x * (uint64_t)max_output_res_y;
+    if (bsr_config->output_scaling_factor != 1.0) {
+      max_resize_pixels=max_output_pixels;
+    }
+  }
+
+  //
+  // select floating-point precision of image composition, blur, and resize buffers. The blur buffer also holds
+  // the output of Airy disk convolution
+  //
+  if ((bsr_config->Gaussian_blur_radius > 0.0) || (bsr_config->Airy_disk_mode == 1)) {
+    blur_pixels=max_image_pixels;
+  } else {
+    blur_pixels=0;
+  }
+  selectBufferPrecision(bsr_config, bsr_state, composition_pixels, blur_pixels, max_resize_pixels);
+
   //
   // allocate shared memory for image composition buffer (floating-point rgb)
   //
   mmap_protection=PROT_READ | PROT_WRITE;
   mmap_visibility=MAP_SHARED | MAP_ANONYMOUS;
-  bsr_state->composition_buffer_size=(size_t)bsr_config->camera_res_x * (size_t)bsr_config->camera_res_y * sizeof(pixel_composition_t);
-  bsr_state->image_composition_buf=(pixel_composition_t *)mmap(NULL, bsr_state->composition_buffer_size, mmap_protection, mmap_visibility, -1, 0);
+  bsr_state->composition_buffer_size=(size_t)composition_pixels * pixelSize(bsr_state->composition_precision);
+  bsr_state->image_composition_buf=mmap(NULL, bsr_state->composition_buffer_size, mmap_protection, mmap_visibility, -1, 0);
   if (bsr_state->image_composition_buf == MAP_FAILED) {
     if ((bsr_config->cgi_mode != 1) && (bsr_config->print_status == 1)) {
       printf("Error: could not allocate shared memory for image composition buffer\n");
@@ -139,17 +298,18 @@ int allocateMemory(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
     exit(1);
   }
   bsr_state->current_image_buf=bsr_state->image_composition_buf;
-  bsr_state->current_image_res_x=bsr_config->camera_res_x;
-  bsr_state->current_image_res_y=bsr_config->camera_res_y;
+  bsr_state->current_image_precision=bsr_state->composition_precision;
+  bsr_state->current_image_res_x=bsr_state->image[0].res_x;
+  bsr_state->current_image_res_y=bsr_state->image[0].res_y;
 
   //
   // allocate shared memory for image blur buffer if needed
   //
-  if (bsr_config->Gaussian_blur_radius > 0.0) {
+  if (blur_pixels > 0) {
     mmap_protection=PROT_READ | PROT_WRITE;
     mmap_visibility=MAP_SHARED | MAP_ANONYMOUS;
-    bsr_state->blur_buffer_size=(size_t)bsr_config->camera_res_x * (size_t)bsr_config->camera_res_y * sizeof(pixel_composition_t);
-    bsr_state->image_blur_buf=(pixel_composition_t *)mmap(NULL, bsr_state->blur_buffer_size, mmap_protection, mmap_visibility, -1, 0);
+    bsr_state->blur_buffer_size=(size_t)blur_pixels * pixelSize(bsr_state->blur_precision);
+    bsr_state->image_blur_buf=mmap(NULL, bsr_state->blur_buffer_size, mmap_protection, mmap_visibility, -1, 0);
     if (bsr_state->image_blur_buf == MAP_FAILED) {
       if (bsr_config->cgi_mode != 1) {
         printf("Error: could not allocate shared memory for image blur buffer\n");
@@ -162,13 +322,13 @@ int allocateMemory(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
   //
   // allocate shared memory for image resize buffer if needed
   //
-  if (bsr_config->output_scaling_factor != 1.0) {
-    bsr_state->resize_res_x=(int)(((double)bsr_config->camera_res_x * bsr_config->output_scaling_factor) + 0.5);
-    bsr_state->resize_res_y=(int)(((double)bsr_config->camera_res_y * bsr_config->output_scaling_factor) + 0.5);
+  if (max_resize_pixels > 0) {
+    bsr_state->resize_res_x=(int)(((double)bsr_state->image[0].res_x * bsr_config->output_scaling_factor) + 0.5);
+    bsr_state->resize_res_y=(int)(((double)bsr_state->image[0].res_y * bsr_config->output_scaling_factor) + 0.5);
     mmap_protection=PROT_READ | PROT_WRITE;
     mmap_visibility=MAP_SHARED | MAP_ANONYMOUS;
-    bsr_state->resize_buffer_size=(size_t)bsr_state->resize_res_x * (size_t)bsr_state->resize_res_y * sizeof(pixel_composition_t);
-    bsr_state->image_resize_buf=(pixel_composition_t *)mmap(NULL, bsr_state->resize_buffer_size, mmap_protection, mmap_visibility, -1, 0);
+    bsr_state->resize_buffer_size=(size_t)max_resize_pixels * pixelSize(bsr_state->resize_precision);
+    bsr_state->image_resize_buf=mmap(NULL, bsr_state->resize_buffer_size, mmap_protection, mmap_visibility, -1, 0);
     if (bsr_state->image_resize_buf == MAP_FAILED) {
       if (bsr_config->cgi_mode != 1) {
         printf("Error: could not allocate shared memory for image resize buffer\n");
@@ -178,6 +338,43 @@ int allocateMemory(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
     }
   }
 
+  //
+  // allocate memory for a copy of the image composition buffer if rendering in progressive passes. This is only
+  // used by the main thread
+  //
+  initPasses(bsr_config, bsr_state);
+  if (bsr_state->num_passes > 1) {
+    mmap_protection=PROT_READ | PROT_WRITE;
+    mmap_visibility=MAP_SHARED | MAP_ANONYMOUS;
+    bsr_state->progressive_buffer_size=bsr_state->composition_buffer_size;
+    bsr_state->image_progressive_buf=mmap(NULL, bsr_state->progressive_buffer_size, mmap_protection, mmap_visibility, -1, 0);
+    if (bsr_state->image_progressive_buf == MAP_FAILED) {
+      if (bsr_config->cgi_mode != 1) {
+        printf("Error: could not allocate memory for progressive rendering buffer\n");
+        fflush(stdout);
+      }
+      exit(1);
+    }
+  }
+
+  //
+  // allocate memory for a copy of the current image before post processing if there are several outputs. This is
+  // only used by the main thread
+  //
+  if (bsr_state->num_outputs > 1) {
+    mmap_protection=PROT_READ | PROT_WRITE;
+    mmap_visibility=MAP_SHARED | MAP_ANONYMOUS;
+    bsr_state->unprocessed_buffer_size=(size_t)max_image_pixels * pixelSize(bsr_state->composition_precision);
+    bsr_state->image_unprocessed_buf=mmap(NULL, bsr_state->unprocessed_buffer_size, mmap_protection, mmap_visibility, -1, 0);
+    if (bsr_state->image_unprocessed_buf == MAP_FAILED) {
+      if (bsr_config->cgi_mode != 1) {
+        printf("Error: could not allocate memory for output list buffer\n");
+        fflush(stdout);
+      }
+      exit(1);
+    }
+  }
+
   //
   // allocate non-shared memory for dedup buffer and initialize
   //
@@ -208,9 +405,9 @@ int allocateMemory(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
   //
   // allocate non-shared memory for dedup index and initialize
   //
-  if ((uint64_t)bsr_config->camera_res_x * (uint64_t)bsr_config->camera_res_y <= 16777216) {
+  if (composition_pixels <= 16777216) {
     bsr_state->dedup_index_mode=0; // use image_offset for dedup index
-    dedup_index_count=bsr_config->camera_res_x * bsr_config->camera_res_y;
+    dedup_index_count=(int)composition_pixels;
     bsr_state->dedup_index_size=(size_t)dedup_index_count * sizeof(dedup_index_t);
   } else {
     bsr_state->dedup_index_mode=1; // use lowest 24 bits of image_offset for dedup index
@@ -273,6 +470,40 @@ int allocateMemory(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
     }
     exit(1);
   }
+  // allocate shared memory for performance counters if enabled
+  if (bsr_config->perf_counters != 0) {
+    bsr_state->perf_stages_size=(size_t)(bsr_state->num_worker_threads + 1) * BSR_PERF_STAGES * sizeof(bsr_perf_stage_t);
+    bsr_state->perf_stages=(bsr_perf_stage_t *)mmap(NULL, bsr_state->perf_stages_size, mmap_protection, mmap_visibility, -1, 0);
+    if (bsr_state->perf_stages == MAP_FAILED) {
+      if (bsr_config->cgi_mode != 1) {
+        printf("Error: could not allocate shared memory for performance counters\n");
+      }
+      exit(1);
+    }
+  }
+  // allocate shared memory for timeline trace events if enabled. Pages are only touched as events are recorded
+  if (bsr_config->trace_file_name[0] != 0) {
+    bsr_state->trace_buffers_size=(size_t)(bsr_state->num_worker_threads + 1) * sizeof(bsr_trace_buffer_t);
+    bsr_state->trace_buffers=(bsr_trace_buffer_t *)mmap(NULL, bsr_state->trace_buffers_size, mmap_protection, mmap_visibility, -1, 0);
+    if (bsr_state->trace_buffers == MAP_FAILED) {
+      if (bsr_config->cgi_mode != 1) {
+        printf("Error: could not allocate shared memory for trace events\n");
+      }
+      exit(1);
+    }
+    bsr_state->trace_start_ns=traceTime();
+  }
+  // allocate shared memory for render statistics if enabled
+  if (bsr_config->stats_json_file_name[0] != 0) {
+    bsr_state->render_stats_size=(size_t)(bsr_state->num_worker_threads + 1) * sizeof(bsr_render_stats_t);
+    bsr_state->render_stats=(bsr_render_stats_t *)mmap(NULL, bsr_state->render_stats_size, mmap_protection, mmap_visibility, -1, 0);
+    if (bsr_state->render_stats == MAP_FAILED) {
+      if (bsr_config->cgi_mode != 1) {
+        printf("Error: could not allocate shared memory for render statistics\n");
+      }
+      exit(1);
+    }
+  }
   if ((bsr_config->cgi_mode != 1) && (bsr_config->print_status == 1)) {
     clock_gettime(CLOCK_REALTIME, &endtime);
     elapsed_time=((double)(endtime.tv_sec - 1500000000) + ((double)endtime.tv_nsec / 1.0E9)) - ((double)(starttime.tv_sec - 1500000000) + ((double)starttime.tv_nsec) / 1.0E9);
@@ -281,23 +512,33 @@ int allocateMemory(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
   }
 
   //
-  // allocate shared memory for image output buffer
+  // if output rows are streamed to the encoder, the output buffer only needs to hold the ring of bands
   //
-  if (bsr_config->output_scaling_factor != 1.0) {
-    output_res_x=bsr_state->resize_res_x;
-    output_res_y=bsr_state->resize_res_y;
-  } else {
-    output_res_x=bsr_config->camera_res_x;
-    output_res_y=bsr_config->camera_res_y;
+  initOutputStream(bsr_config, bsr_state, max_output_res_y);
+  if (bsr_state->stream_output == 1) {
+    max_output_res_y=bsr_state->stream_ring_bands * bsr_state->stream_band_rows;
+    max_output_pixels=(uint64_t)max_output_res_x * (uint64_t)max_output_res_y;
   }
+
+  //
+  // allocate shared memory for image output buffer
+  //
+  output_res_x=max_output_res_x;
+  output_res_y=max_output_res_y;
   mmap_protection=PROT_READ | PROT_WRITE;
   mmap_visibility=MAP_SHARED | MAP_ANONYMOUS;
-  if (bsr_config->bits_per_color == 32) {
-    bsr_state->output_buffer_size=(size_t)output_res_x * (size_t)output_res_y * (size_t)12 * sizeof(unsigned char);
-  } else if ((bsr_config->bits_per_color == 10) || (bsr_config->bits_per_color == 12) || (bsr_config->bits_per_color == 16)) {
-    bsr_state->output_buffer_size=(size_t)output_res_x * (size_t)output_res_y * (size_t)6 * sizeof(unsigned char);
+  max_bits_per_color=0;
+  for (output_index=0; output_index < bsr_state->num_outputs; output_index++) {
+    if (bsr_state->output[output_index].bits_per_color > max_bits_per_color) {
+      max_bits_per_color=bsr_state->output[output_index].bits_per_color;
+    }
+  }
+  if (max_bits_per_color == 32) {
+    bsr_state->output_buffer_size=(size_t)max_output_pixels * (size_t)12 * sizeof(unsigned char);
+  } else if ((max_bits_per_color == 10) || (max_bits_per_color == 12) || (max_bits_per_color == 16)) {
+    bsr_state->output_buffer_size=(size_t)max_output_pixels * (size_t)6 * sizeof(unsigned char);
   } else { // default 8 bits per color
-    bsr_state->output_buffer_size=(size_t)output_res_x * (size_t)output_res_y * (size_t)3 * sizeof(unsigned char);
+    bsr_state->output_buffer_size=(size_t)max_output_pixels * (size_t)3 * sizeof(unsigned char);
   }
   bsr_state->image_output_buf=(unsigned char *)mmap(NULL, bsr_state->output_buffer_size, mmap_protection, mmap_visibility, -1, 0);
   if (bsr_state->image_output_buf == MAP_FAILED) {
@@ -324,9 +565,47 @@ int allocateMemory(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
   }
 
   //
-  // allocate memory for image compression buffers if required
+  // allocate memory for PNG bands deflated by worker threads if required, one deflate buffer per ring slot
+  //
+  if (bsr_state->stream_deflate == 1) {
+    if (bsr_config->bits_per_color == 16) {
+      png_row_bytes=6 * output_res_x;
+    } else {
+      png_row_bytes=3 * output_res_x;
+    }
+    bsr_state->stream_deflate_slot_size=deflatePNGBound(png_row_bytes, bsr_state->stream_band_rows);
+    bsr_state->stream_deflate_buf_size=bsr_state->stream_deflate_slot_size * (size_t)bsr_state->stream_ring_bands;
+    mmap_protection=PROT_READ | PROT_WRITE;
+    mmap_visibility=MAP_SHARED | MAP_ANONYMOUS;
+    bsr_state->stream_deflate_buf=(unsigned char *)mmap(NULL, bsr_state->stream_deflate_buf_size, mmap_protection, mmap_visibility, -1, 0);
+    if (bsr_state->stream_deflate_buf == MAP_FAILED) {
+      if (bsr_config->cgi_mode != 1) {
+        printf("Error: could not allocate shared memory for PNG deflate buffer\n");
+        fflush(stdout);
+      }
+      exit(1);
+    }
+    // allocate non-shared memory for png_filter_buf
+    bsr_state->png_filter_buf_size=(size_t)(png_row_bytes + 1) * sizeof(unsigned char);
+    bsr_state->png_filter_buf=(unsigned char *)malloc(bsr_state->png_filter_buf_size);
+    if (bsr_state->png_filter_buf == NULL) {
+      if (bsr_config->cgi_mode != 1) {
+        printf("Error: could not allocate memory for PNG filter buffer\n");
+      }
+      exit(1);
+    }
+  } // end if stream_deflate
+
+  //
+  // allocate memory for image compression buffers if required, large enough for the largest EXR output
   //
-  if ((bsr_config->image_format == 1) && ((bsr_config->exr_compression == 2) || (bsr_config->exr_compression == 3))) {
+  exr_bits_per_color=0;
+  for (output_index=0; output_index < bsr_state->num_outputs; output_index++) {
+    if ((bsr_state->output[output_index].image_format == 1) && (bsr_state->output[output_index].bits_per_color > exr_bits_per_color)) {
+      exr_bits_per_color=bsr_state->output[output_index].bits_per_color;
+    }
+  }
+  if ((exr_bits_per_color > 0) && ((bsr_config->exr_compression == 2) || (bsr_config->exr_compression == 3))) {
     // allocate shared memory for compressed_sizes table
     mmap_protection=PROT_READ | PROT_WRITE;
     mmap_visibility=MAP_SHARED | MAP_ANONYMOUS;
@@ -348,9 +627,9 @@ int allocateMemory(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
       // deflate, 16 line per block
       lines_per_block=16;
     }
-    if (bsr_config->bits_per_color == 16) {
+    if (exr_bits_per_color == 16) {
       pixel_data_size=6 * output_res_x * lines_per_block;
-    } else if (bsr_config->bits_per_color == 32) {
+    } else if (exr_bits_per_color == 32) {
       pixel_data_size=12 * output_res_x * lines_per_block;
     }
     // allocate non-shared memory for compression_buf1
@@ -0,0 +1,640 @@
+//
+// Billion Star 3D Rendering Engine
+// Kevin M. Loch
+//
+// 3D rendering engine for the ESA Gaia DR3 star dataset
+
+/*
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2021, Kevin Loch
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "bsrender.h" // needs to be first to get GNU_SOURCE define for strcasestr
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "bsr-config.h"
+#include "process-stars.h"
+#include "pixel-buffer.h"
+#include "sky-tile.h"
+
+int initCamera(bsr_config_t *bsr_config, bsr_camera_t *camera) {
+  //
+  // This function initializes camera geometry (position, target, rotation, projection, resolution) from
+  // a set of configuration options.
+  //
+  double pi_over_360=M_PI / 360.0;
+  double pi_over_180=M_PI / 180.0;
+  double camera_icrs_ra_rad;
+  double camera_icrs_dec_rad;
+  double target_icrs_ra_rad;
+  double target_icrs_dec_rad;
+  double target_xy;
+  double target_xy_r;
+  double target_x;
+  double target_y;
+  double target_z;
+  double target_xz;
+  double camera_xy;
+  double camera_xz;
+  double camera_yz;
+  quaternion_t rotation1;
+  quaternion_t rotation2;
+  quaternion_t result;
+
+  //
+  // process user-supplied arguments
+  //
+  camera->camera_fov=bsr_config->camera_fov;
+  camera->camera_res_x=bsr_config->camera_res_x;
+  camera->camera_res_y=bsr_config->camera_res_y;
+  camera->camera_projection=bsr_config->camera_projection;
+  camera->spherical_orientation=bsr_config->spherical_orientation;
+  camera->camera_hfov=bsr_config->camera_fov * pi_over_360; // includes divide by 2
+  camera->camera_half_res_x=(double)bsr_config->camera_res_x / 2.0;
+  camera->camera_half_res_y=(double)bsr_config->camera_res_y / 2.0;
+  camera->pixels_per_radian=camera->camera_half_res_x / camera->camera_hfov;
+  if ((camera->camera_projection == 4) && (camera->camera_fov > 179.0)) {
+    // rectilinear projection is limited to less than 180 degrees field of view
+    camera->camera_fov=179.0;
+    camera->camera_hfov=camera->camera_fov * pi_over_360;
+  }
+  camera->rectilinear_focal_length=camera->camera_half_res_x / tan(camera->camera_hfov);
+  camera_yz=bsr_config->camera_rotation * pi_over_180;
+  camera_xy=bsr_config->camera_pan * pi_over_180;
+  camera_xz=bsr_config->camera_tilt * -pi_over_180;
+
+  //
+  // optionally transform spherical icrs to euclidian icrs if x,y,z are zero
+  //
+  camera->camera_icrs_x=bsr_config->camera_icrs_x;
+  camera->camera_icrs_y=bsr_config->camera_icrs_y;
+  camera->camera_icrs_z=bsr_config->camera_icrs_z;
+  if (((bsr_config->camera_icrs_ra != 0.0) || (bsr_config->camera_icrs_dec != 0.0) || (bsr_config->camera_icrs_r != 0.0))\
+    && (bsr_config->camera_icrs_x == 0.0) && (bsr_config->camera_icrs_y == 0.0) && (bsr_config->camera_icrs_z == 0.0)) {
+    camera_icrs_ra_rad=bsr_config->camera_icrs_ra * pi_over_180;
+    camera_icrs_dec_rad=bsr_config->camera_icrs_dec * pi_over_180;
+    camera->camera_icrs_x=bsr_config->camera_icrs_r * cos(camera_icrs_dec_rad) * cos(camera_icrs_ra_rad);
+    camera->camera_icrs_y=bsr_config->camera_icrs_r * cos(camera_icrs_dec_rad) * sin(camera_icrs_ra_rad);
+    camera->camera_icrs_z=bsr_config->camera_icrs_r * sin(camera_icrs_dec_rad);
+  }
+  camera->target_icrs_x=bsr_config->target_icrs_x;
+  camera->target_icrs_y=bsr_config->target_icrs_y;
+  camera->target_icrs_z=bsr_config->target_icrs_z;
+  if (((bsr_config->target_icrs_ra != 0.0) || (bsr_config->target_icrs_dec != 0.0) || (bsr_config->target_icrs_r != 0.0))\
+    && (bsr_config->target_icrs_x == 0.0) && (bsr_config->target_icrs_y == 0.0) && (bsr_config->target_icrs_z == 0.0)) {
+    target_icrs_ra_rad=bsr_config->target_icrs_ra * pi_over_180;
+    target_icrs_dec_rad=bsr_config->target_icrs_dec * pi_over_180;
+    camera->target_icrs_x=bsr_config->target_icrs_r * cos(target_icrs_dec_rad) * cos(target_icrs_ra_rad);
+    camera->target_icrs_y=bsr_config->target_icrs_r * cos(target_icrs_dec_rad) * sin(target_icrs_ra_rad);
+    camera->target_icrs_z=bsr_config->target_icrs_r * sin(target_icrs_dec_rad);
+  }
+
+  //
+  // translate original target x,y,z to new coordinates as seen by camera position
+  //
+  target_x=camera->target_icrs_x - camera->camera_icrs_x;
+  target_y=camera->target_icrs_y - camera->camera_icrs_y;
+  target_z=camera->target_icrs_z - camera->camera_icrs_z;
+
+  //
+  // initialize target xy angle used in star rotations
+  //
+  target_xy=atan2(target_y, target_x);
+
+  //
+  // initialize target xz angle used in star rotations by setting target xy angle to 0
+  //
+  target_xy_r=sqrt((target_x * target_x) + (target_y * target_y)); 
+  target_x=target_xy_r; // xy=0
+  target_xz=atan2(target_z, target_x);
+
+  //
+  //  initialize rotation quaternion by sequentially combining all rotations in correct order
+  //
+  // target_xy and target_xz
+  rotation1.r=cos(-target_xy / 2.0);
+  rotation1.i=0.0;
+  rotation1.j=0.0;
+  rotation1.k=sin(-target_xy / 2.0);
+  rotation2.r=cos(-target_xz / 2.0);
+  rotation2.i=0.0;
+  rotation2.j=sin(-target_xz / 2.0);
+  rotation2.k=0.0;
+  result=quaternion_product(rotation1, rotation2);
+  // add camera rotation yz angle
+  rotation1.r=result.r;
+  rotation1.i=result.i;
+  rotation1.j=result.j;
+  rotation1.k=result.k;
+  rotation2.r=cos(camera_yz / 2.0);
+  rotation2.i=sin(camera_yz / 2.0);
+  rotation2.j=0.0;
+  rotation2.k=0.0;
+  result=quaternion_product(rotation1, rotation2);
+  // optionally add camera pan
+  if (bsr_config->camera_pan != 0.0) {
+    rotation1.r=result.r;
+    rotation1.i=result.i;
+    rotation1.j=result.j;
+    rotation1.k=result.k;
+    rotation2.r=cos(camera_xy / 2.0);
+    rotation2.i=0.0;
+    rotation2.j=0.0;
+    rotation2.k=sin(camera_xy / 2.0);
+    result=quaternion_product(rotation1, rotation2);
+  }
+  // optionally add camera tilt
+  if (bsr_config->camera_tilt != 0.0) {
+    rotation1.r=result.r;
+    rotation1.i=result.i;
+    rotation1.j=result.j;
+    rotation1.k=result.k;
+    rotation2.r=cos(camera_xz / 2.0);
+    rotation2.i=0.0;
+    rotation2.j=sin(camera_xz / 2.0);
+    rotation2.k=0.0;
+    result=quaternion_product(rotation1, rotation2);
+  }
+  // copy composite rotation quaternion to camera
+  camera->target_rotation.r=result.r;
+  camera->target_rotation.i=result.i;
+  camera->target_rotation.j=result.j;
+  camera->target_rotation.k=result.k;
+
+  //
+  // by default each camera renders into its own output image
+  //
+  camera->image_offset=0;
+  camera->image_stride=camera->camera_res_x;
+
+  //
+  // by default the whole raster is rendered at once (not tiled)
+  //
+  camera->tile_y_min=0;
+  camera->tile_y_max=camera->camera_res_y;
+  camera->star_y_min=0;
+  camera->star_y_max=camera->camera_res_y;
+  camera->star_x_min=0;
+  camera->star_x_max=camera->camera_res_x;
+  camera->view_cone_enable=0;
+
+  return(0);
+}
+
+int rotateCamera(bsr_camera_t *camera, double pan, double tilt) {
+  //
+  // This function adds an additional pan and tilt (decimal degrees) to a camera after all other rotations.
+  // It is used to aim cube map faces relative to the configured camera orientation.
+  //
+  double pi_over_180=M_PI / 180.0;
+  double camera_xy;
+  double camera_xz;
+  quaternion_t rotation2;
+
+  camera_xy=pan * pi_over_180;
+  camera_xz=tilt * -pi_over_180;
+  if (pan != 0.0) {
+    rotation2.r=cos(camera_xy / 2.0);
+    rotation2.i=0.0;
+    rotation2.j=0.0;
+    rotation2.k=sin(camera_xy / 2.0);
+    camera->target_rotation=quaternion_product(camera->target_rotation, rotation2);
+  }
+  if (tilt != 0.0) {
+    rotation2.r=cos(camera_xz / 2.0);
+    rotation2.i=0.0;
+    rotation2.j=sin(camera_xz / 2.0);
+    rotation2.k=0.0;
+    camera->target_rotation=quaternion_product(camera->target_rotation, rotation2);
+  }
+
+  return(0);
+}
+
+int addImage(bsr_state_t *bsr_state, int res_x, int res_y, char *output_file_name) {
+  //
+  // This function adds an output image after any existing output images in the image composition buffer.
+  // Returns the new image index.
+  //
+  bsr_image_t *image;
+  bsr_image_t *previous_image;
+
+  image=bsr_state->image + bsr_state->num_images;
+  if (bsr_state->num_images == 0) {
+    image->image_offset=0;
+  } else {
+    previous_image=image - 1;
+    image->image_offset=previous_image->image_offset + ((uint64_t)previous_image->res_x * (uint64_t)previous_image->res_y);
+  }
+  image->res_x=res_x;
+  image->res_y=res_y;
+  strncpy(image->output_file_name, output_file_name, 255);
+  image->output_file_name[255]=0;
+  bsr_state->num_images++;
+
+  return(bsr_state->num_images - 1);
+}
+
+int placeCamera(bsr_state_t *bsr_state, bsr_camera_t *camera, int image_index, int x, int y) {
+  //
+  // This function places a camera at x,y within an output image
+  //
+  bsr_image_t *image;
+
+  image=bsr_state->image + image_index;
+  camera->image_stride=image->res_x;
+  camera->image_offset=image->image_offset + ((uint64_t)image->res_x * (uint64_t)y) + (uint64_t)x;
+
+  return(0);
+}
+
+int setDefaultImageFileName(bsr_config_t *bsr_config, char *file_name_256, char *suffix) {
+  //
+  // This function sets a default output file name for one of several output images by inserting "-<suffix>" before
+  // the file name extension of the base output_file_name, for example galaxy.png -> galaxy-2.png or galaxy-left.png
+  //
+  char *extension_p;
+  char *directory_p;
+  int base_length;
+  int name_length;
+
+  extension_p=strrchr(bsr_config->output_file_name, '.');
+  directory_p=strrchr(bsr_config->output_file_name, '/');
+  if ((extension_p == NULL) || ((directory_p != NULL) && (extension_p < directory_p))) {
+    // no extension, append suffix
+    base_length=strlen(bsr_config->output_file_name);
+    extension_p=bsr_config->output_file_name + base_length;
+  } else {
+    base_length=extension_p - bsr_config->output_file_name;
+  }
+  if ((base_length + strlen(suffix) + strlen(extension_p) + 1) > 255) {
+    base_length=255 - (int)(strlen(suffix) + strlen(extension_p) + 1);
+    if (base_length < 0) {
+      base_length=0;
+    }
+  }
+
+  //
+  // shortening the base name is not enough if the suffix and extension alone don't fit in 255 characters
+  //
+  name_length=snprintf(file_name_256, 256, "%.*s-%s%s", base_length, bsr_config->output_file_name, suffix, extension_p);
+  if ((name_length < 0) || (name_length > 255)) {
+    if (bsr_config->cgi_mode != 1) {
+      printf("Error: default output file name for image %s of %s is longer than 255 characters\n", suffix, bsr_config->output_file_name);
+      fflush(stdout);
+    }
+    exit(1);
+  }
+
+  return(0);
+}
+
+int initMainCamera(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
+  //
+  // This function sets up a single camera and output image from the main camera configuration
+  //
+  bsr_state->num_cameras=1;
+  bsr_state->num_images=0;
+  initCamera(bsr_config, &bsr_state->camera[0]);
+  addImage(bsr_state, bsr_config->camera_res_x, bsr_config->camera_res_y, bsr_config->output_file_name);
+  placeCamera(bsr_state, &bsr_state->camera[0], 0, 0, 0);
+  if (bsr_config->sky_tile_zoom >= 0) {
+    // the camera raster is one tile of a larger virtual raster
+    initSkyTile(bsr_config, &bsr_state->camera[0]);
+  }
+
+  return(0);
+}
+
+int loadCameraList(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
+  //
+  // This function loads camera definitions from camera_list_file_name. Each non-comment line of the file defines
+  // one camera as a list of option=value pairs separated by spaces, for example:
+  //
+  //   camera_icrs_ra=0.0 camera_icrs_dec=0.0 camera_icrs_r=0.0 target_icrs_x=1.0 camera_res_x=2000 camera_res_y=1000
+  //
+  // Options not specified on a line are inherited from the main configuration. Only camera geometry options
+  // (position, target, rotation, pan, tilt, fov, projection, resolution) and output_file_name are used, all other
+  // rendering options are shared by all cameras.
+  //
+  FILE *camera_list_file;
+  char *input_line_p;
+  char input_line[2048];
+  char segment[2048];
+  char *segment_p;
+  char *symbol_p;
+  size_t segment_length;
+  int from_cgi;
+  bsr_config_t camera_config;
+  int num_cameras;
+  char camera_number[16];
+  char output_file_name[256];
+  int image_index;
+
+  //
+  // camera lists are ignored in CGI mode since only one image can be returned
+  //
+  if (bsr_config->cgi_mode == 1) {
+    return(0);
+  }
+
+  //
+  // attempt to open camera list file
+  //
+  camera_list_file=fopen(bsr_config->camera_list_file_name, "r");
+  if (camera_list_file == NULL) {
+    printf("Error: could not open camera list file %s\n", bsr_config->camera_list_file_name);
+    fflush(stdout);
+    exit(1);
+  }
+  if (bsr_config->print_status == 1) {
+    printf("Loading camera list file %s\n", bsr_config->camera_list_file_name);
+    fflush(stdout);
+  }
+
+  //
+  // read and process each line of camera list file
+  //
+  num_cameras=0;
+  bsr_state->num_images=0;
+  input_line_p=fgets(input_line, 2048, camera_list_file);
+  while (input_line_p != NULL) {
+    //
+    // remove comments and newline
+    //
+    symbol_p=strchr(input_line, '#');
+    if (symbol_p != NULL) {
+      *symbol_p=0;
+    }
+    symbol_p=strchr(input_line, '\n');
+    if (symbol_p != NULL) {
+      *symbol_p=0;
+    }
+
+    //
+    // skip blank lines
+    //
+    segment_p=input_line;
+    while ((*segment_p == ' ') || (*segment_p == '\t') || (*segment_p == '\r')) {
+      segment_p++;
+    }
+    if (*segment_p != 0) {
+      if (num_cameras == BSR_MAX_CAMERAS) {
+        printf("Error: camera list file %s has more than %d cameras\n", bsr_config->camera_list_file_name, BSR_MAX_CAMERAS);
+        fflush(stdout);
+        exit(1);
+      }
+
+      //
+      // start with a copy of the main configuration and apply each option=value pair on this line
+      //
+      camera_config=*bsr_config;
+      camera_config.output_file_name[0]=0;
+      while (*segment_p != 0) {
+        segment_length=strcspn(segment_p, " \t\r");
+        strncpy(segment, segment_p, segment_length);
+        segment[segment_length]=0;
+        from_cgi=0;
+        processConfigSegment(&camera_config, segment, from_cgi);
+        segment_p+=segment_length;
+        while ((*segment_p == ' ') || (*segment_p == '\t') || (*segment_p == '\r')) {
+          segment_p++;
+        }
+      } // end while segments
+
+      //
+      // initialize camera geometry and output image, use default output file name if none was specified
+      //
+      if ((camera_config.camera_res_x < 1) || (camera_config.camera_res_y < 1)) {
+        printf("Error: invalid resolution for camera %d in camera list file %s\n", (num_cameras + 1), bsr_config->camera_list_file_name);
+        fflush(stdout);
+        exit(1);
+      }
+      initCamera(&camera_config, &bsr_state->camera[num_cameras]);
+      if (camera_config.output_file_name[0] == 0) {
+        snprintf(camera_number, 16, "%d", (num_cameras + 1));
+        setDefaultImageFileName(bsr_config, output_file_name, camera_number);
+      } else {
+        strncpy(output_file_name, camera_config.output_file_name, 255);
+        output_file_name[255]=0;
+      }
+      image_index=addImage(bsr_state, camera_config.camera_res_x, camera_config.camera_res_y, output_file_name);
+      placeCamera(bsr_state, &bsr_state->camera[num_cameras], image_index, 0, 0);
+      num_cameras++;
+    } // end if not blank line
+
+    //
+    // load next line from camera list file
+    //
+    input_line_p=fgets(input_line, 2048, camera_list_file);
+  } // end while input_line_p
+  fclose(camera_list_file);
+
+  if (num_cameras == 0) {
+    printf("Error: no cameras found in camera list file %s\n", bsr_config->camera_list_file_name);
+    fflush(stdout);
+    exit(1);
+  }
+  bsr_state->num_cameras=num_cameras;
+
+  return(0);
+}
+
+int initVRCameras(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
+  //
+  // This function sets up cameras for VR output modes from the main camera configuration:
+  //
+  // vr_mode=1, cube map: six 90 degree rectilinear faces of camera_res_y x camera_res_y pixels, aimed right, left, up,
+  // down, front and back relative to the main camera orientation. The packed image is 3 faces wide and 2 faces high:
+  //   +-------+-------+-------+
+  //   | right | left  |  up   |
+  //   +-------+-------+-------+
+  //   | down  | front | back  |
+  //   +-------+-------+-------+
+  //
+  // vr_mode=2, stereo: left and right eye cameras with the main camera projection and resolution, separated by
+  // stereo_separation parsecs perpendicular to the view direction. The packed image has the left eye on top. The eyes
+  // are parallel, so the parallax is only correct near the view direction and camera_fov is limited to 180 degrees.
+  //
+  bsr_config_t face_config;
+  bsr_camera_t *camera;
+  int face_res;
+  int face;
+  int image_index=0;
+  char output_file_name[256];
+  quaternion_t inverse_rotation;
+  quaternion_t left_q;
+  quaternion_t left_icrs;
+  double half_separation;
+  char *cube_face_names[6]={ "right", "left", "up", "down", "front", "back" };
+  double cube_face_pan[6]={ 90.0, -90.0, 0.0, 0.0, 0.0, 180.0 };
+  double cube_face_tilt[6]={ 0.0, 0.0, 90.0, -90.0, 0.0, 0.0 };
+  char *stereo_eye_names[2]={ "left", "right" };
+
+  bsr_state->num_cameras=0;
+  bsr_state->num_images=0;
+  if (bsr_config->vr_mode == 1) {
+    //
+    // cube map
+    //
+    face_res=bsr_config->camera_res_y;
+    face_config=*bsr_config;
+    face_config.camera_res_x=face_res;
+    face_config.camera_res_y=face_res;
+    face_config.camera_fov=90.0;
+    face_config.camera_projection=4;
+    if (bsr_config->vr_packed_output == 1) {
+      image_index=addImage(bsr_state, (face_res * 3), (face_res * 2), bsr_config->output_file_name);
+    }
+    for (face=0; face < 6; face++) {
+      camera=bsr_state->camera + face;
+      initCamera(&face_config, camera);
+      rotateCamera(camera, cube_face_pan[face], cube_face_tilt[face]);
+      if (bsr_config->vr_packed_output == 1) {
+        placeCamera(bsr_state, camera, image_index, ((face % 3) * face_res), ((face / 3) * face_res));
+      } else {
+        setDefaultImageFileName(bsr_config, output_file_name, cube_face_names[face]);
+        image_index=addImage(bsr_state, face_res, face_res, output_file_name);
+        placeCamera(bsr_state, camera, image_index, 0, 0);
+      }
+    }
+    bsr_state->num_cameras=6;
+  } else if (bsr_config->vr_mode == 2) {
+    //
+    // stereo
+    //
+    if (bsr_config->camera_fov > 180.0) {
+      if (bsr_config->cgi_mode != 1) {
+        printf("Error: vr_mode=2 (stereo) is limited to camera_fov of 180 degrees or less\n");
+        fflush(stdout);
+      }
+      exit(1);
+    }
+    if (bsr_config->vr_packed_output == 1) {
+      image_index=addImage(bsr_state, bsr_config->camera_res_x, (bsr_config->camera_res_y * 2), bsr_config->output_file_name);
+    }
+    half_separation=bsr_config->stereo_separation / 2.0;
+    for (face=0; face < 2; face++) {
+      camera=bsr_state->camera + face;
+      initCamera(bsr_config, camera);
+
+      //
+      // find camera left direction (+y in camera coordinates) in icrs coordinates by rotating with the inverse of
+      // target_rotation, then move camera to the left or right keeping the same orientation (parallel eyes)
+      //
+      inverse_rotation.r=camera->target_rotation.r;
+      inverse_rotation.i=-camera->target_rotation.i;
+      inverse_rotation.j=-camera->target_rotation.j;
+      inverse_rotation.k=-camera->target_rotation.k;
+      left_q.r=0.0;
+      left_q.i=0.0;
+      left_q.j=1.0;
+      left_q.k=0.0;
+      left_icrs=quaternion_rotate(inverse_rotation, left_q);
+      if (face == 0) {
+        camera->camera_icrs_x+=(left_icrs.i * half_separation);
+        camera->camera_icrs_y+=(left_icrs.j * half_separation);
+        camera->camera_icrs_z+=(left_icrs.k * half_separation);
+      } else {
+        camera->camera_icrs_x-=(left_icrs.i * half_separation);
+        camera->camera_icrs_y-=(left_icrs.j * half_separation);
+        camera->camera_icrs_z-=(left_icrs.k * half_separation);
+      }
+
+      if (bsr_config->vr_packed_output == 1) {
+        placeCamera(bsr_state, camera, image_index, 0, (face * bsr_config->camera_res_y));
+      } else {
+        setDefaultImageFileName(bsr_config, output_file_name, stereo_eye_names[face]);
+        image_index=addImage(bsr_state, bsr_config->camera_res_x, bsr_config->camera_res_y, output_file_name);
+        placeCamera(bsr_state, camera, image_index, 0, 0);
+      }
+    }
+    bsr_state->num_cameras=2;
+  } else {
+    if (bsr_config->cgi_mode != 1) {
+      printf("Error: unsupported vr_mode %d\n", bsr_config->vr_mode);
+      fflush(stdout);
+    }
+    exit(1);
+  }
+
+  return(0);
+}
+
+int selectImage(bsr_config_t *bsr_config, bsr_state_t *bsr_state, int image_index) {
+  //
+  // This function points the current image buffer and resolution at one output image's section of the image
+  // composition buffer so post processing and image output can process each image in turn.
+  // It is called by all threads, which write identical values to the shared bsr_state. All threads must have
+  // finished with the previous image (rewindThreadStatus()) before this is called.
+  //
+  bsr_image_t *image;
+
+  image=bsr_state->image + image_index;
+
+  //
+  // all threads: set shared state for this image
+  //
+  bsr_state->current_image_buf=(unsigned char *)bsr_state->image_composition_buf + (image->image_offset * pixelSize(bsr_state->composition_precision));
+  bsr_state->current_image_precision=bsr_state->composition_precision;
+  bsr_state->current_image_res_x=image->res_x;
+  bsr_state->current_image_res_y=image->res_y;
+  bsr_state->current_image_y_offset=0;
+  bsr_state->current_image_full_res_y=image->res_y;
+  if (bsr_config->output_scaling_factor != 1.0) {
+    bsr_state->resize_res_x=(int)(((double)image->res_x * bsr_config->output_scaling_factor) + 0.5);
+    bsr_state->resize_res_y=(int)(((double)image->res_y * bsr_config->output_scaling_factor) + 0.5);
+    bsr_state->resize_y_offset=0;
+    bsr_state->resize_full_res_y=bsr_state->resize_res_y;
+  }
+
+  //
+  // all threads: with tiled rendering the image composition buffer only holds the current tile's rows, and only
+  // the current tile's output rows are resized
+  //
+  if (bsr_state->num_tiles > 1) {
+    bsr_state->current_image_res_y=bsr_state->camera[0].tile_y_max - bsr_state->camera[0].tile_y_min;
+    bsr_state->current_image_y_offset=bsr_state->camera[0].tile_y_min;
+    if (bsr_config->output_scaling_factor != 1.0) {
+      bsr_state->resize_res_y=bsr_state->tile_output_res_y;
+      bsr_state->resize_y_offset=bsr_state->tile_output_y;
+    }
+  }
+
+  //
+  // all threads: set this thread's copy of output_file_name for this image
+  //
+  strncpy(bsr_config->output_file_name, image->output_file_name, 255);
+  bsr_config->output_file_name[255]=0;
+
+  return(0);
+}
@@ -0,0 +1,52 @@
+//
+// Billion Star 3D Rendering Engine
+// Kevin M. Loch
+//
+// 3D rendering engine for the ESA Gaia DR3 star dataset
+
+/*
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2021, Kevin Loch
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BSR_MULTI_CAMERA_H
+#define BSR_MULTI_CAMERA_H
+
+int initCamera(bsr_config_t *bsr_config, bsr_camera_t *camera);
+int rotateCamera(bsr_camera_t *camera, double pan, double tilt);
+int addImage(bsr_state_t *bsr_state, int res_x, int res_y, char *output_file_name);
+int placeCamera(bsr_state_t *bsr_state, bsr_camera_t *camera, int image_index, int x, int y);
+int setDefaultImageFileName(bsr_config_t *bsr_config, char *file_name_256, char *suffix);
+int initMainCamera(bsr_config_t *bsr_config, bsr_state_t *bsr_state);
+int loadCameraList(bsr_config_t *bsr_config, bsr_state_t *bsr_state);
+int initVRCameras(bsr_config_t *bsr_config, bsr_state_t *bsr_state);
+int selectImage(bsr_config_t *bsr_config, bsr_state_t *bsr_state, int image_index);
+
+#endif // BSR_MULTI_CAMERA_H
@@ -0,0 +1,288 @@
+//
+// Billion Star 3D Rendering Engine
+// Kevin M. Loch
+//
+// 3D rendering engine for the ESA Gaia DR3 star dataset
+
+/*
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2021, Kevin Loch
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "bsrender.h" // needs to be first to get GNU_SOURCE define for strcasestr
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "bsr-config.h"
+#include "multi-camera.h"
+#include "pixel-buffer.h"
+#include "multi-output.h"
+
+//
+// An output list makes several output images from each rendered image, for example a JPEG preview, a full size PNG
+// and an EXR master, with one pass through the star data files. Each output has its own format, color profile,
+// scaling and exposure (camera_pixel_limit_mag, camera_pixel_limit_mode, camera_gamma). The image is copied before
+// post processing, which is done in place, and restored for each output after the first. Single-threaded encoders
+// write each output in a background image writer while the next output is post-processed.
+//
+
+int storeOutput(bsr_config_t *bsr_config, bsr_output_t *output) {
+  //
+  // copy the options that can be set per output from a validated configuration
+  //
+  snprintf(output->output_file_name, 256, "%s", bsr_config->output_file_name);
+  output->output_format=bsr_config->output_format;
+  output->image_format=bsr_config->image_format;
+  output->image_number_format=bsr_config->image_number_format;
+  output->bits_per_color=bsr_config->bits_per_color;
+  output->color_profile=bsr_config->color_profile;
+  output->pre_limit_intensity=bsr_config->pre_limit_intensity;
+  output->output_scaling_factor=bsr_config->output_scaling_factor;
+  output->camera_pixel_limit_mag=bsr_config->camera_pixel_limit_mag;
+  output->camera_pixel_limit_mode=bsr_config->camera_pixel_limit_mode;
+  output->camera_gamma=bsr_config->camera_gamma;
+
+  return(0);
+}
+
+int applyOutput(bsr_config_t *bsr_config, bsr_output_t *output) {
+  //
+  // set this thread's copy of the output options
+  //
+  snprintf(bsr_config->output_file_name, 256, "%s", output->output_file_name);
+  bsr_config->output_format=output->output_format;
+  bsr_config->image_format=output->image_format;
+  bsr_config->image_number_format=output->image_number_format;
+  bsr_config->bits_per_color=output->bits_per_color;
+  bsr_config->color_profile=output->color_profile;
+  bsr_config->pre_limit_intensity=output->pre_limit_intensity;
+  bsr_config->output_scaling_factor=output->output_scaling_factor;
+  bsr_config->camera_pixel_limit_mag=output->camera_pixel_limit_mag;
+  bsr_config->camera_pixel_limit_mode=output->camera_pixel_limit_mode;
+  bsr_config->camera_gamma=output->camera_gamma;
+
+  return(0);
+}
+
+int initOutputs(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
+  //
+  // one output made with the main configuration. This may be replaced later by loadOutputList()
+  //
+  bsr_state->num_outputs=1;
+  storeOutput(bsr_config, &bsr_state->output[0]);
+
+  return(0);
+}
+
+int loadOutputList(bsr_config_t *bsr_config, bsr_config_t *base_config, bsr_state_t *bsr_state) {
+  //
+  // This function loads output definitions from output_list_file_name. Each non-comment line of the file defines
+  // one output image as a list of option=value pairs separated by spaces, for example:
+  //
+  //   output_file_name=preview.jpg output_format=5 output_scaling_factor=0.25
+  //
+  // Options are applied to base_config, the main configuration before validation, so format dependent defaults
+  // (camera_pixel_limit_mode, color_profile) follow each output's format. Options not specified on a line are
+  // inherited from the main configuration. Only output_file_name, output_format, color_profile,
+  // output_scaling_factor, camera_pixel_limit_mag, camera_pixel_limit_mode, camera_gamma and pre_limit_intensity
+  // are used, all other options are shared by all outputs.
+  //
+  FILE *output_list_file;
+  char *input_line_p;
+  char input_line[2048];
+  char segment[2048];
+  char *segment_p;
+  char *symbol_p;
+  size_t segment_length;
+  int from_cgi;
+  bsr_config_t output_config;
+  int num_outputs;
+  char output_number[16];
+
+  //
+  // output lists are ignored in CGI mode since only one image can be returned
+  //
+  if (bsr_config->cgi_mode == 1) {
+    return(0);
+  }
+  if ((bsr_state->num_images > 1) || (bsr_state->num_frames > 1)) {
+    printf("Error: output_list_file cannot be used with camera_list_file, vr_mode or frame_list_file\n");
+    fflush(stdout);
+    exit(1);
+  }
+
+  //
+  // attempt to open output list file
+  //
+  output_list_file=fopen(bsr_config->output_list_file_name, "r");
+  if (output_list_file == NULL) {
+    printf("Error: could not open output list file %s\n", bsr_config->output_list_file_name);
+    fflush(stdout);
+    exit(1);
+  }
+  if (bsr_config->print_status == 1) {
+    printf("Loading output list file %s\n", bsr_config->output_list_file_name);
+    fflush(stdout);
+  }
+
+  //
+  // read and process each line of output list file
+  //
+  num_outputs=0;
+  input_line_p=fgets(input_line, 2048, output_list_file);
+  while (input_line_p != NULL) {
+    //
+    // remove comments and newline
+    //
+    symbol_p=strchr(input_line, '#');
+    if (symbol_p != NULL) {
+      *symbol_p=0;
+    }
+    symbol_p=strchr(input_line, '\n');
+    if (symbol_p != NULL) {
+      *symbol_p=0;
+    }
+
+    //
+    // skip blank lines
+    //
+    segment_p=input_line;
+    while ((*segment_p == ' ') || (*segment_p == '\t') || (*segment_p == '\r')) {
+      segment_p++;
+    }
+    if (*segment_p != 0) {
+      if (num_outputs == BSR_MAX_OUTPUTS) {
+        printf("Error: output list file %s has more than %d outputs\n", bsr_config->output_list_file_name, BSR_MAX_OUTPUTS);
+        fflush(stdout);
+        exit(1);
+      }
+
+      //
+      // start with a copy of the main configuration before validation and apply each option=value pair on this line
+      //
+      output_config=*base_config;
+      output_config.output_file_name[0]=0;
+      while (*segment_p != 0) {
+        segment_length=strcspn(segment_p, " \t\r");
+        strncpy(segment, segment_p, segment_length);
+        segment[segment_length]=0;
+        from_cgi=0;
+        processConfigSegment(&output_config, segment, from_cgi);
+        segment_p+=segment_length;
+        while ((*segment_p == ' ') || (*segment_p == '\t') || (*segment_p == '\r')) {
+          segment_p++;
+        }
+      } // end while segments
+
+      //
+      // validate output options, use default output file name if none was specified
+      //
+      validateOutputConfig(&output_config);
+      if (output_config.output_file_name[0] == 0) {
+        snprintf(output_number, 16, "%d", (num_outputs + 1));
+        setDefaultImageFileName(bsr_config, output_config.output_file_name, output_number);
+      }
+      storeOutput(&output_config, &bsr_state->output[num_outputs]);
+      num_outputs++;
+    } // end if not blank line
+
+    //
+    // load next line from output list file
+    //
+    input_line_p=fgets(input_line, 2048, output_list_file);
+  } // end while input_line_p
+  fclose(output_list_file);
+
+  if (num_outputs == 0) {
+    printf("Error: no outputs found in output list file %s\n", bsr_config->output_list_file_name);
+    fflush(stdout);
+    exit(1);
+  }
+  bsr_state->num_outputs=num_outputs;
+
+  //
+  // a single output replaces the main configuration's output options and the image's file name before buffers
+  // are allocated
+  //
+  if (num_outputs == 1) {
+    applyOutput(bsr_config, &bsr_state->output[0]);
+    snprintf(bsr_state->image[0].output_file_name, 256, "%s", bsr_config->output_file_name);
+    bsr_state->camera_pixel_limit=pow(100.0, (-bsr_config->camera_pixel_limit_mag / 5.0));
+  }
+
+  return(0);
+}
+
+int selectOutput(bsr_config_t *bsr_config, bsr_state_t *bsr_state, int output_index, int image_index) {
+  //
+  // This function sets this thread's output options for one output of the current image. It is called by all threads,
+  // which write identical values to the shared bsr_state. All threads must have finished with the previous output
+  // (rewindThreadStatus()) before this is called.
+  //
+  bsr_output_t *output;
+
+  output=bsr_state->output + output_index;
+
+  //
+  // all threads: set this thread's copy of the output options
+  //
+  applyOutput(bsr_config, output);
+
+  //
+  // all threads: set shared state for this output. Pixels are already in the image composition buffer so
+  // composition_prescale does not change with camera_pixel_limit
+  //
+  bsr_state->camera_pixel_limit=pow(100.0, (-bsr_config->camera_pixel_limit_mag / 5.0));
+  selectImage(bsr_config, bsr_state, image_index);
+  snprintf(bsr_config->output_file_name, 256, "%s", output->output_file_name);
+
+  return(0);
+}
+
+int saveUnprocessedImage(bsr_state_t *bsr_state) {
+  //
+  // main thread: keep a copy of the current image before it is post-processed in place
+  //
+  memcpy(bsr_state->image_unprocessed_buf, bsr_state->current_image_buf, ((size_t)bsr_state->current_image_res_x * (size_t)bsr_state->current_image_res_y * pixelSize(bsr_state->current_image_precision)));
+
+  return(0);
+}
+
+int restoreUnprocessedImage(bsr_state_t *bsr_state) {
+  //
+  // main thread: restore the current image so the next output is post-processed from the same pixels
+  //
+  memcpy(bsr_state->current_image_buf, bsr_state->image_unprocessed_buf, ((size_t)bsr_state->current_image_res_x * (size_t)bsr_state->current_image_res_y * pixelSize(bsr_state->current_image_precision)));
+
+  return(0);
+}
@@ -37,22 +37,32 @@
  */
 
 #include "bsrender.h" // needs to be first to get GNU_SOURCE define for strcasestr
+#include "pixel-buffer.h"
+
+int drawOverlayPixel(bsr_state_t *bsr_state, int x, int y) {
+  //
+  // This function draws one overlay pixel at (x,y) in full image coordinates. With tiled rendering the current
+  // image buffer only holds some rows of the image, pixels outside of those rows are skipped.
+  //
+  y-=bsr_state->current_image_y_offset;
+  if ((y >= 0) && (y < bsr_state->current_image_res_y)) {
+    storePixel(bsr_state->current_image_buf, bsr_state->current_image_precision, ((uint64_t)bsr_state->current_image_res_x * (uint64_t)y) + (uint64_t)x, 0.9, 0.0, 0.0);
+  }
+  return(0);
+}
 
 int drawCrossHairs(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
   int i;
-  pixel_composition_t *image_composition_p;
   double res_x;
   double res_y;
   double half_res_x;
   double half_res_y;
-  pixel_composition_t *image_buf;
 
   //
-  // get current image buffer and resolution
+  // get current image resolution
   //
-  image_buf=bsr_state->current_image_buf;
   res_x=(double)bsr_state->current_image_res_x;
-  res_y=(double)bsr_state->current_image_res_y;
+  res_y=(double)bsr_state->current_image_full_res_y;
   half_res_x=res_x / 2.0;
   half_res_y=res_y / 2.0;
 
@@ -60,47 +70,32 @@ int drawCrossHairs(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
   // draw crosshairs
   //
   for (i=(half_res_x - (res_y * 0.02)); i < (half_res_x - (res_y * 0.005)); i++) {
-    image_composition_p=image_buf + ((int)res_x * (int)half_res_y) + i;
-    image_composition_p->r=0.9;
-    image_composition_p->g=0.0;
-    image_composition_p->b=0.0;
+    drawOverlayPixel(bsr_state, i, (int)half_res_y);
   }
   for (i=(half_res_x + (res_y * 0.005)); i < (half_res_x + (res_y * 0.02)); i++) {
-    image_composition_p=image_buf + ((int)res_x * (int)half_res_y) + i;
-    image_composition_p->r=0.9;
-    image_composition_p->g=0.0;
-    image_composition_p->b=0.0;
+    drawOverlayPixel(bsr_state, i, (int)half_res_y);
   }
   for (i=(half_res_y - (res_y * 0.02)); i < (half_res_y - (res_y * 0.005)); i++) {
-    image_composition_p=image_buf + ((int)res_x * i) + (int)half_res_x;
-    image_composition_p->r=0.9;
-    image_composition_p->g=0.0;
-    image_composition_p->b=0.0;
+    drawOverlayPixel(bsr_state, (int)half_res_x, i);
   }
   for (i=(half_res_y + (res_y * 0.005)); i < (half_res_y + (res_y * 0.02)); i++) {
-    image_composition_p=image_buf + ((int)res_x * i) + (int)half_res_x;
-    image_composition_p->r=0.9;
-    image_composition_p->g=0.0;
-    image_composition_p->b=0.0;
+    drawOverlayPixel(bsr_state, (int)half_res_x, i);
   }
   return(0);
 }
 
 int drawGridLines(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
   int i;
-  pixel_composition_t *image_composition_p;
   double res_x;
   double res_y;
   double half_res_x;
   double half_res_y;
-  pixel_composition_t *image_buf;
 
   //
-  // get current image buffer and resolution
+  // get current image resolution
   //
-  image_buf=bsr_state->current_image_buf;
   res_x=(double)bsr_state->current_image_res_x;
-  res_y=(double)bsr_state->current_image_res_y;
+  res_y=(double)bsr_state->current_image_full_res_y;
   half_res_x=res_x / 2.0;
   half_res_y=res_y / 2.0;
 
@@ -108,40 +103,22 @@ int drawGridLines(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
   // draw select raster lines
   //
   for (i=0; i < res_x; i++) {
-    image_composition_p=image_buf + (int)res_x * (int)(res_y * 0.25) + i;
-    image_composition_p->r=0.9;
-    image_composition_p->g=0.0;
-    image_composition_p->b=0.0;
+    drawOverlayPixel(bsr_state, i, (int)(res_y * 0.25));
   }
   for (i=0; i < res_x; i++) {
-    image_composition_p=image_buf + (int)res_x * (int)half_res_y + i;
-    image_composition_p->r=0.9;
-    image_composition_p->g=0.0;
-    image_composition_p->b=0.0;
+    drawOverlayPixel(bsr_state, i, (int)half_res_y);
   }
   for (i=0; i < res_x; i++) {
-    image_composition_p=image_buf + (int)res_x * (int)(res_y * 0.75) + i;
-    image_composition_p->r=0.9;
-    image_composition_p->g=0.0;
-    image_composition_p->b=0.0;
+    drawOverlayPixel(bsr_state, i, (int)(res_y * 0.75));
   }
   for (i=0; i < res_y; i++) {
-    image_composition_p=image_buf + (int)res_x * i + (int)(res_x * 0.25);
-    image_composition_p->r=0.9;
-    image_composition_p->g=0.0;
-    image_composition_p->b=0.0;
+    drawOverlayPixel(bsr_state, (int)(res_x * 0.25), i);
   }
   for (i=0; i < res_y; i++) {
-    image_composition_p=image_buf + (int)res_x * i + (int)(half_res_x);
-    image_composition_p->r=0.9;
-    image_composition_p->g=0.0;
-    image_composition_p->b=0.0;
+    drawOverlayPixel(bsr_state, (int)(half_res_x), i);
   }
   for (i=0; i < res_y; i++) {
-    image_composition_p=image_buf + (int)res_x * i + (int)(res_x * 0.75);
-    image_composition_p->r=0.9;
-    image_composition_p->g=0.0;
-    image_composition_p->b=0.0;
+    drawOverlayPixel(bsr_state, (int)(res_x * 0.75), i);
   }
   return(0);
 }
@@ -39,6 +39,7 @@
 #ifndef BSR_OVERLAY_H
 #define BSR_OVERLAY_H
 
+int drawOverlayPixel(bsr_state_t *bsr_state, int x, int y);
 int drawCrossHairs(bsr_config_t *bsr_config, bsr_state_t *bsr_state);
 int drawGridLines(bsr_config_t *bsr_config, bsr_state_t *bsr_state);
 
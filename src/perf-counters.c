@@ -0,0 +1,257 @@
+//
+// Billion Star 3D Rendering Engine
+// Kevin M. Loch
+//
+// 3D rendering engine for the ESA Gaia DR3 star dataset
+
+/*
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2021, Kevin Loch
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "bsrender.h" // needs to be first to get GNU_SOURCE define for strcasestr
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "perf-counters.h"
+
+//
+// Optional performance counters (perf_counters=1 table, 2 JSON). Each thread opens its own user space counters
+// after fork() and reads them at every thread status checkpoint (waitForMainThread(), waitForWorkerThreads() and
+// rewindThreadStatus()). Counts since the previous checkpoint are added to the stage of the checkpoint's
+// THREAD_STATUS value in a globally mmapped table, separately for processing and for waiting on other threads.
+// The main thread aggregates the table after rendering.
+//
+// Hardware events are often not available in virtual machines, those are reported as n/a. task-clock is a
+// software event that is always available.
+//
+
+const char *perf_event_names[BSR_PERF_EVENTS]={"task_clock_ms", "cycles", "instructions", "LLC_misses", "dTLB_misses", "branch_misses"};
+
+const char *perf_stage_names[BSR_PERF_STAGES]={"Startup", "Airy disk maps", "Init image composition", "Process stars",\
+  "Post processing", "Gaussian blur", "Lanczos resampling", "Sequence pixels", "Image output", "Between images"};
+
+int openPerfCounters(bsr_state_t *bsr_state) {
+  //
+  // all threads: open counters for this process, user space only
+  //
+  const uint32_t event_type[BSR_PERF_EVENTS]={PERF_TYPE_SOFTWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,\
+    PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE};
+  const uint64_t event_config[BSR_PERF_EVENTS]={PERF_COUNT_SW_TASK_CLOCK, PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,\
+    PERF_COUNT_HW_CACHE_MISSES, (PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)),\
+    PERF_COUNT_HW_BRANCH_MISSES};
+  struct perf_event_attr event_attr;
+  int i;
+
+  for (i=0; i < BSR_PERF_EVENTS; i++) {
+    memset(&event_attr, 0, sizeof(event_attr));
+    event_attr.size=sizeof(event_attr);
+    event_attr.type=event_type[i];
+    event_attr.config=event_config[i];
+    event_attr.exclude_kernel=1;
+    event_attr.exclude_hv=1;
+    bsr_state->perthread->perf_fd[i]=(int)syscall(SYS_perf_event_open, &event_attr, 0, -1, -1, 0);
+    bsr_state->perthread->perf_last[i]=0;
+    if ((bsr_state->perthread->perf_fd[i] >= 0) && (read(bsr_state->perthread->perf_fd[i], &bsr_state->perthread->perf_last[i], sizeof(uint64_t)) != sizeof(uint64_t))) {
+      close(bsr_state->perthread->perf_fd[i]);
+      bsr_state->perthread->perf_fd[i]=-1;
+    }
+  }
+
+  return(0);
+}
+
+int perfEventAvailable(bsr_state_t *bsr_state, int event) {
+  //
+  // events that could not be opened by any thread are reported as n/a. Counters that were opened are never all zero
+  // for the whole render
+  //
+  bsr_perf_stage_t *perf_stage;
+  int i;
+
+  for (i=0; i < ((bsr_state->num_worker_threads + 1) * BSR_PERF_STAGES); i++) {
+    perf_stage=bsr_state->perf_stages + i;
+    if ((perf_stage->work_count[event] != 0) || (perf_stage->wait_count[event] != 0)) {
+      return(1);
+    }
+  }
+
+  return(0);
+}
+
+double perfValue(uint64_t count, int event) {
+  //
+  // task-clock is in nanoseconds, reported in milliseconds
+  //
+  if (event == 0) {
+    return((double)count / 1.0E6);
+  }
+  return((double)count);
+}
+
+int printPerfJSONValues(uint64_t *count, int *available) {
+  int i;
+
+  for (i=0; i < BSR_PERF_EVENTS; i++) {
+    if (i > 0) {
+      printf(", ");
+    }
+    if (available[i] == 0) {
+      printf("null");
+    } else if (i == 0) {
+      printf("%.3f", perfValue(count[i], i));
+    } else {
+      printf("%llu", (unsigned long long)count[i]);
+    }
+  }
+
+  return(0);
+}
+
+int printPerfTableRow(bsr_state_t *bsr_state, const char *stage_name, const char *thread_name, uint64_t *count, int *available) {
+  int i;
+
+  printf("%-23s %-13s", stage_name, thread_name);
+  for (i=0; i < BSR_PERF_EVENTS; i++) {
+    if (available[i] == 0) {
+      printf(" %13s", "n/a");
+    } else if (i == 0) {
+      printf(" %13.1f", perfValue(count[i], i));
+    } else {
+      printf(" %13llu", (unsigned long long)count[i]);
+    }
+  }
+  if ((available[1] == 1) && (available[2] == 1) && (count[1] > 0)) {
+    printf(" %5.2f", ((double)count[2] / (double)count[1]));
+  } else {
+    printf(" %5s", "n/a");
+  }
+  printf("\n");
+
+  return(0);
+}
+
+int printPerfCounters(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
+  //
+  // main thread: print counters per stage as a table (main thread, sum of worker threads, and the busiest worker
+  // thread to show load imbalance) or as JSON with each thread's counts
+  //
+  bsr_perf_stage_t *perf_stage;
+  uint64_t main_work[BSR_PERF_EVENTS];
+  uint64_t main_wait[BSR_PERF_EVENTS];
+  uint64_t workers_work[BSR_PERF_EVENTS];
+  uint64_t workers_wait[BSR_PERF_EVENTS];
+  uint64_t busiest_work[BSR_PERF_EVENTS];
+  int available[BSR_PERF_EVENTS];
+  int stage;
+  int thread_id;
+  int busiest_thread;
+  int first_entry;
+  int i;
+
+  for (i=0; i < BSR_PERF_EVENTS; i++) {
+    available[i]=perfEventAvailable(bsr_state, i);
+  }
+
+  if (bsr_config->perf_counters == 2) {
+    //
+    // JSON: one entry per stage and thread
+    //
+    printf("{\"perf_counters\": {\"events\": [");
+    for (i=0; i < BSR_PERF_EVENTS; i++) {
+      printf("%s\"%s\"", ((i > 0) ? ", " : ""), perf_event_names[i]);
+    }
+    printf("], \"stages\": [");
+    first_entry=1;
+    for (stage=0; stage < BSR_PERF_STAGES; stage++) {
+      for (thread_id=0; thread_id <= bsr_state->num_worker_threads; thread_id++) {
+        perf_stage=bsr_state->perf_stages + (thread_id * BSR_PERF_STAGES) + stage;
+        if ((perf_stage->work_count[0] == 0) && (perf_stage->wait_count[0] == 0) && (perf_stage->work_count[1] == 0) && (perf_stage->wait_count[1] == 0)) {
+          continue;
+        }
+        printf("%s\n  {\"stage\": \"%s\", \"thread\": %d, \"work\": [", ((first_entry == 1) ? "" : ","), perf_stage_names[stage], thread_id);
+        printPerfJSONValues(perf_stage->work_count, available);
+        printf("], \"wait\": [");
+        printPerfJSONValues(perf_stage->wait_count, available);
+        printf("]}");
+        first_entry=0;
+      }
+    }
+    printf("\n]}}\n");
+    fflush(stdout);
+    return(0);
+  }
+
+  //
+  // table: main thread, all worker threads, and the worker thread with the most task-clock (or cycles) per stage
+  //
+  printf("Performance counters (user space):\n");
+  printf("%-23s %-13s", "Stage", "Threads");
+  for (i=0; i < BSR_PERF_EVENTS; i++) {
+    printf(" %13s", perf_event_names[i]);
+  }
+  printf(" %5s\n", "IPC");
+  for (stage=0; stage < BSR_PERF_STAGES; stage++) {
+    memset(workers_work, 0, sizeof(workers_work));
+    memset(workers_wait, 0, sizeof(workers_wait));
+    perf_stage=bsr_state->perf_stages + stage;
+    memcpy(main_work, perf_stage->work_count, sizeof(main_work));
+    memcpy(main_wait, perf_stage->wait_count, sizeof(main_wait));
+    busiest_thread=1;
+    for (thread_id=1; thread_id <= bsr_state->num_worker_threads; thread_id++) {
+      perf_stage=bsr_state->perf_stages + (thread_id * BSR_PERF_STAGES) + stage;
+      for (i=0; i < BSR_PERF_EVENTS; i++) {
+        workers_work[i]+=perf_stage->work_count[i];
+        workers_wait[i]+=perf_stage->wait_count[i];
+      }
+      if ((perf_stage->work_count[0] + perf_stage->work_count[1]) > (bsr_state->perf_stages[(busiest_thread * BSR_PERF_STAGES) + stage].work_count[0] + bsr_state->perf_stages[(busiest_thread * BSR_PERF_STAGES) + stage].work_count[1])) {
+        busiest_thread=thread_id;
+      }
+    }
+    if ((main_work[0] + main_wait[0] + workers_work[0] + workers_wait[0] + main_work[1] + main_wait[1] + workers_work[1] + workers_wait[1]) == 0) {
+      continue;
+    }
+    memcpy(busiest_work, bsr_state->perf_stages[(busiest_thread * BSR_PERF_STAGES) + stage].work_count, sizeof(busiest_work));
+    printPerfTableRow(bsr_state, perf_stage_names[stage], "main", main_work, available);
+    printPerfTableRow(bsr_state, "", "main wait", main_wait, available);
+    printPerfTableRow(bsr_state, "", "workers", workers_work, available);
+    printPerfTableRow(bsr_state, "", "workers wait", workers_wait, available);
+    if (bsr_state->num_worker_threads > 1) {
+      printPerfTableRow(bsr_state, "", "busiest", busiest_work, available);
+    }
+  }
+  fflush(stdout);
+
+  return(0);
+}
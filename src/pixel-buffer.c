@@ -0,0 +1,140 @@
+//
+// Billion Star 3D Rendering Engine
+// Kevin M. Loch
+//
+// 3D rendering engine for the ESA Gaia DR3 star dataset
+
+/*
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2021, Kevin Loch
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "bsrender.h" // needs to be first to get GNU_SOURCE define for strcasestr
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "pixel-buffer.h"
+
+size_t pixelSize(int precision) {
+  if (precision == 16) {
+    return(sizeof(pixel_composition_fp16_t));
+  } else if (precision == 64) {
+    return(sizeof(pixel_composition_fp64_t));
+  }
+  return(sizeof(pixel_composition_fp32_t));
+}
+
+uint64_t bufferMemoryLimit(bsr_config_t *bsr_config) {
+  //
+  // This function returns the memory budget for image buffers in bytes, buffer_memory_limit MB or
+  // 3/4 of physical memory by default
+  //
+  long pages;
+  long page_size;
+
+  if (bsr_config->buffer_memory_limit > 0) {
+    return((uint64_t)bsr_config->buffer_memory_limit * (uint64_t)1048576);
+  }
+  pages=sysconf(_SC_PHYS_PAGES);
+  page_size=sysconf(_SC_PAGE_SIZE);
+  if ((pages > 0) && (page_size > 0)) {
+    return(((uint64_t)pages * (uint64_t)page_size / (uint64_t)4) * (uint64_t)3);
+  }
+  return(UINT64_MAX);
+}
+
+int selectBufferPrecision(bsr_config_t *bsr_config, bsr_state_t *bsr_state, uint64_t composition_pixels, uint64_t blur_pixels, uint64_t resize_pixels) {
+  //
+  // This function selects the floating-point precision of the image composition, blur and resize buffers. Buffers
+  // set to 0 (auto) use 32-bit floats unless the total size of all buffers would exceed buffer_memory_limit, in
+  // which case they use 16-bit floats. The default limit (0) is 3/4 of physical memory.
+  //
+  uint64_t memory_limit;
+  uint64_t buffer_memory;
+  int use_fp16=0;
+
+  //
+  // determine memory limit in bytes
+  //
+  memory_limit=bufferMemoryLimit(bsr_config);
+
+  //
+  // start with configured precision, or 32-bit for auto
+  //
+  bsr_state->composition_precision=bsr_config->composition_precision;
+  bsr_state->blur_precision=bsr_config->blur_precision;
+  bsr_state->resize_precision=bsr_config->resize_precision;
+  if (bsr_state->composition_precision == 0) {
+    bsr_state->composition_precision=32;
+  }
+  if (bsr_state->blur_precision == 0) {
+    bsr_state->blur_precision=32;
+  }
+  if (bsr_state->resize_precision == 0) {
+    bsr_state->resize_precision=32;
+  }
+
+  //
+  // switch auto buffers to 16-bit if they don't fit
+  //
+  buffer_memory=(composition_pixels * (uint64_t)pixelSize(bsr_state->composition_precision))\
+    + (blur_pixels * (uint64_t)pixelSize(bsr_state->blur_precision))\
+    + (resize_pixels * (uint64_t)pixelSize(bsr_state->resize_precision));
+  if (buffer_memory > memory_limit) {
+    if (bsr_config->composition_precision == 0) {
+      bsr_state->composition_precision=16;
+      use_fp16=1;
+    }
+    if (bsr_config->blur_precision == 0) {
+      bsr_state->blur_precision=16;
+      use_fp16=1;
+    }
+    if (bsr_config->resize_precision == 0) {
+      bsr_state->resize_precision=16;
+      use_fp16=1;
+    }
+  }
+  if ((use_fp16 == 1) && (bsr_config->cgi_mode != 1) && (bsr_config->print_status == 1)) {
+    printf("Using 16-bit floating-point image buffers to fit in buffer memory limit of %lluMB\n", (unsigned long long)(memory_limit / (uint64_t)1048576));
+    fflush(stdout);
+  }
+
+  //
+  // 16-bit composition buffers store pixels normalized to the camera saturation level to stay within
+  // the limited range of half precision floats. Post processing accounts for this when normalizing
+  //
+  if (bsr_state->composition_precision == 16) {
+    bsr_state->composition_prescale=1.0 / bsr_state->camera_pixel_limit;
+  } else {
+    bsr_state->composition_prescale=1.0;
+  }
+
+  return(0);
+}
@@ -0,0 +1,213 @@
+//
+// Billion Star 3D Rendering Engine
+// Kevin M. Loch
+//
+// 3D rendering engine for the ESA Gaia DR3 star dataset
+
+/*
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2021, Kevin Loch
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BSR_PIXEL_BUFFER_H
+#define BSR_PIXEL_BUFFER_H
+
+#include <string.h>
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
+
+//
+// Pixel access kernels for image composition, blur, and resize buffers. Buffer precision is selected at runtime so
+// these are inlined into each stage's loops, where the precision test is loop-invariant and hoisted by the compiler.
+// Pixel values are always double precision outside of the buffers.
+//
+// 16-bit pixels use F16C instructions if available (-mf16c or -march=native), otherwise a software conversion.
+//
+
+#define BSR_FP16_MAX 65504.0 // largest finite half precision value
+
+static inline uint16_t floatToHalf(double value) {
+  float f;
+#ifndef __F16C__
+  uint32_t x;
+  uint16_t sign;
+  int exponent;
+  uint32_t mantissa;
+  uint32_t remainder;
+  uint32_t halfway;
+  int shift;
+  uint16_t half;
+#endif
+
+  //
+  // saturate instead of overflowing to infinity
+  //
+  if (value > BSR_FP16_MAX) {
+    value=BSR_FP16_MAX;
+  } else if (value < -BSR_FP16_MAX) {
+    value=-BSR_FP16_MAX;
+  }
+  f=(float)value;
+
+#ifdef __F16C__
+  return(_cvtss_sh(f, 0));
+#else
+  //
+  // round to nearest even, NaN is the only non-finite input
+  //
+  memcpy(&x, &f, 4);
+  sign=(uint16_t)((x >> 16) & 0x8000);
+  if (((x >> 23) & 0xff) == 0xff) {
+    return(sign | 0x7e00);
+  }
+  exponent=(int)((x >> 23) & 0xff) - 127 + 15;
+  mantissa=x & 0x7fffff;
+  if (exponent <= 0) {
+    // subnormal or zero
+    if (exponent < -10) {
+      return(sign);
+    }
+    mantissa|=0x800000;
+    shift=14 - exponent;
+    half=(uint16_t)(mantissa >> shift);
+    remainder=mantissa & ((1 << shift) - 1);
+    halfway=1 << (shift - 1);
+  } else {
+    half=(uint16_t)((exponent << 10) | (mantissa >> 13));
+    remainder=mantissa & 0x1fff;
+    halfway=0x1000;
+  }
+  if ((remainder > halfway) || ((remainder == halfway) && ((half & 1) == 1))) {
+    half++; // may carry into exponent, which is still correct
+  }
+  return(sign | half);
+#endif
+}
+
+static inline double halfToFloat(uint16_t half) {
+#ifdef __F16C__
+  return((double)_cvtsh_ss(half));
+#else
+  uint32_t x;
+  uint32_t exponent;
+  uint32_t mantissa;
+  float f;
+
+  exponent=(half >> 10) & 0x1f;
+  mantissa=half & 0x3ff;
+  if (exponent == 0) {
+    // subnormal or zero
+    f=(float)mantissa * 5.9604644775390625E-8f; // 2^-24
+    return((half & 0x8000) ? -(double)f : (double)f);
+  } else if (exponent == 31) {
+    x=((uint32_t)(half & 0x8000) << 16) | 0x7f800000 | (mantissa << 13);
+  } else {
+    x=((uint32_t)(half & 0x8000) << 16) | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+  }
+  memcpy(&f, &x, 4);
+  return((double)f);
+#endif
+}
+
+static inline void loadPixel(void *buf, int precision, uint64_t offset, double *r, double *g, double *b) {
+  pixel_composition_fp16_t *pixel_fp16;
+  pixel_composition_fp32_t *pixel_fp32;
+  pixel_composition_fp64_t *pixel_fp64;
+
+  if (precision == 32) {
+    pixel_fp32=(pixel_composition_fp32_t *)buf + offset;
+    *r=pixel_fp32->r;
+    *g=pixel_fp32->g;
+    *b=pixel_fp32->b;
+  } else if (precision == 64) {
+    pixel_fp64=(pixel_composition_fp64_t *)buf + offset;
+    *r=pixel_fp64->r;
+    *g=pixel_fp64->g;
+    *b=pixel_fp64->b;
+  } else {
+    pixel_fp16=(pixel_composition_fp16_t *)buf + offset;
+    *r=halfToFloat(pixel_fp16->r);
+    *g=halfToFloat(pixel_fp16->g);
+    *b=halfToFloat(pixel_fp16->b);
+  }
+}
+
+static inline void storePixel(void *buf, int precision, uint64_t offset, double r, double g, double b) {
+  pixel_composition_fp16_t *pixel_fp16;
+  pixel_composition_fp32_t *pixel_fp32;
+  pixel_composition_fp64_t *pixel_fp64;
+
+  if (precision == 32) {
+    pixel_fp32=(pixel_composition_fp32_t *)buf + offset;
+    pixel_fp32->r=r;
+    pixel_fp32->g=g;
+    pixel_fp32->b=b;
+  } else if (precision == 64) {
+    pixel_fp64=(pixel_composition_fp64_t *)buf + offset;
+    pixel_fp64->r=r;
+    pixel_fp64->g=g;
+    pixel_fp64->b=b;
+  } else {
+    pixel_fp16=(pixel_composition_fp16_t *)buf + offset;
+    pixel_fp16->r=floatToHalf(r);
+    pixel_fp16->g=floatToHalf(g);
+    pixel_fp16->b=floatToHalf(b);
+  }
+}
+
+static inline void addPixel(void *buf, int precision, uint64_t offset, double r, double g, double b) {
+  pixel_composition_fp16_t *pixel_fp16;
+  pixel_composition_fp32_t *pixel_fp32;
+  pixel_composition_fp64_t *pixel_fp64;
+
+  if (precision == 32) {
+    pixel_fp32=(pixel_composition_fp32_t *)buf + offset;
+    pixel_fp32->r+=r;
+    pixel_fp32->g+=g;
+    pixel_fp32->b+=b;
+  } else if (precision == 64) {
+    pixel_fp64=(pixel_composition_fp64_t *)buf + offset;
+    pixel_fp64->r+=r;
+    pixel_fp64->g+=g;
+    pixel_fp64->b+=b;
+  } else {
+    pixel_fp16=(pixel_composition_fp16_t *)buf + offset;
+    pixel_fp16->r=floatToHalf(halfToFloat(pixel_fp16->r) + r);
+    pixel_fp16->g=floatToHalf(halfToFloat(pixel_fp16->g) + g);
+    pixel_fp16->b=floatToHalf(halfToFloat(pixel_fp16->b) + b);
+  }
+}
+
+size_t pixelSize(int precision);
+uint64_t bufferMemoryLimit(bsr_config_t *bsr_config);
+int selectBufferPrecision(bsr_config_t *bsr_config, bsr_state_t *bsr_state, uint64_t composition_pixels, uint64_t blur_pixels, uint64_t resize_pixels);
+
+#endif // BSR_PIXEL_BUFFER_H
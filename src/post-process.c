@@ -44,6 +44,7 @@
 #include "Lanczos.h"
 #include "Gaussian-blur.h"
 #include "overlay.h"
+#include "pixel-buffer.h"
 
 int postProcess(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
   struct timespec starttime;
@@ -52,15 +53,20 @@ int postProcess(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
   uint64_t image_offset;
   int current_image_x;
   int current_image_y;
-  pixel_composition_t *current_image_p;
+  uint64_t current_image_offset;
+  int current_image_precision;
   double inv_camera_pixel_limit;
   double pixel_r;
   double pixel_g;
   double pixel_b;
   int current_image_res_x;
   int current_image_res_y;
-  int lines_per_thread;
+  int first_line;
+  int end_line;
   int i;
+  int trace_event;
+  int blur_limit;
+  int resize_log;
 
   //
   // main thread: display status message if not in CGI mode
@@ -72,15 +78,28 @@ int postProcess(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
   }
 
   //
-  // all threads: get current image resolution and lines per thread
+  // all threads: get current image resolution
   //
   current_image_res_x=bsr_state->current_image_res_x;
   current_image_res_y=bsr_state->current_image_res_y;
-  lines_per_thread=(int)ceil(((double)current_image_res_y / (double)(bsr_state->num_worker_threads + 1)));
-  if (lines_per_thread < 1) {
-    lines_per_thread=1;
+  inv_camera_pixel_limit = 1.0 / (bsr_state->camera_pixel_limit * bsr_state->composition_prescale);
+  current_image_precision=bsr_state->current_image_precision;
+
+  //
+  // all threads: the per-pixel preparation for Gaussian blur and Lanczos resampling is done in the same pass, so the
+  // image is only read and written once before blurring or resizing. If the image is blurred, log scale for
+  // resampling is applied by the blur's vertical pass instead
+  //
+  if (bsr_config->Gaussian_blur_radius > 0.0) {
+    blur_limit=1;
+  } else {
+    blur_limit=0;
+  }
+  if ((bsr_config->output_scaling_factor != 1.0) && (blur_limit == 0)) {
+    resize_log=1;
+  } else {
+    resize_log=0;
   }
-  inv_camera_pixel_limit = 1.0 / bsr_state->camera_pixel_limit;
 
   //
   // worker threads:  wait for main thread to say go
@@ -90,52 +109,77 @@ int postProcess(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
     waitForMainThread(bsr_state, THREAD_STATUS_POST_PROCESS_BEGIN);
   } else {
     // main thread
+    initRowBlocks(bsr_state, current_image_res_y, 1);
     for (i=1; i <= bsr_state->num_worker_threads; i++) {
       bsr_state->status_array[i].status=THREAD_STATUS_POST_PROCESS_BEGIN;
     }
   } // end if not main thread
 
+  trace_event=traceBegin(bsr_state, "Post processing", NULL);
+
   //
-  // all threads: normalize pixels to 1.0 reference, and apply cmaera_gamma
+  // all threads: normalize pixels to 1.0 reference, and apply cmaera_gamma to each block of lines
   //
-  current_image_x=0;
-  current_image_y=bsr_state->perthread->my_thread_id * lines_per_thread;
-  current_image_p=bsr_state->current_image_buf + ((uint64_t)current_image_res_x * (uint64_t)current_image_y);
-  for (image_offset=0; ((image_offset < ((uint64_t)bsr_state->current_image_res_x * (uint64_t)lines_per_thread)) && (current_image_y < current_image_res_y)); image_offset++) {
-    // normalize pixel values to camera saturation reference level = 1.0
-    pixel_r=current_image_p->r * inv_camera_pixel_limit;
-    pixel_g=current_image_p->g * inv_camera_pixel_limit;
-    pixel_b=current_image_p->b * inv_camera_pixel_limit;
+  while (nextRowBlock(bsr_state, &first_line, &end_line) == 1) {
+    current_image_x=0;
+    current_image_y=first_line;
+    current_image_offset=(uint64_t)current_image_res_x * (uint64_t)current_image_y;
+    for (image_offset=0; ((image_offset < ((uint64_t)current_image_res_x * (uint64_t)(end_line - first_line))) && (current_image_y < current_image_res_y)); image_offset++) {
+      // normalize pixel values to camera saturation reference level = 1.0
+      loadPixel(bsr_state->current_image_buf, current_image_precision, current_image_offset, &pixel_r, &pixel_g, &pixel_b);
+      pixel_r*=inv_camera_pixel_limit;
+      pixel_g*=inv_camera_pixel_limit;
+      pixel_b*=inv_camera_pixel_limit;
 
-    // optionally apply camera gamma setting
-    if (bsr_config->camera_gamma != 1.0) { // this is expensive so only if not 1.0
-      pixel_r=pow(pixel_r, bsr_config->camera_gamma);
-      pixel_g=pow(pixel_g, bsr_config->camera_gamma);
-      pixel_b=pow(pixel_b, bsr_config->camera_gamma);
-    }
+      // optionally apply camera gamma setting
+      if (bsr_config->camera_gamma != 1.0) { // this is expensive so only if not 1.0
+        pixel_r=pow(pixel_r, bsr_config->camera_gamma);
+        pixel_g=pow(pixel_g, bsr_config->camera_gamma);
+        pixel_b=pow(pixel_b, bsr_config->camera_gamma);
+      }
+
+      // optionally pre-limit intensity before blur/resize
+      if (bsr_config->pre_limit_intensity == 1) {
+        if (bsr_config->camera_pixel_limit_mode == 0) {
+          limitIntensity(bsr_config, &pixel_r, &pixel_g, &pixel_b);
+        } else if (bsr_config->camera_pixel_limit_mode == 1) {
+          limitIntensityPreserveColor(bsr_config, &pixel_r, &pixel_g, &pixel_b);
+        }
+      }
 
-    // optionally pre-limit intensity before blur/resize
-    if (bsr_config->pre_limit_intensity == 1) {
-      if (bsr_config->camera_pixel_limit_mode == 0) {
+      // optionally limit to [0..BSR_BLUR_RESCALE] for Gaussian blur. Values are limited in the range [0..1] then
+      // scaled back so buffers keep the same magnitude as the input image, which keeps fp16 buffers away from
+      // subnormal values
+      if (blur_limit == 1) {
+        pixel_r/=BSR_BLUR_RESCALE;
+        pixel_g/=BSR_BLUR_RESCALE;
+        pixel_b/=BSR_BLUR_RESCALE;
         limitIntensity(bsr_config, &pixel_r, &pixel_g, &pixel_b);
-      } else if (bsr_config->camera_pixel_limit_mode == 1) {
-        limitIntensityPreserveColor(bsr_config, &pixel_r, &pixel_g, &pixel_b);
+        pixel_r*=BSR_BLUR_RESCALE;
+        pixel_g*=BSR_BLUR_RESCALE;
+        pixel_b*=BSR_BLUR_RESCALE;
       }
-    }
 
-    // copy back to current image buf
-    current_image_p->r=pixel_r;
-    current_image_p->g=pixel_g;
-    current_image_p->b=pixel_b;
+      // optionally convert to log scale for Lanczos resampling
+      if (resize_log == 1) {
+        LanczosLogPixel(&pixel_r, &pixel_g, &pixel_b);
+      }
 
-    // if end of this line, move to next line
-    current_image_x++;
-    if (current_image_x == bsr_state->current_image_res_x) {
-      current_image_x=0;
-      current_image_y++;
-    }
-    current_image_p++;
-  } // end for i
+      // copy back to current image buf
+      storePixel(bsr_state->current_image_buf, current_image_precision, current_image_offset, pixel_r, pixel_g, pixel_b);
+
+      // if end of this line, move to next line
+      current_image_x++;
+      if (current_image_x == bsr_state->current_image_res_x) {
+        current_image_x=0;
+        current_image_y++;
+        checkCancel(bsr_state);
+      }
+      current_image_offset++;
+    } // end for i
+  } // end while nextRowBlock
+
+  traceEnd(bsr_state, trace_event);
 
   //
   // worker threads: signal this thread is done and wait until main thread says we can continue to next step.
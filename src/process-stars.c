@@ -45,7 +45,7 @@
 
 //
 // note: all functions in this file should remain in this file for compiler optimization
-// exception: quaternion_product() is only used by init-state.c but is grouped here
+// exception: quaternion_product() is only used by multi-camera.c but is grouped here
 // for clarity.
 //
 
@@ -164,9 +164,11 @@ int sendPixelToMainThread(bsr_state_t *bsr_state, uint64_t image_offset, double
       bsr_state->perthread->thread_buf_p->status_right=1;
       bsr_state->perthread->thread_buf_p++;
       bsr_state->perthread->thread_buffer_index++;
+      bsr_state->perthread->stats.pixels_sent++;
       success=1;
     } else {
       idle_count++;
+      bsr_state->perthread->stats.send_stalls++;
       if (idle_count > 10000) {
         // check if main thread is still alive
         checkExceptions(bsr_state);
@@ -188,6 +190,7 @@ int sendDedupBufferToMainThread(bsr_state_t *bsr_state) {
   int dedup_buf_i;
   uint64_t dedup_index_offset;
 
+  bsr_state->perthread->stats.dedup_flushes++;
   dedup_buf_p=bsr_state->dedup_buf; // start at beginning of dedup buffer
   for (dedup_buf_i=0; dedup_buf_i < bsr_state->perthread->dedup_count; dedup_buf_i++) {
     //
@@ -264,14 +267,17 @@ int sendPixelToDedupBuffer(bsr_state_t *bsr_state, uint64_t image_offset, double
     dedup_buf_p->g=g;
     dedup_buf_p->b=b;
     dedup_index_p->dedup_record_p=dedup_buf_p;
+    bsr_state->perthread->stats.dedup_inserts++;
   } else if (dedup_index_p->dedup_record_p->image_offset == image_offset) {
     // duplicate pixel locaiton, add to existing dedup buffer record values
     dedup_buf_p=dedup_index_p->dedup_record_p;
     dedup_buf_p->r+=r;
     dedup_buf_p->g+=g;
     dedup_buf_p->b+=b;
+    bsr_state->perthread->stats.dedup_merges++;
   } else {
     // dedup index collision, send this pixel directly to main thread
+    bsr_state->perthread->stats.dedup_collisions++;
     sendPixelToMainThread(bsr_state, image_offset, r, g, b);
   } // end if dedup_index_p->dedup_record_p
 
@@ -285,7 +291,7 @@ int sendPixelToDedupBuffer(bsr_state_t *bsr_state, uint64_t image_offset, double
   return(0);
 }
 
-int antiAliasPixel(bsr_config_t *bsr_config, bsr_state_t *bsr_state, double output_x_d, double output_y_d, double r, double g, double b) {
+int antiAliasPixel(bsr_config_t *bsr_config, bsr_state_t *bsr_state, bsr_camera_t *camera, double output_x_d, double output_y_d, double r, double g, double b) {
   //
   // This function takes an output pixel and spreads it across several pixels. Pixels are spread in a square pattern similar to horizontal+vertical
   // LPF's commonly found in DSLR's. This spread uses floating-point position variables for accurate interpolation.
@@ -315,8 +321,8 @@ int antiAliasPixel(bsr_config_t *bsr_config, bsr_state_t *bsr_state, double outp
   //
   // scan spread grid, and for each spread pixel detemine intensity and send to dedup buffer
   //
-  for (spread_y=(int)top_edge; spread_y <= (int)bottom_edge; spread_y++) {
-    for (spread_x=(int)left_edge; spread_x <= (int)right_edge; spread_x++) {
+  for (spread_y=(int)floor(top_edge); spread_y <= (int)floor(bottom_edge); spread_y++) {
+    for (spread_x=(int)floor(left_edge); spread_x <= (int)floor(right_edge); spread_x++) {
       // determine how much of spread pattern overlaps this output pixel
       x_overlap=0.0;
       y_overlap=0.0;
@@ -349,8 +355,8 @@ int antiAliasPixel(bsr_config_t *bsr_config, bsr_state_t *bsr_state, double outp
       output_b=aa_factor * b;
 
       // send to dedup buffer if within raster bounds
-      if ((spread_x >= 0) && (spread_x < bsr_config->camera_res_x) && (spread_y >= 0) && (spread_y < bsr_config->camera_res_y)) {
-        image_offset=((uint64_t)bsr_config->camera_res_x * (uint64_t)spread_y) + (uint64_t)spread_x;
+      if ((spread_x >= 0) && (spread_x < camera->camera_res_x) && (spread_y >= camera->tile_y_min) && (spread_y < camera->tile_y_max)) {
+        image_offset=camera->image_offset + ((uint64_t)camera->image_stride * (uint64_t)(spread_y - camera->tile_y_min)) + (uint64_t)spread_x;
         sendPixelToDedupBuffer(bsr_state, image_offset, output_r, output_g, output_b);
       }
     } // end for spread_x
@@ -364,6 +370,7 @@ int processStars(bsr_config_t *bsr_config, bsr_state_t *bsr_state, input_file_t
   // This function handles the most expensive operations in bsrender. It performs the following:
   //
   // - reads stars from the supplied input file
+  // - for each camera:
   // - filters stars by distance from target or camera, and color temperature
   // - translates position relative to camera position
   // - rotates stars to center on target (and optional pan/tilt away from target)
@@ -387,6 +394,7 @@ int processStars(bsr_config_t *bsr_config, bsr_state_t *bsr_state, input_file_t
   double star_y;
   double star_z;
   double star_r2; // squared
+  double view_cone_dot;
   double star_xy_r;
   double star_yz_r;
   double render_distance2; // distance from selected point to star (squared)
@@ -431,6 +439,16 @@ int processStars(bsr_config_t *bsr_config, bsr_state_t *bsr_state, input_file_t
   uint32_t *tmp32_p;
   double star_distance_from_earth2;
   double intensity_test;
+  int camera_index;
+  bsr_camera_t *camera;
+  bsr_file_stats_t *file_stats;
+  uint64_t view_cone_rejects=0;
+  uint64_t distance_rejects=0;
+  uint64_t intensity_rejects=0;
+  uint64_t color_rejects=0;
+  uint64_t off_raster_rejects=0;
+  uint64_t stars_rendered=0;
+  uint64_t dedup_pixels_begin;
 
   //
   // init shortcut variables
@@ -442,6 +460,7 @@ int processStars(bsr_config_t *bsr_config, bsr_state_t *bsr_state, input_file_t
   if (input_records_per_thread < 1) {
     input_records_per_thread=1;
   }
+  dedup_pixels_begin=bsr_state->perthread->stats.dedup_inserts + bsr_state->perthread->stats.dedup_merges + bsr_state->perthread->stats.dedup_collisions;
 
   //
   // process each line of input file
@@ -484,6 +503,11 @@ int processStars(bsr_config_t *bsr_config, bsr_state_t *bsr_state, input_file_t
     // BSRENDER_LE for little-endian and BSRENDER_BE for big-endian.
     //
 
+    // periodically check if the render has been canceled
+    if ((input_record_rel & 0xffff) == 0) {
+      checkCancel(bsr_state);
+    }
+
     //
     // unpack star record from 33 byte star_record into individual variables
     //
@@ -578,233 +602,278 @@ int processStars(bsr_config_t *bsr_config, bsr_state_t *bsr_state, input_file_t
 #endif
 
     //
-    // translate original star x,y,z to new coordinates as seen by camera position
+    // transform and render this star for each camera. Star records are only decoded once per pass through
+    // the input file regardless of the number of cameras
     //
-    star_x=star_icrs_x - bsr_config->camera_icrs_x;
-    star_y=star_icrs_y - bsr_config->camera_icrs_y;
-    star_z=star_icrs_z - bsr_config->camera_icrs_z;
-    star_r2=(star_x * star_x) + (star_y * star_y) + (star_z * star_z); // leave squared for now for better performance
+    for (camera_index=0; camera_index < bsr_state->num_cameras; camera_index++) {
+      camera=bsr_state->camera + camera_index;
 
-    //
-    // determine star intensity test for intensity filter
-    //
-    linear_intensity=linear_1pc_intensity / star_r2;
-    if (bsr_config->star_intensity_selector == 0) {
-      // intensity as seen from camera position
-      intensity_test=linear_intensity;
-    } else if (bsr_config->star_intensity_selector == 1) {
-      // intensity as seen from Earth
-      star_distance_from_earth2=(star_icrs_x * star_icrs_x) + (star_icrs_y * star_icrs_y) + (star_icrs_z * star_icrs_z); // leave squared, used as squared on next line
-      intensity_test=linear_1pc_intensity / star_distance_from_earth2;
-    } else {
-      // absolute magnitude (intensity at 10pc)
-      intensity_test=linear_1pc_intensity * 0.01;
-    }
-
-    //
-    // determine render distance for distance filter
-    //
-    if (bsr_config->render_distance_selector == 0) { // selected point is camera
-      render_distance2=star_r2; // star distance from camera
-    } else { // selected point is target
-      // leave squared
-      render_distance2=((star_icrs_x - bsr_config->target_icrs_x) * (star_icrs_x - bsr_config->target_icrs_x))\
-                     + ((star_icrs_y - bsr_config->target_icrs_y) * (star_icrs_y - bsr_config->target_icrs_y))\
-                     + ((star_icrs_z - bsr_config->target_icrs_z) * (star_icrs_z - bsr_config->target_icrs_z)); // important, use un-translated/rotated coordinates
-    } // end if render_distance_selector
+      //
+      // translate original star x,y,z to new coordinates as seen by camera position
+      //
+      star_x=star_icrs_x - camera->camera_icrs_x;
+      star_y=star_icrs_y - camera->camera_icrs_y;
+      star_z=star_icrs_z - camera->camera_icrs_z;
+      star_r2=(star_x * star_x) + (star_y * star_y) + (star_z * star_z); // leave squared for now for better performance
 
-    //
-    // only continue if star distance is greater than zero and filters are passed (distance, intensity, color)
-    //
-    if ((star_r2 > 0.0)\
-     && (render_distance2 >= bsr_state->render_distance_min2) && (render_distance2 <= bsr_state->render_distance_max2)\
-     && (intensity_test >= bsr_state->linear_star_intensity_min) && (intensity_test <= bsr_state->linear_star_intensity_max)\
-     && (color_temperature >= bsr_config->star_color_min) && (color_temperature <= bsr_config->star_color_max)) {
+      //
+      // sky tiles: skip stars outside the view cone around the tile
+      //
+      if (camera->view_cone_enable == 1) {
+        view_cone_dot=(star_x * camera->view_cone_x) + (star_y * camera->view_cone_y) + (star_z * camera->view_cone_z);
+        if ((view_cone_dot <= 0.0) || ((view_cone_dot * view_cone_dot) < (camera->view_cone_cos2 * star_r2))) {
+          view_cone_rejects++;
+          continue;
+        }
+      }
 
       //
-      // rotate star with quaternion multiplication.
-      // target_rotation includes rotation to aim at target as well as optional pan and tilt away from target
+      // determine star intensity test for intensity filter
       //
-      if (bsr_state->target_rotation.r != 0.0) {
-        star_q.i=star_x;
-        star_q.j=star_y;
-        star_q.k=star_z;
-        rotated_star_q=quaternion_rotate(bsr_state->target_rotation, star_q);
-        star_x=rotated_star_q.i;
-        star_y=rotated_star_q.j;
-        star_z=rotated_star_q.k;
+      linear_intensity=linear_1pc_intensity / star_r2;
+      if (bsr_config->star_intensity_selector == 0) {
+        // intensity as seen from camera position
+        intensity_test=linear_intensity;
+      } else if (bsr_config->star_intensity_selector == 1) {
+        // intensity as seen from Earth
+        star_distance_from_earth2=(star_icrs_x * star_icrs_x) + (star_icrs_y * star_icrs_y) + (star_icrs_z * star_icrs_z); // leave squared, used as squared on next line
+        intensity_test=linear_1pc_intensity / star_distance_from_earth2;
+      } else {
+        // absolute magnitude (intensity at 10pc)
+        intensity_test=linear_1pc_intensity * 0.01;
       }
 
       //
-      // project star onto output raster x,y
+      // determine render distance for distance filter
       //
-      if (bsr_config->camera_projection == 0) {
-        // lat/lon 
-        star_xy_r=sqrt((star_x * star_x) + (star_y * star_y));
-        output_az=atan2(star_y, star_x); // star_xy angle
-        output_el=atan2(star_z, star_xy_r);
-        output_x_d=(-bsr_state->pixels_per_radian * output_az) + bsr_state->camera_half_res_x;
-        output_y_d=(-bsr_state->pixels_per_radian * output_el) + bsr_state->camera_half_res_y;
-        output_x=(int)output_x_d;
-        output_y=(int)output_y_d;
-      } else if (bsr_config->camera_projection == 1) {
-        // spherical
-        star_yz_r=sqrt((star_y * star_y) + (star_z * star_z));
-        spherical_angle=atan2(star_z, star_y); // star_yz angle
-        spherical_distance=atan2(star_yz_r, fabs(star_x));
-        output_az=spherical_distance * cos(spherical_angle);
-        output_el=spherical_distance * sin(spherical_angle);
-        if (bsr_config->spherical_orientation == 1) { // side by side orientation
-          if (star_x > 0.0) { // star is in front of camera, draw on left side
-            output_az+=pi_over_2;
-          } else { // star is behind camera, draw on right
-            output_az=-pi_over_2-output_az;
-          } // end if star_x
-        } else { // front=center orientation
-          if (star_x < 0.0) { // star is behind camera we need to move to sides of front spherical frame
-            if (star_y > 0.0) { // left
-              output_az=M_PI-output_az;
-            } else { // right
-              output_az=-M_PI-output_az;
-            }  // end if star_y
-          } // end if star_x
-        } // end if spherical_orientation
-        output_x_d=(-bsr_state->pixels_per_radian * output_az) + bsr_state->camera_half_res_x;
-        output_y_d=(-bsr_state->pixels_per_radian * output_el) + bsr_state->camera_half_res_y;
-        output_x=(int)output_x_d;
-        output_y=(int)output_y_d;
-      } else if (bsr_config->camera_projection == 2) {
-        // Hammer
-        star_xy_r=sqrt((star_x * star_x) + (star_y * star_y));
-        star_xy=atan2(star_y, star_x);
-        output_az_by2=star_xy / 2.0;
-        output_el=atan2(star_z, star_xy_r);
-        output_x_d=(-bsr_state->pixels_per_radian * M_PI * cos(output_el) * sin(output_az_by2) / (sqrt(1.0 + (cos(output_el) * cos(output_az_by2))))) + bsr_state->camera_half_res_x;
-        output_y_d=(-bsr_state->pixels_per_radian * pi_over_2 * sin(output_el) / (sqrt(1.0 + (cos(output_el) * cos(output_az_by2))))) + bsr_state->camera_half_res_y;
-        output_x=(int)output_x_d;
-        output_y=(int)output_y_d;
-      } else if (bsr_config->camera_projection == 3) {
-        // Mollewide
-        star_xy_r=sqrt((star_x * star_x) + (star_y * star_y));
-        output_az=atan2(star_y, star_x); // star_xy angle
-        output_el=atan2(star_z, star_xy_r);
-        two_mollewide_angle=2.0 * asin(2.0 * output_el / M_PI);
-        for (i=0; i < bsr_config->Mollewide_iterations; i++) {
-          two_mollewide_angle-=(two_mollewide_angle + sin(two_mollewide_angle) - (M_PI * sin(output_el))) / (1.0 + cos(two_mollewide_angle));
-        }
-        mollewide_angle=two_mollewide_angle * 0.5;
-        output_x_d=(-bsr_state->pixels_per_radian * output_az * cos(mollewide_angle)) + bsr_state->camera_half_res_x;
-        output_y_d=(-bsr_state->pixels_per_radian * pi_over_2 * sin(mollewide_angle)) + bsr_state->camera_half_res_y;
-        output_x=(int)output_x_d; 
-        output_y=(int)output_y_d;
-      } // end if camera_projection
+      if (bsr_config->render_distance_selector == 0) { // selected point is camera
+        render_distance2=star_r2; // star distance from camera
+      } else { // selected point is target
+        // leave squared
+        render_distance2=((star_icrs_x - camera->target_icrs_x) * (star_icrs_x - camera->target_icrs_x))\
+                       + ((star_icrs_y - camera->target_icrs_y) * (star_icrs_y - camera->target_icrs_y))\
+                       + ((star_icrs_z - camera->target_icrs_z) * (star_icrs_z - camera->target_icrs_z)); // important, use un-translated/rotated coordinates
+      } // end if render_distance_selector
 
       //
-      // if star is within raster bounds, send star (or Airy disk pixels) to dedup buffer
+      // only continue if star distance is greater than zero and filters are passed (distance, intensity, color)
       //
-      if ((output_x >= 0) && (output_x < bsr_config->camera_res_x) && (output_y >= 0) && (output_y < bsr_config->camera_res_y)) {
-        if (bsr_config->Airy_disk_enable == 1) {
-          //
-          // Airy disk mode, use Airy disk maps to find all pixel values for this star and send to dedup buffer
-          //
-          Airymap_autoscale=(int)(sqrt(linear_intensity * 10.0 / bsr_state->camera_pixel_limit) * 2.0 * bsr_config->Airy_disk_first_null);
-          if (Airymap_autoscale < bsr_config->Airy_disk_min_extent) {
-            Airymap_autoscale=bsr_config->Airy_disk_min_extent;
-          } else if (Airymap_autoscale > bsr_config->Airy_disk_max_extent) {
-            Airymap_autoscale=bsr_config->Airy_disk_max_extent;
+      if ((star_r2 > 0.0)\
+       && (render_distance2 >= bsr_state->render_distance_min2) && (render_distance2 <= bsr_state->render_distance_max2)\
+       && (intensity_test >= bsr_state->linear_star_intensity_min) && (intensity_test <= bsr_state->linear_star_intensity_max)\
+       && (color_temperature >= bsr_config->star_color_min) && (color_temperature <= bsr_config->star_color_max)) {
+
+        //
+        // rotate star with quaternion multiplication.
+        // target_rotation includes rotation to aim at target as well as optional pan and tilt away from target
+        //
+        if ((camera->target_rotation.r != 1.0) && (camera->target_rotation.r != -1.0)) { // skip identity rotation
+          star_q.i=star_x;
+          star_q.j=star_y;
+          star_q.k=star_z;
+          rotated_star_q=quaternion_rotate(camera->target_rotation, star_q);
+          star_x=rotated_star_q.i;
+          star_y=rotated_star_q.j;
+          star_z=rotated_star_q.k;
+        }
+
+        //
+        // project star onto output raster x,y
+        //
+        if (camera->camera_projection == 0) {
+          // lat/lon 
+          star_xy_r=sqrt((star_x * star_x) + (star_y * star_y));
+          output_az=atan2(star_y, star_x); // star_xy angle
+          output_el=atan2(star_z, star_xy_r);
+          output_x_d=(-camera->pixels_per_radian * output_az) + camera->camera_half_res_x;
+          output_y_d=(-camera->pixels_per_radian * output_el) + camera->camera_half_res_y;
+          output_x=(int)floor(output_x_d); // sky tiles have stars left of and above the raster
+          output_y=(int)floor(output_y_d);
+        } else if (camera->camera_projection == 1) {
+          // spherical
+          star_yz_r=sqrt((star_y * star_y) + (star_z * star_z));
+          spherical_angle=atan2(star_z, star_y); // star_yz angle
+          spherical_distance=atan2(star_yz_r, fabs(star_x));
+          output_az=spherical_distance * cos(spherical_angle);
+          output_el=spherical_distance * sin(spherical_angle);
+          if (camera->spherical_orientation == 1) { // side by side orientation
+            if (star_x > 0.0) { // star is in front of camera, draw on left side
+              output_az+=pi_over_2;
+            } else { // star is behind camera, draw on right
+              output_az=-pi_over_2-output_az;
+            } // end if star_x
+          } else { // front=center orientation
+            if (star_x < 0.0) { // star is behind camera we need to move to sides of front spherical frame
+              if (star_y > 0.0) { // left
+                output_az=M_PI-output_az;
+              } else { // right
+                output_az=-M_PI-output_az;
+              }  // end if star_y
+            } // end if star_x
+          } // end if spherical_orientation
+          output_x_d=(-camera->pixels_per_radian * output_az) + camera->camera_half_res_x;
+          output_y_d=(-camera->pixels_per_radian * output_el) + camera->camera_half_res_y;
+          output_x=(int)output_x_d;
+          output_y=(int)output_y_d;
+        } else if (camera->camera_projection == 2) {
+          // Hammer
+          star_xy_r=sqrt((star_x * star_x) + (star_y * star_y));
+          star_xy=atan2(star_y, star_x);
+          output_az_by2=star_xy / 2.0;
+          output_el=atan2(star_z, star_xy_r);
+          output_x_d=(-camera->pixels_per_radian * M_PI * cos(output_el) * sin(output_az_by2) / (sqrt(1.0 + (cos(output_el) * cos(output_az_by2))))) + camera->camera_half_res_x;
+          output_y_d=(-camera->pixels_per_radian * pi_over_2 * sin(output_el) / (sqrt(1.0 + (cos(output_el) * cos(output_az_by2))))) + camera->camera_half_res_y;
+          output_x=(int)output_x_d;
+          output_y=(int)output_y_d;
+        } else if (camera->camera_projection == 3) {
+          // Mollewide
+          star_xy_r=sqrt((star_x * star_x) + (star_y * star_y));
+          output_az=atan2(star_y, star_x); // star_xy angle
+          output_el=atan2(star_z, star_xy_r);
+          two_mollewide_angle=2.0 * asin(2.0 * output_el / M_PI);
+          for (i=0; i < bsr_config->Mollewide_iterations; i++) {
+            two_mollewide_angle-=(two_mollewide_angle + sin(two_mollewide_angle) - (M_PI * sin(output_el))) / (1.0 + cos(two_mollewide_angle));
           }
-          Airymap_width=Airymap_autoscale + 1;
-          star_rgb_red=bsr_state->rgb_red[color_temperature];
-          star_rgb_green=bsr_state->rgb_green[color_temperature];
-          star_rgb_blue=bsr_state->rgb_blue[color_temperature];
-          for (Airymap_y=0; Airymap_y < Airymap_width; Airymap_y++) {
-            Airymap_row_offset=Airymap_max_width * Airymap_y;
-            Airymap_red_p=bsr_state->Airymap_red + Airymap_row_offset;
-            Airymap_green_p=bsr_state->Airymap_green + Airymap_row_offset;
-            Airymap_blue_p=bsr_state->Airymap_blue + Airymap_row_offset;
-            for (Airymap_x=0; Airymap_x < Airymap_width; Airymap_x++) {
-              r=(linear_intensity * *Airymap_red_p * star_rgb_red);
-              g=(linear_intensity * *Airymap_green_p * star_rgb_green);
-              b=(linear_intensity * *Airymap_blue_p * star_rgb_blue);
-              // quadrant +x,+y
-              Airymap_output_x=output_x + Airymap_x;
-              Airymap_output_y=output_y + Airymap_y;
-              if ((Airymap_output_x >= 0) && (Airymap_output_x < bsr_config->camera_res_x) && (Airymap_output_y >= 0) && (Airymap_output_y < bsr_config->camera_res_y)
-                && (*Airymap_red_p > 0.0) && (*Airymap_green_p > 0.0) && (*Airymap_blue_p > 0.0)) {
-                // Airymap pixel is within image raster, send to anti-alias function or direct to dedup buffer
-                if (bsr_config->anti_alias_enable == 1) {
-                  antiAliasPixel(bsr_config, bsr_state, (output_x_d + (double)Airymap_x), (output_y_d + (double)Airymap_y), r, g, b);
-                } else {
-                  image_offset=((uint64_t)bsr_config->camera_res_x * (uint64_t)Airymap_output_y) + (uint64_t)Airymap_output_x;
-                  sendPixelToDedupBuffer(bsr_state, image_offset, r, g, b);
-                }
-              } // end if Airymap pixel is within image raster
-              // quadrant -x,+y
-              if (Airymap_x > 0) {
-                Airymap_output_x=output_x - Airymap_x;
-                Airymap_output_y=output_y + Airymap_y;
-                if ((Airymap_output_x >= 0) && (Airymap_output_x < bsr_config->camera_res_x) && (Airymap_output_y >= 0) && (Airymap_output_y < bsr_config->camera_res_y)
-                  && (*Airymap_red_p > 0.0) && (*Airymap_green_p > 0.0) && (*Airymap_blue_p > 0.0)) {
-                  // Airymap pixel is within image raster, send to anti-alias function or direct to dedup buffer
-                  if (bsr_config->anti_alias_enable == 1) {
-                    antiAliasPixel(bsr_config, bsr_state, (output_x_d - (double)Airymap_x), (output_y_d + (double)Airymap_y), r, g, b);
-                  } else {
-                    image_offset=((uint64_t)bsr_config->camera_res_x * (uint64_t)Airymap_output_y) + (uint64_t)Airymap_output_x;
-                    sendPixelToDedupBuffer(bsr_state, image_offset, r, g, b);
-                  }
-                } // end if Airymap pixel is within image raster
-              } // end quadrant -x,+y
-              // quadrant +x,-y
-              if (Airymap_y > 0) {
+          mollewide_angle=two_mollewide_angle * 0.5;
+          output_x_d=(-camera->pixels_per_radian * output_az * cos(mollewide_angle)) + camera->camera_half_res_x;
+          output_y_d=(-camera->pixels_per_radian * pi_over_2 * sin(mollewide_angle)) + camera->camera_half_res_y;
+          output_x=(int)output_x_d; 
+          output_y=(int)output_y_d;
+        } else if (camera->camera_projection == 4) {
+          // rectilinear (gnomonic), only stars in front of camera can be projected
+          output_x=-1;
+          if (star_x > 0.0) {
+            output_x_d=(-camera->rectilinear_focal_length * star_y / star_x) + camera->camera_half_res_x;
+            output_y_d=(-camera->rectilinear_focal_length * star_z / star_x) + camera->camera_half_res_y;
+            if ((fabs(output_x_d) < 1.0E9) && (fabs(output_y_d) < 1.0E9)) { // stay within int range for stars close to 90 degrees off axis
+              output_x=(int)output_x_d;
+              output_y=(int)output_y_d;
+            }
+          }
+        } // end if camera_projection
+
+        //
+        // if star is within raster bounds, send star (or Airy disk pixels) to dedup buffer. With tiled rendering
+        // star_y_min/max also exclude stars too far from the current tile to reach it, sky tiles include stars
+        // just outside the raster
+        //
+        if ((output_x >= camera->star_x_min) && (output_x < camera->star_x_max) && (output_y >= camera->star_y_min) && (output_y < camera->star_y_max)) {
+          stars_rendered++;
+          if ((bsr_config->Airy_disk_enable == 1) && (bsr_config->Airy_disk_mode == 0)) {
+            //
+            // Airy disk mode, use Airy disk maps to find all pixel values for this star and send to dedup buffer
+            //
+            Airymap_autoscale=(int)(sqrt(linear_intensity * 10.0 / bsr_state->camera_pixel_limit) * 2.0 * bsr_config->Airy_disk_first_null);
+            if (Airymap_autoscale < bsr_config->Airy_disk_min_extent) {
+              Airymap_autoscale=bsr_config->Airy_disk_min_extent;
+            } else if (Airymap_autoscale > bsr_config->Airy_disk_max_extent) {
+              Airymap_autoscale=bsr_config->Airy_disk_max_extent;
+            }
+            Airymap_width=Airymap_autoscale + 1;
+            star_rgb_red=bsr_state->rgb_red[color_temperature];
+            star_rgb_green=bsr_state->rgb_green[color_temperature];
+            star_rgb_blue=bsr_state->rgb_blue[color_temperature];
+            for (Airymap_y=0; Airymap_y < Airymap_width; Airymap_y++) {
+              Airymap_row_offset=Airymap_max_width * Airymap_y;
+              Airymap_red_p=bsr_state->Airymap_red + Airymap_row_offset;
+              Airymap_green_p=bsr_state->Airymap_green + Airymap_row_offset;
+              Airymap_blue_p=bsr_state->Airymap_blue + Airymap_row_offset;
+              for (Airymap_x=0; Airymap_x < Airymap_width; Airymap_x++) {
+                r=(linear_intensity * *Airymap_red_p * star_rgb_red);
+                g=(linear_intensity * *Airymap_green_p * star_rgb_green);
+                b=(linear_intensity * *Airymap_blue_p * star_rgb_blue);
+                // quadrant +x,+y
                 Airymap_output_x=output_x + Airymap_x;
-                Airymap_output_y=output_y - Airymap_y;
-                if ((Airymap_output_x >= 0) && (Airymap_output_x < bsr_config->camera_res_x) && (Airymap_output_y >= 0) && (Airymap_output_y < bsr_config->camera_res_y)
-                  && (*Airymap_red_p > 0.0) && (*Airymap_green_p > 0.0) && (*Airymap_blue_p > 0.0)) {
-                  // Airymap pixel is within image raster, send to anti-alias function or direct to dedup buffer
-                  if (bsr_config->anti_alias_enable == 1) {
-                    antiAliasPixel(bsr_config, bsr_state, (output_x_d + (double)Airymap_x), (output_y_d - (double)Airymap_y), r, g, b);
-                  } else {
-                    image_offset=((uint64_t)bsr_config->camera_res_x * (uint64_t)Airymap_output_y) + (uint64_t)Airymap_output_x;
-                    sendPixelToDedupBuffer(bsr_state, image_offset, r, g, b);
-                  }
-                } // end if Airymap pixel is within image raster
-              } // end quadrant +x,-y
-              // quadrant -x,-y
-              if ((Airymap_x > 0) && (Airymap_y > 0)) {
-                Airymap_output_x=output_x - Airymap_x;
-                Airymap_output_y=output_y - Airymap_y;
-                if ((Airymap_output_x >= 0) && (Airymap_output_x < bsr_config->camera_res_x) && (Airymap_output_y >= 0) && (Airymap_output_y < bsr_config->camera_res_y)
+                Airymap_output_y=output_y + Airymap_y;
+                if ((Airymap_output_x >= camera->star_x_min) && (Airymap_output_x < camera->star_x_max) && (Airymap_output_y >= camera->star_y_min) && (Airymap_output_y < camera->star_y_max)
                   && (*Airymap_red_p > 0.0) && (*Airymap_green_p > 0.0) && (*Airymap_blue_p > 0.0)) {
-                  // Airymap pixel is within image raster, send to anti-alias function or direct to dedup buffer
+                  // Airymap pixel is within image raster (or close enough to reach it with anti-aliasing), send to anti-alias function or direct to dedup buffer
                   if (bsr_config->anti_alias_enable == 1) {
-                    antiAliasPixel(bsr_config, bsr_state, (output_x_d - (double)Airymap_x), (output_y_d - (double)Airymap_y), r, g, b);
-                  } else {
-                    image_offset=((uint64_t)bsr_config->camera_res_x * (uint64_t)Airymap_output_y) + (uint64_t)Airymap_output_x;
+                    antiAliasPixel(bsr_config, bsr_state, camera, (output_x_d + (double)Airymap_x), (output_y_d + (double)Airymap_y), r, g, b);
+                  } else if ((Airymap_output_x >= 0) && (Airymap_output_x < camera->camera_res_x) && (Airymap_output_y >= camera->tile_y_min) && (Airymap_output_y < camera->tile_y_max)) {
+                    image_offset=camera->image_offset + ((uint64_t)camera->image_stride * (uint64_t)(Airymap_output_y - camera->tile_y_min)) + (uint64_t)Airymap_output_x;
                     sendPixelToDedupBuffer(bsr_state, image_offset, r, g, b);
                   }
                 } // end if Airymap pixel is within image raster
-              } // end quadrant -x,-y
-              Airymap_red_p++;
-              Airymap_green_p++;
-              Airymap_blue_p++;
-            } // end for Airymap_x
-          } // end for Airymap_y
-        } else {
-          //
-          // not Airy disk mode, send star pixel to anti-alias function or direct to dedup buffer
-          //
-          r=(linear_intensity * bsr_state->rgb_red[color_temperature]);
-          g=(linear_intensity * bsr_state->rgb_green[color_temperature]);
-          b=(linear_intensity * bsr_state->rgb_blue[color_temperature]);
-          if (bsr_config->anti_alias_enable == 1) {
-            antiAliasPixel(bsr_config, bsr_state, output_x_d, output_y_d, r, g, b);
+                // quadrant -x,+y
+                if (Airymap_x > 0) {
+                  Airymap_output_x=output_x - Airymap_x;
+                  Airymap_output_y=output_y + Airymap_y;
+                  if ((Airymap_output_x >= camera->star_x_min) && (Airymap_output_x < camera->star_x_max) && (Airymap_output_y >= camera->star_y_min) && (Airymap_output_y < camera->star_y_max)
+                    && (*Airymap_red_p > 0.0) && (*Airymap_green_p > 0.0) && (*Airymap_blue_p > 0.0)) {
+                    // Airymap pixel is within image raster (or close enough to reach it with anti-aliasing), send to anti-alias function or direct to dedup buffer
+                    if (bsr_config->anti_alias_enable == 1) {
+                      antiAliasPixel(bsr_config, bsr_state, camera, (output_x_d - (double)Airymap_x), (output_y_d + (double)Airymap_y), r, g, b);
+                    } else if ((Airymap_output_x >= 0) && (Airymap_output_x < camera->camera_res_x) && (Airymap_output_y >= camera->tile_y_min) && (Airymap_output_y < camera->tile_y_max)) {
+                      image_offset=camera->image_offset + ((uint64_t)camera->image_stride * (uint64_t)(Airymap_output_y - camera->tile_y_min)) + (uint64_t)Airymap_output_x;
+                      sendPixelToDedupBuffer(bsr_state, image_offset, r, g, b);
+                    }
+                  } // end if Airymap pixel is within image raster
+                } // end quadrant -x,+y
+                // quadrant +x,-y
+                if (Airymap_y > 0) {
+                  Airymap_output_x=output_x + Airymap_x;
+                  Airymap_output_y=output_y - Airymap_y;
+                  if ((Airymap_output_x >= camera->star_x_min) && (Airymap_output_x < camera->star_x_max) && (Airymap_output_y >= camera->star_y_min) && (Airymap_output_y < camera->star_y_max)
+                    && (*Airymap_red_p > 0.0) && (*Airymap_green_p > 0.0) && (*Airymap_blue_p > 0.0)) {
+                    // Airymap pixel is within image raster (or close enough to reach it with anti-aliasing), send to anti-alias function or direct to dedup buffer
+                    if (bsr_config->anti_alias_enable == 1) {
+                      antiAliasPixel(bsr_config, bsr_state, camera, (output_x_d + (double)Airymap_x), (output_y_d - (double)Airymap_y), r, g, b);
+                    } else if ((Airymap_output_x >= 0) && (Airymap_output_x < camera->camera_res_x) && (Airymap_output_y >= camera->tile_y_min) && (Airymap_output_y < camera->tile_y_max)) {
+                      image_offset=camera->image_offset + ((uint64_t)camera->image_stride * (uint64_t)(Airymap_output_y - camera->tile_y_min)) + (uint64_t)Airymap_output_x;
+                      sendPixelToDedupBuffer(bsr_state, image_offset, r, g, b);
+                    }
+                  } // end if Airymap pixel is within image raster
+                } // end quadrant +x,-y
+                // quadrant -x,-y
+                if ((Airymap_x > 0) && (Airymap_y > 0)) {
+                  Airymap_output_x=output_x - Airymap_x;
+                  Airymap_output_y=output_y - Airymap_y;
+                  if ((Airymap_output_x >= camera->star_x_min) && (Airymap_output_x < camera->star_x_max) && (Airymap_output_y >= camera->star_y_min) && (Airymap_output_y < camera->star_y_max)
+                    && (*Airymap_red_p > 0.0) && (*Airymap_green_p > 0.0) && (*Airymap_blue_p > 0.0)) {
+                    // Airymap pixel is within image raster (or close enough to reach it with anti-aliasing), send to anti-alias function or direct to dedup buffer
+                    if (bsr_config->anti_alias_enable == 1) {
+                      antiAliasPixel(bsr_config, bsr_state, camera, (output_x_d - (double)Airymap_x), (output_y_d - (double)Airymap_y), r, g, b);
+                    } else if ((Airymap_output_x >= 0) && (Airymap_output_x < camera->camera_res_x) && (Airymap_output_y >= camera->tile_y_min) && (Airymap_output_y < camera->tile_y_max)) {
+                      image_offset=camera->image_offset + ((uint64_t)camera->image_stride * (uint64_t)(Airymap_output_y - camera->tile_y_min)) + (uint64_t)Airymap_output_x;
+                      sendPixelToDedupBuffer(bsr_state, image_offset, r, g, b);
+                    }
+                  } // end if Airymap pixel is within image raster
+                } // end quadrant -x,-y
+                Airymap_red_p++;
+                Airymap_green_p++;
+                Airymap_blue_p++;
+              } // end for Airymap_x
+            } // end for Airymap_y
           } else {
-            image_offset=((uint64_t)bsr_config->camera_res_x * (uint64_t)output_y) + (uint64_t)output_x;
-            sendPixelToDedupBuffer(bsr_state, image_offset, r, g, b);
-          }
-        } // end if Airy disk mode
-      } // end if star is within image raster
-    } // end if within distance ranges
+            //
+            // not Airy disk mode (or Airy disks are convolved with the whole image later), send star pixel to
+            // anti-alias function or direct to dedup buffer
+            //
+            r=(linear_intensity * bsr_state->rgb_red[color_temperature]);
+            g=(linear_intensity * bsr_state->rgb_green[color_temperature]);
+            b=(linear_intensity * bsr_state->rgb_blue[color_temperature]);
+            if (bsr_config->anti_alias_enable == 1) {
+              antiAliasPixel(bsr_config, bsr_state, camera, output_x_d, output_y_d, r, g, b);
+            } else if ((output_x >= 0) && (output_x < camera->camera_res_x) && (output_y >= camera->tile_y_min) && (output_y < camera->tile_y_max)) {
+              image_offset=camera->image_offset + ((uint64_t)camera->image_stride * (uint64_t)(output_y - camera->tile_y_min)) + (uint64_t)output_x;
+              sendPixelToDedupBuffer(bsr_state, image_offset, r, g, b);
+            }
+          } // end if Airy disk mode
+        } else {
+          off_raster_rejects++;
+        } // end if star is within image raster
+      } else if (bsr_state->render_stats != NULL) {
+        // render statistics: count the first filter that failed
+        if ((star_r2 <= 0.0) || (render_distance2 < bsr_state->render_distance_min2) || (render_distance2 > bsr_state->render_distance_max2)) {
+          distance_rejects++;
+        } else if ((intensity_test < bsr_state->linear_star_intensity_min) || (intensity_test > bsr_state->linear_star_intensity_max)) {
+          intensity_rejects++;
+        } else {
+          color_rejects++;
+        }
+      } // end if within distance ranges
+    } // end for camera_index
 
     input_record_abs++;
   } // end input loop
@@ -816,5 +885,20 @@ int processStars(bsr_config_t *bsr_config, bsr_state_t *bsr_state, input_file_t
     sendDedupBufferToMainThread(bsr_state);
   } // end if dedup buffer has remaining entries
 
+  //
+  // add this thread's counts to the render statistics for this input file
+  //
+  if (bsr_state->render_stats != NULL) {
+    file_stats=&bsr_state->perthread->stats.file[bsr_state->perthread->stats_file_index];
+    file_stats->stars_read+=input_record_rel;
+    file_stats->view_cone_rejects+=view_cone_rejects;
+    file_stats->distance_rejects+=distance_rejects;
+    file_stats->intensity_rejects+=intensity_rejects;
+    file_stats->color_rejects+=color_rejects;
+    file_stats->off_raster_rejects+=off_raster_rejects;
+    file_stats->stars_rendered+=stars_rendered;
+    file_stats->pixel_contributions+=(bsr_state->perthread->stats.dedup_inserts + bsr_state->perthread->stats.dedup_merges + bsr_state->perthread->stats.dedup_collisions) - dedup_pixels_begin;
+  }
+
   return(0);
 }
@@ -0,0 +1,169 @@
+//
+// Billion Star 3D Rendering Engine
+// Kevin M. Loch
+//
+// 3D rendering engine for the ESA Gaia DR3 star dataset
+
+/*
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2021, Kevin Loch
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "bsrender.h" // needs to be first to get GNU_SOURCE define for strcasestr
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "util.h"
+#include "progressive.h"
+#include "process-stars.h"
+
+//
+// Progressive rendering splits the star data files into passes that add to the same image composition buffer.
+// After each pass but the last, the composition buffer is copied, post-processed and sent as one part of a
+// multipart/x-mixed-replace CGI response, then restored so the next pass can add fainter stars. The first pass
+// (external and pq100 files) gives a preview in a fraction of the full rendering time.
+//
+// Input files are numbered in rendering order: 0 = external, 1 = pq100, 2 = pq050, 3 = pq030, 4 = pq020, 5 = pq010,
+// 6 = pq005, 7 = pq003, 8 = pq002, 9 = pq001, 10 = pq000
+//
+
+int inputFileEnabled(bsr_config_t *bsr_config, int file_index) {
+  //
+  // Gaia files are read if they are above Gaia_min_parallax_quality, pq100 is always read
+  //
+  const int pq_min[BSR_NUM_INPUT_FILES]={0, 100, 50, 30, 20, 10, 5, 3, 2, 1, 0};
+
+  if (file_index == 0) {
+    return(bsr_config->external_db_enable);
+  }
+  if (bsr_config->Gaia_db_enable != 1) {
+    return(0);
+  }
+  if ((file_index == 1) || (bsr_config->Gaia_min_parallax_quality < pq_min[file_index - 1])) {
+    return(1);
+  }
+
+  return(0);
+}
+
+input_file_t *inputFile(bsr_state_t *bsr_state, int file_index) {
+  input_file_t *input_files[BSR_NUM_INPUT_FILES]={&bsr_state->input_file_external, &bsr_state->input_file_pq100,\
+    &bsr_state->input_file_pq050, &bsr_state->input_file_pq030, &bsr_state->input_file_pq020, &bsr_state->input_file_pq010,\
+    &bsr_state->input_file_pq005, &bsr_state->input_file_pq003, &bsr_state->input_file_pq002, &bsr_state->input_file_pq001,\
+    &bsr_state->input_file_pq000};
+
+  return(input_files[file_index]);
+}
+
+const char *inputFileName(int file_index) {
+  const char *input_file_names[BSR_NUM_INPUT_FILES]={"external", "pq100", "pq050", "pq030", "pq020", "pq010", "pq005",\
+    "pq003", "pq002", "pq001", "pq000"};
+
+  return(input_file_names[file_index]);
+}
+
+int initPasses(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
+  //
+  // This function splits the input files into passes. Passes start at pq050 and pq005, and are only used if they
+  // have files on both sides. Progressive rendering is limited to a single untiled image. With load_composition the
+  // single pass has no input files, the image composition buffer is read from the composition file instead
+  //
+  const int pass_boundary[BSR_MAX_PASSES - 1]={2, 6};
+  int boundary;
+  int files_before;
+  int files_after;
+  int file_index;
+  int i;
+
+  bsr_state->num_passes=1;
+  bsr_state->pass_first_file[0]=0;
+  if ((bsr_config->progressive == 1) && (bsr_config->load_composition_file_name[0] == 0) && (bsr_state->num_images == 1) && (bsr_state->num_frames == 1) && (bsr_state->num_tiles == 1)) {
+    for (i=0; i < (BSR_MAX_PASSES - 1); i++) {
+      boundary=pass_boundary[i];
+      files_before=0;
+      for (file_index=bsr_state->pass_first_file[bsr_state->num_passes - 1]; file_index < boundary; file_index++) {
+        files_before+=inputFileEnabled(bsr_config, file_index);
+      }
+      files_after=0;
+      for (file_index=boundary; file_index < BSR_NUM_INPUT_FILES; file_index++) {
+        files_after+=inputFileEnabled(bsr_config, file_index);
+      }
+      if ((files_before > 0) && (files_after > 0)) {
+        bsr_state->pass_first_file[bsr_state->num_passes]=boundary;
+        bsr_state->num_passes++;
+      }
+    }
+  }
+  if (bsr_config->load_composition_file_name[0] != 0) {
+    bsr_state->pass_first_file[bsr_state->num_passes]=0;
+  } else {
+    bsr_state->pass_first_file[bsr_state->num_passes]=BSR_NUM_INPUT_FILES;
+  }
+
+  return(0);
+}
+
+int processPassFiles(bsr_config_t *bsr_config, bsr_state_t *bsr_state, int pass_index) {
+  //
+  // worker threads: send each input file of this pass to the rendering function
+  //
+  int file_index;
+  int trace_event;
+
+  for (file_index=bsr_state->pass_first_file[pass_index]; file_index < bsr_state->pass_first_file[pass_index + 1]; file_index++) {
+    if (inputFileEnabled(bsr_config, file_index) == 1) {
+      trace_event=traceBegin(bsr_state, "Process stars", inputFileName(file_index));
+      bsr_state->perthread->stats_file_index=file_index;
+      processStars(bsr_config, bsr_state, inputFile(bsr_state, file_index));
+      traceEnd(bsr_state, trace_event);
+    }
+  }
+
+  return(0);
+}
+
+int saveProgressiveImage(bsr_state_t *bsr_state) {
+  //
+  // main thread: keep a copy of the image composition buffer before it is post-processed in place
+  //
+  memcpy(bsr_state->image_progressive_buf, bsr_state->image_composition_buf, bsr_state->composition_buffer_size);
+
+  return(0);
+}
+
+int restoreProgressiveImage(bsr_state_t *bsr_state) {
+  //
+  // main thread: restore the image composition buffer so the next pass adds to the unprocessed image
+  //
+  memcpy(bsr_state->image_composition_buf, bsr_state->image_progressive_buf, bsr_state->composition_buffer_size);
+
+  return(0);
+}
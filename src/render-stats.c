@@ -0,0 +1,189 @@
+//
+// Billion Star 3D Rendering Engine
+// Kevin M. Loch
+//
+// 3D rendering engine for the ESA Gaia DR3 star dataset
+
+/*
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2021, Kevin Loch
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "bsrender.h" // needs to be first to get GNU_SOURCE define for strcasestr
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "progressive.h"
+#include "render-stats.h"
+
+//
+// Render statistics (stats_json=FILE, or - for stdout). Worker threads count stars read from each input file, stars
+// rejected by each filter, stars rendered and pixel contributions in processStars(), and dedup and main thread
+// buffer activity in the dedup/transport functions. Counts are kept in each thread's private bsr_thread_state_t and
+// copied to the globally mmapped render_stats array at the process stars checkpoint. The main thread adds them up
+// and writes a JSON report after rendering. Counts are totals over all cameras, frames, tiles and passes.
+//
+
+double statsRatio(uint64_t numerator, uint64_t denominator) {
+  if (denominator == 0) {
+    return(0.0);
+  }
+  return((double)numerator / (double)denominator);
+}
+
+int addFileStats(bsr_file_stats_t *total, bsr_file_stats_t *file_stats) {
+  total->stars_read+=file_stats->stars_read;
+  total->view_cone_rejects+=file_stats->view_cone_rejects;
+  total->distance_rejects+=file_stats->distance_rejects;
+  total->intensity_rejects+=file_stats->intensity_rejects;
+  total->color_rejects+=file_stats->color_rejects;
+  total->off_raster_rejects+=file_stats->off_raster_rejects;
+  total->stars_rendered+=file_stats->stars_rendered;
+  total->pixel_contributions+=file_stats->pixel_contributions;
+
+  return(0);
+}
+
+int printFileStats(FILE *stats_file, bsr_state_t *bsr_state, bsr_file_stats_t *file_stats) {
+  //
+  // filter rejects and the pass rate are per star and camera
+  //
+  fprintf(stats_file, "\"stars_read\": %llu, \"view_cone_rejects\": %llu, \"distance_rejects\": %llu, \"intensity_rejects\": %llu, \"color_rejects\": %llu, \"off_raster_rejects\": %llu, \"stars_rendered\": %llu, \"pixel_contributions\": %llu, \"pass_rate\": %.6f, \"pixels_per_star\": %.3f",\
+    (unsigned long long)file_stats->stars_read, (unsigned long long)file_stats->view_cone_rejects, (unsigned long long)file_stats->distance_rejects,\
+    (unsigned long long)file_stats->intensity_rejects, (unsigned long long)file_stats->color_rejects, (unsigned long long)file_stats->off_raster_rejects,\
+    (unsigned long long)file_stats->stars_rendered, (unsigned long long)file_stats->pixel_contributions,\
+    statsRatio(file_stats->stars_rendered, (file_stats->stars_read * (uint64_t)bsr_state->num_cameras)),\
+    statsRatio(file_stats->pixel_contributions, file_stats->stars_rendered));
+
+  return(0);
+}
+
+int writeRenderStats(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
+  FILE *stats_file;
+  bsr_render_stats_t *thread_stats;
+  bsr_file_stats_t file_total;
+  bsr_file_stats_t total;
+  uint64_t dedup_inserts=0;
+  uint64_t dedup_merges=0;
+  uint64_t dedup_collisions=0;
+  uint64_t dedup_flushes=0;
+  uint64_t pixels_sent=0;
+  uint64_t send_stalls=0;
+  uint64_t dedup_pixels;
+  int first_entry;
+  int file_index;
+  int thread_id;
+
+  if (strcmp(bsr_config->stats_json_file_name, "-") == 0) {
+    stats_file=stdout;
+  } else {
+    stats_file=fopen(bsr_config->stats_json_file_name, "w");
+    if (stats_file == NULL) {
+      if (bsr_config->print_status == 1) {
+        printf("Warning: could not open statistics file %s\n", bsr_config->stats_json_file_name);
+        fflush(stdout);
+      }
+      return(1);
+    }
+  }
+
+  //
+  // totals of worker threads
+  //
+  for (thread_id=1; thread_id <= bsr_state->num_worker_threads; thread_id++) {
+    thread_stats=bsr_state->render_stats + thread_id;
+    dedup_inserts+=thread_stats->dedup_inserts;
+    dedup_merges+=thread_stats->dedup_merges;
+    dedup_collisions+=thread_stats->dedup_collisions;
+    dedup_flushes+=thread_stats->dedup_flushes;
+    pixels_sent+=thread_stats->pixels_sent;
+    send_stalls+=thread_stats->send_stalls;
+  }
+  dedup_pixels=dedup_inserts + dedup_merges + dedup_collisions;
+
+  fprintf(stats_file, "{\n  \"worker_threads\": %d, \"cameras\": %d, \"per_thread_buffer\": %d,\n", bsr_state->num_worker_threads, bsr_state->num_cameras, bsr_state->per_thread_buffers);
+
+  //
+  // input files that were read
+  //
+  memset(&total, 0, sizeof(total));
+  fprintf(stats_file, "  \"files\": [");
+  first_entry=1;
+  for (file_index=0; file_index < BSR_NUM_INPUT_FILES; file_index++) {
+    memset(&file_total, 0, sizeof(file_total));
+    for (thread_id=1; thread_id <= bsr_state->num_worker_threads; thread_id++) {
+      addFileStats(&file_total, &bsr_state->render_stats[thread_id].file[file_index]);
+    }
+    if (file_total.stars_read == 0) {
+      continue;
+    }
+    addFileStats(&total, &file_total);
+    fprintf(stats_file, "%s\n    {\"file\": \"%s\", ", ((first_entry == 1) ? "" : ","), inputFileName(file_index));
+    printFileStats(stats_file, bsr_state, &file_total);
+    fprintf(stats_file, "}");
+    first_entry=0;
+  }
+  fprintf(stats_file, "\n  ],\n  \"total\": {");
+  printFileStats(stats_file, bsr_state, &total);
+  fprintf(stats_file, "},\n");
+
+  //
+  // dedup buffer and transport to the main thread
+  //
+  fprintf(stats_file, "  \"dedup\": {\"inserts\": %llu, \"merges\": %llu, \"collisions\": %llu, \"flushes\": %llu, \"merge_rate\": %.6f, \"collision_rate\": %.6f},\n",\
+    (unsigned long long)dedup_inserts, (unsigned long long)dedup_merges, (unsigned long long)dedup_collisions, (unsigned long long)dedup_flushes,\
+    statsRatio(dedup_merges, dedup_pixels), statsRatio(dedup_collisions, dedup_pixels));
+  fprintf(stats_file, "  \"transport\": {\"pixels_sent\": %llu, \"send_stalls\": %llu, \"stalls_per_pixel\": %.6f, \"main_scan_passes\": %llu, \"main_empty_scans\": %llu, \"main_pixels_integrated\": %llu, \"pixels_per_scan\": %.3f},\n",\
+    (unsigned long long)pixels_sent, (unsigned long long)send_stalls, statsRatio(send_stalls, pixels_sent),\
+    (unsigned long long)bsr_state->render_stats[0].main_scan_passes, (unsigned long long)bsr_state->render_stats[0].main_empty_scans,\
+    (unsigned long long)bsr_state->render_stats[0].main_pixels_integrated,\
+    statsRatio(bsr_state->render_stats[0].main_pixels_integrated, bsr_state->render_stats[0].main_scan_passes));
+
+  //
+  // per worker thread transport, uneven stalls show which threads wait for the main thread
+  //
+  fprintf(stats_file, "  \"workers\": [");
+  for (thread_id=1; thread_id <= bsr_state->num_worker_threads; thread_id++) {
+    thread_stats=bsr_state->render_stats + thread_id;
+    fprintf(stats_file, "%s\n    {\"thread\": %d, \"pixels_sent\": %llu, \"send_stalls\": %llu, \"dedup_merges\": %llu, \"dedup_collisions\": %llu}",\
+      ((thread_id == 1) ? "" : ","), thread_id, (unsigned long long)thread_stats->pixels_sent, (unsigned long long)thread_stats->send_stalls,\
+      (unsigned long long)thread_stats->dedup_merges, (unsigned long long)thread_stats->dedup_collisions);
+  }
+  fprintf(stats_file, "\n  ]\n}\n");
+
+  if (stats_file == stdout) {
+    fflush(stdout);
+  } else {
+    fclose(stats_file);
+  }
+
+  return(0);
+}
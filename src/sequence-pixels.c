@@ -38,39 +38,19 @@
 
 #include "bsrender.h" // needs to be first to get GNU_SOURCE define for strcasestr
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <time.h>
 #include "util.h"
+#include "pixel-buffer.h"
 
-int sequencePixels(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
+__attribute__((noinline)) double encodePQ(double pixel) {
   //
-  // This function takes pixel data from the current_image_buf after image generation and post processing
-  // and converts it into the specific unsigned char sequence required by an image output format (encoder).
-  // Image formats use a variety of number formats (integer/floating-point), encoding gamma, bit depth, color
-  // channel order, and endianness.
+  // Rec. 2100 PQ transfer function used by sequencePixelRows() and to find encode table thresholds. pixel must be in
+  // the range [0..1]. Kept out of line so both use the same compiled expression, with -Ofast an inlined copy may
+  // round differently and the table would no longer match direct encoding
   //
-  struct timespec starttime;
-  struct timespec endtime;
-  double elapsed_time;
-  uint64_t image_offset;
-  pixel_composition_t *current_image_p;
-  unsigned char *image_output_p;
-  unsigned char *image_output_R_p=NULL; // used by EXR since it groups same-channel pixel data together
-  unsigned char *image_output_G_p=NULL; // used by EXR since it groups same-channel pixel data together
-  unsigned char *image_output_B_p=NULL; // used by EXR since it groups same-channel pixel data together
-  const double one_over_2dot4=1.0 / 2.4;
-  double pixel_r;
-  double pixel_g;
-  double pixel_b;
-  int lines_per_thread;
-  int i;
-  int output_res_x;
-  int output_res_y;
-  int output_x;
-  int output_y;
-  int bytes_per_pixel=0;
-  int bytes_per_color=0;
-  double hdr_normalization_factor;
   double Ym1;
 
   // Rec. 2100 PQ constants
@@ -80,61 +60,248 @@ int sequencePixels(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
   const double c2=18.8515625;
   const double c3=18.6875;
 
+  Ym1=pow(pixel, m1);
+  return(pow(((c1 + (c2 * Ym1)) / (1.0 + (c3 * Ym1))), m2));
+}
+
+double decodePQ(double value) {
   //
-  // main thread: display status message if not in CGI mode
+  // inverse of encodePQ(), only used as a starting point to find encode table thresholds
   //
-  if ((bsr_state->perthread->my_pid == bsr_state->main_pid) && (bsr_config->cgi_mode != 1) && (bsr_config->print_status == 1)) {
-    clock_gettime(CLOCK_REALTIME, &starttime);
-    if (bsr_config->image_number_format == 0) {
-      if (bsr_config->bits_per_color == 8) { 
-        printf("Converting to 8-bit unsigned integer per color...");
-      } else if (bsr_config->bits_per_color == 10) {
-        printf("Converting to 10-bit unsigned integer per color...");
-      } else if (bsr_config->bits_per_color == 12) {
-        printf("Converting to 12-bit unsigned integer per color...");
-      } else if (bsr_config->bits_per_color == 16) {
-        printf("Converting to 16-bit unsigned integer per color...");
-      } else if (bsr_config->bits_per_color == 32) {
-        printf("Converting to 32-bit unsigned integer per color...");
-      }
-    } else if (bsr_config->image_number_format == 1) {
-      if (bsr_config->bits_per_color == 16) {
-        printf("Converting to 16-bit floating-point per color...");
-      } else if (bsr_config->bits_per_color == 32) {
-        printf("Converting to 32-bit floating-point per color...");
-      }
+  double Em2;
+
+  // Rec. 2100 PQ constants
+  const double m1=0.1593017578125;
+  const double m2=78.84375;
+  const double c1=0.8359375;
+  const double c2=18.8515625;
+  const double c3=18.6875;
+
+  Em2=pow(value, (1.0 / m2));
+  if (Em2 <= c1) {
+    return(0.0);
+  }
+  return(pow(((Em2 - c1) / (c2 - (c3 * Em2))), (1.0 / m1)));
+}
+
+int encodeQuantizePQ(int max_code, double pixel) {
+  // quantization done by the image format output code in sequencePixelRows()
+  return((int)((encodePQ(pixel) * (double)max_code) + 0.5));
+}
+
+int encodeMaxCode(bsr_config_t *bsr_config) {
+  //
+  // maximum integer code if the output format quantizes transfer function output to integers, or 0 if not
+  //
+  if ((bsr_config->image_format == 0) || (bsr_config->image_format == 2)) { // PNG, JPG
+    if (bsr_config->bits_per_color == 8) {
+      return(255);
+    } else if (bsr_config->bits_per_color == 16) {
+      return(65535);
+    }
+  } else if ((bsr_config->image_format == 3) || (bsr_config->image_format == 4)) { // AVIF, HEIF
+    if (bsr_config->bits_per_color == 8) {
+      return(255);
+    } else if (bsr_config->bits_per_color == 10) {
+      return(1023);
+    } else if (bsr_config->bits_per_color == 12) {
+      return(4095);
     }
-    fflush(stdout);
   }
+  return(0);
+}
 
+int useEncodeTable(bsr_config_t *bsr_config, bsr_state_t *bsr_state, int max_code) {
   //
-  // all threads: get current image resolution, lines per thread, and hdr_nromalization_factor
+  // encode tables are used for the Rec. 2100 PQ transfer function quantized to integers (two pow() calls and a
+  // division per channel) if the table costs much less to build than encoding this thread's share of the image
+  // directly. Each table threshold takes about 16 transfer function calls to find. sRGB and Rec. 709 style transfer
+  // functions are not faster with tables since they are a single pow() and most pixels use the linear segment
   //
-  output_res_x=bsr_state->current_image_res_x;
-  output_res_y=bsr_state->current_image_res_y;
-  lines_per_thread=(int)ceil(((double)bsr_state->current_image_res_y / (double)(bsr_state->num_worker_threads + 1)));
-  if (lines_per_thread < 1) {
-    lines_per_thread=1;
+  double thread_pixels;
+
+  if ((max_code == 0) || (bsr_config->color_profile != 8) || (bsr_config->image_format == 1)) {
+    return(0);
   }
-  hdr_normalization_factor=(double)bsr_config->hdr_neutral_white_ref / 10000.0;
+  thread_pixels=(double)bsr_state->current_image_res_x * (double)bsr_state->current_image_res_y / (double)(bsr_state->num_worker_threads + 1);
+  if (((double)max_code * 16.0 * 4.0) < (thread_pixels * 3.0)) {
+    return(1);
+  }
+  return(0);
+}
 
+bsr_encode_table_t *initEncodeTable(bsr_config_t *bsr_config, bsr_state_t *bsr_state, int max_code) {
   //
-  // worker threads:  wait for main thread to say go
-  // main thread: tell worker threads to go
+  // Encode tables replace the PQ transfer function and quantization with a table lookup. thresholds[code] is the
+  // smallest pixel value that quantizes to at least 'code', found by bisection with the same transfer function used
+  // otherwise, so the output is identical. Buckets index the exponent and top mantissa bits of the pixel value and
+  // hold the code at the start of each bucket, so a lookup is a bucket read and a short forward scan of thresholds.
+  // Each thread keeps its table until the bit depth changes
   //
-  if (bsr_state->perthread->my_pid != bsr_state->main_pid) {
-    waitForMainThread(bsr_state, THREAD_STATUS_SEQUENCE_PIXELS_BEGIN);
-  } else {
-    // main thread
-    for (i=1; i <= bsr_state->num_worker_threads; i++) {
-      bsr_state->status_array[i].status=THREAD_STATUS_SEQUENCE_PIXELS_BEGIN;
+  bsr_encode_table_t *encode_table;
+  double *thresholds;
+  uint16_t *buckets;
+  double x0;
+  double lo;
+  double hi;
+  double delta;
+  double mid;
+  double bucket_start;
+  uint64_t lo_bits;
+  uint64_t hi_bits;
+  uint64_t mid_bits;
+  uint64_t bucket_start_bits;
+  int bucket_bits;
+  int num_buckets;
+  int bucket;
+  int code;
+
+  encode_table=&bsr_state->perthread->encode_table;
+  if ((encode_table->thresholds != NULL) && (encode_table->max_code == max_code)) {
+    return(encode_table);
+  }
+  free(encode_table->thresholds);
+  free(encode_table->buckets);
+  encode_table->thresholds=NULL;
+  encode_table->buckets=NULL;
+  bucket_bits=0;
+  while ((bucket_bits < 11) && ((1 << (bucket_bits + 1)) < max_code)) {
+    bucket_bits++;
+  }
+  num_buckets=(BSR_ENCODE_TABLE_EXPONENTS << bucket_bits) + 2;
+  thresholds=(double *)malloc((size_t)(max_code + 2) * sizeof(double));
+  buckets=(uint16_t *)malloc((size_t)num_buckets * sizeof(uint16_t));
+  if ((thresholds == NULL) || (buckets == NULL)) {
+    free(thresholds);
+    free(buckets);
+    return(NULL); // fall back to the PQ transfer function
+  }
+
+  thresholds[0]=0.0;
+  for (code=1; code <= max_code; code++) {
+    //
+    // bracket the threshold around the inverse transfer function estimate
+    //
+    x0=decodePQ(((double)code - 0.5) / (double)max_code);
+    if (!(x0 >= 0.0)) {
+      x0=0.0;
+    } else if (x0 > 1.0) {
+      x0=1.0;
+    }
+    delta=(x0 * 1.0E-12) + 1.0E-300;
+    lo=x0 - delta;
+    while ((lo > 0.0) && (encodeQuantizePQ(max_code, lo) >= code)) {
+      delta*=16.0;
+      lo=x0 - delta;
+    }
+    if (lo < 0.0) {
+      lo=0.0;
+    }
+    delta=(x0 * 1.0E-12) + 1.0E-300;
+    hi=x0 + delta;
+    while ((hi < 1.0) && (encodeQuantizePQ(max_code, hi) < code)) {
+      delta*=16.0;
+      hi=x0 + delta;
+    }
+    if (hi > 1.0) {
+      hi=1.0;
     }
-  } // end if not main thread
+
+    //
+    // bisect on the bit patterns of non-negative doubles, which are ordered the same as their values
+    //
+    memcpy(&lo_bits, &lo, sizeof(uint64_t));
+    memcpy(&hi_bits, &hi, sizeof(uint64_t));
+    while ((hi_bits - lo_bits) > 1) {
+      mid_bits=lo_bits + ((hi_bits - lo_bits) / 2);
+      memcpy(&mid, &mid_bits, sizeof(uint64_t));
+      if (encodeQuantizePQ(max_code, mid) >= code) {
+        hi_bits=mid_bits;
+      } else {
+        lo_bits=mid_bits;
+      }
+    }
+    memcpy(&thresholds[code], &hi_bits, sizeof(uint64_t));
+  } // end for code
+  thresholds[max_code + 1]=2.0; // sentinel, pixels are limited to [0..1]
 
   //
-  // all threads: convert current_image_buf to unsigned char byte sequence and store
-  // in image_output_buf. Also update row_pointers if PNG or JPG image format
+  // bucket 0 is [0..2^-BSR_ENCODE_TABLE_EXPONENTS), the rest start at evenly spaced mantissas of each exponent
+  //
+  buckets[0]=0;
+  code=0;
+  for (bucket=1; bucket < num_buckets; bucket++) {
+    bucket_start_bits=((uint64_t)(1023 - BSR_ENCODE_TABLE_EXPONENTS) << 52) + ((uint64_t)(bucket - 1) << (52 - bucket_bits));
+    memcpy(&bucket_start, &bucket_start_bits, sizeof(uint64_t));
+    while (thresholds[code + 1] <= bucket_start) {
+      code++;
+    }
+    buckets[bucket]=(uint16_t)code;
+  }
+
+  encode_table->thresholds=thresholds;
+  encode_table->buckets=buckets;
+  encode_table->max_code=max_code;
+  encode_table->bucket_bits=bucket_bits;
+
+  return(encode_table);
+}
+
+static inline double encodeLookup(bsr_encode_table_t *encode_table, double pixel) {
+  //
+  // find the largest code with thresholds[code] <= pixel, starting from the code at the start of pixel's bucket.
+  // Returns code / max_code so the image format output code rounds back to the same code
+  //
+  uint64_t pixel_bits;
+  uint64_t bucket;
+  uint64_t last_bucket;
+  int code;
+
+  if (pixel < encode_table->thresholds[1]) {
+    return(0.0); // most pixels of most star fields
+  }
+  memcpy(&pixel_bits, &pixel, sizeof(uint64_t));
+  bucket=(pixel_bits >> (52 - encode_table->bucket_bits)) - ((uint64_t)(1023 - BSR_ENCODE_TABLE_EXPONENTS) << encode_table->bucket_bits) + 1;
+  last_bucket=((uint64_t)BSR_ENCODE_TABLE_EXPONENTS << encode_table->bucket_bits) + 1;
+  if (pixel_bits < ((uint64_t)(1023 - BSR_ENCODE_TABLE_EXPONENTS) << 52)) {
+    bucket=0;
+  } else if (bucket > last_bucket) {
+    bucket=last_bucket;
+  }
+  code=encode_table->buckets[bucket];
+  while (encode_table->thresholds[code + 1] <= pixel) {
+    code++;
+  }
+
+  return((double)code / (double)encode_table->max_code);
+}
+
+int sequencePixelRows(bsr_config_t *bsr_config, bsr_state_t *bsr_state, int first_row, int num_rows, unsigned char *image_output_p) {
+  //
+  // This function converts num_rows rows of current_image_buf starting at first_row into the byte sequence required
+  // by the output image format and stores them contiguously at image_output_p. Used by sequencePixels() for each
+  // thread's share of the image and by streamImage() for each band of rows.
   //
+  uint64_t image_offset;
+  uint64_t current_image_offset;
+  int current_image_precision;
+  unsigned char *image_output_R_p=NULL; // used by EXR since it groups same-channel pixel data together
+  unsigned char *image_output_G_p=NULL; // used by EXR since it groups same-channel pixel data together
+  unsigned char *image_output_B_p=NULL; // used by EXR since it groups same-channel pixel data together
+  const double one_over_2dot4=1.0 / 2.4;
+  double pixel_r;
+  double pixel_g;
+  double pixel_b;
+  int output_res_x;
+  int output_x;
+  int bytes_per_pixel=0;
+  int bytes_per_color=0;
+  double hdr_normalization_factor;
+  bsr_encode_table_t *encode_table;
+  int encode_max_code;
+
+  output_res_x=bsr_state->current_image_res_x;
+  hdr_normalization_factor=(double)bsr_config->hdr_neutral_white_ref / 10000.0;
   if (bsr_config->bits_per_color == 8) {
     bytes_per_color=1;
     bytes_per_pixel=3;
@@ -145,27 +312,25 @@ int sequencePixels(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
     bytes_per_color=4;
     bytes_per_pixel=12;
   }
+  encode_max_code=encodeMaxCode(bsr_config);
+  encode_table=NULL;
+  if (useEncodeTable(bsr_config, bsr_state, encode_max_code) == 1) {
+    encode_table=initEncodeTable(bsr_config, bsr_state, encode_max_code);
+  }
   output_x=0;
-  output_y=bsr_state->perthread->my_thread_id * lines_per_thread;
-  image_output_p=bsr_state->image_output_buf + ((uint64_t)output_res_x * (uint64_t)output_y * (uint64_t)bytes_per_pixel);
   if (bsr_config->image_format == 1) {
     // EXR groups same channel pixel data together
     image_output_B_p=image_output_p;
     image_output_G_p=image_output_p + ((uint64_t)bytes_per_color * (uint64_t)output_res_x);
     image_output_R_p=image_output_p + (2ll * (uint64_t)bytes_per_color * (uint64_t)output_res_x);
   }
-  current_image_p=bsr_state->current_image_buf + ((uint64_t)output_res_x * (uint64_t)output_y);
-  // only update row_pointers if PNG or JPG output format
-  if (((bsr_config->image_format == 0) || (bsr_config->image_format == 2)) && (output_y < output_res_y)) {
-    bsr_state->row_pointers[output_y]=image_output_p;
-  }
-  for (image_offset=0; ((image_offset < ((uint64_t)output_res_x * (uint64_t)lines_per_thread)) && (output_y < output_res_y)); image_offset++) {
+  current_image_offset=(uint64_t)output_res_x * (uint64_t)first_row;
+  current_image_precision=bsr_state->current_image_precision;
+  for (image_offset=0; image_offset < ((uint64_t)output_res_x * (uint64_t)num_rows); image_offset++) {
     //
     // copy pixel data from current_image_buf
     //
-    pixel_r=current_image_p->r;
-    pixel_g=current_image_p->g;
-    pixel_b=current_image_p->b;
+    loadPixel(bsr_state->current_image_buf, current_image_precision, current_image_offset, &pixel_r, &pixel_g, &pixel_b);
 
     //
     // renormalize and/or limit intensity and apply transfer function (encoding gamma) for formats that use it
@@ -238,12 +403,15 @@ int sequencePixels(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
         }
 
         // apply transfer function        
-        Ym1=pow(pixel_r, m1);
-        pixel_r=pow(((c1 + (c2 * Ym1)) / (1.0 + (c3 * Ym1))), m2);
-        Ym1=pow(pixel_g, m1);
-        pixel_g=pow(((c1 + (c2 * Ym1)) / (1.0 + (c3 * Ym1))), m2);
-        Ym1=pow(pixel_b, m1);
-        pixel_b=pow(((c1 + (c2 * Ym1)) / (1.0 + (c3 * Ym1))), m2);
+        if (encode_table != NULL) {
+          pixel_r=encodeLookup(encode_table, pixel_r);
+          pixel_g=encodeLookup(encode_table, pixel_g);
+          pixel_b=encodeLookup(encode_table, pixel_b);
+        } else {
+          pixel_r=encodePQ(pixel_r);
+          pixel_g=encodePQ(pixel_g);
+          pixel_b=encodePQ(pixel_b);
+        }
       } // end if color_profile
     } // end if image_format
 
@@ -392,18 +560,13 @@ int sequencePixels(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
     } // end if image_format
 
     //
-    // if we have reached end of row, update x,y and image format specific variables
+    // if we have reached end of row, update image format specific variables
     //
     output_x++;
     if (output_x == output_res_x) {
       output_x=0;
-      output_y++;
-      if ((bsr_config->image_format == 0) || (bsr_config->image_format == 2)) {
-        // update row_pointers if PNG or JPG output format
-        if (((image_offset + (uint64_t)1) < ((uint64_t)output_res_x * (uint64_t)lines_per_thread)) && (output_y < output_res_y)) {
-          bsr_state->row_pointers[output_y]=image_output_p;
-        }
-      } else if (bsr_config->image_format == 1) {
+      checkCancel(bsr_state);
+      if (bsr_config->image_format == 1) {
         // EXR, update local channel pointers
         image_output_B_p=image_output_p;
         image_output_G_p=image_output_p + ((uint64_t)bytes_per_color * (uint64_t)output_res_x);
@@ -411,8 +574,111 @@ int sequencePixels(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
       } // end if image_format
     } //end if output_x
 
-    current_image_p++;
-  } // end for i
+    current_image_offset++;
+  } // end for image_offset
+
+  return(0);
+}
+
+int sequencePixels(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
+  //
+  // This function takes pixel data from the current_image_buf after image generation and post processing
+  // and converts it into the specific unsigned char sequence required by an image output format (encoder).
+  // Image formats use a variety of number formats (integer/floating-point), encoding gamma, bit depth, color
+  // channel order, and endianness.
+  //
+  struct timespec starttime;
+  struct timespec endtime;
+  double elapsed_time;
+  int current_image_first_row;
+  unsigned char *image_output_p;
+  int i;
+  int output_res_x;
+  int output_res_y;
+  int output_y;
+  int end_y;
+  int num_rows;
+  int bytes_per_pixel=0;
+  //
+  // main thread: display status message if not in CGI mode
+  //
+  if ((bsr_state->perthread->my_pid == bsr_state->main_pid) && (bsr_config->cgi_mode != 1) && (bsr_config->print_status == 1)) {
+    clock_gettime(CLOCK_REALTIME, &starttime);
+    if (bsr_config->image_number_format == 0) {
+      if (bsr_config->bits_per_color == 8) { 
+        printf("Converting to 8-bit unsigned integer per color...");
+      } else if (bsr_config->bits_per_color == 10) {
+        printf("Converting to 10-bit unsigned integer per color...");
+      } else if (bsr_config->bits_per_color == 12) {
+        printf("Converting to 12-bit unsigned integer per color...");
+      } else if (bsr_config->bits_per_color == 16) {
+        printf("Converting to 16-bit unsigned integer per color...");
+      } else if (bsr_config->bits_per_color == 32) {
+        printf("Converting to 32-bit unsigned integer per color...");
+      }
+    } else if (bsr_config->image_number_format == 1) {
+      if (bsr_config->bits_per_color == 16) {
+        printf("Converting to 16-bit floating-point per color...");
+      } else if (bsr_config->bits_per_color == 32) {
+        printf("Converting to 32-bit floating-point per color...");
+      }
+    }
+    fflush(stdout);
+  }
+  int trace_event;
+
+  //
+  // all threads: get current image resolution
+  //
+  output_res_x=bsr_state->current_image_res_x;
+  output_res_y=bsr_state->current_image_res_y;
+  current_image_first_row=0;
+  if (bsr_state->num_tiles > 1) {
+    // tiled rendering: only output the current tile's rows, the rest of the current image is halo
+    output_res_y=bsr_state->tile_output_res_y;
+    current_image_first_row=bsr_state->tile_output_y - bsr_state->current_image_y_offset;
+  }
+
+  //
+  // worker threads:  wait for main thread to say go
+  // main thread: tell worker threads to go
+  //
+  if (bsr_state->perthread->my_pid != bsr_state->main_pid) {
+    waitForMainThread(bsr_state, THREAD_STATUS_SEQUENCE_PIXELS_BEGIN);
+  } else {
+    // main thread
+    initRowBlocks(bsr_state, output_res_y, 1);
+    for (i=1; i <= bsr_state->num_worker_threads; i++) {
+      bsr_state->status_array[i].status=THREAD_STATUS_SEQUENCE_PIXELS_BEGIN;
+    }
+  } // end if not main thread
+
+  trace_event=traceBegin(bsr_state, "Sequence pixels", NULL);
+
+  //
+  // all threads: convert each block of rows of current_image_buf to unsigned char byte sequence and store
+  // in image_output_buf. Also update row_pointers if PNG or JPG image format
+  //
+  if (bsr_config->bits_per_color == 8) {
+    bytes_per_pixel=3;
+  } else if ((bsr_config->bits_per_color == 10) || (bsr_config->bits_per_color == 12) || (bsr_config->bits_per_color == 16)) {
+    bytes_per_pixel=6;
+  } else if (bsr_config->bits_per_color == 32) {
+    bytes_per_pixel=12;
+  }
+  while (nextRowBlock(bsr_state, &output_y, &end_y) == 1) {
+    num_rows=end_y - output_y;
+    image_output_p=bsr_state->image_output_buf + ((uint64_t)output_res_x * (uint64_t)output_y * (uint64_t)bytes_per_pixel);
+    // only update row_pointers if PNG or JPG output format
+    if ((bsr_config->image_format == 0) || (bsr_config->image_format == 2)) {
+      for (i=0; i < num_rows; i++) {
+        bsr_state->row_pointers[output_y + i]=image_output_p + ((uint64_t)output_res_x * (uint64_t)i * (uint64_t)bytes_per_pixel);
+      }
+    }
+    sequencePixelRows(bsr_config, bsr_state, (current_image_first_row + output_y), num_rows, image_output_p);
+  }
+
+  traceEnd(bsr_state, trace_event);
 
   //
   // worker threads: signal this thread is done and wait until main thread says we can continue to next step.
@@ -39,6 +39,13 @@
 #ifndef BSR_SEQUENCE_PIXELS_H
 #define BSR_SEQUENCE_PIXELS_H
 
+double encodePQ(double pixel);
+double decodePQ(double value);
+int encodeQuantizePQ(int max_code, double pixel);
+int encodeMaxCode(bsr_config_t *bsr_config);
+int useEncodeTable(bsr_config_t *bsr_config, bsr_state_t *bsr_state, int max_code);
+bsr_encode_table_t *initEncodeTable(bsr_config_t *bsr_config, bsr_state_t *bsr_state, int max_code);
+int sequencePixelRows(bsr_config_t *bsr_config, bsr_state_t *bsr_state, int first_row, int num_rows, unsigned char *image_output_p);
 int sequencePixels(bsr_config_t *bsr_config, bsr_state_t *bsr_state);
 
 #endif // BSR_SEQUENCE_PIXELS_H
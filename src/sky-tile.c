@@ -0,0 +1,164 @@
+//
+// Billion Star 3D Rendering Engine
+// Kevin M. Loch
+//
+// 3D rendering engine for the ESA Gaia DR3 star dataset
+
+/*
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2021, Kevin Loch
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "bsrender.h" // needs to be first to get GNU_SOURCE define for strcasestr
+#include <stdio.h>
+#include <math.h>
+#include "sky-tile.h"
+#include "process-stars.h"
+
+//
+// Sky tiles are square sections of a virtual full sky lat/lon (equirectangular) raster, addressed like slippy map
+// tiles: zoom level z has 2^(z+1) x 2^z tiles of sky_tile_size pixels, with tile 0,0 at the top left. A tile is
+// rendered with the usual lat/lon projection by moving the projection center so that only the tile's section of
+// the virtual raster lands on the camera raster. Stars are culled with a cone around the tile before they are
+// rotated and projected, so deep zoom levels only pay for the stars near the tile.
+//
+// Each tile is a separate request, so tiles are stored in the image cache (cache_directory) like any other image.
+//
+
+int initSkyTile(bsr_config_t *bsr_config, bsr_camera_t *camera) {
+  double virtual_res_x;
+  double virtual_res_y;
+  double tile_half_width;
+  double center_az;
+  double center_el;
+  double cone_cos;
+  double corner_el;
+  double corner_cos;
+  int corner;
+  quaternion_t inverse_rotation;
+  quaternion_t axis_q;
+  quaternion_t axis_icrs;
+  int star_margin;
+  int tile_left;
+  int tile_top;
+
+  //
+  // virtual raster geometry, the camera raster is the tile
+  //
+  virtual_res_x=(double)bsr_config->sky_tile_size * (double)(2 << bsr_config->sky_tile_zoom);
+  virtual_res_y=virtual_res_x / 2.0;
+  camera->pixels_per_radian=virtual_res_x / (2.0 * M_PI);
+  camera->camera_half_res_x=(virtual_res_x / 2.0) - ((double)bsr_config->sky_tile_x * (double)bsr_config->sky_tile_size);
+  camera->camera_half_res_y=(virtual_res_y / 2.0) - ((double)bsr_config->sky_tile_y * (double)bsr_config->sky_tile_size);
+
+  //
+  // render stars just outside the tile that can reach it. Airy disks extend up to Airy_disk_max_extent pixels from
+  // the star's center and anti-aliasing spreads each pixel by up to anti_alias_radius
+  //
+  star_margin=1;
+  if (bsr_config->Airy_disk_enable == 1) {
+    star_margin+=bsr_config->Airy_disk_max_extent;
+  }
+  if (bsr_config->anti_alias_enable == 1) {
+    star_margin+=(int)ceil(bsr_config->anti_alias_radius) + 1;
+  }
+  tile_left=bsr_config->sky_tile_x * bsr_config->sky_tile_size;
+  tile_top=bsr_config->sky_tile_y * bsr_config->sky_tile_size;
+  camera->star_x_min=-star_margin;
+  camera->star_x_max=camera->camera_res_x + star_margin;
+  camera->star_y_min=-star_margin;
+  camera->star_y_max=camera->camera_res_y + star_margin;
+
+  //
+  // but not outside the virtual raster, so tiles are the same as the corresponding section of the full image
+  //
+  if (camera->star_x_min < -tile_left) {
+    camera->star_x_min=-tile_left;
+  }
+  if (camera->star_x_max > ((int)virtual_res_x - tile_left)) {
+    camera->star_x_max=(int)virtual_res_x - tile_left;
+  }
+  if (camera->star_y_min < -tile_top) {
+    camera->star_y_min=-tile_top;
+  }
+  if (camera->star_y_max > ((int)virtual_res_y - tile_top)) {
+    camera->star_y_max=(int)virtual_res_y - tile_top;
+  }
+
+  //
+  // view cone around the tile and margin. The largest angle from the tile center is at a corner as long as the
+  // tile spans less than 90 degrees of azimuth and does not reach a pole, otherwise culling is not used.
+  // Corners on the same row are the same angle from the center
+  //
+  camera->view_cone_enable=0;
+  tile_half_width=((double)bsr_config->sky_tile_size / 2.0) + (double)star_margin;
+  center_az=(camera->camera_half_res_x - ((double)bsr_config->sky_tile_size / 2.0)) / camera->pixels_per_radian;
+  center_el=(camera->camera_half_res_y - ((double)bsr_config->sky_tile_size / 2.0)) / camera->pixels_per_radian;
+  tile_half_width/=camera->pixels_per_radian;
+  if ((tile_half_width >= (M_PI / 4.0)) || ((fabs(center_el) + tile_half_width) >= (M_PI / 2.0))) {
+    return(0);
+  }
+  cone_cos=1.0;
+  for (corner=0; corner < 2; corner++) {
+    corner_el=center_el + ((corner == 0) ? tile_half_width : -tile_half_width);
+    corner_cos=(sin(center_el) * sin(corner_el)) + (cos(center_el) * cos(corner_el) * cos(tile_half_width));
+    if (corner_cos < cone_cos) {
+      cone_cos=corner_cos;
+    }
+  }
+  if (cone_cos <= 0.0) {
+    return(0);
+  }
+
+  //
+  // cone axis in camera coordinates, rotated to icrs coordinates with the inverse of target_rotation
+  //
+  axis_q.r=0.0;
+  axis_q.i=cos(center_el) * cos(center_az);
+  axis_q.j=cos(center_el) * sin(center_az);
+  axis_q.k=sin(center_el);
+  if ((camera->target_rotation.r != 1.0) && (camera->target_rotation.r != -1.0)) {
+    inverse_rotation.r=camera->target_rotation.r;
+    inverse_rotation.i=-camera->target_rotation.i;
+    inverse_rotation.j=-camera->target_rotation.j;
+    inverse_rotation.k=-camera->target_rotation.k;
+    axis_icrs=quaternion_rotate(inverse_rotation, axis_q);
+  } else {
+    axis_icrs=axis_q;
+  }
+  camera->view_cone_x=axis_icrs.i;
+  camera->view_cone_y=axis_icrs.j;
+  camera->view_cone_z=axis_icrs.k;
+  camera->view_cone_cos2=cone_cos * cone_cos;
+  camera->view_cone_enable=1;
+
+  return(0);
+}
@@ -0,0 +1,289 @@
+//
+// Billion Star 3D Rendering Engine
+// Kevin M. Loch
+//
+// 3D rendering engine for the ESA Gaia DR3 star dataset
+
+/*
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2021, Kevin Loch
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "bsrender.h" // needs to be first to get GNU_SOURCE define for strcasestr
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include "stream-output.h"
+#include "sequence-pixels.h"
+#include "util.h"
+#include "bsr-png.h"
+#include "bsr-jpeg.h"
+
+//
+// Streaming output overlaps pixel sequencing with the PNG or JPEG encoder. Instead of sequencing the whole image
+// into image_output_buf and then encoding it, worker threads sequence bands of output_band_rows rows into a ring
+// of bands and the main thread encodes each band as soon as it is complete. image_output_buf only needs to hold the
+// ring, and in CGI mode the first bytes of the image are sent while the rest is still being sequenced.
+//
+// Each slot of the ring has a status in bsr_state->stream_band_status: the band number + 1 of the band it holds
+// once that band is complete. Worker threads do not reuse a slot until the main thread has encoded the band it
+// holds (stream_bands_encoded).
+//
+// PNG bands are also filtered and deflated by the worker thread that sequenced them unless png_parallel_deflate is
+// disabled, so the main thread only writes each band's IDAT chunk. See deflatePNGRows().
+//
+
+int initOutputStream(bsr_config_t *bsr_config, bsr_state_t *bsr_state, int max_output_res_y) {
+  //
+  // This function decides if output rows are streamed to the encoder and the size of the ring of bands. Streaming
+  // is used for PNG and JPEG output unless output_band_rows is 0, whole images are handed to background image
+  // writers or there are several outputs of different formats.
+  //
+  bsr_state->stream_output=0;
+  bsr_state->stream_deflate=0;
+  bsr_state->stream_band_rows=0;
+  bsr_state->stream_ring_bands=0;
+
+  if ((bsr_config->output_band_rows > 0) && ((bsr_config->image_format == 0) || (bsr_config->image_format == 2)) && (bsr_state->num_outputs == 1)\
+   && ((bsr_state->num_tiles > 1) || (bsr_config->image_writer_threads == 0) || ((bsr_state->num_frames == 1) && (bsr_state->num_images == 1)))) {
+    bsr_state->stream_output=1;
+    if ((bsr_config->image_format == 0) && (bsr_config->png_parallel_deflate == 1)) {
+      bsr_state->stream_deflate=1;
+    }
+    bsr_state->stream_band_rows=bsr_config->output_band_rows;
+    if (bsr_state->stream_band_rows > max_output_res_y) {
+      bsr_state->stream_band_rows=max_output_res_y;
+    }
+
+    // two bands per worker thread so workers can keep sequencing while the main thread encodes
+    bsr_state->stream_ring_bands=2 * bsr_state->num_worker_threads;
+    if (bsr_state->stream_ring_bands < 2) {
+      bsr_state->stream_ring_bands=2;
+    } else if (bsr_state->stream_ring_bands > BSR_MAX_STREAM_BANDS) {
+      bsr_state->stream_ring_bands=BSR_MAX_STREAM_BANDS;
+    }
+    if ((bsr_state->stream_ring_bands * bsr_state->stream_band_rows) > max_output_res_y) {
+      bsr_state->stream_ring_bands=(max_output_res_y + bsr_state->stream_band_rows - 1) / bsr_state->stream_band_rows;
+    }
+  }
+
+  return(0);
+}
+
+int streamImage(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
+  //
+  // This function replaces sequencePixels() and the PNG/JPEG output functions when streaming output is enabled.
+  // Worker threads sequence bands of rows into the ring, the main thread encodes them in order. With tiled rendering
+  // only the current tile's rows are streamed; the encoder is started with the first tile and finished with the last.
+  //
+  struct timespec starttime;
+  struct timespec endtime;
+  double elapsed_time;
+  volatile int *band_status;
+  volatile int *bands_encoded;
+  unsigned char *band_output_p;
+  int current_image_first_row;
+  int output_res_x;
+  int output_res_y;
+  int full_res_y;
+  int bytes_per_pixel;
+  int band_rows;
+  int ring_bands;
+  int num_bands;
+  int band;
+  int slot;
+  int rows;
+  int loop_count;
+  int trace_event;
+  int i;
+
+  //
+  // all threads: get current image resolution and band layout
+  //
+  output_res_x=bsr_state->current_image_res_x;
+  output_res_y=bsr_state->current_image_res_y;
+  full_res_y=bsr_state->current_image_res_y;
+  current_image_first_row=0;
+  if (bsr_state->num_tiles > 1) {
+    // tiled rendering: only output the current tile's rows, the rest of the current image is halo
+    output_res_y=bsr_state->tile_output_res_y;
+    full_res_y=bsr_state->current_image_full_res_y;
+    current_image_first_row=bsr_state->tile_output_y - bsr_state->current_image_y_offset;
+  }
+  if (bsr_config->bits_per_color == 16) {
+    bytes_per_pixel=6;
+  } else {
+    bytes_per_pixel=3;
+  }
+  band_rows=bsr_state->stream_band_rows;
+  ring_bands=bsr_state->stream_ring_bands;
+  num_bands=(output_res_y + band_rows - 1) / band_rows;
+  band_status=bsr_state->stream_band_status;
+  bands_encoded=&bsr_state->stream_bands_encoded;
+
+  //
+  // worker threads: wait for main thread to say go
+  // main thread: reset ring, start encoder, and tell worker threads to go
+  //
+  if (bsr_state->perthread->my_pid != bsr_state->main_pid) {
+    waitForMainThread(bsr_state, THREAD_STATUS_SEQUENCE_PIXELS_BEGIN);
+  } else {
+    // main thread
+    if ((bsr_config->cgi_mode != 1) && (bsr_config->print_status == 1)) {
+      clock_gettime(CLOCK_REALTIME, &starttime);
+      if (bsr_state->num_tiles > 1) {
+        printf("Writing rows %d-%d of %s in bands of %d rows...", bsr_state->tile_output_y, (bsr_state->tile_output_y + output_res_y - 1), bsr_config->output_file_name, band_rows);
+      } else {
+        printf("Writing %s in bands of %d rows...", bsr_config->output_file_name, band_rows);
+      }
+      fflush(stdout);
+    }
+    for (slot=0; slot < ring_bands; slot++) {
+      band_status[slot]=0;
+    }
+    *bands_encoded=0;
+    for (i=0; i < (ring_bands * band_rows); i++) {
+      bsr_state->row_pointers[i]=bsr_state->image_output_buf + ((uint64_t)output_res_x * (uint64_t)i * (uint64_t)bytes_per_pixel);
+    }
+    __sync_synchronize();
+    for (i=1; i <= bsr_state->num_worker_threads; i++) {
+      bsr_state->status_array[i].status=THREAD_STATUS_SEQUENCE_PIXELS_BEGIN;
+    }
+    if ((bsr_state->num_tiles == 1) || (bsr_state->tile_index == 0)) {
+      if (bsr_config->image_format == 0) {
+        beginPNG(bsr_config, bsr_state, output_res_x, full_res_y);
+      } else if (bsr_config->image_format == 2) {
+        beginJpeg(bsr_config, bsr_state, output_res_x, full_res_y);
+      }
+    }
+  } // end if not main thread
+
+  if (bsr_state->perthread->my_pid != bsr_state->main_pid) {
+    //
+    // worker threads: sequence every num_worker_threads'th band into the ring, waiting for its slot to be encoded
+    //
+    for (band=(bsr_state->perthread->my_thread_id - 1); band < num_bands; band+=bsr_state->num_worker_threads) {
+      slot=band % ring_bands;
+      loop_count=0;
+      while (band >= (*bands_encoded + ring_bands)) {
+        // periodically check for exceptions
+        loop_count++;
+        if ((loop_count % 10000) == 0) {
+          checkExceptions(bsr_state);
+          loop_count=1;
+        }
+      }
+      rows=band_rows;
+      if (((band + 1) * band_rows) > output_res_y) {
+        rows=output_res_y - (band * band_rows);
+      }
+      band_output_p=bsr_state->image_output_buf + ((uint64_t)output_res_x * (uint64_t)slot * (uint64_t)band_rows * (uint64_t)bytes_per_pixel);
+      trace_event=traceBegin(bsr_state, "Sequence band", NULL);
+      sequencePixelRows(bsr_config, bsr_state, (current_image_first_row + (band * band_rows)), rows, band_output_p);
+      traceEnd(bsr_state, trace_event);
+      if (bsr_state->stream_deflate == 1) {
+        trace_event=traceBegin(bsr_state, "Deflate band", NULL);
+        deflatePNGRows(bsr_config, bsr_state, (bsr_state->row_pointers + (slot * band_rows)), rows, output_res_x, (bsr_state->stream_deflate_buf + (slot * bsr_state->stream_deflate_slot_size)),\
+         bsr_state->stream_deflate_slot_size, &bsr_state->stream_deflate_sizes[slot], &bsr_state->stream_deflate_lengths[slot], &bsr_state->stream_deflate_adler[slot]);
+        traceEnd(bsr_state, trace_event);
+      }
+      __sync_synchronize();
+      band_status[slot]=band + 1;
+    } // end for band
+  } else {
+    //
+    // main thread: encode bands in order as they are completed
+    //
+    for (band=0; band < num_bands; band++) {
+      slot=band % ring_bands;
+      loop_count=0;
+      while (band_status[slot] != (band + 1)) {
+        // periodically check for exceptions
+        loop_count++;
+        if ((loop_count % 10000) == 0) {
+          checkExceptions(bsr_state);
+          loop_count=1;
+        }
+      }
+      __sync_synchronize();
+      rows=band_rows;
+      if (((band + 1) * band_rows) > output_res_y) {
+        rows=output_res_y - (band * band_rows);
+      }
+      trace_event=traceBegin(bsr_state, "Encode band", NULL);
+      if (bsr_state->stream_deflate == 1) {
+        writePNGDeflated(bsr_config, bsr_state, (bsr_state->stream_deflate_buf + (slot * bsr_state->stream_deflate_slot_size)), bsr_state->stream_deflate_sizes[slot],\
+         bsr_state->stream_deflate_lengths[slot], bsr_state->stream_deflate_adler[slot]);
+      } else if (bsr_config->image_format == 0) {
+        writePNGRows(bsr_config, bsr_state, (bsr_state->row_pointers + (slot * band_rows)), rows);
+      } else if (bsr_config->image_format == 2) {
+        writeJpegRows(bsr_config, bsr_state, (bsr_state->row_pointers + (slot * band_rows)), rows);
+      }
+      traceEnd(bsr_state, trace_event);
+      __sync_synchronize();
+      *bands_encoded=band + 1;
+    } // end for band
+  } // end if not main thread
+
+  //
+  // worker threads: signal this thread is done and wait until main thread says we can continue to next step.
+  // main thread: finish encoder, wait until all other threads are done and then signal that they can continue.
+  //
+  if (bsr_state->perthread->my_pid != bsr_state->main_pid) {
+    bsr_state->status_array[bsr_state->perthread->my_thread_id].status=THREAD_STATUS_SEQUENCE_PIXELS_COMPLETE;
+    waitForMainThread(bsr_state, THREAD_STATUS_SEQUENCE_PIXELS_CONTINUE);
+  } else {
+    if ((bsr_state->num_tiles == 1) || (bsr_state->tile_index == (bsr_state->num_tiles - 1))) {
+      if (bsr_config->image_format == 0) {
+        endPNG(bsr_config, bsr_state);
+      } else if (bsr_config->image_format == 2) {
+        endJpeg(bsr_config, bsr_state);
+      }
+    }
+    waitForWorkerThreads(bsr_state, THREAD_STATUS_SEQUENCE_PIXELS_COMPLETE);
+    // ready to continue, set all worker thread status to continue
+    for (i=1; i <= bsr_state->num_worker_threads; i++) {
+      bsr_state->status_array[i].status=THREAD_STATUS_SEQUENCE_PIXELS_CONTINUE;
+    }
+  } // end if not main thread
+
+  //
+  // main thread: output execution time if not in CGI mode
+  //
+  if ((bsr_state->perthread->my_pid == bsr_state->main_pid) && (bsr_config->cgi_mode != 1) && (bsr_config->print_status == 1)) {
+    clock_gettime(CLOCK_REALTIME, &endtime);
+    elapsed_time=((double)(endtime.tv_sec - 1500000000) + ((double)endtime.tv_nsec / 1.0E9)) - ((double)(starttime.tv_sec - 1500000000) + ((double)starttime.tv_nsec) / 1.0E9);
+    printf(" (%.3fs)\n", elapsed_time);
+    fflush(stdout);
+  }
+
+  return(0);
+}
@@ -0,0 +1,366 @@
+//
+// Billion Star 3D Rendering Engine
+// Kevin M. Loch
+//
+// 3D rendering engine for the ESA Gaia DR3 star dataset
+
+/*
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2021, Kevin Loch
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "bsrender.h" // needs to be first to get GNU_SOURCE define for strcasestr
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "tiled-render.h"
+#include "pixel-buffer.h"
+#include "Lanczos.h"
+#include "bsr-png.h"
+#include "bsr-jpeg.h"
+
+//
+// Tiled rendering splits each image into horizontal tiles (bands of output rows) so the image composition, blur,
+// resize and output buffers only need to hold one tile at a time. Each tile is rendered with a full pass through
+// the star data files, post processed, and its rows are streamed to the PNG or JPEG encoder.
+//
+// Tiles overlap their neighbors by a halo of image composition rows needed by the Gaussian blur and Lanczos kernels
+// and Airy disk convolution so the output is the same as rendering the whole image at once. Stars are rendered if their center is anywhere
+// within the image raster (as usual), but only pixels within the current tile are stored.
+//
+
+int tileCompositionRows(bsr_config_t *bsr_config, bsr_state_t *bsr_state, int output_y, int output_res_y, int *y_min, int *y_max) {
+  //
+  // This function finds the range of image composition rows [y_min..y_max) needed to produce output image rows
+  // [output_y..output_y+output_res_y), including the halo required by Lanczos resampling, Gaussian blur and Airy disk
+  // convolution
+  //
+  int res_y;
+  double radius;
+  double source_w;
+  double source_y_center;
+  int blur_half_width;
+
+  res_y=bsr_state->image[0].res_y;
+
+  //
+  // Lanczos resampling reads source rows within the kernel radius of each output row's center
+  //
+  if (bsr_config->output_scaling_factor != 1.0) {
+    radius=LanczosRadius(bsr_config);
+    source_w=1.0 / bsr_config->output_scaling_factor;
+    source_y_center=((double)output_y * source_w) + (source_w / 2.0) - 0.5;
+    *y_min=(int)floor(source_y_center - radius) + 1;
+    source_y_center=((double)(output_y + output_res_y - 1) * source_w) + (source_w / 2.0) - 0.5;
+    *y_max=(int)floor(source_y_center + radius) + 1;
+  } else {
+    *y_min=output_y;
+    *y_max=output_y + output_res_y;
+  }
+
+  //
+  // Gaussian blur reads source rows within half the kernel width of each row
+  //
+  if (bsr_config->Gaussian_blur_radius > 0.0) {
+    blur_half_width=((int)ceil(bsr_config->Gaussian_blur_radius) * 3) + 1;
+    *y_min-=blur_half_width;
+    *y_max+=blur_half_width;
+  }
+
+  //
+  // Airy disk convolution reads source rows within Airy_disk_max_extent of each row
+  //
+  if (bsr_config->Airy_disk_mode == 1) {
+    *y_min-=bsr_config->Airy_disk_max_extent;
+    *y_max+=bsr_config->Airy_disk_max_extent;
+  }
+
+  //
+  // limit to image raster
+  //
+  if (*y_min < 0) {
+    *y_min=0;
+  }
+  if (*y_max > res_y) {
+    *y_max=res_y;
+  }
+
+  return(0);
+}
+
+int initTiles(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
+  //
+  // This function decides if images are rendered in tiles and the number of output rows per tile. With tile_height=0
+  // (auto) tiles are only used if the full size image buffers would exceed buffer_memory_limit even with 16-bit
+  // buffers. Tile height is then the largest that keeps all image buffers within the limit.
+  //
+  int res_x;
+  int res_y;
+  int output_res_x;
+  int output_res_y;
+  int bytes_per_pixel;
+  int composition_bytes;
+  int blur_bytes=0;
+  int resize_bytes=0;
+  int halo_rows;
+  int y_min;
+  int y_max;
+  uint64_t memory_limit;
+  uint64_t full_memory;
+  double row_memory;
+  double halo_memory;
+  int tile_rows;
+  int tiles_supported;
+
+  //
+  // default is one tile covering the whole image
+  //
+  res_x=bsr_state->image[0].res_x;
+  res_y=bsr_state->image[0].res_y;
+  if (bsr_config->output_scaling_factor != 1.0) {
+    output_res_x=(int)(((double)res_x * bsr_config->output_scaling_factor) + 0.5);
+    output_res_y=(int)(((double)res_y * bsr_config->output_scaling_factor) + 0.5);
+  } else {
+    output_res_x=res_x;
+    output_res_y=res_y;
+  }
+  bsr_state->num_tiles=1;
+  bsr_state->tile_index=0;
+  bsr_state->tile_output_rows=output_res_y;
+  bsr_state->tile_output_y=0;
+  bsr_state->tile_output_res_y=output_res_y;
+
+  //
+  // tiles are streamed to the encoder so only single camera, single output PNG and JPEG output is supported
+  //
+  if ((bsr_state->num_images == 1) && (bsr_state->num_cameras == 1) && (bsr_state->num_outputs == 1) && ((bsr_config->image_format == 0) || (bsr_config->image_format == 2))) {
+    tiles_supported=1;
+  } else {
+    tiles_supported=0;
+  }
+  if ((bsr_config->tile_height > 0) && (tiles_supported == 0)) {
+    if (bsr_config->cgi_mode != 1) {
+      printf("Error: tiled rendering requires a single camera, a single output and PNG or JPEG output\n");
+      fflush(stdout);
+    }
+    exit(1);
+  }
+
+  //
+  // bytes per output pixel
+  //
+  if (bsr_config->bits_per_color == 32) {
+    bytes_per_pixel=12;
+  } else if ((bsr_config->bits_per_color == 10) || (bsr_config->bits_per_color == 12) || (bsr_config->bits_per_color == 16)) {
+    bytes_per_pixel=6;
+  } else {
+    bytes_per_pixel=3;
+  }
+
+  memory_limit=bufferMemoryLimit(bsr_config);
+  if (bsr_config->tile_height > 0) {
+    tile_rows=bsr_config->tile_height;
+  } else {
+    //
+    // auto: check if full size image buffers fit with 16-bit floating-point for any auto precision buffers
+    //
+    composition_bytes=(int)pixelSize((bsr_config->composition_precision == 0) ? 16 : bsr_config->composition_precision);
+    if ((bsr_config->Gaussian_blur_radius > 0.0) || (bsr_config->Airy_disk_mode == 1)) {
+      blur_bytes=(int)pixelSize((bsr_config->blur_precision == 0) ? 16 : bsr_config->blur_precision);
+    }
+    if (bsr_config->output_scaling_factor != 1.0) {
+      resize_bytes=(int)pixelSize((bsr_config->resize_precision == 0) ? 16 : bsr_config->resize_precision);
+    }
+    full_memory=((uint64_t)res_x * (uint64_t)res_y * (uint64_t)(composition_bytes + blur_bytes))\
+      + ((uint64_t)output_res_x * (uint64_t)output_res_y * (uint64_t)(resize_bytes + bytes_per_pixel));
+    if ((full_memory <= memory_limit) || (tiles_supported == 0)) {
+      return(0);
+    }
+
+    //
+    // find largest tile height that fits, using 32-bit floating-point for auto precision buffers
+    //
+    composition_bytes=(int)pixelSize((bsr_config->composition_precision == 0) ? 32 : bsr_config->composition_precision);
+    if ((bsr_config->Gaussian_blur_radius > 0.0) || (bsr_config->Airy_disk_mode == 1)) {
+      blur_bytes=(int)pixelSize((bsr_config->blur_precision == 0) ? 32 : bsr_config->blur_precision);
+    }
+    if (bsr_config->output_scaling_factor != 1.0) {
+      resize_bytes=(int)pixelSize((bsr_config->resize_precision == 0) ? 32 : bsr_config->resize_precision);
+    }
+    tileCompositionRows(bsr_config, bsr_state, (output_res_y / 2), 1, &y_min, &y_max);
+    halo_rows=(y_max - y_min) + 2; // composition rows for a single output row, plus rounding
+    halo_memory=(double)halo_rows * (double)res_x * (double)(composition_bytes + blur_bytes);
+    row_memory=((double)res_y / (double)output_res_y * (double)res_x * (double)(composition_bytes + blur_bytes))\
+      + ((double)output_res_x * (double)(resize_bytes + bytes_per_pixel)) + (double)sizeof(unsigned char *);
+    if ((double)memory_limit > halo_memory) {
+      tile_rows=(int)(((double)memory_limit - halo_memory) / row_memory);
+    } else {
+      tile_rows=1;
+    }
+  }
+  if (tile_rows < 1) {
+    tile_rows=1;
+  } else if (tile_rows > output_res_y) {
+    tile_rows=output_res_y;
+  }
+
+  //
+  // set number of tiles
+  //
+  bsr_state->tile_output_rows=tile_rows;
+  bsr_state->tile_output_res_y=tile_rows;
+  bsr_state->num_tiles=(output_res_y + tile_rows - 1) / tile_rows;
+  if ((bsr_state->num_tiles > 1) && (bsr_config->cgi_mode != 1) && (bsr_config->print_status == 1)) {
+    if (bsr_config->tile_height > 0) {
+      printf("Rendering in %d tiles of %d rows\n", bsr_state->num_tiles, tile_rows);
+    } else {
+      printf("Rendering in %d tiles of %d rows to fit in buffer memory limit of %lluMB\n", bsr_state->num_tiles, tile_rows, (unsigned long long)(memory_limit / (uint64_t)1048576));
+    }
+    fflush(stdout);
+  }
+
+  return(0);
+}
+
+int selectTile(bsr_config_t *bsr_config, bsr_state_t *bsr_state, int tile_index) {
+  //
+  // This function sets the output rows for the current tile and the range of image composition rows that are
+  // rendered for it. Called by main thread only, after all threads have finished with the previous tile and
+  // before the image composition buffer is initialized.
+  //
+  bsr_camera_t *camera;
+  int output_res_y;
+  int y_min;
+  int y_max;
+  int star_margin;
+
+  camera=bsr_state->camera;
+  if (bsr_config->output_scaling_factor != 1.0) {
+    output_res_y=(int)(((double)bsr_state->image[0].res_y * bsr_config->output_scaling_factor) + 0.5);
+  } else {
+    output_res_y=bsr_state->image[0].res_y;
+  }
+
+  //
+  // output rows for this tile
+  //
+  bsr_state->tile_index=tile_index;
+  bsr_state->tile_output_y=tile_index * bsr_state->tile_output_rows;
+  bsr_state->tile_output_res_y=bsr_state->tile_output_rows;
+  if ((bsr_state->tile_output_y + bsr_state->tile_output_res_y) > output_res_y) {
+    bsr_state->tile_output_res_y=output_res_y - bsr_state->tile_output_y;
+  }
+
+  //
+  // image composition rows for this tile
+  //
+  tileCompositionRows(bsr_config, bsr_state, bsr_state->tile_output_y, bsr_state->tile_output_res_y, &y_min, &y_max);
+  camera->tile_y_min=y_min;
+  camera->tile_y_max=y_max;
+
+  //
+  // skip stars that cannot reach this tile. Airy disks extend up to Airy_disk_max_extent pixels from the star's
+  // center (unless convolved later, which the tile's halo rows account for) and anti-aliasing spreads each pixel by
+  // up to anti_alias_radius
+  //
+  star_margin=1;
+  if ((bsr_config->Airy_disk_enable == 1) && (bsr_config->Airy_disk_mode == 0)) {
+    star_margin+=bsr_config->Airy_disk_max_extent;
+  }
+  if (bsr_config->anti_alias_enable == 1) {
+    star_margin+=(int)ceil(bsr_config->anti_alias_radius) + 1;
+  }
+  camera->star_y_min=y_min - star_margin;
+  if (camera->star_y_min < 0) {
+    camera->star_y_min=0;
+  }
+  camera->star_y_max=y_max + star_margin;
+  if (camera->star_y_max > camera->camera_res_y) {
+    camera->star_y_max=camera->camera_res_y;
+  }
+
+  if ((bsr_config->cgi_mode != 1) && (bsr_config->print_status == 1)) {
+    printf("Tile %d of %d, output rows %d-%d\n", (tile_index + 1), bsr_state->num_tiles, bsr_state->tile_output_y, (bsr_state->tile_output_y + bsr_state->tile_output_res_y - 1));
+    fflush(stdout);
+  }
+
+  return(0);
+}
+
+int outputImageTile(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
+  //
+  // This function streams the current tile's output rows to the PNG or JPEG encoder. The encoder is started with the
+  // first tile and finished with the last tile. Called by main thread only.
+  //
+  struct timespec starttime;
+  struct timespec endtime;
+  double elapsed_time;
+
+  //
+  // display status update if not in CGI mode
+  //
+  if ((bsr_config->cgi_mode != 1) && (bsr_config->print_status == 1)) {
+    clock_gettime(CLOCK_REALTIME, &starttime);
+    printf("Writing rows %d-%d of %s...", bsr_state->tile_output_y, (bsr_state->tile_output_y + bsr_state->tile_output_res_y - 1), bsr_config->output_file_name);
+    fflush(stdout);
+  }
+
+  if (bsr_config->image_format == 0) {
+    if (bsr_state->tile_index == 0) {
+      beginPNG(bsr_config, bsr_state, bsr_state->current_image_res_x, bsr_state->current_image_full_res_y);
+    }
+    writePNGRows(bsr_config, bsr_state, bsr_state->row_pointers, bsr_state->tile_output_res_y);
+    if (bsr_state->tile_index == (bsr_state->num_tiles - 1)) {
+      endPNG(bsr_config, bsr_state);
+    }
+  } else if (bsr_config->image_format == 2) {
+    if (bsr_state->tile_index == 0) {
+      beginJpeg(bsr_config, bsr_state, bsr_state->current_image_res_x, bsr_state->current_image_full_res_y);
+    }
+    writeJpegRows(bsr_config, bsr_state, bsr_state->row_pointers, bsr_state->tile_output_res_y);
+    if (bsr_state->tile_index == (bsr_state->num_tiles - 1)) {
+      endJpeg(bsr_config, bsr_state);
+    }
+  }
+
+  //
+  // display status message if not CGI mode
+  //
+  if ((bsr_config->cgi_mode != 1) && (bsr_config->print_status == 1)) {
+    clock_gettime(CLOCK_REALTIME, &endtime);
+    elapsed_time=((double)(endtime.tv_sec - 1500000000) + ((double)endtime.tv_nsec / 1.0E9)) - ((double)(starttime.tv_sec - 1500000000) + ((double)starttime.tv_nsec) / 1.0E9);
+    printf(" (%.3fs)\n", elapsed_time);
+    fflush(stdout);
+  }
+
+  return(0);
+}
@@ -0,0 +1,115 @@
+//
+// Billion Star 3D Rendering Engine
+// Kevin M. Loch
+//
+// 3D rendering engine for the ESA Gaia DR3 star dataset
+
+/*
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2021, Kevin Loch
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "bsrender.h" // needs to be first to get GNU_SOURCE define for strcasestr
+#include <stdint.h>
+#include <stdio.h>
+#include "util.h"
+#include "trace.h"
+
+//
+// Timeline trace (trace=file.json). Each thread records begin/end timestamps of rendering steps and of waiting at
+// thread status checkpoints with traceBegin()/traceEnd() in util.c into its own globally mmapped event buffer. After
+// rendering the main thread writes all events in Chrome Trace Event format, which can be loaded into
+// chrome://tracing or ui.perfetto.dev to see each worker thread's timeline.
+//
+
+int writeTraceFile(bsr_config_t *bsr_config, bsr_state_t *bsr_state) {
+  FILE *trace_file;
+  bsr_trace_buffer_t *trace_buffer;
+  bsr_trace_event_t *trace_event;
+  int thread_id;
+  int event_index;
+  int dropped_events;
+
+  trace_file=fopen(bsr_config->trace_file_name, "w");
+  if (trace_file == NULL) {
+    if (bsr_config->print_status == 1) {
+      printf("Warning: could not open trace file %s\n", bsr_config->trace_file_name);
+      fflush(stdout);
+    }
+    return(1);
+  }
+
+  //
+  // thread names, thread 0 is the main thread
+  //
+  fprintf(trace_file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+  fprintf(trace_file, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": 0, \"args\": {\"name\": \"bsrender\"}}", (int)bsr_state->main_pid);
+  for (thread_id=0; thread_id <= bsr_state->num_worker_threads; thread_id++) {
+    if (thread_id == 0) {
+      fprintf(trace_file, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": 0, \"args\": {\"name\": \"main thread\"}}", (int)bsr_state->main_pid);
+    } else {
+      fprintf(trace_file, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, \"args\": {\"name\": \"worker thread %d\"}}", (int)bsr_state->main_pid, thread_id, thread_id);
+    }
+    fprintf(trace_file, ",\n{\"name\": \"thread_sort_index\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, \"args\": {\"sort_index\": %d}}", (int)bsr_state->main_pid, thread_id, thread_id);
+  }
+
+  //
+  // complete ("X") events with microsecond timestamps relative to the start of rendering. Events that were never
+  // ended (thread exited early) are skipped
+  //
+  dropped_events=0;
+  for (thread_id=0; thread_id <= bsr_state->num_worker_threads; thread_id++) {
+    trace_buffer=bsr_state->trace_buffers + thread_id;
+    dropped_events+=trace_buffer->dropped_events;
+    for (event_index=0; event_index < trace_buffer->num_events; event_index++) {
+      trace_event=&trace_buffer->events[event_index];
+      if (trace_event->end_ns < trace_event->begin_ns) {
+        continue;
+      }
+      fprintf(trace_file, ",\n{\"name\": \"%s\", \"cat\": \"bsrender\", \"ph\": \"X\", \"pid\": %d, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",\
+        trace_event->name, (int)bsr_state->main_pid, thread_id,\
+        ((double)(trace_event->begin_ns - bsr_state->trace_start_ns) / 1000.0), ((double)(trace_event->end_ns - trace_event->begin_ns) / 1000.0));
+      if (trace_event->detail[0] != 0) {
+        fprintf(trace_file, ", \"args\": {\"detail\": \"%s\"}", trace_event->detail);
+      }
+      fprintf(trace_file, "}");
+    }
+  }
+  fprintf(trace_file, "\n]}\n");
+  fclose(trace_file);
+
+  if ((dropped_events > 0) && (bsr_config->print_status == 1)) {
+    printf("Warning: %d trace events were dropped, limit is %d per thread\n", dropped_events, BSR_TRACE_MAX_EVENTS);
+    fflush(stdout);
+  }
+
+  return(0);
+}
@@ -56,9 +56,58 @@ Command line only options:\n\
 Privileged options - these cannot be changed by remote users in CGI mode:\n\
      --data_file_directory=DIR, -d        Path to galaxy-* data files, limit 255 characters\n\
      --output_file_name=FILE, -o          Output filename, may include path, limit 255 characters\n\
+     --camera_list_file=FILE              Optional list of cameras to render in a single pass through the star data\n\
+                                          files. Each line defines one camera with space separated option=value\n\
+                                          pairs. Only position, target, rotation, pan, tilt, fov, projection,\n\
+                                          resolution and output_file_name are used, other options are inherited\n\
+     --frame_list_file=FILE               Optional list of camera keyframes for rendering animations in batch mode.\n\
+                                          Each line defines one keyframe with space separated option=value pairs\n\
+                                          and frames=NUM, the number of frames from the previous keyframe.\n\
+                                          Position, target, rotation, pan, tilt and fov are linearly interpolated.\n\
+                                          Worker threads, tables and buffers are reused for every frame\n\
+     --output_list_file=FILE              Optional list of output images to make from one rendering. Each line\n\
+                                          defines one output with space separated option=value pairs. Only\n\
+                                          output_file_name, output_format, color_profile, output_scaling_factor,\n\
+                                          camera_pixel_limit_mag, camera_pixel_limit_mode, camera_gamma and\n\
+                                          pre_limit_intensity are used, other options are inherited\n\
+     --daemon_socket=FILE                 Run as a daemon serving CGI style requests on this UNIX socket. Data files\n\
+                                          and rgb tables stay loaded between requests. See bsr-client\n\
+     --cache_directory=DIR                Cache CGI images in DIR and serve identical requests from the cache\n\
+     --cache_size_limit=NUM               Maximum size of cache_directory in MB, least recently used images removed\n\
+     --admission_file=FILE                Enable admission control for CGI requests, using FILE to share the table\n\
+                                          of rendering and queued requests between processes\n\
+     --image_writer_threads=NUM           Maximum number of background processes encoding and writing PNG, JPEG,\n\
+                                          AVIF or HEIF images while the next frame or image is rendered, 0 = none\n\
+     --composition_precision=NUM          Bits per color of the image composition buffer: 16, 32, 64, or 0 = auto\n\
+     --blur_precision=NUM                 Bits per color of the Gaussian blur buffer: 16, 32, 64, or 0 = auto\n\
+     --resize_precision=NUM               Bits per color of the Lanczos resize buffer: 16, 32, 64, or 0 = auto\n\
+                                          Auto uses 32 bits unless image buffers would exceed buffer_memory_limit,\n\
+                                          then 16 bits. 16-bit buffers are normalized to the camera pixel limit\n\
+     --buffer_memory_limit=NUM            Memory budget in MB for automatic buffer precision and tiled rendering,\n\
+                                          0 = 3/4 of system memory\n\
+     --tile_height=NUM                    Render PNG or JPEG images in horizontal tiles of NUM output rows to limit\n\
+                                          memory use. 0 = auto, only tile if image buffers exceed buffer_memory_limit\n\
+     --output_band_rows=NUM               Stream PNG or JPEG output to the encoder in bands of NUM rows while worker\n\
+                                          threads sequence later bands, 0 = sequence the whole image before encoding\n\
+     --png_parallel_deflate=BOOL          yes = worker threads filter and deflate streamed PNG bands in parallel\n\
+                                          no = the main thread deflates the whole PNG image with libpng\n\
      --print_status=BOOL, -q              yes = sppress non-error status messages (also -q)\n\
                                           no = will allow informational status messages\n\
                                           All messages are always suppressed in CGI mode\n\
+     --perf_counters=NUM                  0 = disabled\n\
+                                          1 = print per stage performance counters (task clock, cycles,\n\
+                                              instructions, cache/TLB/branch misses) for main and worker threads\n\
+                                          2 = print performance counters per stage and thread as JSON\n\
+                                          Hardware events may not be available in virtual machines\n\
+     --trace=FILE                         Write a timeline of each thread's rendering steps and waits to FILE in\n\
+                                          Chrome Trace Event JSON format (chrome://tracing, ui.perfetto.dev)\n\
+     --stats_json=FILE                    Write render statistics to FILE as JSON (- for stdout): stars read from\n\
+                                          each input file, filter rejects, pixel contributions, dedup merge and\n\
+                                          collision rates and main thread buffer stalls\n\
+     --save_composition=FILE              Save the linear image composition buffer to FILE after rendering stars\n\
+     --load_composition=FILE              Load the image composition buffer from FILE instead of rendering stars,\n\
+                                          to re-expose, blur, resize or re-encode an image saved with\n\
+                                          save_composition. Camera resolution and Airy_disk_mode must match\n\
      --num_threads=NUM                    Total number of threads including main thread and worker\n\
                                           threads (minimum 2)\n\
                                           For best performance set to number of vcpus\n\
@@ -73,6 +122,15 @@ Privileged options - these cannot be changed by remote users in CGI mode:\n\
      --cgi_Gaia_min_parallax_quality=NUM  Minimum allowed parallax quality of Gaia stars for CGI users\n\
      --cgi_allow_Airy_disk=BOOL           yes = Airy disk mode is allowed for CGI users\n\
      --cgi_allow_anti_alias=BOOL          yes = anti-aliasing mode is allowed for CGI users\n\
+     --cgi_cache_max_age=NUM              Seconds browsers and proxies may cache CGI images, 0 = no-store headers\n\
+     --cgi_max_request_cost=FLOAT         Maximum estimated CPU-seconds of a CGI request, 0 = unlimited\n\
+     --cgi_max_request_memory=NUM         Maximum estimated memory of a CGI request in MB, 0 = unlimited\n\
+     --cgi_max_active_cost=FLOAT          Maximum estimated CPU-seconds of all CGI requests rendering at once\n\
+     --cgi_max_active_memory=NUM          Maximum estimated memory in MB of all CGI requests rendering at once\n\
+     --cgi_degrade_requests=BOOL          yes = reduce resolution or raise parallax quality of requests over the\n\
+                                          per-request budget, no = reject them\n\
+     --cgi_max_queued=NUM                 Maximum number of CGI requests waiting for the active budget\n\
+     --cgi_queue_timeout=NUM              Seconds a CGI request may wait before it is rejected with HTTP 503\n\
      --cgi_min_Airy_disk_first_null=FLOAT Minimum allowed first null distance for CGI users\n\
      --cgi_max_Airy_disk_min_extent=NUM   Maximum allowed Airy disk minimum extent for CGI users\n\
      --cgi_max_Airy_disk_max_extent=NUM   Maximum allowed Airy disk extent for CGI users\n\
@@ -110,10 +168,26 @@ Camera\n\
      --camera_color_saturation=FLOAT      Chroma saturation level (4.0 = 4x crhoma)\n\
      --camera_gamma=FLOAT                 Image gamma adjustment. This option never changes PNG header gamma as it\n\
                                           is intended to modify the way the image looks\n\
-     --camera_projection=NUM              Raster projection: 0 = lat/lon, 1 = spherical, 2 = Hammer, 3 = Mollewide\n\
+     --camera_projection=NUM              Raster projection: 0 = lat/lon, 1 = spherical, 2 = Hammer, 3 = Mollewide,\n\
+                                          4 = rectilinear (fov limited to 179 degrees)\n\
      --spherical_orientation=NUM          Spherical projection orientation: 0 = forward centered, 1 = forward on\n\
                                           left, rear on right\n\
      --Mollewide_iterations=NUM           Number of iterations for Mollewide projection algorithm\n\
+     --vr_mode=NUM                        VR output mode: 0 = disabled, 1 = cube map, 2 = stereo\n\
+                                          Cube map renders six 90 degree rectilinear faces of camera_res_y x\n\
+                                          camera_res_y relative to the camera orientation. Stereo renders left and\n\
+                                          right eye images using the camera projection and resolution with\n\
+                                          parallel eyes, limited to camera_fov of 180 degrees or less\n\
+     --vr_packed_output=BOOL              yes = output one packed image (cube map 3x2 faces: right, left, up / down,\n\
+                                          front, back; stereo left eye over right eye)\n\
+                                          no = output one file per face or eye, adding \"-<face>\" to output_file_name\n\
+     --stereo_separation=FLOAT            Distance between left and right eye cameras in parsecs\n\
+     --sky_tile_zoom=NUM                  -1 = disabled, 0 or more = render one tile of a virtual full sky lat/lon\n\
+                                          image of 2^(zoom+1) x 2^zoom tiles (like slippy map tiles). Sets\n\
+                                          camera_projection, camera_fov and camera resolution\n\
+     --sky_tile_x=NUM                     Tile column, 0 = left edge of the virtual image\n\
+     --sky_tile_y=NUM                     Tile row, 0 = top edge of the virtual image\n\
+     --sky_tile_size=NUM                  Tile width and height in pixels\n\
 \n\
 Camera bandpass filters\n\
      --red_filter_long_limit=FLOAT        Red channel passpand long wavelength limit in nm\n\
@@ -135,6 +209,10 @@ Diffraction\n\
                                           Larger values can dramatically increase rendering time\n\
      --Airy_disk_obstruction=FLOAT        Aperture obstruction ratio (secondary mirror for example). Set to 0.0\n\
                                           for unobstructed aperture. Hubble=0.127\n\
+     --Airy_disk_mode=NUM                 0 = Airy disk map for each star, autoscaled between min-max extent\n\
+                                          1 = render stars as points and convolve the image with the full\n\
+                                          Airy disk by FFT. Faster for large extents or many bright stars\n\
+                                          Sky tiles always use mode 0\n\
 \n\
 Anti-aliasing\n\
      --anti_alias_enable=BOOL             yes = spread pixel intensity to neighboring pixels\n\
@@ -152,6 +230,8 @@ Post-processing\n\
      --pre_limit_intensity=yes            Apply pixel intensity limit before blur/resize/encoding gamma. This is\n\
                                           disabled automatically when an HDR color profile is selected\n\
      --Gaussian_blur_radius=FLOAT         Optional Gaussian blur with this radius in pixels\n\
+     --Gaussian_blur_mode=NUM             0 = automatic (recursive at radius 4.0 and above), 1 = direct convolution,\n\
+                                          2 = recursive (time does not depend on radius)\n\
      --output_scaling_factor=FLOAT        Optional output scaling using Lanczos2 interpolation\n\
      --Lanczos_order=NUM                  Lanczos order parameter for output scaling\n\
 \n\
@@ -192,6 +272,9 @@ Output\n\
                                           is normalized to this value before encoding. Pixels brighter than this\n\
                                           will be displayed brighter (up to 10,000 nits for PQ profile) on supported\n\
                                           hardware/software\n\
+     --progressive=BOOL                   yes = CGI mode sends a multipart/x-mixed-replace response with a preview\n\
+                                          of the brightest data files first, then refined images as fainter\n\
+                                          parallax quality files are added\n\
 \n\
 Camera position in Euclidian ICRS coordinates\n\
      --camera_icrs_y=FLOAT                y coordinate in parsecs\n\
@@ -40,7 +40,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <poll.h>
+#include <dirent.h>
+#include <unistd.h>
 #include <sys/wait.h>
+#include <strings.h>
+#include <arpa/inet.h>
 
 int littleEndianTest() {
   uint64_t tmp64;
@@ -412,14 +420,213 @@ int printVersion(bsr_config_t *bsr_config) {
   return(0);
 }
 
+int httpdConnectionAddress(bsr_state_t *bsr_state) {
+  //
+  // This function stores this request's client address and port (REMOTE_ADDR, REMOTE_PORT) in the format used by
+  // the rem_address column of /proc/net/tcp and /proc/net/tcp6: each 32-bit word of the address in host byte order
+  // and the port, all in hex. Returns 0 if the connection can't be identified
+  //
+  char *remote_addr;
+  char *remote_port;
+  char *port_end;
+  long port;
+  struct in_addr addr4;
+  struct in6_addr addr6;
+  uint32_t words[4];
+
+  bsr_state->httpd_remote_tcp[0]=0;
+  bsr_state->httpd_remote_tcp6[0]=0;
+  remote_addr=getenv("REMOTE_ADDR");
+  remote_port=getenv("REMOTE_PORT");
+  if ((remote_addr == NULL) || (remote_port == NULL)) {
+    return(0);
+  }
+  port=strtol(remote_port, &port_end, 10);
+  if ((port_end == remote_port) || (*port_end != 0) || (port < 1) || (port > 65535)) {
+    return(0);
+  }
+
+  if (inet_pton(AF_INET, remote_addr, &addr4) == 1) {
+    // IPv4 client, shown in tcp or as an IPv4-mapped address (::ffff:a.b.c.d) in tcp6
+    memcpy(&words[0], &addr4, 4);
+    snprintf(bsr_state->httpd_remote_tcp, 48, "%08X:%04X", words[0], (unsigned int)port);
+    memset(&addr6, 0, sizeof(addr6));
+    addr6.s6_addr[10]=0xff;
+    addr6.s6_addr[11]=0xff;
+    memcpy(&addr6.s6_addr[12], &addr4, 4);
+  } else if (inet_pton(AF_INET6, remote_addr, &addr6) != 1) {
+    return(0);
+  }
+  memcpy(words, &addr6, 16);
+  snprintf(bsr_state->httpd_remote_tcp6, 48, "%08X%08X%08X%08X:%04X", words[0], words[1], words[2], words[3], (unsigned int)port);
+
+  return(1);
+}
+
+static int httpdHoldsSocket(pid_t httpd_pid, unsigned long socket_inode) {
+  //
+  // returns 1 if one of the httpd parent process's open files is the socket with this inode
+  //
+  char path[320];
+  char link_target[64];
+  unsigned long inode;
+  int link_length;
+  int found;
+  DIR *fd_dir;
+  struct dirent *dir_entry;
+
+  snprintf(path, 320, "/proc/%d/fd", (int)httpd_pid);
+  fd_dir=opendir(path);
+  if (fd_dir == NULL) {
+    return(0);
+  }
+  found=0;
+  dir_entry=readdir(fd_dir);
+  while ((dir_entry != NULL) && (found == 0)) {
+    snprintf(path, 320, "/proc/%d/fd/%s", (int)httpd_pid, dir_entry->d_name);
+    link_length=readlink(path, link_target, 63);
+    if (link_length > 0) {
+      link_target[link_length]=0;
+      if ((sscanf(link_target, "socket:[%lu]", &inode) == 1) && (inode == socket_inode)) {
+        found=1;
+      }
+    }
+    dir_entry=readdir(fd_dir);
+  }
+  closedir(fd_dir);
+
+  return(found);
+}
+
+int httpdConnectionClosed(bsr_state_t *bsr_state) {
+  //
+  // This function checks if this request's tcp connection, held by the httpd parent process, is in CLOSE_WAIT,
+  // meaning the client closed the connection (closed browser/tab or hit the stop button) while nothing was being
+  // written to it. Other connections of the httpd process (e.g. other clients' keep-alive connections) are not
+  // checked. Returns 0 if sockets can't be inspected (e.g. httpd runs as a different user)
+  //
+  const char *tcp_tables[2]={"/proc/net/tcp", "/proc/net/tcp6"};
+  const char *remote_tcp[2];
+  char rem_address[64];
+  char line[512];
+  unsigned long inode;
+  int state;
+  int closed;
+  int t;
+  FILE *tcp_table;
+
+  remote_tcp[0]=bsr_state->httpd_remote_tcp;
+  remote_tcp[1]=bsr_state->httpd_remote_tcp6;
+
+  //
+  // look up the state of this request's connection in the kernel tcp tables, 08 = CLOSE_WAIT
+  //
+  closed=0;
+  for (t=0; ((t < 2) && (closed == 0)); t++) {
+    if (remote_tcp[t][0] == 0) {
+      continue;
+    }
+    tcp_table=fopen(tcp_tables[t], "r");
+    if (tcp_table == NULL) {
+      continue;
+    }
+    while ((closed == 0) && (fgets(line, 512, tcp_table) != NULL)) {
+      if (sscanf(line, "%*d: %*s %63s %x %*s %*s %*s %*d %*d %lu", rem_address, &state, &inode) == 3) {
+        if ((state == 0x08) && (strcasecmp(rem_address, remote_tcp[t]) == 0) && (httpdHoldsSocket(bsr_state->httpd_pid, inode) == 1)) {
+          closed=1;
+        }
+      }
+    }
+    fclose(tcp_table);
+  }
+
+  return(closed);
+}
+
+int clientDisconnected(bsr_state_t *bsr_state) {
+  //
+  // This function checks if the CGI client has gone away. Returns 1 if the render should be canceled
+  //
+  struct pollfd client_poll;
+  time_t now;
+
+  //
+  // output closed by the web server (pipe) or daemon client (socket)
+  //
+  client_poll.fd=bsr_state->client_fd;
+  client_poll.events=0;
+  client_poll.revents=0;
+  if ((poll(&client_poll, 1, 0) > 0) && ((client_poll.revents & (POLLHUP | POLLERR)) != 0)) {
+    return(1);
+  }
+
+  //
+  // httpd keeps our output open until it tries to write to a closed connection, so also check its tcp connection.
+  // This walks /proc so only do it once per second
+  //
+  if (bsr_state->check_httpd_connection == 1) {
+    now=time(NULL);
+    if (now != bsr_state->perthread->last_connection_check) {
+      bsr_state->perthread->last_connection_check=now;
+      if (httpdConnectionClosed(bsr_state) == 1) {
+        return(1);
+      }
+    }
+  }
+
+  return(0);
+}
+
+int cancelRender(bsr_state_t *bsr_state) {
+  //
+  // main thread: tell all worker threads to exit, give them a moment to do so, then exit. Memory buffers are
+  // released as each process exits
+  //
+  struct timespec poll_interval;
+  int i;
+
+  for (i=0; i <= bsr_state->num_worker_threads; i++) {
+    bsr_state->status_array[i].cancel=1;
+  }
+  poll_interval.tv_sec=0;
+  poll_interval.tv_nsec=10000000;
+  for (i=0; i < 200; i++) {
+    if ((waitpid(-1, NULL, WNOHANG) == -1) && (errno == ECHILD)) {
+      break;
+    }
+    nanosleep(&poll_interval, NULL);
+  }
+  exit(1);
+
+  return(0);
+}
+
+int checkCancel(bsr_state_t *bsr_state) {
+  //
+  // called from processing loops at row or block granularity. The main thread cancels the render if the client
+  // has disconnected, worker threads exit once the main thread has canceled
+  //
+  if (bsr_state->perthread->my_thread_id == 0) {
+    if ((bsr_state->client_fd >= 0) && (clientDisconnected(bsr_state) == 1)) {
+      cancelRender(bsr_state);
+    }
+  } else if (bsr_state->status_array[bsr_state->perthread->my_thread_id].cancel != 0) {
+    exit(1);
+  }
+
+  return(0);
+}
+
 int checkExceptions(bsr_state_t *bsr_state) {
   int i;
 
   if (bsr_state->perthread->my_thread_id == 0) {
     // main thread
 
-    // TBD: see if httpd parent's tcp socket is in CLOSE_WAIT
-    // This could be caused by closing browser/tab or hitting stop button
+    // see if the client has disconnected (closed browser/tab or hit stop button), if so cancel the render
+    if ((bsr_state->client_fd >= 0) && (clientDisconnected(bsr_state) == 1)) {
+      cancelRender(bsr_state);
+    }
 
     // see if parent httpd process has died
     if (getppid() != bsr_state->httpd_pid) {
@@ -440,9 +647,9 @@ int checkExceptions(bsr_state_t *bsr_state) {
   } else {
     // worker thread
 
-    // check if main thread has died
-    if (getppid() != bsr_state->main_pid) {
-      // main thread has died, exit
+    // check if main thread has died or canceled the render
+    if ((getppid() != bsr_state->main_pid) || (bsr_state->status_array[bsr_state->perthread->my_thread_id].cancel != 0)) {
+      // main thread has died or canceled the render, exit
       exit(1);
     }
   }
@@ -450,11 +657,97 @@ int checkExceptions(bsr_state_t *bsr_state) {
   return(0);
 }
 
+int samplePerfCounters(bsr_state_t *bsr_state, int status, int waiting) {
+  //
+  // all threads: add performance counts since the last checkpoint to the stage of 'status', waiting=1 for time
+  // spent waiting at the checkpoint. Counters are opened by openPerfCounters() in perf-counters.c
+  //
+  bsr_perf_stage_t *perf_stage;
+  uint64_t value;
+  int stage;
+  int i;
+
+  stage=status / 10;
+  if (stage < 0) {
+    stage=0;
+  } else if (stage >= BSR_PERF_STAGES) {
+    stage=BSR_PERF_STAGES - 1;
+  }
+  perf_stage=bsr_state->perf_stages + (bsr_state->perthread->my_thread_id * BSR_PERF_STAGES) + stage;
+  for (i=0; i < BSR_PERF_EVENTS; i++) {
+    if ((bsr_state->perthread->perf_fd[i] >= 0) && (read(bsr_state->perthread->perf_fd[i], &value, sizeof(uint64_t)) == sizeof(uint64_t))) {
+      if (waiting == 1) {
+        perf_stage->wait_count[i]+=(value - bsr_state->perthread->perf_last[i]);
+      } else {
+        perf_stage->work_count[i]+=(value - bsr_state->perthread->perf_last[i]);
+      }
+      bsr_state->perthread->perf_last[i]=value;
+    }
+  }
+
+  return(0);
+}
+
+uint64_t traceTime() {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return(((uint64_t)now.tv_sec * 1000000000) + (uint64_t)now.tv_nsec);
+}
+
+int traceBegin(bsr_state_t *bsr_state, const char *name, const char *detail) {
+  //
+  // all threads: begin a timeline trace event in this thread's buffer. Returns the event index to pass to
+  // traceEnd(), or -1 if tracing is disabled or the buffer is full. Written to the trace file by writeTraceFile()
+  //
+  bsr_trace_buffer_t *trace_buffer;
+  bsr_trace_event_t *trace_event;
+
+  if (bsr_state->trace_buffers == NULL) {
+    return(-1);
+  }
+  trace_buffer=bsr_state->trace_buffers + bsr_state->perthread->my_thread_id;
+  if (trace_buffer->num_events >= BSR_TRACE_MAX_EVENTS) {
+    trace_buffer->dropped_events++;
+    return(-1);
+  }
+  trace_event=&trace_buffer->events[trace_buffer->num_events];
+  strncpy(trace_event->name, name, (BSR_TRACE_NAME_SIZE - 1));
+  trace_event->name[BSR_TRACE_NAME_SIZE - 1]=0;
+  trace_event->detail[0]=0;
+  if (detail != NULL) {
+    strncpy(trace_event->detail, detail, (BSR_TRACE_DETAIL_SIZE - 1));
+    trace_event->detail[BSR_TRACE_DETAIL_SIZE - 1]=0;
+  }
+  trace_event->end_ns=0;
+  trace_event->begin_ns=traceTime();
+
+  // event is complete before it is counted
+  trace_buffer->num_events++;
+
+  return(trace_buffer->num_events - 1);
+}
+
+int traceEnd(bsr_state_t *bsr_state, int event_index) {
+  if (event_index >= 0) {
+    bsr_state->trace_buffers[bsr_state->perthread->my_thread_id].events[event_index].end_ns=traceTime();
+  }
+
+  return(0);
+}
+
 int waitForWorkerThreads(bsr_state_t *bsr_state, int min_status) {
   int i;
   int loop_count;
+  int trace_event;
   volatile int all_workers_done;
 
+  if (bsr_state->perf_stages != NULL) {
+    samplePerfCounters(bsr_state, min_status, 0);
+  }
+  trace_event=traceBegin(bsr_state, "Wait for worker threads", NULL);
+
   loop_count=0;
   all_workers_done=0;
   while (all_workers_done == 0) {
@@ -475,12 +768,23 @@ int waitForWorkerThreads(bsr_state_t *bsr_state, int min_status) {
     }
   }
 
+  traceEnd(bsr_state, trace_event);
+  if (bsr_state->perf_stages != NULL) {
+    samplePerfCounters(bsr_state, min_status, 1);
+  }
+
   return(0);
 }
 
 int waitForMainThread(bsr_state_t *bsr_state, int min_status) {
   volatile int cont;
   int loop_count;
+  int trace_event;
+
+  if (bsr_state->perf_stages != NULL) {
+    samplePerfCounters(bsr_state, min_status, 0);
+  }
+  trace_event=traceBegin(bsr_state, "Wait for main thread", NULL);
 
   loop_count=0;
   cont=0;
@@ -499,9 +803,114 @@ int waitForMainThread(bsr_state_t *bsr_state, int min_status) {
     }
   }
 
+  traceEnd(bsr_state, trace_event);
+  if (bsr_state->perf_stages != NULL) {
+    samplePerfCounters(bsr_state, min_status, 1);
+  }
+
   return(0);
 }
 
+int rewindThreadStatus(bsr_state_t *bsr_state, int rewind_status) {
+  //
+  // This function lets the thread status checkpoints be reused for another image (camera, frame, etc.)
+  // Status values only increase during normal processing, so all threads first meet at
+  // THREAD_STATUS_REWIND_READY then the main thread sets all worker threads back to rewind_status.
+  //
+  volatile int cont;
+  int loop_count;
+  int trace_event;
+  int i;
+
+  if (bsr_state->perthread->my_pid != bsr_state->main_pid) {
+    //
+    // worker threads: signal we are ready and wait until main thread rewinds our status
+    //
+    if (bsr_state->perf_stages != NULL) {
+      samplePerfCounters(bsr_state, THREAD_STATUS_REWIND_READY, 0);
+    }
+    trace_event=traceBegin(bsr_state, "Wait for main thread", NULL);
+    bsr_state->status_array[bsr_state->perthread->my_thread_id].status=THREAD_STATUS_REWIND_READY;
+    loop_count=0;
+    cont=0;
+    while (cont == 0) {
+
+      // periodically check for exceptions
+      loop_count++;
+      if ((loop_count % 10000) == 0) {
+        checkExceptions(bsr_state);
+        loop_count=1;
+      }
+
+      // see if main thread has rewound our status
+      if (bsr_state->status_array[bsr_state->perthread->my_thread_id].status < THREAD_STATUS_REWIND_READY) {
+        cont=1;
+      }
+    }
+    traceEnd(bsr_state, trace_event);
+    if (bsr_state->perf_stages != NULL) {
+      samplePerfCounters(bsr_state, THREAD_STATUS_REWIND_READY, 1);
+    }
+  } else {
+    //
+    // main thread: wait until all worker threads are ready and then rewind their status
+    //
+    waitForWorkerThreads(bsr_state, THREAD_STATUS_REWIND_READY);
+    for (i=1; i <= bsr_state->num_worker_threads; i++) {
+      bsr_state->status_array[i].status=rewind_status;
+    }
+  } // end if not main thread
+
+  return(0);
+}
+
+int initRowBlocks(bsr_state_t *bsr_state, int num_rows, int min_block_rows) {
+  //
+  // main thread: set up the shared row block counter for an image stage. Must be called before the main thread sets
+  // the stage's BEGIN status, and not before all threads have passed the COMPLETE status of the previous stage that
+  // used it. All threads then call nextRowBlock() until it returns 0, so threads that finish early take more blocks
+  // instead of waiting for the slowest thread. Rows are any unit of work in a stage (image rows, column strips,
+  // compression blocks). Blocks are a multiple of min_block_rows rows, BSR_ROW_BLOCKS_PER_THREAD sets granularity
+  //
+  int block_rows;
+
+  if (min_block_rows < 1) {
+    min_block_rows=1;
+  }
+  block_rows=(int)ceil(((double)num_rows / (double)((bsr_state->num_worker_threads + 1) * BSR_ROW_BLOCKS_PER_THREAD)));
+  if (block_rows < min_block_rows) {
+    block_rows=min_block_rows;
+  } else if ((block_rows % min_block_rows) != 0) {
+    block_rows+=(min_block_rows - (block_rows % min_block_rows));
+  }
+  bsr_state->row_block_num_rows=num_rows;
+  bsr_state->row_block_rows=block_rows;
+  bsr_state->row_block_next=0;
+  __sync_synchronize();
+
+  return(0);
+}
+
+int nextRowBlock(bsr_state_t *bsr_state, int *first_row, int *end_row) {
+  //
+  // all threads: claim the next block of rows [first_row..end_row) of the current image stage. Returns 1 if a block
+  // was claimed or 0 if all rows have been handed out. Each thread gets its blocks in increasing order
+  //
+  int first;
+
+  first=__sync_fetch_and_add(&bsr_state->row_block_next, bsr_state->row_block_rows);
+  if (first >= bsr_state->row_block_num_rows) {
+    return(0);
+  }
+  *first_row=first;
+  *end_row=first + bsr_state->row_block_rows;
+  if (*end_row > bsr_state->row_block_num_rows) {
+    *end_row=bsr_state->row_block_num_rows;
+  }
+
+  return(1);
+}
+
 int limitIntensity(bsr_config_t *bsr_config, double *pixel_r, double *pixel_g, double *pixel_b) {
   //
   // limit pixel to range 0.0-1.0 without regard to color
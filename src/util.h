@@ -51,9 +51,18 @@ int storeHalfLE(unsigned char *dest, float src);
 int storeFloatLE(unsigned char *dest, float src);
 int getQueryString(bsr_config_t *bsr_config);
 int printVersion(bsr_config_t *bsr_config);
+int samplePerfCounters(bsr_state_t *bsr_state, int status, int waiting);
+uint64_t traceTime();
+int traceBegin(bsr_state_t *bsr_state, const char *name, const char *detail);
+int traceEnd(bsr_state_t *bsr_state, int event_index);
 int waitForWorkerThreads(bsr_state_t *bsr_state, int min_status);
 int waitForMainThread(bsr_state_t *bsr_state, int min_status);
+int httpdConnectionAddress(bsr_state_t *bsr_state);
 int checkExceptions(bsr_state_t *bsr_state);
+int checkCancel(bsr_state_t *bsr_state);
+int rewindThreadStatus(bsr_state_t *bsr_state, int rewind_status);
+int initRowBlocks(bsr_state_t *bsr_state, int num_rows, int min_block_rows);
+int nextRowBlock(bsr_state_t *bsr_state, int *first_row, int *end_row);
 int limitIntensity(bsr_config_t *bsr_config, double *pixel_r, double *pixel_g, double *pixel_b);
 int limitIntensityPreserveColor(bsr_config_t *bsr_config, double *pixel_r, double *pixel_g, double *pixel_b);
 